@@ -0,0 +1,441 @@
+// A tracker for the states resources are in, which writes their barriers.
+//
+// Every resource is tracked with the state each of its subresources is in.
+// Before a command, whatever it is about to use is declared with the state
+// it needs; the tracker works out the transitions that takes, and hands all
+// of them to the command list in one call when the command is about to be
+// recorded.  What needs no barrier gets none: a state the subresource is
+// already in, reads folded into a combined read state, and the promotions
+// from COMMON that Direct3D 12 does on its own.  When a state is known to be
+// needed a while ahead, a split barrier can be begun early, and only ended
+// where the resource is used.
+//
+// Nothing here talks to Direct3D 12.  Barriers go out through BarrierDevice,
+// which bench.cpp stands in for with a command list that only records them.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#ifndef ASSERT
+#define ASSERT(expr)    assert(expr)
+#endif
+
+
+
+// Resource states, with the values of D3D12_RESOURCE_STATES.
+#define BARRIERS_COMMON             0x0000u
+#define BARRIERS_PRESENT            0x0000u
+#define BARRIERS_VERTEX_BUFFER      0x0001u     // And constant buffers.
+#define BARRIERS_INDEX_BUFFER       0x0002u
+#define BARRIERS_RENDER_TARGET      0x0004u
+#define BARRIERS_UNORDERED_ACCESS   0x0008u
+#define BARRIERS_DEPTH_WRITE        0x0010u
+#define BARRIERS_DEPTH_READ         0x0020u
+#define BARRIERS_NON_PIXEL_SHADER   0x0040u
+#define BARRIERS_PIXEL_SHADER       0x0080u
+#define BARRIERS_INDIRECT_ARGUMENT  0x0200u
+#define BARRIERS_COPY_DEST          0x0400u
+#define BARRIERS_COPY_SOURCE        0x0800u
+
+// The states that only read, any of which combine into one state.
+#define BARRIERS_READ               (BARRIERS_VERTEX_BUFFER | BARRIERS_INDEX_BUFFER |       \
+                                     BARRIERS_DEPTH_READ | BARRIERS_NON_PIXEL_SHADER |      \
+                                     BARRIERS_PIXEL_SHADER | BARRIERS_INDIRECT_ARGUMENT |   \
+                                     BARRIERS_COPY_SOURCE)
+
+// What a texture in the COMMON state is promoted to without a barrier.
+// Buffers are promoted to anything.
+#define BARRIERS_TEXTURE_PROMOTIONS (BARRIERS_NON_PIXEL_SHADER | BARRIERS_PIXEL_SHADER |    \
+                                     BARRIERS_COPY_DEST | BARRIERS_COPY_SOURCE)
+
+// D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES.
+#define BARRIERS_ALL                0xffffffffu
+
+#define BARRIERS_NO_SPLIT           0xffffffffu
+
+// The values of D3D12_RESOURCE_BARRIER_TYPE and D3D12_RESOURCE_BARRIER_FLAGS.
+enum {
+    BARRIER_TRANSITION  = 0,
+    BARRIER_UAV         = 2,
+    BARRIER_DROPPED     = 0xff,     // Merged away before it went out.
+};
+
+enum {
+    BARRIER_FULL        = 0,
+    BARRIER_BEGIN       = 1,
+    BARRIER_END         = 2,
+};
+
+typedef struct Barrier {
+    void        *resource;
+    uint32_t    subresource;    // Or BARRIERS_ALL.
+    uint32_t    before;
+    uint32_t    after;
+    uint8_t     type;
+    uint8_t     flags;
+} Barrier;
+
+typedef struct BarrierDevice {
+    void        *ctx;
+    void        (*emit)(void *ctx, Barrier const *barriers, int count);
+} BarrierDevice;
+
+typedef struct BarrierSubresource {
+    uint32_t    state;
+    uint32_t    split;          // What a begun split barrier goes to.
+    uint32_t    split_sub;      // And the subresource it was begun for, or BARRIERS_ALL.
+    int         pending;        // Its barrier waiting to go out, or -1.
+    uint32_t    used;           // The last flush it was used before.
+    bool        promoted;       // Got into its state without a barrier.
+} BarrierSubresource;
+
+typedef struct BarrierResource {
+    void                *resource;
+    bool                buffer;
+    int                 subresource_count;
+    BarrierSubresource  *subresources;
+} BarrierResource;
+
+typedef struct BarrierStats {
+    uint64_t    uses;           // Of a subresource, or all alike at once.
+    uint64_t    emitted;        // Barriers that went out.
+    uint64_t    elided;         // Uses that needed none.
+    uint64_t    promoted;       // Of those, the ones promoted from COMMON.
+    uint64_t    merged;         // Uses folded into a barrier already waiting.
+    uint64_t    split;          // Split barriers that were begun.
+    uint64_t    calls;
+} BarrierStats;
+
+typedef struct Barriers {
+    BarrierDevice       device;
+
+    BarrierResource     *resources;
+    int                 resource_count;
+    int                 resource_capacity;
+
+    // What the next flush hands out, and which resource each one is for.
+    Barrier             *pending;
+    int                 *pending_ids;
+    int                 pending_count;
+    int                 pending_capacity;
+
+    // Counts flushes, so that uses by the same command are told apart.
+    uint32_t            epoch;
+
+    BarrierStats        stats;
+} Barriers;
+
+
+
+static void barriers_init(Barriers *t, BarrierDevice const *device)
+{
+    memset(t, 0, sizeof(*t));
+    t->device = *device;
+    t->epoch = 1;
+}
+
+static void barriers_shutdown(Barriers *t)
+{
+    for (int i = 0; i < t->resource_count; i++)
+        free(t->resources[i].subresources);
+    free(t->resources);
+    free(t->pending);
+    free(t->pending_ids);
+    memset(t, 0, sizeof(*t));
+}
+
+// Starts tracking a resource whose subresources are all in `state`.
+// Returns the id the other calls take.
+static int barriers_track(Barriers *t, void *resource, int subresource_count, bool buffer, uint32_t state)
+{
+    ASSERT(subresource_count > 0);
+
+    if (t->resource_count == t->resource_capacity) {
+        t->resource_capacity = (t->resource_capacity) ? t->resource_capacity * 2 : 16;
+        t->resources = (BarrierResource *)realloc(
+            t->resources, t->resource_capacity * sizeof(BarrierResource));
+        ASSERT(t->resources);
+    }
+
+    BarrierResource *r = &t->resources[t->resource_count];
+    r->resource = resource;
+    r->buffer = buffer;
+    r->subresource_count = subresource_count;
+    r->subresources = (BarrierSubresource *)malloc(subresource_count * sizeof(BarrierSubresource));
+    ASSERT(r->subresources);
+
+    for (int i = 0; i < subresource_count; i++) {
+        r->subresources[i].state = state;
+        r->subresources[i].split = BARRIERS_NO_SPLIT;
+        r->subresources[i].split_sub = BARRIERS_ALL;
+        r->subresources[i].pending = -1;
+        r->subresources[i].used = 0;
+        r->subresources[i].promoted = false;
+    }
+    return t->resource_count++;
+}
+
+// Points a tracked resource at another one, such as a back buffer that a
+// resize made anew, in `state`.  Nothing may be waiting for the old one.
+static void barriers_rebind(Barriers *t, int id, void *resource, uint32_t state)
+{
+    BarrierResource *r = &t->resources[id];
+    r->resource = resource;
+    for (int i = 0; i < r->subresource_count; i++) {
+        ASSERT(r->subresources[i].pending < 0);
+        r->subresources[i].state = state;
+        r->subresources[i].split = BARRIERS_NO_SPLIT;
+        r->subresources[i].split_sub = BARRIERS_ALL;
+        r->subresources[i].promoted = false;
+    }
+}
+
+static uint32_t barriers_state(Barriers const *t, int id, uint32_t subresource)
+{
+    return t->resources[id].subresources[(subresource == BARRIERS_ALL) ? 0 : subresource].state;
+}
+
+static bool barriers_read_only(uint32_t state)
+{
+    return state != 0 && (state & ~BARRIERS_READ) == 0;
+}
+
+// Whether every subresource is where the first one is, so that one barrier
+// for all of them does.
+static bool barriers_uniform(BarrierResource const *r)
+{
+    BarrierSubresource const *first = &r->subresources[0];
+    for (int i = 1; i < r->subresource_count; i++) {
+        BarrierSubresource const *s = &r->subresources[i];
+        if (s->state != first->state || s->split != first->split ||
+            s->split_sub != first->split_sub || s->pending != first->pending || s->promoted != first->promoted)
+            return false;
+    }
+    return true;
+}
+
+static void barriers_push(Barriers *t, int id, Barrier const *barrier)
+{
+    if (t->pending_count == t->pending_capacity) {
+        t->pending_capacity = (t->pending_capacity) ? t->pending_capacity * 2 : 64;
+        t->pending = (Barrier *)realloc(t->pending, t->pending_capacity * sizeof(Barrier));
+        t->pending_ids = (int *)realloc(t->pending_ids, t->pending_capacity * sizeof(int));
+        ASSERT(t->pending && t->pending_ids);
+    }
+    t->pending[t->pending_count] = *barrier;
+    t->pending_ids[t->pending_count] = id;
+    t->pending_count++;
+}
+
+// Sets the subresources `sub` stands for (all of them, for BARRIERS_ALL)
+// to where the first of them now is.
+static void barriers_spread(BarrierResource *r, uint32_t sub)
+{
+    if (sub != BARRIERS_ALL)
+        return;
+    for (int i = 1; i < r->subresource_count; i++)
+        r->subresources[i] = r->subresources[0];
+}
+
+
+
+// Recording
+
+// Hands every barrier waiting so far to the command list, in one call.
+// Commands recorded after it see their resources in the states they need.
+static void barriers_flush(Barriers *t)
+{
+    int count = 0;
+    for (int i = 0; i < t->pending_count; i++) {
+        Barrier const *b = &t->pending[i];
+
+        BarrierResource *r = &t->resources[t->pending_ids[i]];
+        int first = (b->subresource == BARRIERS_ALL) ? 0 : (int)b->subresource;
+        int end = (b->subresource == BARRIERS_ALL) ? r->subresource_count : first + 1;
+        for (int s = first; s < end; s++)
+            r->subresources[s].pending = -1;
+
+        if (b->type != BARRIER_DROPPED)
+            t->pending[count++] = *b;
+    }
+    t->pending_count = 0;
+    t->epoch++;
+
+    if (count > 0) {
+        t->device.emit(t->device.ctx, t->pending, count);
+        t->stats.emitted += count;
+        t->stats.calls++;
+    }
+}
+
+// Brings one subresource into `state`, or all of them at once when `sub`
+// is BARRIERS_ALL and they are all alike.
+static void barriers_use_one(Barriers *t, int id, uint32_t sub, uint32_t state)
+{
+    BarrierResource *r = &t->resources[id];
+    BarrierSubresource *s = &r->subresources[(sub == BARRIERS_ALL) ? 0 : sub];
+    t->stats.uses++;
+
+    bool again = s->used == t->epoch;
+    int first = (sub == BARRIERS_ALL) ? 0 : (int)sub;
+    int end = (sub == BARRIERS_ALL) ? r->subresource_count : first + 1;
+    for (int i = first; i < end; i++)
+        r->subresources[i].used = t->epoch;
+
+    // A split barrier that was begun ends where the resource is used, for
+    // the subresources it was begun for: one begun for all of them ends for
+    // all of them, even when only one is used.
+    if (s->split != BARRIERS_NO_SPLIT) {
+        if (s->pending >= 0)
+            barriers_flush(t);
+
+        uint32_t begun = s->split_sub;
+        Barrier end = {r->resource, begun, s->state, s->split, BARRIER_TRANSITION, BARRIER_END};
+        int from = (begun == BARRIERS_ALL) ? 0 : (int)begun;
+        int to = (begun == BARRIERS_ALL) ? r->subresource_count : from + 1;
+        for (int i = from; i < to; i++) {
+            BarrierSubresource *e = &r->subresources[i];
+            e->state = e->split;
+            e->split = BARRIERS_NO_SPLIT;
+            e->split_sub = BARRIERS_ALL;
+            e->pending = t->pending_count;
+        }
+        barriers_push(t, id, &end);
+
+        if (s->state == state) {
+            t->stats.elided++;
+            return;
+        }
+    }
+
+    uint32_t current = s->state;
+
+    // Already there.  Back to back unordered access still takes a barrier,
+    // so that the second command sees what the first one wrote.
+    if (current == state || (barriers_read_only(state) && (current & state) == state)) {
+        if (state == BARRIERS_UNORDERED_ACCESS && !again) {
+            Barrier uav = {r->resource, BARRIERS_ALL, state, state, BARRIER_UAV, BARRIER_FULL};
+            barriers_push(t, id, &uav);
+        } else {
+            t->stats.elided++;
+        }
+        return;
+    }
+
+    // Promoted from COMMON, or from one read state it was promoted to into
+    // more of them.
+    uint32_t promotions = (r->buffer) ? ~0u : BARRIERS_TEXTURE_PROMOTIONS;
+    bool from_common = current == BARRIERS_COMMON;
+    bool from_promoted = s->promoted && barriers_read_only(current) && barriers_read_only(state);
+    if ((from_common || from_promoted) && s->pending < 0 && (state & ~promotions) == 0) {
+        s->state = (from_promoted) ? current | state : state;
+        s->promoted = true;
+        barriers_spread(r, sub);
+        t->stats.elided++;
+        t->stats.promoted++;
+        return;
+    }
+
+    // A barrier for the same subresources waits already, for another use
+    // by the same command: fold this one into it.
+    if (s->pending >= 0) {
+        Barrier *b = &t->pending[s->pending];
+        if (b->type == BARRIER_TRANSITION && b->flags == BARRIER_FULL && b->subresource == sub) {
+            b->after = (barriers_read_only(b->after) && barriers_read_only(state)) ? b->after | state : state;
+            s->state = b->after;
+            if (b->before == b->after) {
+                b->type = BARRIER_DROPPED;
+                s->pending = -1;
+            }
+            barriers_spread(r, sub);
+            t->stats.merged++;
+            return;
+        }
+        barriers_flush(t);
+    }
+
+    // Reads by the same command add up.  Otherwise, the subresource goes
+    // to just the state it is used in, so that its subresources stay alike.
+    uint32_t after = (again && barriers_read_only(current) && barriers_read_only(state)) ?
+        current | state : state;
+
+    Barrier barrier = {r->resource, sub, current, after, BARRIER_TRANSITION, BARRIER_FULL};
+    s->state = after;
+    s->promoted = false;
+    s->pending = t->pending_count;
+    barriers_push(t, id, &barrier);
+    barriers_spread(r, sub);
+}
+
+// Declares that the next command uses `subresource` (or BARRIERS_ALL of
+// them) in `state`.  Uses between two flushes are for the same command.
+static void barriers_use(Barriers *t, int id, uint32_t subresource, uint32_t state)
+{
+    BarrierResource *r = &t->resources[id];
+
+    if (subresource != BARRIERS_ALL || r->subresource_count == 1 || barriers_uniform(r)) {
+        barriers_use_one(t, id, (r->subresource_count == 1) ? BARRIERS_ALL : subresource, state);
+        return;
+    }
+
+    for (int i = 0; i < r->subresource_count; i++)
+        barriers_use_one(t, id, (uint32_t)i, state);
+}
+
+// Starts moving `subresource` (or BARRIERS_ALL of them) into `state` ahead
+// of where it is used: the GPU may work on it in between, and the barrier
+// is only ended by barriers_use().  Until then, the resource is not used.
+static void barriers_begin(Barriers *t, int id, uint32_t subresource, uint32_t state)
+{
+    BarrierResource *r = &t->resources[id];
+
+    // All of them with one barrier, or each on its own.
+    bool whole = r->subresource_count == 1 || (subresource == BARRIERS_ALL && barriers_uniform(r));
+    int first = (subresource == BARRIERS_ALL) ? 0 : (int)subresource;
+    int end = (whole) ? 1 : (subresource == BARRIERS_ALL) ? r->subresource_count : first + 1;
+
+    for (int i = first; i < end; i++) {
+        uint32_t at = (whole) ? BARRIERS_ALL : (uint32_t)i;
+        BarrierSubresource *s = &r->subresources[i];
+
+        // Nothing to begin when it gets there without a barrier, or has one
+        // on the way already.
+        uint32_t promotions = (r->buffer) ? ~0u : BARRIERS_TEXTURE_PROMOTIONS;
+        if (s->state == state || s->split != BARRIERS_NO_SPLIT || s->pending >= 0 ||
+            (barriers_read_only(state) && (s->state & state) == state) ||
+            (s->state == BARRIERS_COMMON && (state & ~promotions) == 0))
+            continue;
+
+        Barrier begin = {r->resource, at, s->state, state, BARRIER_TRANSITION, BARRIER_BEGIN};
+        s->split = state;
+        s->split_sub = at;
+        s->pending = t->pending_count;
+        barriers_push(t, id, &begin);
+        barriers_spread(r, at);
+        t->stats.split++;
+    }
+}
+
+// Once the command list was executed: buffers, and whatever was promoted
+// into read states, decay back to COMMON.
+static void barriers_submit(Barriers *t)
+{
+    ASSERT(t->pending_count == 0);
+
+    for (int i = 0; i < t->resource_count; i++) {
+        BarrierResource *r = &t->resources[i];
+        for (int k = 0; k < r->subresource_count; k++) {
+            BarrierSubresource *s = &r->subresources[k];
+            if (s->split != BARRIERS_NO_SPLIT)
+                continue;
+            if (r->buffer || (s->promoted && barriers_read_only(s->state))) {
+                s->state = BARRIERS_COMMON;
+                s->promoted = false;
+            }
+        }
+    }
+}
@@ -0,0 +1,392 @@
+// Instanced batches of one mesh.
+//
+// Every instance has a transform, an offset, a UV offset and a color of its
+// own, kept structure-of-arrays on the CPU.  Once a frame, the instances that
+// vs() would put on screen are packed into upload memory as per-instance
+// vertex data, a chunk at a time across the threads of a pool, and every
+// chunk becomes one instanced draw.
+//
+// To tell which instances are on screen, the CPU does what vs() does to
+// their positions, several instances at a time (8 with AVX2, 4 with SSE2):
+// the rotation and zoom, which the whole batch shares, applied to a circle
+// around every instance.  batch_expand() turns packed instances back into
+// plain vertices, for soft.h to draw.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+#include "scene.h"
+#include "threads.h"
+
+#ifndef ASSERT
+#define ASSERT(expr)    assert(expr)
+#endif
+
+
+
+#define BATCH_CHUNK     16384   // Instances per draw, at most.
+
+static const float      BATCH_PI        = 3.14159265359f;
+static const float      BATCH_TWO_PI    = 2.0f * BATCH_PI;
+
+// An instance as vs() reads it, from the second vertex buffer.
+typedef struct BatchInstance {
+    float transform[4];     // 2x2, row major, applied to the mesh first.
+    float offset[2];        // Then added, before the rotation and zoom.
+    float uv_offset[2];
+    float color[4];         // Multiplies the vertex colors.
+} BatchInstance;
+
+// What DrawInstanced() takes, in instances.
+typedef struct BatchDraw {
+    int first;
+    int count;
+} BatchDraw;
+
+enum {
+    BATCH_M00, BATCH_M01, BATCH_M10, BATCH_M11,
+    BATCH_X, BATCH_Y,
+    BATCH_U, BATCH_V,
+    BATCH_R, BATCH_G, BATCH_B, BATCH_A,
+    BATCH_RADIUS,           // Of a circle around the transformed mesh.
+    BATCH_FIELDS
+};
+
+typedef struct Batch {
+    float       mesh_radius;
+
+    float       *fields[BATCH_FIELDS];
+    int         count;
+    int         capacity;
+
+    // Made by batch_pack(), one per chunk with anything on screen.
+    BatchDraw   *draws;
+    int         draw_count;
+    int         visible;
+} Batch;
+
+
+
+static void batch_init(Batch *batch, Vertex const *mesh, int vertex_count)
+{
+    memset(batch, 0, sizeof(*batch));
+
+    for (int i = 0; i < vertex_count; i++) {
+        float x = mesh[i].pos[0];
+        float y = mesh[i].pos[1];
+        float r = sqrtf(x * x + y * y);
+        if (r > batch->mesh_radius)
+            batch->mesh_radius = r;
+    }
+}
+
+static void batch_free(Batch *batch)
+{
+    for (int f = 0; f < BATCH_FIELDS; f++)
+        free(batch->fields[f]);
+    free(batch->draws);
+    memset(batch, 0, sizeof(*batch));
+}
+
+static void batch_clear(Batch *batch)
+{
+    batch->count = 0;
+    batch->draw_count = 0;
+    batch->visible = 0;
+}
+
+// Returns the index of the instance.
+static int batch_add(Batch *batch, float const transform[4], float const offset[2],
+                     float const uv_offset[2], float const color[4])
+{
+    if (batch->count == batch->capacity) {
+        // A whole number of SIMD registers, so loads never run off the end.
+        int capacity = (batch->capacity) ? batch->capacity * 2 : 1024;
+        for (int f = 0; f < BATCH_FIELDS; f++) {
+            batch->fields[f] = (float *)realloc(batch->fields[f], capacity * sizeof(float));
+            ASSERT(batch->fields[f]);
+        }
+
+        int chunks = (capacity + BATCH_CHUNK - 1) / BATCH_CHUNK;
+        batch->draws = (BatchDraw *)realloc(batch->draws, chunks * sizeof(BatchDraw));
+        ASSERT(batch->draws);
+
+        batch->capacity = capacity;
+    }
+
+    int i = batch->count++;
+    float **f = batch->fields;
+
+    f[BATCH_M00][i] = transform[0];
+    f[BATCH_M01][i] = transform[1];
+    f[BATCH_M10][i] = transform[2];
+    f[BATCH_M11][i] = transform[3];
+    f[BATCH_X][i] = offset[0];
+    f[BATCH_Y][i] = offset[1];
+    f[BATCH_U][i] = uv_offset[0];
+    f[BATCH_V][i] = uv_offset[1];
+    f[BATCH_R][i] = color[0];
+    f[BATCH_G][i] = color[1];
+    f[BATCH_B][i] = color[2];
+    f[BATCH_A][i] = color[3];
+
+    // The Frobenius norm is never less than how far the transform stretches.
+    float norm = sqrtf(transform[0] * transform[0] + transform[1] * transform[1] +
+                       transform[2] * transform[2] + transform[3] * transform[3]);
+    f[BATCH_RADIUS][i] = batch->mesh_radius * norm;
+
+    return i;
+}
+
+// Fills the scene with `count` instances in a grid, each turned, tinted and
+// textured a little differently.  A single instance is the mesh as it is.
+static void batch_grid(Batch *batch, int count)
+{
+    static const float identity[4] = {1.0f, 0.0f, 0.0f, 1.0f};
+    static const float zero[2] = {0.0f, 0.0f};
+    static const float white[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+
+    batch_clear(batch);
+    if (count == 1) {
+        batch_add(batch, identity, zero, zero, white);
+        return;
+    }
+
+    int side = (int)ceilf(sqrtf((float)count));
+    float cell = 2.0f / (float)side;
+    float scale = 0.5f * cell / batch->mesh_radius;
+
+    uint32_t state = 1;
+    for (int i = 0; i < count; i++) {
+        state = state * 1664525u + 1013904223u;
+        float random = (float)(state >> 8) / (float)(1 << 24);
+
+        float angle = random * BATCH_TWO_PI;
+        float c = cosf(angle) * scale;
+        float s = sinf(angle) * scale;
+
+        float transform[4] = {c, -s, s, c};
+        float offset[2] = {
+            -1.0f + cell * ((float)(i % side) + 0.5f),
+            -1.0f + cell * ((float)(i / side) + 0.5f)
+        };
+        float uv_offset[2] = {0.5f * (float)(i % 2), 0.5f * (float)((i / side) % 2)};
+        float color[4] = {0.5f + 0.5f * random, 1.0f - 0.5f * random, 1.0f, 1.0f};
+
+        batch_add(batch, transform, offset, uv_offset, color);
+    }
+}
+
+
+
+// SIMD Lanes
+
+#ifdef __AVX2__
+
+#define BATCH_LANES 8
+
+typedef __m256 BatchF;
+
+static inline BatchF batch_vload(float const *p)    { return _mm256_loadu_ps(p); }
+static inline BatchF batch_v1(float a)              { return _mm256_set1_ps(a); }
+static inline BatchF batch_vadd(BatchF a, BatchF b) { return _mm256_add_ps(a, b); }
+static inline BatchF batch_vsub(BatchF a, BatchF b) { return _mm256_sub_ps(a, b); }
+static inline BatchF batch_vmul(BatchF a, BatchF b) { return _mm256_mul_ps(a, b); }
+static inline BatchF batch_vabs(BatchF a)           { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+static inline BatchF batch_vlt(BatchF a, BatchF b)  { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+static inline BatchF batch_vand(BatchF a, BatchF b) { return _mm256_and_ps(a, b); }
+static inline int    batch_vmask(BatchF a)          { return _mm256_movemask_ps(a); }
+
+#else
+
+#define BATCH_LANES 4
+
+typedef __m128 BatchF;
+
+static inline BatchF batch_vload(float const *p)    { return _mm_loadu_ps(p); }
+static inline BatchF batch_v1(float a)              { return _mm_set1_ps(a); }
+static inline BatchF batch_vadd(BatchF a, BatchF b) { return _mm_add_ps(a, b); }
+static inline BatchF batch_vsub(BatchF a, BatchF b) { return _mm_sub_ps(a, b); }
+static inline BatchF batch_vmul(BatchF a, BatchF b) { return _mm_mul_ps(a, b); }
+static inline BatchF batch_vabs(BatchF a)           { return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+static inline BatchF batch_vlt(BatchF a, BatchF b)  { return _mm_cmplt_ps(a, b); }
+static inline BatchF batch_vand(BatchF a, BatchF b) { return _mm_and_ps(a, b); }
+static inline int    batch_vmask(BatchF a)          { return _mm_movemask_ps(a); }
+
+#endif
+
+// The lowest lane set in a mask that is not 0.
+static inline int batch_ctz(unsigned mask)
+{
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+
+// How many lanes a mask has set.
+static inline int batch_popcount(unsigned mask)
+{
+#ifdef _MSC_VER
+    return (int)__popcnt(mask);
+#else
+    return __builtin_popcount(mask);
+#endif
+}
+
+
+
+// Packing
+
+// vs()'s rotation and zoom as one matrix, row major, given cbuffer0:
+// {width, height, aspect, uptime}.
+static void batch_view(float const consts[4], float view[4])
+{
+    float aspect = consts[2];
+    float uptime = consts[3];
+
+    float angle = fmodf(uptime / 21.0f, 1.0f) * BATCH_TWO_PI;
+    float c = cosf(angle);
+    float s = sinf(angle);
+    float zoom = powf(cosf(uptime - BATCH_PI) + 1.0f, 3.0f) + 1.0f;
+
+    view[0] = zoom * aspect * c;
+    view[1] = zoom * aspect * s;
+    view[2] = zoom * -s;
+    view[3] = zoom * c;
+}
+
+typedef struct BatchPack {
+    Batch           *batch;
+    BatchInstance   *dst;
+    float           view[4];
+    float           reach[2];   // How far a radius of 1 reaches on screen.
+} BatchPack;
+
+static void batch_pack_chunk(void *ctx, int chunk, int thread)
+{
+    BatchPack *pack = (BatchPack *)ctx;
+    Batch *batch = pack->batch;
+    float *const *f = batch->fields;
+
+    int first = chunk * BATCH_CHUNK;
+    int end = first + BATCH_CHUNK;
+    if (end > batch->count)
+        end = batch->count;
+
+    BatchInstance *dst = pack->dst + first;
+    int count = 0;
+
+    BatchF v00 = batch_v1(pack->view[0]);
+    BatchF v01 = batch_v1(pack->view[1]);
+    BatchF v10 = batch_v1(pack->view[2]);
+    BatchF v11 = batch_v1(pack->view[3]);
+    BatchF reach_x = batch_v1(pack->reach[0]);
+    BatchF reach_y = batch_v1(pack->reach[1]);
+    BatchF one = batch_v1(1.0f);
+
+    for (int i = first; i < end; i += BATCH_LANES) {
+        BatchF x = batch_vload(f[BATCH_X] + i);
+        BatchF y = batch_vload(f[BATCH_Y] + i);
+        BatchF r = batch_vload(f[BATCH_RADIUS] + i);
+
+        // Where vs() puts the center, and whether the circle around it
+        // overlaps the screen.
+        BatchF cx = batch_vadd(batch_vmul(v00, x), batch_vmul(v01, y));
+        BatchF cy = batch_vadd(batch_vmul(v10, x), batch_vmul(v11, y));
+        BatchF in_x = batch_vlt(batch_vsub(batch_vabs(cx), batch_vmul(reach_x, r)), one);
+        BatchF in_y = batch_vlt(batch_vsub(batch_vabs(cy), batch_vmul(reach_y, r)), one);
+
+        int mask = batch_vmask(batch_vand(in_x, in_y));
+        if (end - i < BATCH_LANES)
+            mask &= (1 << (end - i)) - 1;
+
+        // Upload memory is write-combined: whole instances, front to back.
+        while (mask) {
+            int k = i + batch_ctz((unsigned)mask);
+            mask &= mask - 1;
+
+            float *out = (float *)&dst[count++];
+            _mm_storeu_ps(out + 0, _mm_setr_ps(f[BATCH_M00][k], f[BATCH_M01][k],
+                                               f[BATCH_M10][k], f[BATCH_M11][k]));
+            _mm_storeu_ps(out + 4, _mm_setr_ps(f[BATCH_X][k], f[BATCH_Y][k],
+                                               f[BATCH_U][k], f[BATCH_V][k]));
+            _mm_storeu_ps(out + 8, _mm_setr_ps(f[BATCH_R][k], f[BATCH_G][k],
+                                               f[BATCH_B][k], f[BATCH_A][k]));
+        }
+    }
+
+    batch->draws[chunk].first = first;
+    batch->draws[chunk].count = count;
+}
+
+// Packs the instances on screen into `dst`, which has room for all of them,
+// and makes the draws for them.  Returns how many are on screen.
+static int batch_pack(Batch *batch, Pool *pool, float const consts[4], BatchInstance *dst)
+{
+    BatchPack pack;
+    pack.batch = batch;
+    pack.dst = dst;
+    batch_view(consts, pack.view);
+
+    // The length of each row of the view is as far as it stretches along
+    // that axis.
+    pack.reach[0] = sqrtf(pack.view[0] * pack.view[0] + pack.view[1] * pack.view[1]);
+    pack.reach[1] = sqrtf(pack.view[2] * pack.view[2] + pack.view[3] * pack.view[3]);
+
+    int chunks = (batch->count + BATCH_CHUNK - 1) / BATCH_CHUNK;
+    if (pool && chunks > 1)
+        pool_for(pool, chunks, batch_pack_chunk, &pack);
+    else {
+        for (int c = 0; c < chunks; c++)
+            batch_pack_chunk(&pack, c, 0);
+    }
+
+    batch->draw_count = 0;
+    batch->visible = 0;
+    for (int c = 0; c < chunks; c++) {
+        if (batch->draws[c].count > 0) {
+            batch->draws[batch->draw_count++] = batch->draws[c];
+            batch->visible += batch->draws[c].count;
+        }
+    }
+    return batch->visible;
+}
+
+// The vertices of every packed instance, as vs() sees them before its
+// rotation and zoom: what soft_draw() takes.
+static void batch_expand(BatchInstance const *instances, int count,
+                         Vertex const *mesh, int vertex_count, Vertex *out)
+{
+    for (int i = 0; i < count; i++) {
+        BatchInstance const *instance = &instances[i];
+        float const *m = instance->transform;
+
+        for (int v = 0; v < vertex_count; v++) {
+            Vertex const *in = &mesh[v];
+            float x = in->pos[0];
+            float y = in->pos[1];
+
+            out->pos[0] = m[0] * x + m[1] * y + instance->offset[0];
+            out->pos[1] = m[2] * x + m[3] * y + instance->offset[1];
+            out->uv[0] = in->uv[0] + instance->uv_offset[0];
+            out->uv[1] = in->uv[1] + instance->uv_offset[1];
+            for (int c = 0; c < 4; c++)
+                out->color[c] = in->color[c] * instance->color[c];
+            out++;
+        }
+    }
+}
@@ -0,0 +1,849 @@
+// Block compression of textures on the CPU.
+//
+// Every 4x4 block of texels is encoded on its own:
+//
+// * BC1 stores two RGB565 endpoints and picks one of four colours on the line
+//   between them for every texel, in 8 bytes.  Texels with alpha under half
+//   make the block switch to three colours plus transparent black.
+//
+// * BC3 adds to that an 8-byte alpha block: two 8-bit endpoints and a choice
+//   of eight values between them.
+//
+// * BC7 stores both in 16 bytes at a much higher precision.  Only mode 6 is
+//   written: one RGBA line with 7-bit endpoints, a shared low bit for each,
+//   and sixteen steps between them.
+//
+// The endpoints start at the ends of the principal axis of the block's
+// texels.  Each texel then picks the closest step, four texels at a time in
+// SSE registers, and the endpoints are refit to those choices by least
+// squares.  The quality presets trade how many times that is repeated for
+// speed.  Blocks are spread across the threads of a Pool a row at a time.
+//
+// A decoder for the same formats comes along, to check the encoder with.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <assert.h>
+
+#include <emmintrin.h>
+
+#include "threads.h"
+#include "texture.h"
+
+#ifndef ASSERT
+#define ASSERT(expr)    assert(expr)
+#endif
+
+
+
+// Presets
+
+enum {
+    BCN_FAST,
+    BCN_NORMAL,
+    BCN_HIGH,
+    BCN_QUALITIES
+};
+
+static struct {
+    int     axis_steps;     // Power iterations towards the principal axis.
+    int     refits;         // Least squares refits of the endpoints.
+    bool    search;         // Try every way to round the endpoints.
+} const bcn_qualities[BCN_QUALITIES] = {
+    {2, 0, false},
+    {4, 2, false},
+    {8, 4, true},
+};
+
+
+
+// Blocks
+// The texels of a block are kept one channel after the other, 0 to 255, so
+// that four texels of one channel fill an SSE register.
+
+typedef struct BcnBlock {
+    union {
+        __m128  v[4][4];        // [channel][texels 4i..4i+3]
+        float   f[4][16];
+    };
+    __m128  weight[4];          // 0 for texels the colour does not matter for.
+} BcnBlock;
+
+// Texels past the edge of the image repeat the last row or column.
+static void bcn_fetch(TextureImage const *image, int bx, int by, BcnBlock *block)
+{
+    for (int y = 0; y < 4; y++) {
+        int sy = (by * 4 + y < image->height) ? by * 4 + y : image->height - 1;
+        uint32_t const *row = image->texels + (size_t)sy * image->width;
+
+        for (int x = 0; x < 4; x++) {
+            int sx = (bx * 4 + x < image->width) ? bx * 4 + x : image->width - 1;
+            uint32_t texel = row[sx];
+            for (int c = 0; c < 4; c++)
+                block->f[c][y * 4 + x] = (float)((texel >> (8 * c)) & 0xff);
+        }
+    }
+    for (int i = 0; i < 4; i++)
+        block->weight[i] = _mm_set1_ps(1.0f);
+}
+
+static inline float bcn_sum(__m128 v)
+{
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_add_ss(v, _mm_shuffle_ps(v, v, 1));
+    return _mm_cvtss_f32(v);
+}
+
+static inline float bcn_min(float a, float b)
+{
+    return (a < b) ? a : b;
+}
+
+static inline float bcn_max(float a, float b)
+{
+    return (a > b) ? a : b;
+}
+
+static inline int bcn_clamp(int value, int lo, int hi)
+{
+    return (value < lo) ? lo : (value > hi) ? hi : value;
+}
+
+// The direction along which channels [first, first + channels) vary the most,
+// and their mean, over the texels that matter.
+static void bcn_axis(BcnBlock const *block, int first, int channels, int steps,
+                     float mean[4], float axis[4])
+{
+    __m128 total = _mm_setzero_ps();
+    for (int i = 0; i < 4; i++)
+        total = _mm_add_ps(total, block->weight[i]);
+    float count = bcn_sum(total);
+    if (count == 0.0f)
+        count = 1.0f;
+
+    float lo[4], hi[4];
+    for (int c = 0; c < channels; c++) {
+        __m128 sum = _mm_setzero_ps();
+        __m128 min = _mm_set1_ps(FLT_MAX);
+        __m128 max = _mm_set1_ps(-FLT_MAX);
+        for (int i = 0; i < 4; i++) {
+            __m128 v = block->v[first + c][i];
+            __m128 used = _mm_cmpgt_ps(block->weight[i], _mm_setzero_ps());
+            sum = _mm_add_ps(sum, _mm_mul_ps(v, block->weight[i]));
+            min = _mm_min_ps(min, _mm_or_ps(_mm_and_ps(used, v), _mm_andnot_ps(used, _mm_set1_ps(FLT_MAX))));
+            max = _mm_max_ps(max, _mm_or_ps(_mm_and_ps(used, v), _mm_andnot_ps(used, _mm_set1_ps(-FLT_MAX))));
+        }
+        mean[c] = bcn_sum(sum) / count;
+
+        float m[4], n[4];
+        _mm_storeu_ps(m, min);
+        _mm_storeu_ps(n, max);
+        lo[c] = bcn_min(bcn_min(m[0], m[1]), bcn_min(m[2], m[3]));
+        hi[c] = bcn_max(bcn_max(n[0], n[1]), bcn_max(n[2], n[3]));
+    }
+
+    float cov[4][4];
+    for (int a = 0; a < channels; a++) {
+        for (int b = a; b < channels; b++) {
+            __m128 ma = _mm_set1_ps(mean[a]);
+            __m128 mb = _mm_set1_ps(mean[b]);
+            __m128 sum = _mm_setzero_ps();
+            for (int i = 0; i < 4; i++) {
+                __m128 da = _mm_sub_ps(block->v[first + a][i], ma);
+                __m128 db = _mm_sub_ps(block->v[first + b][i], mb);
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_mul_ps(da, db), block->weight[i]));
+            }
+            cov[a][b] = cov[b][a] = bcn_sum(sum);
+        }
+    }
+
+    // Start from the diagonal of the bounding box, turned to agree with the
+    // covariance, then let power iteration do the rest.
+    for (int c = 0; c < channels; c++)
+        axis[c] = hi[c] - lo[c];
+    for (int c = 1; c < channels; c++) {
+        if (cov[0][c] < 0.0f)
+            axis[c] = -axis[c];
+    }
+
+    for (int step = 0; step < steps; step++) {
+        float next[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+        for (int a = 0; a < channels; a++) {
+            for (int b = 0; b < channels; b++)
+                next[a] += cov[a][b] * axis[b];
+        }
+
+        float length = 0.0f;
+        for (int c = 0; c < channels; c++)
+            length = bcn_max(length, fabsf(next[c]));
+        if (length == 0.0f)
+            break;
+        for (int c = 0; c < channels; c++)
+            axis[c] = next[c] / length;
+    }
+
+    float length = 0.0f;
+    for (int c = 0; c < channels; c++)
+        length += axis[c] * axis[c];
+    length = sqrtf(length);
+    for (int c = 0; c < channels; c++)
+        axis[c] = (length > 0.0f) ? axis[c] / length : 0.0f;
+}
+
+// The endpoints at either end of the texels projected onto the axis.
+static void bcn_extent(BcnBlock const *block, int first, int channels,
+                       float const mean[4], float const axis[4], float e0[4], float e1[4])
+{
+    __m128 min = _mm_set1_ps(FLT_MAX);
+    __m128 max = _mm_set1_ps(-FLT_MAX);
+
+    for (int i = 0; i < 4; i++) {
+        __m128 t = _mm_setzero_ps();
+        for (int c = 0; c < channels; c++) {
+            __m128 d = _mm_sub_ps(block->v[first + c][i], _mm_set1_ps(mean[c]));
+            t = _mm_add_ps(t, _mm_mul_ps(d, _mm_set1_ps(axis[c])));
+        }
+        __m128 used = _mm_cmpgt_ps(block->weight[i], _mm_setzero_ps());
+        min = _mm_min_ps(min, _mm_or_ps(_mm_and_ps(used, t), _mm_andnot_ps(used, _mm_set1_ps(FLT_MAX))));
+        max = _mm_max_ps(max, _mm_or_ps(_mm_and_ps(used, t), _mm_andnot_ps(used, _mm_set1_ps(-FLT_MAX))));
+    }
+
+    float m[4], n[4];
+    _mm_storeu_ps(m, min);
+    _mm_storeu_ps(n, max);
+    float lo = bcn_min(bcn_min(m[0], m[1]), bcn_min(m[2], m[3]));
+    float hi = bcn_max(bcn_max(n[0], n[1]), bcn_max(n[2], n[3]));
+    if (lo > hi)
+        lo = hi = 0.0f;
+
+    for (int c = 0; c < channels; c++) {
+        e0[c] = mean[c] + axis[c] * lo;
+        e1[c] = mean[c] + axis[c] * hi;
+    }
+}
+
+// Picks, for every texel, the closest of `count` palette entries over
+// channels [first, first + channels).  Returns the total squared error of
+// the texels that matter.
+static float bcn_select(BcnBlock const *block, int first, int channels,
+                        float const (*palette)[4], int count, uint8_t indices[16])
+{
+    __m128 total = _mm_setzero_ps();
+
+    for (int i = 0; i < 4; i++) {
+        __m128 best = _mm_set1_ps(FLT_MAX);
+        __m128i best_index = _mm_setzero_si128();
+
+        for (int k = 0; k < count; k++) {
+            __m128 error = _mm_setzero_ps();
+            for (int c = 0; c < channels; c++) {
+                __m128 d = _mm_sub_ps(block->v[first + c][i], _mm_set1_ps(palette[k][first + c]));
+                error = _mm_add_ps(error, _mm_mul_ps(d, d));
+            }
+            __m128i closer = _mm_castps_si128(_mm_cmplt_ps(error, best));
+            best = _mm_min_ps(best, error);
+            best_index = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(k)),
+                                      _mm_andnot_si128(closer, best_index));
+        }
+
+        total = _mm_add_ps(total, _mm_mul_ps(best, block->weight[i]));
+
+        int chosen[4];
+        _mm_storeu_si128((__m128i *)chosen, best_index);
+        for (int j = 0; j < 4; j++)
+            indices[i * 4 + j] = (uint8_t)chosen[j];
+    }
+
+    return bcn_sum(total);
+}
+
+// The endpoints that best reproduce the texels, given the palette entries
+// they picked and where each entry lies between the endpoints (0 to 1).
+// Returns false if the picks do not pin down the endpoints.
+static bool bcn_refit(BcnBlock const *block, int first, int channels,
+                      uint8_t const indices[16], float const *positions,
+                      float e0[4], float e1[4])
+{
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+    float ax[4] = {0}, bx[4] = {0};
+
+    for (int i = 0; i < 16; i++) {
+        float w = ((float const *)&block->weight[i / 4])[i % 4];
+        float b = positions[indices[i]];
+        float a = 1.0f - b;
+        aa += w * a * a;
+        ab += w * a * b;
+        bb += w * b * b;
+        for (int c = 0; c < channels; c++) {
+            ax[c] += w * a * block->f[first + c][i];
+            bx[c] += w * b * block->f[first + c][i];
+        }
+    }
+
+    float det = aa * bb - ab * ab;
+    if (fabsf(det) < 1e-6f)
+        return false;
+
+    for (int c = 0; c < channels; c++) {
+        e0[c] = bcn_min(bcn_max((bb * ax[c] - ab * bx[c]) / det, 0.0f), 255.0f);
+        e1[c] = bcn_min(bcn_max((aa * bx[c] - ab * ax[c]) / det, 0.0f), 255.0f);
+    }
+    return true;
+}
+
+
+
+// BC1 Colour
+
+static float const bcn_bc1_positions4[4] = {0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f};
+static float const bcn_bc1_positions3[4] = {0.0f, 1.0f, 0.5f, 0.0f};
+
+static uint16_t bcn_to_565(float const e[4])
+{
+    int r = bcn_clamp((int)(e[0] * (31.0f / 255.0f) + 0.5f), 0, 31);
+    int g = bcn_clamp((int)(e[1] * (63.0f / 255.0f) + 0.5f), 0, 63);
+    int b = bcn_clamp((int)(e[2] * (31.0f / 255.0f) + 0.5f), 0, 31);
+    return (uint16_t)((r << 11) | (g << 5) | b);
+}
+
+static void bcn_from_565(uint16_t c, int rgb[3])
+{
+    int r = (c >> 11) & 31;
+    int g = (c >> 5) & 63;
+    int b = c & 31;
+    rgb[0] = (r << 3) | (r >> 2);
+    rgb[1] = (g << 2) | (g >> 4);
+    rgb[2] = (b << 3) | (b >> 2);
+}
+
+// The colours a BC1 block can pick from, as the decoder works them out.
+// Entry 3 of a three-colour block is transparent black.
+static void bcn_bc1_palette(uint16_t c0, uint16_t c1, bool four, int palette[4][4])
+{
+    int a[3], b[3];
+    bcn_from_565(c0, a);
+    bcn_from_565(c1, b);
+
+    for (int c = 0; c < 3; c++) {
+        palette[0][c] = a[c];
+        palette[1][c] = b[c];
+        if (four) {
+            palette[2][c] = (2 * a[c] + b[c]) / 3;
+            palette[3][c] = (a[c] + 2 * b[c]) / 3;
+        } else {
+            palette[2][c] = (a[c] + b[c]) / 2;
+            palette[3][c] = 0;
+        }
+    }
+    for (int i = 0; i < 4; i++)
+        palette[i][3] = (four || i < 3) ? 255 : 0;
+}
+
+// Writes the colour half of a block.  In a three-colour block, the texels
+// with no weight are the transparent ones.
+static void bcn_encode_colour(BcnBlock const *block, int quality, bool four, uint8_t out[8])
+{
+    float const *positions = four ? bcn_bc1_positions4 : bcn_bc1_positions3;
+    int entries = four ? 4 : 3;
+
+    float mean[4], axis[4], e0[4], e1[4];
+    bcn_axis(block, 0, 3, bcn_qualities[quality].axis_steps, mean, axis);
+    bcn_extent(block, 0, 3, mean, axis, e0, e1);
+
+    uint16_t best0 = 0, best1 = 0;
+    uint8_t best_indices[16] = {0};
+    float best_error = FLT_MAX;
+
+    for (int pass = 0; pass <= bcn_qualities[quality].refits; pass++) {
+        uint16_t c0 = bcn_to_565(e0);
+        uint16_t c1 = bcn_to_565(e1);
+
+        int ints[4][4];
+        float palette[4][4];
+        bcn_bc1_palette(c0, c1, four, ints);
+        for (int i = 0; i < 4; i++) {
+            for (int c = 0; c < 4; c++)
+                palette[i][c] = (float)ints[i][c];
+        }
+
+        uint8_t indices[16];
+        float error = bcn_select(block, 0, 3, palette, entries, indices);
+        if (error < best_error) {
+            best_error = error;
+            best0 = c0;
+            best1 = c1;
+            memcpy(best_indices, indices, 16);
+        }
+
+        if (pass == bcn_qualities[quality].refits || error == 0.0f ||
+            !bcn_refit(block, 0, 3, indices, positions, e0, e1))
+            break;
+    }
+
+    // The order of the endpoints tells the decoder how many colours there
+    // are: four when the first is greater.
+    static uint8_t const swap4[4] = {1, 0, 3, 2};
+    static uint8_t const swap3[4] = {1, 0, 2, 3};
+
+    if (four && best0 < best1) {
+        uint16_t t = best0; best0 = best1; best1 = t;
+        for (int i = 0; i < 16; i++)
+            best_indices[i] = swap4[best_indices[i]];
+    } else if (four && best0 == best1) {
+        memset(best_indices, 0, 16);
+    } else if (!four && best0 > best1) {
+        uint16_t t = best0; best0 = best1; best1 = t;
+        for (int i = 0; i < 16; i++)
+            best_indices[i] = swap3[best_indices[i]];
+    }
+
+    if (!four) {
+        for (int i = 0; i < 16; i++) {
+            if (((float const *)&block->weight[i / 4])[i % 4] == 0.0f)
+                best_indices[i] = 3;
+        }
+    }
+
+    uint32_t bits = 0;
+    for (int i = 0; i < 16; i++)
+        bits |= (uint32_t)best_indices[i] << (2 * i);
+
+    out[0] = (uint8_t)best0;
+    out[1] = (uint8_t)(best0 >> 8);
+    out[2] = (uint8_t)best1;
+    out[3] = (uint8_t)(best1 >> 8);
+    memcpy(out + 4, &bits, 4);
+}
+
+static void bcn_encode_bc1(BcnBlock *block, int quality, uint8_t out[8])
+{
+    int transparent = 0;
+    for (int i = 0; i < 16; i++) {
+        if (block->f[3][i] < 128.0f) {
+            ((float *)&block->weight[i / 4])[i % 4] = 0.0f;
+            transparent++;
+        }
+    }
+
+    if (transparent == 16) {
+        uint32_t bits = 0xffffffffu;
+        memset(out, 0, 4);
+        memcpy(out + 4, &bits, 4);
+        return;
+    }
+
+    bcn_encode_colour(block, quality, transparent == 0, out);
+}
+
+
+
+// BC3 Alpha
+
+static float const bcn_alpha_positions8[8] = {
+    0.0f, 1.0f, 1.0f / 7.0f, 2.0f / 7.0f, 3.0f / 7.0f, 4.0f / 7.0f, 5.0f / 7.0f, 6.0f / 7.0f,
+};
+static float const bcn_alpha_positions6[8] = {
+    0.0f, 1.0f, 1.0f / 5.0f, 2.0f / 5.0f, 3.0f / 5.0f, 4.0f / 5.0f, 0.0f, 0.0f,
+};
+
+// Eight values between the endpoints when the first is greater, otherwise
+// six, plus 0 and 255.
+static void bcn_alpha_palette(int a0, int a1, int palette[8])
+{
+    palette[0] = a0;
+    palette[1] = a1;
+    if (a0 > a1) {
+        for (int i = 1; i < 7; i++)
+            palette[i + 1] = ((7 - i) * a0 + i * a1) / 7;
+    } else {
+        for (int i = 1; i < 5; i++)
+            palette[i + 1] = ((5 - i) * a0 + i * a1) / 5;
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+}
+
+static float bcn_try_alpha(BcnBlock const *block, int a0, int a1,
+                           uint8_t indices[16])
+{
+    int ints[8];
+    float palette[8][4] = {{0.0f}};
+    bcn_alpha_palette(a0, a1, ints);
+    for (int i = 0; i < 8; i++)
+        palette[i][3] = (float)ints[i];
+    return bcn_select(block, 3, 1, palette, 8, indices);
+}
+
+static void bcn_encode_alpha(BcnBlock const *block, int quality, uint8_t out[8])
+{
+    float lo = 255.0f, hi = 0.0f;
+    float inner_lo = 255.0f, inner_hi = 0.0f;
+    for (int i = 0; i < 16; i++) {
+        float a = block->f[3][i];
+        lo = bcn_min(lo, a);
+        hi = bcn_max(hi, a);
+        if (a > 0.0f && a < 255.0f) {
+            inner_lo = bcn_min(inner_lo, a);
+            inner_hi = bcn_max(inner_hi, a);
+        }
+    }
+
+    int best0 = (int)hi, best1 = (int)lo;
+    uint8_t best_indices[16] = {0};
+    float best_error = 0.0f;
+
+    if (best0 != best1) {
+        // Eight values from the extremes, refit if asked to.
+        float e0[4] = {0}, e1[4] = {0};
+        e0[3] = hi;
+        e1[3] = lo;
+        best_error = FLT_MAX;
+
+        for (int pass = 0; pass <= bcn_qualities[quality].refits; pass++) {
+            int a0 = bcn_clamp((int)(e0[3] + 0.5f), 0, 255);
+            int a1 = bcn_clamp((int)(e1[3] + 0.5f), 0, 255);
+            if (a0 <= a1)
+                break;
+
+            uint8_t indices[16];
+            float error = bcn_try_alpha(block, a0, a1, indices);
+            if (error < best_error) {
+                best_error = error;
+                best0 = a0;
+                best1 = a1;
+                memcpy(best_indices, indices, 16);
+            }
+
+            if (pass == bcn_qualities[quality].refits || error == 0.0f ||
+                !bcn_refit(block, 3, 1, indices, bcn_alpha_positions8, e0, e1))
+                break;
+        }
+
+        // Six values in between, when the block also holds 0 or 255.
+        if (bcn_qualities[quality].search && inner_lo <= inner_hi &&
+            (lo == 0.0f || hi == 255.0f)) {
+            uint8_t indices[16];
+            int a0 = (int)inner_lo, a1 = (int)inner_hi;
+            float error = bcn_try_alpha(block, a0, a1, indices);
+            if (error < best_error) {
+                best_error = error;
+                best0 = a0;
+                best1 = a1;
+                memcpy(best_indices, indices, 16);
+            }
+        }
+    }
+
+    uint64_t bits = 0;
+    for (int i = 0; i < 16; i++)
+        bits |= (uint64_t)best_indices[i] << (3 * i);
+
+    out[0] = (uint8_t)best0;
+    out[1] = (uint8_t)best1;
+    for (int i = 0; i < 6; i++)
+        out[2 + i] = (uint8_t)(bits >> (8 * i));
+}
+
+static void bcn_encode_bc3(BcnBlock const *block, int quality, uint8_t out[16])
+{
+    bcn_encode_alpha(block, quality, out);
+    bcn_encode_colour(block, quality, true, out + 8);
+}
+
+
+
+// BC7 Mode 6
+
+static int const bcn_bc7_weights[16] = {
+    0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64,
+};
+
+static inline int bcn_bc7_lerp(int e0, int e1, int index)
+{
+    int w = bcn_bc7_weights[index];
+    return ((64 - w) * e0 + w * e1 + 32) >> 6;
+}
+
+// Rounds an endpoint to 7 bits a channel, plus the low bit they share.
+static void bcn_bc7_round(float const e[4], int pbit, int q[4])
+{
+    for (int c = 0; c < 4; c++)
+        q[c] = bcn_clamp((int)((e[c] - pbit) * 0.5f + 0.5f), 0, 127);
+}
+
+static float bcn_bc7_round_error(float const e[4], int pbit)
+{
+    int q[4];
+    bcn_bc7_round(e, pbit, q);
+    float error = 0.0f;
+    for (int c = 0; c < 4; c++) {
+        float d = (float)((q[c] << 1) | pbit) - e[c];
+        error += d * d;
+    }
+    return error;
+}
+
+static void bcn_put_bits(uint8_t *out, int *at, uint32_t value, int count)
+{
+    for (int i = 0; i < count; i++, (*at)++) {
+        if (value & (1u << i))
+            out[*at / 8] |= (uint8_t)(1u << (*at % 8));
+    }
+}
+
+static void bcn_encode_bc7(BcnBlock const *block, int quality, uint8_t out[16])
+{
+    float positions[16];
+    for (int i = 0; i < 16; i++)
+        positions[i] = bcn_bc7_weights[i] / 64.0f;
+
+    float mean[4], axis[4], e0[4], e1[4];
+    bcn_axis(block, 0, 4, bcn_qualities[quality].axis_steps, mean, axis);
+    bcn_extent(block, 0, 4, mean, axis, e0, e1);
+
+    int best_q0[4] = {0}, best_q1[4] = {0};
+    int best_p0 = 0, best_p1 = 0;
+    uint8_t best_indices[16] = {0};
+    float best_error = FLT_MAX;
+
+    for (int pass = 0; pass <= bcn_qualities[quality].refits; pass++) {
+        // Either try every combination of low bits, or take the one that
+        // rounds each endpoint the closest.
+        int p0_first = 0, p0_last = 1, p1_first = 0, p1_last = 1;
+        if (!bcn_qualities[quality].search) {
+            p0_first = p0_last = (bcn_bc7_round_error(e0, 1) < bcn_bc7_round_error(e0, 0));
+            p1_first = p1_last = (bcn_bc7_round_error(e1, 1) < bcn_bc7_round_error(e1, 0));
+        }
+
+        uint8_t indices[16];
+        float error = FLT_MAX;
+
+        for (int p0 = p0_first; p0 <= p0_last; p0++) {
+            for (int p1 = p1_first; p1 <= p1_last; p1++) {
+                int q0[4], q1[4];
+                bcn_bc7_round(e0, p0, q0);
+                bcn_bc7_round(e1, p1, q1);
+
+                float palette[16][4];
+                for (int i = 0; i < 16; i++) {
+                    for (int c = 0; c < 4; c++)
+                        palette[i][c] = (float)bcn_bc7_lerp((q0[c] << 1) | p0, (q1[c] << 1) | p1, i);
+                }
+
+                uint8_t tried[16];
+                float e = bcn_select(block, 0, 4, palette, 16, tried);
+                if (e < error) {
+                    error = e;
+                    memcpy(indices, tried, 16);
+                }
+                if (e < best_error) {
+                    best_error = e;
+                    memcpy(best_q0, q0, sizeof(q0));
+                    memcpy(best_q1, q1, sizeof(q1));
+                    best_p0 = p0;
+                    best_p1 = p1;
+                    memcpy(best_indices, tried, 16);
+                }
+            }
+        }
+
+        if (pass == bcn_qualities[quality].refits || error == 0.0f ||
+            !bcn_refit(block, 0, 4, indices, positions, e0, e1))
+            break;
+    }
+
+    // The top bit of the first index is implied to be 0.
+    if (best_indices[0] & 8) {
+        for (int c = 0; c < 4; c++) {
+            int t = best_q0[c]; best_q0[c] = best_q1[c]; best_q1[c] = t;
+        }
+        int t = best_p0; best_p0 = best_p1; best_p1 = t;
+        for (int i = 0; i < 16; i++)
+            best_indices[i] = (uint8_t)(15 - best_indices[i]);
+    }
+
+    memset(out, 0, 16);
+    int at = 0;
+    bcn_put_bits(out, &at, 1u << 6, 7);
+    for (int c = 0; c < 4; c++) {
+        bcn_put_bits(out, &at, (uint32_t)best_q0[c], 7);
+        bcn_put_bits(out, &at, (uint32_t)best_q1[c], 7);
+    }
+    bcn_put_bits(out, &at, (uint32_t)best_p0, 1);
+    bcn_put_bits(out, &at, (uint32_t)best_p1, 1);
+    bcn_put_bits(out, &at, best_indices[0], 3);
+    for (int i = 1; i < 16; i++)
+        bcn_put_bits(out, &at, best_indices[i], 4);
+    ASSERT(at == 128);
+}
+
+
+
+// Encoding
+
+typedef struct BcnJob {
+    TextureImage const  *image;
+    uint8_t             *dst;
+    int                 format;
+    int                 quality;
+    int                 blocks_x;
+} BcnJob;
+
+static void bcn_encode_row(void *ctx, int by, int thread)
+{
+    BcnJob *job = (BcnJob *)ctx;
+    int bytes = texture_formats[job->format].block_bytes;
+    uint8_t *out = job->dst + (size_t)by * job->blocks_x * bytes;
+
+    for (int bx = 0; bx < job->blocks_x; bx++, out += bytes) {
+        BcnBlock block;
+        bcn_fetch(job->image, bx, by, &block);
+
+        switch (job->format) {
+        case TEXTURE_BC1: bcn_encode_bc1(&block, job->quality, out); break;
+        case TEXTURE_BC3: bcn_encode_bc3(&block, job->quality, out); break;
+        case TEXTURE_BC7: bcn_encode_bc7(&block, job->quality, out); break;
+        }
+    }
+}
+
+// Compresses an image into tightly packed rows of blocks, as texture_pack()
+// takes them: texture_size() bytes.
+static void bcn_encode(Pool *pool, int format, int quality, TextureImage const *image, uint8_t *dst)
+{
+    ASSERT(format == TEXTURE_BC1 || format == TEXTURE_BC3 || format == TEXTURE_BC7);
+    ASSERT(quality >= 0 && quality < BCN_QUALITIES);
+
+    BcnJob job = {image, dst, format, quality, (image->width + 3) / 4};
+    pool_for(pool, (image->height + 3) / 4, bcn_encode_row, &job);
+}
+
+
+
+// Decoding
+
+static void bcn_decode_colour(uint8_t const in[8], bool four_only, uint32_t texels[16])
+{
+    uint16_t c0 = (uint16_t)(in[0] | (in[1] << 8));
+    uint16_t c1 = (uint16_t)(in[2] | (in[3] << 8));
+    uint32_t bits;
+    memcpy(&bits, in + 4, 4);
+
+    int palette[4][4];
+    bcn_bc1_palette(c0, c1, four_only || c0 > c1, palette);
+
+    for (int i = 0; i < 16; i++) {
+        int const *p = palette[(bits >> (2 * i)) & 3];
+        texels[i] = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) |
+            ((uint32_t)p[3] << 24);
+    }
+}
+
+static void bcn_decode_alpha(uint8_t const in[8], uint32_t texels[16])
+{
+    int palette[8];
+    bcn_alpha_palette(in[0], in[1], palette);
+
+    uint64_t bits = 0;
+    for (int i = 0; i < 6; i++)
+        bits |= (uint64_t)in[2 + i] << (8 * i);
+
+    for (int i = 0; i < 16; i++) {
+        uint32_t a = (uint32_t)palette[(bits >> (3 * i)) & 7];
+        texels[i] = (texels[i] & 0x00ffffffu) | (a << 24);
+    }
+}
+
+static uint32_t bcn_get_bits(uint8_t const *in, int *at, int count)
+{
+    uint32_t value = 0;
+    for (int i = 0; i < count; i++, (*at)++)
+        value |= (uint32_t)((in[*at / 8] >> (*at % 8)) & 1) << i;
+    return value;
+}
+
+// Only mode 6 is understood, the one the encoder writes.  Other blocks come
+// out magenta.
+static void bcn_decode_bc7(uint8_t const in[16], uint32_t texels[16])
+{
+    if ((in[0] & 0x7f) != 0x40) {
+        for (int i = 0; i < 16; i++)
+            texels[i] = 0xffff00ffu;
+        return;
+    }
+
+    int at = 7;
+    int q0[4], q1[4];
+    for (int c = 0; c < 4; c++) {
+        q0[c] = (int)bcn_get_bits(in, &at, 7);
+        q1[c] = (int)bcn_get_bits(in, &at, 7);
+    }
+    int p0 = (int)bcn_get_bits(in, &at, 1);
+    int p1 = (int)bcn_get_bits(in, &at, 1);
+
+    for (int i = 0; i < 16; i++) {
+        int index = (int)bcn_get_bits(in, &at, (i == 0) ? 3 : 4);
+        uint32_t texel = 0;
+        for (int c = 0; c < 4; c++)
+            texel |= (uint32_t)bcn_bc7_lerp((q0[c] << 1) | p0, (q1[c] << 1) | p1, index) << (8 * c);
+        texels[i] = texel;
+    }
+}
+
+// Expands tightly packed rows of blocks back into RGBA8 texels.
+static void bcn_decode(int format, uint8_t const *src, int width, int height, uint32_t *dst)
+{
+    int bytes = texture_formats[format].block_bytes;
+    int blocks_x = (width + 3) / 4;
+    int blocks_y = (height + 3) / 4;
+
+    for (int by = 0; by < blocks_y; by++) {
+        for (int bx = 0; bx < blocks_x; bx++) {
+            uint8_t const *in = src + ((size_t)by * blocks_x + bx) * bytes;
+            uint32_t texels[16];
+
+            switch (format) {
+            case TEXTURE_BC1:
+                bcn_decode_colour(in, false, texels);
+                break;
+            case TEXTURE_BC3:
+                bcn_decode_colour(in + 8, true, texels);
+                bcn_decode_alpha(in, texels);
+                break;
+            case TEXTURE_BC7:
+                bcn_decode_bc7(in, texels);
+                break;
+            }
+
+            for (int y = 0; y < 4 && by * 4 + y < height; y++) {
+                for (int x = 0; x < 4 && bx * 4 + x < width; x++)
+                    dst[(size_t)(by * 4 + y) * width + bx * 4 + x] = texels[y * 4 + x];
+            }
+        }
+    }
+}
+
+// Peak signal-to-noise ratio in dB of `b` against `a`, over red, green and
+// blue, and alpha too if asked.  Identical images give INFINITY.
+static double bcn_psnr(uint32_t const *a, uint32_t const *b, size_t count, bool alpha)
+{
+    int channels = alpha ? 4 : 3;
+    double sum = 0.0;
+
+    for (size_t i = 0; i < count; i++) {
+        for (int c = 0; c < channels; c++) {
+            int d = (int)((a[i] >> (8 * c)) & 0xff) - (int)((b[i] >> (8 * c)) & 0xff);
+            sum += d * d;
+        }
+    }
+
+    if (sum == 0.0)
+        return INFINITY;
+    double mse = sum / ((double)count * channels);
+    return 10.0 * log10(255.0 * 255.0 / mse);
+}
@@ -0,0 +1,4552 @@
+// Headless benchmarks of the CPU-side machinery behind hello.cpp.
+//
+// Usage: bench [name ...]
+//
+// Runs the named benchmarks, or all of them.  Where the real thing would talk
+// to the GPU, the stand-ins of fake.h take its place, so everything here runs
+// on any machine, Linux build boxes included.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <float.h>
+#include <assert.h>
+
+#include <chrono>
+
+#define ASSERT(expr)    assert(expr)
+
+#include "fake.h"
+#include "frames.h"
+#include "upload.h"
+#include "transfer.h"
+#include "threads.h"
+#include "texture.h"
+#include "bcn.h"
+#include "cache.h"
+#include "tasks.h"
+#include "profile.h"
+#include "batch.h"
+#include "descriptors.h"
+#include "barriers.h"
+#include "jobs.h"
+#include "events.h"
+#include "pacing.h"
+#include "heaps.h"
+#include "constants.h"
+#include "vertices.h"
+#include "pack.h"
+#include "mesh.h"
+#include "capture.h"
+#include "reload.h"
+#include "pipelines.h"
+#include "indirect.h"
+#include "resolution.h"
+
+
+
+static double seconds(void)
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Keeps the CPU busy for a while, as recording a command list would.
+static void spin(double duration)
+{
+    double end = seconds() + duration;
+    while (seconds() < end)
+        ;
+}
+
+
+
+// Frames in Flight
+//
+// Every frame costs `record` seconds of CPU time and `execute` seconds of GPU
+// time.  With a single frame in flight they add up; with more, they overlap
+// and the slower of the two sets the pace.  The swap chain is resized now
+// and then, which has to drain the queue.
+
+static void bench_frames(void)
+{
+    double record = 0.002;
+    double execute = 0.003;
+    int frame_count = 200;
+    int resize_every = 50;
+
+    printf("frames: %.1f ms CPU + %.1f ms GPU per frame, resize every %d frames\n",
+           record * 1000.0, execute * 1000.0, resize_every);
+
+    for (int in_flight = 1; in_flight <= FRAMES_MAX; in_flight++) {
+        FakeQueue queue;
+        FakeFence fence;
+        fake_queue_init(&queue);
+        fake_fence_init(&fence, 0);
+
+        Frames frames;
+        frames_init(&frames, in_flight);
+
+        double waited = 0.0;
+        int stalls = 0;
+
+        double t0 = seconds();
+
+        for (int i = 0; i < frame_count; i++) {
+            if (i > 0 && i % resize_every == 0) {
+                uint64_t value = frames_drain(&frames);
+                fake_fence_wait(&fence, value);
+                ASSERT(fake_fence_completed(&fence) >= value);
+            }
+
+            uint64_t value = frames_begin(&frames);
+            if (fake_fence_completed(&fence) < value) {
+                double w0 = seconds();
+                fake_fence_wait(&fence, value);
+                waited += seconds() - w0;
+                stalls++;
+            }
+
+            spin(record);
+
+            fake_queue_execute(&queue, execute);
+            fake_queue_signal(&queue, &fence, frames_end(&frames));
+        }
+
+        fake_fence_wait(&fence, frames_drain(&frames));
+
+        double elapsed = seconds() - t0;
+
+        fake_queue_shutdown(&queue);
+
+        printf("  %d in flight: %6.2f ms/frame, %6.1f FPS, "
+               "CPU waited %5.1f%% (%d stalls), GPU busy %5.1f%%\n",
+               in_flight, 1000.0 * elapsed / frame_count, frame_count / elapsed,
+               100.0 * waited / elapsed, stalls, 100.0 * queue.busy / elapsed);
+    }
+}
+
+
+
+// Upload Ring
+//
+// Every frame streams a mix of vertex data, constant buffers and texture
+// rows into the ring, with a few frames in flight on the stand-in queue.
+// After every frame, what the frames still in flight wrote is checked, to
+// make sure the ring never hands out memory the GPU could still be reading.
+
+typedef struct BenchUpload {
+    FakeFence   *fence;
+    uint64_t    seen;   // The latest completed value the ring was told of.
+} BenchUpload;
+
+static bool bench_upload_create(void *ctx, uint64_t size, UploadBuffer *buffer)
+{
+    // As aligned as the GPU's, which are placed at 64 KB.
+    buffer->cpu = (uint8_t *)aligned_alloc(4096, size);
+    buffer->resource = buffer->cpu;
+    buffer->gpu = (uint64_t)(uintptr_t)buffer->cpu;
+    buffer->size = size;
+    return buffer->cpu != NULL;
+}
+
+static void bench_upload_destroy(void *ctx, UploadBuffer *buffer)
+{
+    free(buffer->cpu);
+}
+
+static uint64_t bench_upload_completed(void *ctx)
+{
+    BenchUpload *b = (BenchUpload *)ctx;
+    b->seen = (b->fence) ? fake_fence_completed(b->fence) : UINT64_MAX;
+    return b->seen;
+}
+
+static void bench_upload_wait(void *ctx, uint64_t value)
+{
+    BenchUpload *b = (BenchUpload *)ctx;
+    if (b->fence)
+        fake_fence_wait(b->fence, value);
+    if (value > b->seen)
+        b->seen = value;
+}
+
+// A cheap, reproducible source of sizes.
+static uint32_t bench_random(uint32_t *state)
+{
+    *state = *state * 1664525u + 1013904223u;
+    return *state >> 8;
+}
+
+static void bench_upload_frames(char const *name, uint64_t max_size)
+{
+    int frame_count = 300;
+    int in_flight = 3;
+    double execute = 0.001;
+
+    FakeQueue queue;
+    FakeFence fence;
+    fake_queue_init(&queue);
+    fake_fence_init(&fence, 0);
+
+    BenchUpload b = {&fence, 0};
+    UploadDevice device = {
+        &b, bench_upload_create, bench_upload_destroy,
+        bench_upload_completed, bench_upload_wait
+    };
+
+    Upload upload;
+    bool ok = upload_init(&upload, &device, 64 * 1024, max_size);
+    ASSERT(ok);
+
+    Frames frames;
+    frames_init(&frames, in_flight);
+
+    // What each frame slot wrote, with the fence value that retires it.
+    enum { MAX_CHECKS = 512 };
+    static UploadAllocation checks[FRAMES_MAX][MAX_CHECKS];
+    static uint64_t check_sizes[FRAMES_MAX][MAX_CHECKS];
+    int check_counts[FRAMES_MAX] = {0};
+    uint8_t check_tags[FRAMES_MAX] = {0};
+    uint64_t check_values[FRAMES_MAX] = {0};
+
+    uint32_t random = 1;
+
+    double t0 = seconds();
+
+    for (int i = 0; i < frame_count; i++) {
+        int slot = frames.index;
+        fake_fence_wait(&fence, frames_begin(&frames));
+
+        check_counts[slot] = 0;
+        check_tags[slot] = (uint8_t)(i + 1);
+
+        // The load rises and falls over time, to make the ring grow.
+        int draws = 20 + (int)(bench_random(&random) % 200) * (1 + (i / 50) % 3);
+
+        for (int k = 0; k < draws; k++) {
+            uint64_t size;
+            uint64_t alignment;
+            switch (bench_random(&random) % 8) {
+            case 0:
+                size = 256 * (1 + bench_random(&random) % 64);     // Texture rows.
+                alignment = UPLOAD_ALIGN_TEXTURE;
+                break;
+            case 1: case 2:
+                size = 32 * (3 + bench_random(&random) % 300);     // Vertices.
+                alignment = UPLOAD_ALIGN_VERTEX;
+                break;
+            default:
+                size = 16 * (1 + bench_random(&random) % 16);      // Constants.
+                alignment = UPLOAD_ALIGN_CONSTANTS;
+                break;
+            }
+
+            UploadAllocation a;
+            ok = upload_alloc(&upload, size, alignment, &a);
+            ASSERT(ok);
+            ASSERT(a.offset % alignment == 0);
+
+            memset(a.cpu, check_tags[slot], size);
+            if (check_counts[slot] < MAX_CHECKS) {
+                checks[slot][check_counts[slot]] = a;
+                check_sizes[slot][check_counts[slot]] = size;
+                check_counts[slot]++;
+            }
+        }
+
+        // Frames the ring has not been told are done must be untouched.
+        for (int s = 0; s < in_flight; s++) {
+            if (s == slot || check_values[s] <= b.seen)
+                continue;
+            for (int k = 0; k < check_counts[s]; k++) {
+                uint8_t const *p = checks[s][k].cpu;
+                ASSERT(p[0] == check_tags[s] && p[check_sizes[s][k] - 1] == check_tags[s]);
+            }
+        }
+
+        fake_queue_execute(&queue, execute);
+        uint64_t value = frames_end(&frames);
+        fake_queue_signal(&queue, &fence, value);
+        upload_end_frame(&upload, value);
+        check_values[slot] = value;
+    }
+
+    fake_fence_wait(&fence, frames_drain(&frames));
+    double elapsed = seconds() - t0;
+
+    fake_queue_shutdown(&queue);
+
+    UploadStats const *st = &upload.stats;
+    printf("  %-8s %6.1f KB/frame (peak %6.1f KB), padding %4.1f%%, "
+           "%llu grows to %llu KB, %llu stalls, %.1f ms/frame\n",
+           name, upload_bytes_per_frame(&upload) / 1024.0, st->peak_bytes / 1024.0,
+           100.0 * st->padding / (double)(st->bytes + st->padding),
+           (unsigned long long)st->grows, (unsigned long long)(upload.buffer.size / 1024),
+           (unsigned long long)st->stalls, 1000.0 * elapsed / frame_count);
+
+    upload_retire(&upload, fake_fence_completed(&fence));
+    upload_shutdown(&upload);
+}
+
+static void bench_upload(void)
+{
+    printf("upload: 3 frames in flight, mixed vertex/constant/texture data\n");
+
+    bench_upload_frames("growing", 64 * 1024 * 1024);
+    bench_upload_frames("capped", 2 * 1024 * 1024);
+
+
+    // The allocator alone, with a GPU that is never behind.
+
+    BenchUpload b = {NULL, 0};
+    UploadDevice device = {
+        &b, bench_upload_create, bench_upload_destroy,
+        bench_upload_completed, bench_upload_wait
+    };
+
+    Upload upload;
+    bool ok = upload_init(&upload, &device, 4 * 1024 * 1024, 4 * 1024 * 1024);
+    ASSERT(ok);
+
+    int count = 10 * 1000 * 1000;
+    uint64_t fence = 0;
+
+    double t0 = seconds();
+    for (int i = 0; i < count; i++) {
+        UploadAllocation a;
+        ok = upload_alloc(&upload, 256, UPLOAD_ALIGN_CONSTANTS, &a);
+        ASSERT(ok);
+        if (i % 1000 == 999)
+            upload_end_frame(&upload, ++fence);
+    }
+    double elapsed = seconds() - t0;
+
+    printf("  %.1f M allocations/s (256 B constants, 1000 per frame)\n",
+           count / elapsed / 1e6);
+
+    upload_shutdown(&upload);
+}
+
+
+
+// Copy Queue
+//
+// Assets of various sizes turn up every frame and have to be uploaded while
+// the direct queue keeps rendering.  Recording the copies into the frame
+// makes that frame as slow as the copies are; a copy queue of its own runs
+// them alongside, and batching several copies per submission pays the cost
+// of a submission less often.  Reports the frame times, how long assets
+// take to become usable, and the upload throughput.
+
+#define BENCH_ASSETS    2048
+
+static void bench_transfer_run(char const *name, int batch)
+{
+    int frame_count = 240;
+    double record = 0.0005;
+    double execute = 0.002;
+    double submission = 0.0002;         // Fixed cost of a submission.
+    double bandwidth = 8e9;             // Bytes per second.
+
+    FakeQueue direct, copy;
+    FakeFence direct_fence, copy_fence;
+    fake_queue_init(&direct);
+    fake_queue_init(&copy);
+    fake_fence_init(&direct_fence, 0);
+    fake_fence_init(&copy_fence, 0);
+
+    Frames frames;
+    frames_init(&frames, 2);
+
+    Transfer transfer;
+    transfer_init(&transfer, 3, batch, 32 * 1024 * 1024);
+
+    static uint64_t tickets[BENCH_ASSETS];
+    static double requested[BENCH_ASSETS];
+    int asset_count = 0;
+    int ready_count = 0;
+    double latency = 0.0;
+    double worst_latency = 0.0;
+    uint64_t bytes = 0;
+
+    double worst_frame = 0.0;
+    uint32_t random = 7;
+
+    double t0 = seconds();
+    double frame_start = t0;
+
+    for (int i = 0; i < frame_count; i++) {
+        fake_fence_wait(&direct_fence, frames_begin(&frames));
+
+        // Find out which assets have become usable.  Copies recorded into
+        // the frame carry the direct queue's fence value instead.
+        FakeFence *ticket_fence = (batch == 0) ? &direct_fence : &copy_fence;
+        uint64_t completed = fake_fence_completed(ticket_fence);
+        while (ready_count < asset_count && transfer_ready(tickets[ready_count], completed)) {
+            double l = seconds() - requested[ready_count];
+            latency += l;
+            if (l > worst_latency)
+                worst_latency = l;
+            ready_count++;
+        }
+
+        spin(record);
+
+        // New assets to upload: mostly a few small ones, now and then a burst.
+        int arrivals = (int)(bench_random(&random) % 4);
+        if (i % 40 == 0)
+            arrivals += 24;
+
+        double frame_cost = execute;
+
+        for (int k = 0; k < arrivals && asset_count < BENCH_ASSETS; k++) {
+            uint64_t size = 64 * 1024 * (1 + bench_random(&random) % 64);
+            double cost = (double)size / bandwidth;
+            bytes += size;
+
+            requested[asset_count] = seconds();
+
+            if (batch == 0) {
+                // Recorded straight into the frame.
+                frame_cost += cost;
+                tickets[asset_count] = frames.value + 1;
+            } else {
+                uint64_t wait;
+                if (transfer_begin(&transfer, &wait))
+                    fake_fence_wait(&copy_fence, wait);
+
+                tickets[asset_count] = transfer_add(&transfer, size);
+                fake_queue_execute(&copy, cost);
+
+                if (transfer_full(&transfer)) {
+                    fake_queue_execute(&copy, submission);
+                    fake_queue_signal(&copy, &copy_fence, transfer_submit(&transfer));
+                }
+            }
+            asset_count++;
+        }
+
+        // Whatever is left goes out at the end of the frame.
+        if (batch != 0 && transfer.open) {
+            fake_queue_execute(&copy, submission);
+            fake_queue_signal(&copy, &copy_fence, transfer_submit(&transfer));
+        }
+
+        fake_queue_execute(&direct, frame_cost);
+        uint64_t value = frames_end(&frames);
+        fake_queue_signal(&direct, &direct_fence, value);
+
+        double now = seconds();
+        if (now - frame_start > worst_frame && i > 0)
+            worst_frame = now - frame_start;
+        frame_start = now;
+    }
+
+    fake_fence_wait(&direct_fence, frames_drain(&frames));
+    fake_fence_wait(&copy_fence, transfer_drain(&transfer));
+    double elapsed = seconds() - t0;
+
+    fake_queue_shutdown(&direct);
+    fake_queue_shutdown(&copy);
+
+    uint64_t completed = fake_fence_completed((batch == 0) ? &direct_fence : &copy_fence);
+    while (ready_count < asset_count && transfer_ready(tickets[ready_count], completed)) {
+        latency += seconds() - requested[ready_count];
+        ready_count++;
+    }
+
+    printf("  %-14s %5.2f ms/frame (worst %5.2f), asset latency %6.2f ms (worst %6.2f), "
+           "%6.0f MB/s, %llu submissions\n",
+           name, 1000.0 * elapsed / frame_count, 1000.0 * worst_frame,
+           1000.0 * latency / asset_count, 1000.0 * worst_latency,
+           bytes / elapsed / 1e6,
+           (unsigned long long)((batch == 0) ? frame_count : transfer.stats.batches));
+}
+
+static void bench_transfer(void)
+{
+    printf("transfer: 2 ms frames, 64 KB..4 MB assets, bursts every 40 frames\n");
+
+    bench_transfer_run("direct queue", 0);
+    bench_transfer_run("copy, batch 1", 1);
+    bench_transfer_run("copy, batch 8", 8);
+    bench_transfer_run("copy, batch 64", 64);
+}
+
+
+
+// Texture Preparation
+//
+// An 8K RGBA8 texture gets its full mip chain, with both filters and in both
+// color spaces, then every level is packed into pitch-aligned upload memory.
+
+static void bench_texture(void)
+{
+    Pool pool;
+    pool_init(&pool, 0);
+
+    printf("texture: %d thread(s)\n", pool.thread_count);
+
+
+    // A small case that can be checked by hand: 2x2 checkers average to grey.
+
+    {
+        uint32_t texels[] = {0x20000000, 0x20ffffff, 0x20ffffff, 0x20000000};
+        TextureImage levels[2] = {{2, 2, texels}};
+        texture_mips(&pool, levels, 2, TEXTURE_BOX, false);
+        ASSERT(levels[1].width == 1 && levels[1].height == 1);
+        ASSERT(levels[1].texels[0] == 0x20808080);
+        texture_free_mips(levels, 2);
+
+        TextureDesc desc = {TEXTURE_RGBA8, 2, 2, 1, 2};
+        TextureFootprint f[2];
+        uint64_t total = texture_footprints(&desc, 0, 2, 0, f);
+        ASSERT(f[0].offset == 0 && f[0].row_pitch == 256 && f[0].rows == 2 && f[0].row_size == 8);
+        ASSERT(f[1].offset == 512 && f[1].rows == 1 && f[1].row_size == 4);
+        ASSERT(total == 516);
+    }
+
+
+    int size = 8192;
+    int mip_count = texture_mip_count(size, size);
+
+    TextureImage levels[TEXTURE_MAX_MIPS];
+    levels[0].width = size;
+    levels[0].height = size;
+    levels[0].texels = (uint32_t *)malloc((size_t)size * size * sizeof(uint32_t));
+    ASSERT(levels[0].texels);
+
+    uint32_t random = 3;
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            uint32_t noise = bench_random(&random) & 0x1f;
+            levels[0].texels[(size_t)y * size + x] =
+                ((x >> 5) & 0xff) | (((y >> 5) & 0xff) << 8) | (noise << 16) | 0xff000000u;
+        }
+    }
+
+    double source = (double)size * size * 4;
+
+    static struct {
+        char const  *name;
+        int         filter;
+        bool        srgb;
+    } const runs[] = {
+        {"box",         TEXTURE_BOX,    false},
+        {"box sRGB",    TEXTURE_BOX,    true},
+        {"kaiser",      TEXTURE_KAISER, false},
+        {"kaiser sRGB", TEXTURE_KAISER, true},
+    };
+
+    for (size_t r = 0; r < sizeof(runs) / sizeof(*runs); r++) {
+        double t0 = seconds();
+        texture_mips(&pool, levels, mip_count, runs[r].filter, runs[r].srgb);
+        double elapsed = seconds() - t0;
+
+        printf("  mips, %-12s %dx%d, %d levels: %7.1f ms, %7.1f MB/s\n",
+               runs[r].name, size, size, mip_count, 1000.0 * elapsed, source / elapsed / 1e6);
+
+        if (r + 1 < sizeof(runs) / sizeof(*runs))
+            texture_free_mips(levels, mip_count);
+    }
+
+
+    // Pack the whole chain, as if for a texture array of one slice.
+
+    TextureDesc desc = {TEXTURE_RGBA8, size, size, 1, mip_count};
+    TextureFootprint footprints[TEXTURE_MAX_MIPS];
+    uint64_t total = texture_footprints(&desc, 0, mip_count, 0, footprints);
+
+    uint8_t const *subresources[TEXTURE_MAX_MIPS];
+    for (int i = 0; i < mip_count; i++)
+        subresources[i] = (uint8_t const *)levels[i].texels;
+
+    uint8_t *staging = (uint8_t *)malloc(total);
+    ASSERT(staging);
+    memset(staging, 0xcd, total);  // Touch the pages before timing.
+
+    double t0 = seconds();
+    texture_pack(&pool, footprints, mip_count, subresources, staging);
+    double elapsed = seconds() - t0;
+
+    printf("  pack, %d levels, %.1f MB: %7.1f ms, %7.1f MB/s\n",
+           mip_count, total / 1e6, 1000.0 * elapsed, total / elapsed / 1e6);
+
+    for (int i = 0; i < mip_count; i++) {
+        TextureFootprint const *f = &footprints[i];
+        uint8_t const *last = staging + f->offset + (size_t)f->row_pitch * (f->rows - 1);
+        ASSERT(!memcmp(last, subresources[i] + (size_t)f->row_size * (f->rows - 1), f->row_size));
+    }
+
+    free(staging);
+    texture_free_mips(levels, mip_count);
+    free(levels[0].texels);
+    pool_shutdown(&pool);
+}
+
+
+
+// Block Compression
+// Encodes an image made to be hard on it in every format and at every
+// quality, then decodes it again to see how much was lost.
+
+static void bench_bcn(void)
+{
+    Pool pool;
+    pool_init(&pool, 0);
+
+    printf("bcn: %d thread(s)\n", pool.thread_count);
+
+
+    // Black and white survive BC1 and BC3 unchanged, at every quality.  In
+    // mode 6 of BC7, red, green, blue and alpha share their lowest bit, so
+    // opaque black can be off by one.
+
+    {
+        uint32_t texels[16];
+        for (int i = 0; i < 16; i++)
+            texels[i] = (((i ^ (i >> 2)) & 1) ? 0xffffffffu : 0xff000000u);
+        TextureImage image = {4, 4, texels};
+
+        for (int format = TEXTURE_BC1; format <= TEXTURE_BC7; format++) {
+            for (int quality = 0; quality < BCN_QUALITIES; quality++) {
+                uint8_t block[16];
+                uint32_t decoded[16];
+                bcn_encode(&pool, format, quality, &image, block);
+                bcn_decode(format, block, 4, 4, decoded);
+                if (format != TEXTURE_BC7)
+                    ASSERT(!memcmp(decoded, texels, sizeof(texels)));
+                else
+                    ASSERT(bcn_psnr(texels, decoded, 16, true) > 45.0);
+            }
+        }
+    }
+
+
+    int size = 1024;
+    size_t count = (size_t)size * size;
+
+    TextureImage image = {size, size, (uint32_t *)malloc(count * sizeof(uint32_t))};
+    uint32_t *decoded = (uint32_t *)malloc(count * sizeof(uint32_t));
+    uint8_t *blocks = (uint8_t *)malloc(texture_size(TEXTURE_BC7, size, size));
+    ASSERT(image.texels && decoded && blocks);
+
+    // Smooth gradients, sharp edges and a little noise in every channel.
+    uint32_t random = 5;
+    for (int y = 0; y < size; y++) {
+        for (int x = 0; x < size; x++) {
+            int noise = (int)(bench_random(&random) & 0x0f) - 8;
+            int r = x * 255 / size;
+            int g = (int)(127.5f + 127.5f * sinf(x * 0.05f) * cosf(y * 0.03f));
+            int b = (((x >> 5) ^ (y >> 5)) & 1) ? 200 : 40;
+            int a = 255 - (x + y) * 255 / (2 * size);
+            r = bcn_clamp(r + noise, 0, 255);
+            b = bcn_clamp(b + noise, 0, 255);
+            image.texels[(size_t)y * size + x] =
+                (uint32_t)r | ((uint32_t)g << 8) | ((uint32_t)b << 16) | ((uint32_t)a << 24);
+        }
+    }
+
+    static char const *const formats[] = {"", "BC1", "BC3", "BC7"};
+    static char const *const qualities[] = {"fast", "normal", "high"};
+
+    for (int format = TEXTURE_BC1; format <= TEXTURE_BC7; format++) {
+        // BC1 only keeps whether alpha is over half, so leave alpha out of it.
+        bool alpha = (format != TEXTURE_BC1);
+        if (!alpha) {
+            for (size_t i = 0; i < count; i++)
+                image.texels[i] |= 0xff000000u;
+        }
+
+        for (int quality = 0; quality < BCN_QUALITIES; quality++) {
+            double t0 = seconds();
+            bcn_encode(&pool, format, quality, &image, blocks);
+            double elapsed = seconds() - t0;
+
+            bcn_decode(format, blocks, size, size, decoded);
+            double psnr = bcn_psnr(image.texels, decoded, count, alpha);
+
+            printf("  %s %-6s %dx%d: %7.1f ms, %7.1f MB/s, PSNR %5.2f dB%s\n",
+                   formats[format], qualities[quality], size, size, 1000.0 * elapsed,
+                   count * 4 / elapsed / 1e6, psnr, alpha ? " (RGBA)" : " (RGB)");
+        }
+
+        if (!alpha) {
+            // Put the alpha back for the formats that keep it.
+            for (int y = 0; y < size; y++) {
+                for (int x = 0; x < size; x++) {
+                    uint32_t a = (uint32_t)(255 - (x + y) * 255 / (2 * size));
+                    image.texels[(size_t)y * size + x] =
+                        (image.texels[(size_t)y * size + x] & 0x00ffffffu) | (a << 24);
+                }
+            }
+        }
+    }
+
+    free(blocks);
+    free(decoded);
+    free(image.texels);
+    pool_shutdown(&pool);
+}
+
+
+
+// Shader Cache
+// A stand-in compiler takes as long as a small shader takes D3DCompile(),
+// and turns out bytecode that depends on everything in the key.  The source
+// includes a file the benchmark edits between runs.
+
+typedef struct BenchCompiler {
+    char const  *include;
+    double      cost;
+    int         compiled;
+} BenchCompiler;
+
+static char const bench_cache_source[] =
+    "#include \"common.hlsli\"\n"
+    "float4 vs(float4 p : POSITION) : SV_POSITION { return p * SCALE; }\n"
+    "float4 ps(float4 p : SV_POSITION) : SV_TARGET { return p.xxxx * SCALE; }\n";
+
+static void *bench_cache_compile(void *ctx, CacheRequest const *request, size_t *size)
+{
+    BenchCompiler *compiler = (BenchCompiler *)ctx;
+    spin(compiler->cost);
+    compiler->compiled++;
+
+    // The bytecode is whatever the key hashes to, repeated.
+    CacheKey h = cache_hash_begin();
+    cache_hash_string(&h, request->source, request->source_size);
+    cache_hash_string(&h, compiler->include, strlen(compiler->include));
+    for (int i = 0; i < request->define_count; i++)
+        cache_hash_string(&h, request->defines[i].value, strlen(request->defines[i].value));
+    cache_hash_string(&h, request->entry, strlen(request->entry));
+
+    *size = 1024 + (size_t)(h.lo % 1024);
+    uint32_t *code = (uint32_t *)malloc((*size + 3) & ~(size_t)3);
+    ASSERT(code);
+    uint32_t random = (uint32_t)h.hi;
+    for (size_t i = 0; i < (*size + 3) / 4; i++)
+        code[i] = bench_random(&random);
+    return code;
+}
+
+static char *bench_cache_read(void *ctx, char const *path, size_t *size)
+{
+    BenchCompiler *compiler = (BenchCompiler *)ctx;
+    if (strcmp(path, "common.hlsli") != 0)
+        return NULL;
+
+    *size = strlen(compiler->include);
+    char *text = (char *)malloc(*size + 1);
+    ASSERT(text);
+    memcpy(text, compiler->include, *size + 1);
+    return text;
+}
+
+// Opens the cache, asks it for every variant of both shaders, closes it.
+static void bench_cache_run(char const *name, char const *path, uint32_t version,
+                            BenchCompiler *bc)
+{
+    static char const *const values[] = {
+        "1", "2", "3", "4", "5", "6", "7", "8", "9", "10", "11", "12", "13", "14", "15", "16",
+    };
+    static char const *const entries[][2] = {{"vs", "vs_5_0"}, {"ps", "ps_5_0"}};
+
+    CacheCompiler compiler = {bc, bench_cache_compile, bench_cache_read};
+    bc->compiled = 0;
+
+    double t0 = seconds();
+    Cache cache;
+    cache_open(&cache, path, version);
+    double t1 = seconds();
+
+    size_t bytes = 0;
+    for (int v = 0; v < 16; v++) {
+        for (int e = 0; e < 2; e++) {
+            CacheDefine define = {"SCALE", values[v]};
+            CacheRequest request = {
+                "shaders.hlsl", bench_cache_source, sizeof(bench_cache_source) - 1,
+                &define, 1, entries[e][0], entries[e][1], 0,
+            };
+            size_t size;
+            void const *code = cache_compile(&cache, &request, &compiler, &size);
+            ASSERT(code);
+            bytes += size;
+        }
+    }
+    double t2 = seconds();
+
+    printf("  %-22s open %6.3f ms, %2d loaded, %5d bytes dropped, "
+           "%2d hits, %2d misses, %7.2f ms total\n",
+           name, 1000.0 * (t1 - t0), cache.stats.loaded, cache.stats.dropped,
+           cache.stats.hits, cache.stats.misses, 1000.0 * (t2 - t0));
+    ASSERT(cache.stats.misses == bc->compiled);
+
+    cache_close(&cache);
+}
+
+static void bench_cache(void)
+{
+    char const *path = "bench.cache";
+    remove(path);
+
+    BenchCompiler bc = {"#define ONE 1.0\n", 0.010, 0};
+
+    printf("cache: 32 shaders, %.0f ms to compile each\n", bc.cost * 1000.0);
+
+    bench_cache_run("cold", path, 1, &bc);
+    ASSERT(bc.compiled == 32);
+    bench_cache_run("warm", path, 1, &bc);
+    ASSERT(bc.compiled == 0);
+
+    // Every shader includes the edited file.  Edited back, the records from
+    // the first run are still there.
+    bc.include = "#define ONE 1.0f\n";
+    bench_cache_run("include edited", path, 1, &bc);
+    ASSERT(bc.compiled == 32);
+    bc.include = "#define ONE 1.0\n";
+    bench_cache_run("include edited back", path, 1, &bc);
+    ASSERT(bc.compiled == 0);
+
+    // A flipped byte takes everything after it along: here, some of the
+    // records of the first run.
+    FILE *file = fopen(path, "r+b");
+    ASSERT(file);
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, size / 4, SEEK_SET);
+    int c = fgetc(file);
+    fseek(file, size / 4, SEEK_SET);
+    fputc(c ^ 0x5a, file);
+    fclose(file);
+
+    bench_cache_run("corrupted", path, 1, &bc);
+    ASSERT(bc.compiled > 0);
+    bench_cache_run("repaired", path, 1, &bc);
+    ASSERT(bc.compiled == 0);
+
+    bench_cache_run("new compiler", path, 2, &bc);
+    ASSERT(bc.compiled == 32);
+
+    remove(path);
+}
+
+
+
+// Startup Tasks
+// The stages hello.cpp starts up with, with what each one roughly costs on a
+// desktop machine, and what it depends on.  Run on one thread, they add up;
+// on several, the critical path sets the pace.
+
+static void bench_tasks_stage(void *ctx)
+{
+    spin(*(double *)ctx);
+}
+
+static void bench_tasks_run(int thread_count)
+{
+    static struct {
+        char const  *name;
+        double      cost;
+        int         deps[4];    // Indices + 1, so that 0 ends the list.
+    } const stages[] = {
+        {"shaders",         0.060,  {0}},
+        {"texture data",    0.030,  {0}},
+        {"device",          0.040,  {0}},
+        {"root signature",  0.002,  {3}},
+        {"pipeline",        0.015,  {1, 4}},
+        {"command lists",   0.001,  {3, 5}},
+        {"copy lists",      0.001,  {3}},
+        {"fences",          0.0005, {3}},
+        {"upload ring",     0.001,  {3, 8}},
+        {"vertex buffer",   0.001,  {3}},
+        {"texture",         0.002,  {2, 3}},
+        {"assets",          0.003,  {7, 9, 10, 11}},
+    };
+    int count = (int)(sizeof(stages) / sizeof(*stages));
+
+    double costs[TASKS_MAX];
+    Tasks tasks;
+    tasks_init(&tasks);
+
+    for (int i = 0; i < count; i++) {
+        costs[i] = stages[i].cost;
+        tasks_add(&tasks, stages[i].name, bench_tasks_stage, &costs[i]);
+        for (int d = 0; d < 4 && stages[i].deps[d]; d++)
+            tasks_after(&tasks, i, stages[i].deps[d] - 1);
+    }
+
+    Pool pool;
+    pool_init(&pool, thread_count);
+    tasks_run(&tasks, &pool);
+    pool_shutdown(&pool);
+
+    // Nothing started before what it depends on was done.
+    for (int i = 0; i < count; i++) {
+        Task const *t = &tasks.tasks[i];
+        for (int d = 0; d < t->dep_count; d++)
+            ASSERT(tasks.tasks[t->deps[d]].end <= t->start);
+    }
+
+    char report[4096];
+    tasks_report(&tasks, report, sizeof(report));
+    printf("%d thread(s), ", thread_count);
+    fputs(report, stdout);
+}
+
+static void bench_tasks(void)
+{
+    printf("tasks: the startup stages of hello.cpp\n");
+    bench_tasks_run(1);
+    bench_tasks_run(4);
+}
+
+
+
+// Frame Profiler
+// A thousand frames with made-up phase times, a hitch every hundredth, and
+// the GPU reporting two frames late, so the statistics are known ahead.
+// Then the cost of profiling a frame, and a reader copying the ring while
+// the frame loop keeps overwriting it.
+
+static Profile bench_profile_ring;
+static ProfileFrame bench_profile_frames[PROFILE_CAPACITY];
+
+static void bench_profile_known(void)
+{
+    Profile *profile = &bench_profile_ring;
+    profile_init(profile);
+
+    double const phases[PROFILE_PHASES] = {0.0, 0.0001, 0.002, 0.005, 0.0005, 0.001};
+    double const frame = 0.0086;
+    double const hitch = 0.030;
+    int const count = 1000;
+    int const latency = 2;
+
+    double now = 0.0;
+    for (int i = 0; i < count; i++) {
+        uint64_t index = profile_begin_frame(profile, now);
+        for (int p = 0; p < PROFILE_PHASES; p++) {
+            now += phases[p];
+            if (p == PROFILE_WAIT && i % 100 == 99)
+                now += hitch;
+            profile_mark(profile, p, now);
+        }
+        profile_end_frame(profile, now, true);
+
+        if (index >= (uint64_t)latency) {
+            uint64_t done = index - latency;
+            profile_gpu(profile, done, 0.0086 * done + 0.001, 0.0086 * done + 0.008);
+        }
+    }
+    profile_flush(profile);
+
+    int read = profile_read(profile, bench_profile_frames, PROFILE_CAPACITY);
+    ASSERT(read == count);
+
+    ProfileStats stats;
+    profile_stats(bench_profile_frames, read, &stats);
+
+    ASSERT(stats.hitches == count / 100);
+    ASSERT(stats.gpu_count == count - latency);
+    ASSERT(fabs(stats.frame.p50 - frame) < 1e-9);
+    ASSERT(fabs(stats.frame.p95 - frame) < 1e-9);
+    ASSERT(fabs(stats.frame.p99 - frame) < 1e-9);
+    ASSERT(fabs(stats.frame.max - (frame + hitch)) < 1e-9);
+    ASSERT(fabs(stats.phases[PROFILE_WAIT].max - (phases[PROFILE_WAIT] + hitch)) < 1e-9);
+    ASSERT(fabs(stats.gpu.p50 - 0.007) < 1e-9);
+    ASSERT(stats.histogram[8] == count - count / 100);
+    ASSERT(stats.histogram[38 < PROFILE_BUCKETS ? 38 : PROFILE_BUCKETS - 1] == count / 100);
+
+    char report[2048];
+    profile_report(&stats, report, sizeof(report));
+    fputs(report, stdout);
+
+
+    // Both exports, to see they come out whole.
+    char const *paths[] = {"bench.json", "bench.csv"};
+    for (int k = 0; k < 2; k++) {
+        FILE *file = fopen(paths[k], "wb");
+        ASSERT(file);
+        bool ok = (k == 0) ? profile_write_trace(file, bench_profile_frames, read)
+                           : profile_write_csv(file, bench_profile_frames, read);
+        ASSERT(ok);
+        long size = ftell(file);
+        fclose(file);
+        remove(paths[k]);
+        printf("  %s: %ld bytes\n", (k == 0) ? "trace" : "csv", size);
+    }
+}
+
+static void bench_profile_cost(void)
+{
+    Profile *profile = &bench_profile_ring;
+    profile_init(profile);
+
+    int const count = 1000000;
+    double t0 = seconds();
+    for (int i = 0; i < count; i++) {
+        uint64_t index = profile_begin_frame(profile, seconds());
+        for (int p = 0; p < PROFILE_PHASES; p++)
+            profile_mark(profile, p, seconds());
+        profile_end_frame(profile, seconds(), true);
+        if (index >= 2)
+            profile_gpu(profile, index - 2, 0.0, 0.0);
+    }
+    double t1 = seconds();
+
+    printf("  %.0f ns per frame, clock reads included\n", 1e9 * (t1 - t0) / count);
+}
+
+// The writer numbers everything after the frame, so a torn copy shows.
+static void bench_profile_writer(Profile *profile, int count)
+{
+    for (int i = 0; i < count; i++) {
+        uint64_t index = profile_begin_frame(profile, (double)i);
+        for (int p = 0; p < PROFILE_PHASES; p++)
+            profile_mark(profile, p, (double)i);
+        profile_end_frame(profile, (double)index, false);
+    }
+}
+
+static void bench_profile_reader(void)
+{
+    Profile *profile = &bench_profile_ring;
+    profile_init(profile);
+
+    int const count = 20000000;
+    std::thread writer(bench_profile_writer, profile, count);
+
+    static ProfileFrame frames[PROFILE_CAPACITY];
+    int reads = 0;
+    int lapped = 0;
+    int64_t dropped = 0;
+
+    while (profile->published.load(std::memory_order_relaxed) < PROFILE_CAPACITY)
+        ;
+
+    while (profile->published.load(std::memory_order_relaxed) < (uint64_t)count) {
+        int n = profile_read(profile, frames, PROFILE_CAPACITY);
+        for (int i = 0; i < n; i++) {
+            ASSERT(frames[i].begin == (double)frames[i].index);
+            ASSERT(frames[i].end == (double)frames[i].index);
+            ASSERT(i == 0 || frames[i].index == frames[i - 1].index + 1);
+        }
+
+        reads++;
+        lapped += (n < PROFILE_CAPACITY);
+        dropped += PROFILE_CAPACITY - n;
+    }
+    writer.join();
+
+    // With the writer gone, nothing was overwritten: every frame is there.
+    int n = profile_read(profile, frames, PROFILE_CAPACITY);
+    ASSERT(n == PROFILE_CAPACITY);
+    ASSERT(frames[n - 1].index == (uint64_t)count - 1);
+
+    printf("  %d reads while writing, %d lapped by the writer, %.1f frames dropped per read\n",
+           reads, lapped, (double)dropped / (reads ? reads : 1));
+}
+
+static void bench_profile(void)
+{
+    printf("profile: known frames\n");
+    bench_profile_known();
+    printf("profile: cost\n");
+    bench_profile_cost();
+    printf("profile: reading the ring while it is written\n");
+    bench_profile_reader();
+}
+
+
+
+// Instanced Batches
+// A million instances over the scene, packed at a few points of the
+// animation: zoomed out, where all of them are on screen, and zoomed in,
+// where most are culled.  What got packed is checked against the same
+// test done one instance at a time in double precision, and the SIMD
+// kernel is timed against that plain loop.
+
+// Whether vs() puts instance `i` on screen, with `margin` to spare (the
+// sign telling which way).
+static bool bench_batch_visible(Batch const *batch, float const consts[4], int i, double margin)
+{
+    float view[4];
+    batch_view(consts, view);
+
+    float *const *f = batch->fields;
+    double x = f[BATCH_X][i];
+    double y = f[BATCH_Y][i];
+    double r = f[BATCH_RADIUS][i];
+
+    double cx = (double)view[0] * x + (double)view[1] * y;
+    double cy = (double)view[2] * x + (double)view[3] * y;
+    double rx = r * sqrt((double)view[0] * view[0] + (double)view[1] * view[1]);
+    double ry = r * sqrt((double)view[2] * view[2] + (double)view[3] * view[3]);
+
+    return fabs(cx) - rx < 1.0 - margin && fabs(cy) - ry < 1.0 - margin;
+}
+
+// The plain loop: one instance at a time, through the same arrays.
+static int bench_batch_scalar(Batch const *batch, float const consts[4], BatchInstance *dst)
+{
+    float view[4];
+    batch_view(consts, view);
+    float reach_x = sqrtf(view[0] * view[0] + view[1] * view[1]);
+    float reach_y = sqrtf(view[2] * view[2] + view[3] * view[3]);
+
+    float *const *f = batch->fields;
+    int count = 0;
+    for (int i = 0; i < batch->count; i++) {
+        float cx = view[0] * f[BATCH_X][i] + view[1] * f[BATCH_Y][i];
+        float cy = view[2] * f[BATCH_X][i] + view[3] * f[BATCH_Y][i];
+        float r = f[BATCH_RADIUS][i];
+        if (fabsf(cx) - reach_x * r < 1.0f && fabsf(cy) - reach_y * r < 1.0f) {
+            BatchInstance *out = &dst[count++];
+            out->transform[0] = f[BATCH_M00][i];
+            out->transform[1] = f[BATCH_M01][i];
+            out->transform[2] = f[BATCH_M10][i];
+            out->transform[3] = f[BATCH_M11][i];
+            out->offset[0] = f[BATCH_X][i];
+            out->offset[1] = f[BATCH_Y][i];
+            out->uv_offset[0] = f[BATCH_U][i];
+            out->uv_offset[1] = f[BATCH_V][i];
+            out->color[0] = f[BATCH_R][i];
+            out->color[1] = f[BATCH_G][i];
+            out->color[2] = f[BATCH_B][i];
+            out->color[3] = f[BATCH_A][i];
+        }
+    }
+    return count;
+}
+
+static void bench_batch(void)
+{
+    int const count = 1000000;
+    int const rounds = 20;
+
+    Batch batch;
+    batch_init(&batch, triangle, (int)(sizeof(triangle) / sizeof(*triangle)));
+    batch_grid(&batch, count);
+
+    BatchInstance *dst = (BatchInstance *)malloc(count * sizeof(BatchInstance));
+    ASSERT(dst);
+
+    Pool pool;
+    pool_init(&pool, 0);
+
+    // Uptimes where vs() zooms out all the way, half way, and all the way in.
+    float const uptimes[] = {0.0f, 1.57f, 3.14f};
+
+    printf("batch: %d instances, %d-wide SIMD, %d thread(s)\n",
+           count, BATCH_LANES, pool.thread_count);
+
+    for (int u = 0; u < 3; u++) {
+        float consts[4] = {1280.0f, 720.0f, 720.0f / 1280.0f, uptimes[u]};
+
+        // What got packed is what should have been, give or take rounding
+        // at the very edge of the screen.
+        batch_pack(&batch, &pool, consts, dst);
+        for (int d = 0; d < batch.draw_count; d++) {
+            BatchDraw const *draw = &batch.draws[d];
+            ASSERT(draw->count > 0 && draw->count <= BATCH_CHUNK);
+
+            int chunk_end = (draw->first / BATCH_CHUNK + 1) * BATCH_CHUNK;
+            int i = draw->first;
+            for (int k = 0; k < draw->count; k++, i++) {
+                BatchInstance const *packed = &dst[draw->first + k];
+                while (i < chunk_end && (batch.fields[BATCH_X][i] != packed->offset[0] ||
+                                         batch.fields[BATCH_Y][i] != packed->offset[1])) {
+                    ASSERT(!bench_batch_visible(&batch, consts, i, 1e-4));
+                    i++;
+                }
+                ASSERT(i < chunk_end);
+                ASSERT(bench_batch_visible(&batch, consts, i, -1e-4));
+            }
+        }
+
+        double t0 = seconds();
+        int scalar = 0;
+        for (int r = 0; r < rounds; r++)
+            scalar = bench_batch_scalar(&batch, consts, dst);
+        double t1 = seconds();
+        for (int r = 0; r < rounds; r++)
+            batch_pack(&batch, NULL, consts, dst);
+        double t2 = seconds();
+        for (int r = 0; r < rounds; r++)
+            batch_pack(&batch, &pool, consts, dst);
+        double t3 = seconds();
+
+        ASSERT(scalar == batch.visible);
+
+        double total = (double)count * rounds;
+        printf("  uptime %.2f: %7d on screen in %2d draws, "
+               "%7.1f M/s plain, %7.1f M/s SIMD, %7.1f M/s pooled\n",
+               uptimes[u], batch.visible, batch.draw_count,
+               total / (t1 - t0) / 1e6, total / (t2 - t1) / 1e6, total / (t3 - t2) / 1e6);
+    }
+
+    pool_shutdown(&pool);
+    free(dst);
+    batch_free(&batch);
+}
+
+
+
+// Descriptor Heaps
+// Single descriptors churn through a heap of a million, freed with the
+// frame's fence value and reused two frames later; descriptor tables of
+// all sizes churn through a smaller one, to see how it fragments.  Then
+// textures created in a staging heap are copied into the shader-visible
+// one, queued in random order, to see how many runs the copies take, and
+// twice into the same place, to see that the later copy wins.
+
+typedef struct BenchDescriptor {
+    uint64_t    words[4];   // As large as a D3D12 descriptor, more or less.
+} BenchDescriptor;
+
+typedef struct BenchDescriptorHeaps {
+    BenchDescriptor *staging;
+    BenchDescriptor *visible;
+    int             calls;
+} BenchDescriptorHeaps;
+
+static void bench_descriptors_copy(void *ctx, DescriptorCopy const *copies, int count)
+{
+    BenchDescriptorHeaps *heaps = (BenchDescriptorHeaps *)ctx;
+    for (int i = 0; i < count; i++) {
+        memcpy(&heaps->visible[copies[i].dst], &heaps->staging[copies[i].src],
+               copies[i].count * sizeof(BenchDescriptor));
+    }
+    heaps->calls++;
+}
+
+static void bench_descriptors_churn(void)
+{
+    Descriptors heap;
+    bool ok = descriptors_init(&heap, 1000000, NULL);
+    ASSERT(ok);
+
+    // A freed handle goes stale, even once its descriptor is reused.
+    DescriptorHandle first = descriptors_alloc(&heap, 1);
+    descriptors_free(&heap, first, 0);
+    DescriptorHandle again = descriptors_alloc(&heap, 1);
+    ASSERT(descriptors_index(&heap, again) == 0);
+    ASSERT(again != first && !descriptors_valid(&heap, first) && descriptors_valid(&heap, again));
+    descriptors_free(&heap, again, 0);
+
+    int const live = 65536;
+    int const per_frame = 1024;
+    int const frames = 2000;
+    int const in_flight = 2;
+
+    DescriptorHandle *handles = (DescriptorHandle *)malloc(live * sizeof(DescriptorHandle));
+    ASSERT(handles);
+    for (int i = 0; i < live; i++)
+        handles[i] = descriptors_alloc(&heap, 1);
+
+    uint32_t random = 1;
+    double t0 = seconds();
+    for (int frame = 1; frame <= frames; frame++) {
+        descriptors_retire(&heap, (frame > in_flight) ? (uint64_t)(frame - in_flight) : 0);
+
+        for (int k = 0; k < per_frame; k++) {
+            int i = (int)(bench_random(&random) % live);
+            descriptors_free(&heap, handles[i], (uint64_t)frame);
+            handles[i] = descriptors_alloc(&heap, 1);
+            ASSERT(handles[i] != DESCRIPTORS_NONE);
+        }
+    }
+    double t1 = seconds();
+
+    DescriptorStats stats = descriptors_stats(&heap);
+    printf("  singles: %.1f M alloc+free/s, %u in use, %d free ranges, %u largest\n",
+           (double)frames * per_frame / (t1 - t0) / 1e6,
+           stats.used, stats.free_ranges, stats.largest_free);
+
+    free(handles);
+    descriptors_shutdown(&heap);
+}
+
+static void bench_descriptors_tables(void)
+{
+    uint32_t const capacity = 65536;
+
+    Descriptors heap;
+    bool ok = descriptors_init(&heap, capacity, NULL);
+    ASSERT(ok);
+
+    int const slots = 2048;
+    DescriptorHandle handles[2048] = {0};
+    uint32_t used = 0;
+
+    uint32_t random = 7;
+    int const steps = 1000000;
+    double t0 = seconds();
+    for (int step = 0; step < steps; step++) {
+        int i = (int)(bench_random(&random) % slots);
+        if (handles[i]) {
+            used -= heap.counts[descriptors_index(&heap, handles[i])];
+            descriptors_free(&heap, handles[i], 0);
+            handles[i] = DESCRIPTORS_NONE;
+        } else {
+            // Mostly small tables, now and then a large one.
+            uint32_t size = 1 + bench_random(&random) % 16;
+            if (bench_random(&random) % 16 == 0)
+                size *= 8;
+            handles[i] = descriptors_alloc(&heap, size);
+            if (handles[i])
+                used += size;
+        }
+    }
+    double t1 = seconds();
+
+    DescriptorStats stats = descriptors_stats(&heap);
+    ASSERT(stats.used == used);
+    uint32_t free_total = capacity - stats.used;
+    printf("  tables:  %.1f M ops/s, %u of %u in use, %d free ranges, "
+           "largest %u of %u free (%.0f%% fragmented), %llu failed\n",
+           steps / (t1 - t0) / 1e6, stats.used, capacity, stats.free_ranges,
+           stats.largest_free, free_total,
+           100.0 * (1.0 - (double)stats.largest_free / (double)free_total),
+           (unsigned long long)stats.failures);
+
+    descriptors_shutdown(&heap);
+}
+
+static void bench_descriptors_copies(void)
+{
+    int const textures = 4096;
+    uint32_t const capacity = 16384;
+
+    BenchDescriptorHeaps heaps;
+    heaps.staging = (BenchDescriptor *)calloc(capacity, sizeof(BenchDescriptor));
+    heaps.visible = (BenchDescriptor *)calloc(capacity, sizeof(BenchDescriptor));
+    heaps.calls = 0;
+    ASSERT(heaps.staging && heaps.visible);
+
+    DescriptorDevice device = {&heaps, bench_descriptors_copy};
+
+    Descriptors staging, visible;
+    bool ok = descriptors_init(&staging, capacity, NULL) &&
+              descriptors_init(&visible, capacity, &device);
+    ASSERT(ok);
+
+    // Both heaps have seen some churn already, so neither hands out one
+    // unbroken run.
+    uint32_t random = 3;
+    DescriptorHandle holes[1024];
+    for (int i = 0; i < 1024; i++) {
+        holes[i] = descriptors_alloc(&staging, 1);
+        descriptors_alloc(&visible, 1);
+    }
+    for (int i = 0; i < 1024; i += 1 + (int)(bench_random(&random) % 8))
+        descriptors_free(&staging, holes[i], 0);
+
+    uint32_t *src = (uint32_t *)malloc(textures * sizeof(uint32_t));
+    uint32_t *dst = (uint32_t *)malloc(textures * sizeof(uint32_t));
+    ASSERT(src && dst);
+
+    for (int i = 0; i < textures; i++) {
+        src[i] = descriptors_index(&staging, descriptors_alloc(&staging, 1));
+        dst[i] = descriptors_index(&visible, descriptors_alloc(&visible, 1));
+        heaps.staging[src[i]].words[0] = (uint64_t)i + 1;
+    }
+
+    // Textures finish loading in any order.
+    for (int i = textures - 1; i > 0; i--) {
+        int k = (int)(bench_random(&random) % (uint32_t)(i + 1));
+        uint32_t s = src[i], d = dst[i];
+        src[i] = src[k]; dst[i] = dst[k];
+        src[k] = s; dst[k] = d;
+    }
+
+    double t0 = seconds();
+    for (int i = 0; i < textures; i++)
+        descriptors_copy(&visible, dst[i], src[i], 1);
+    int runs = descriptors_flush(&visible);
+    double t1 = seconds();
+
+    for (int i = 0; i < textures; i++)
+        ASSERT(!memcmp(&heaps.visible[dst[i]], &heaps.staging[src[i]], sizeof(BenchDescriptor)));
+    ASSERT(heaps.calls == 1);
+
+    printf("  copies:  %d descriptors in %d runs, one call, %.1f us\n",
+           textures, runs, 1e6 * (t1 - t0));
+
+    // A texture that was replaced before the copies went out: of two
+    // copies into its slot, the later one wins.
+    for (int i = 0; i < textures; i++) {
+        descriptors_copy(&visible, dst[i], src[i], 1);
+        descriptors_copy(&visible, dst[i], src[textures - 1 - i], 1);
+    }
+    descriptors_flush(&visible);
+    for (int i = 0; i < textures; i++)
+        ASSERT(!memcmp(&heaps.visible[dst[i]], &heaps.staging[src[textures - 1 - i]], sizeof(BenchDescriptor)));
+
+    free(src);
+    free(dst);
+    descriptors_shutdown(&staging);
+    descriptors_shutdown(&visible);
+    free(heaps.staging);
+    free(heaps.visible);
+}
+
+static void bench_descriptors(void)
+{
+    printf("descriptors:\n");
+    bench_descriptors_churn();
+    bench_descriptors_tables();
+    bench_descriptors_copies();
+}
+
+
+
+// Resource Barriers
+// A frame like the one hello.cpp records, with an offscreen target and a
+// texture that is written to a mip at a time, checked barrier by barrier.
+// Then thousands of draws over a thousand resources, through a command list
+// that replays every barrier against the states it has seen so far, to
+// check that each one starts where the last one left off.  Barriers that go
+// out are counted against the ones a barrier per changed state would take.
+
+#define BENCH_BARRIERS_RESOURCES    1024
+#define BENCH_BARRIERS_SUBRESOURCES 10
+#define BENCH_BARRIERS_MOVING       0x80000000u     // Between begin and end.
+
+typedef struct BenchBarrierList {
+    Barrier     log[64];
+    int         logged;
+    int         calls;
+
+    // The states the GPU would see, when replaying.
+    bool        replay;
+    int         counts[BENCH_BARRIERS_RESOURCES];
+    uint32_t    states[BENCH_BARRIERS_RESOURCES][BENCH_BARRIERS_SUBRESOURCES];
+} BenchBarrierList;
+
+static void bench_barriers_emit(void *ctx, Barrier const *barriers, int count)
+{
+    BenchBarrierList *list = (BenchBarrierList *)ctx;
+    list->calls++;
+
+    if (!list->replay) {
+        for (int i = 0; i < count; i++) {
+            ASSERT(list->logged < (int)(sizeof(list->log) / sizeof(*list->log)));
+            list->log[list->logged++] = barriers[i];
+        }
+        return;
+    }
+
+    for (int i = 0; i < count; i++) {
+        Barrier const *b = &barriers[i];
+        if (b->type == BARRIER_UAV)
+            continue;
+
+        int id = (int)((uintptr_t)b->resource - 1);
+        int first = (b->subresource == BARRIERS_ALL) ? 0 : (int)b->subresource;
+        int end = (b->subresource == BARRIERS_ALL) ? list->counts[id] : first + 1;
+        for (int s = first; s < end; s++) {
+            uint32_t *state = &list->states[id][s];
+            if (b->flags == BARRIER_BEGIN) {
+                ASSERT(*state == b->before);
+                *state = BENCH_BARRIERS_MOVING | b->after;
+            } else if (b->flags == BARRIER_END) {
+                ASSERT(*state == (BENCH_BARRIERS_MOVING | b->after));
+                *state = b->after;
+            } else {
+                ASSERT(*state == b->before && b->before != b->after);
+                *state = b->after;
+            }
+        }
+    }
+}
+
+static bool bench_barriers_logged(BenchBarrierList const *list, int i, void *resource,
+                                  uint32_t subresource, uint32_t before, uint32_t after, int flags)
+{
+    Barrier const *b = &list->log[i];
+    return b->resource == resource && b->subresource == subresource && b->before == before &&
+           b->after == after && b->type == BARRIER_TRANSITION && b->flags == flags;
+}
+
+static void bench_barriers_frame(void)
+{
+    static BenchBarrierList list;
+    memset(&list, 0, sizeof(list));
+
+    BarrierDevice device = {&list, bench_barriers_emit};
+    Barriers t;
+    barriers_init(&t, &device);
+
+    void *back_buffer = (void *)1, *vertices = (void *)2, *texture = (void *)3, *target = (void *)4;
+    int rt = barriers_track(&t, back_buffer, 1, false, BARRIERS_PRESENT);
+    int vb = barriers_track(&t, vertices, 1, true, BARRIERS_COMMON);
+    int tex = barriers_track(&t, texture, 4, false, BARRIERS_COMMON);
+    int off = barriers_track(&t, target, 1, false, BARRIERS_COMMON);
+
+    for (int frame = 0; frame < 2; frame++) {
+        list.logged = 0;
+        list.calls = 0;
+
+        // The back buffer starts moving as soon as recording starts.
+        barriers_begin(&t, rt, BARRIERS_ALL, BARRIERS_RENDER_TARGET);
+        barriers_flush(&t);
+
+        // Both reads of the texture are promoted from COMMON.
+        barriers_use(&t, rt, BARRIERS_ALL, BARRIERS_RENDER_TARGET);
+        barriers_use(&t, vb, BARRIERS_ALL, BARRIERS_VERTEX_BUFFER);
+        barriers_use(&t, tex, BARRIERS_ALL, BARRIERS_PIXEL_SHADER);
+        barriers_use(&t, tex, BARRIERS_ALL, BARRIERS_NON_PIXEL_SHADER);
+        barriers_flush(&t);
+
+        // Another draw with the same: nothing.
+        barriers_use(&t, rt, BARRIERS_ALL, BARRIERS_RENDER_TARGET);
+        barriers_use(&t, vb, BARRIERS_ALL, BARRIERS_VERTEX_BUFFER);
+        barriers_use(&t, tex, BARRIERS_ALL, BARRIERS_PIXEL_SHADER);
+        barriers_flush(&t);
+
+        // Render into the top mip, then read all of them again.
+        barriers_use(&t, off, BARRIERS_ALL, BARRIERS_RENDER_TARGET);
+        barriers_use(&t, tex, 0, BARRIERS_COPY_DEST);
+        barriers_flush(&t);
+
+        barriers_use(&t, off, BARRIERS_ALL, BARRIERS_PIXEL_SHADER);
+        barriers_use(&t, tex, BARRIERS_ALL, BARRIERS_PIXEL_SHADER);
+        barriers_use(&t, tex, BARRIERS_ALL, BARRIERS_NON_PIXEL_SHADER);
+        barriers_flush(&t);
+
+        // Thought better of it: back where it was, so no barrier at all.
+        barriers_use(&t, off, BARRIERS_ALL, BARRIERS_RENDER_TARGET);
+        barriers_use(&t, off, BARRIERS_ALL, BARRIERS_PIXEL_SHADER);
+        barriers_flush(&t);
+
+        barriers_use(&t, rt, BARRIERS_ALL, BARRIERS_PRESENT);
+        barriers_flush(&t);
+        barriers_submit(&t);
+
+        uint32_t read = BARRIERS_PIXEL_SHADER | BARRIERS_NON_PIXEL_SHADER;
+        uint32_t off_before = (frame == 0) ? BARRIERS_COMMON : BARRIERS_PIXEL_SHADER;
+
+        ASSERT(list.logged == 7 && list.calls == 5);
+        ASSERT(bench_barriers_logged(&list, 0, back_buffer, BARRIERS_ALL,
+                                     BARRIERS_PRESENT, BARRIERS_RENDER_TARGET, BARRIER_BEGIN));
+        ASSERT(bench_barriers_logged(&list, 1, back_buffer, BARRIERS_ALL,
+                                     BARRIERS_PRESENT, BARRIERS_RENDER_TARGET, BARRIER_END));
+        ASSERT(bench_barriers_logged(&list, 2, target, BARRIERS_ALL,
+                                     off_before, BARRIERS_RENDER_TARGET, BARRIER_FULL));
+        ASSERT(bench_barriers_logged(&list, 3, texture, 0,
+                                     read, BARRIERS_COPY_DEST, BARRIER_FULL));
+        ASSERT(bench_barriers_logged(&list, 4, target, BARRIERS_ALL,
+                                     BARRIERS_RENDER_TARGET, BARRIERS_PIXEL_SHADER, BARRIER_FULL));
+        ASSERT(bench_barriers_logged(&list, 5, texture, 0,
+                                     BARRIERS_COPY_DEST, read, BARRIER_FULL));
+        ASSERT(bench_barriers_logged(&list, 6, back_buffer, BARRIERS_ALL,
+                                     BARRIERS_RENDER_TARGET, BARRIERS_PRESENT, BARRIER_FULL));
+
+        // The buffer and the promoted mips decay; the mip that was written
+        // to stays where the last barrier put it.
+        ASSERT(barriers_state(&t, vb, 0) == BARRIERS_COMMON);
+        ASSERT(barriers_state(&t, tex, 0) == read);
+        for (int mip = 1; mip < 4; mip++)
+            ASSERT(barriers_state(&t, tex, mip) == BARRIERS_COMMON);
+    }
+
+    BarrierStats stats = t.stats;
+    printf("  frame:   %llu uses, %llu barriers in %llu calls, %llu elided (%llu promoted), "
+           "%llu merged, %llu split\n",
+           (unsigned long long)stats.uses, (unsigned long long)stats.emitted,
+           (unsigned long long)stats.calls, (unsigned long long)stats.elided,
+           (unsigned long long)stats.promoted, (unsigned long long)stats.merged,
+           (unsigned long long)stats.split);
+
+    barriers_shutdown(&t);
+}
+
+// A split begun for all subresources ends for all of them, with the
+// barrier it was begun with, even when only one of them is used.
+static void bench_barriers_split(void)
+{
+    static BenchBarrierList list;
+    memset(&list, 0, sizeof(list));
+
+    BarrierDevice device = {&list, bench_barriers_emit};
+    Barriers t;
+    barriers_init(&t, &device);
+
+    void *texture = (void *)1;
+    int tex = barriers_track(&t, texture, 4, false, BARRIERS_PIXEL_SHADER);
+
+    // Used in the state the split goes to: the end is all it takes.
+    barriers_begin(&t, tex, BARRIERS_ALL, BARRIERS_RENDER_TARGET);
+    barriers_flush(&t);
+    barriers_use(&t, tex, 0, BARRIERS_RENDER_TARGET);
+    barriers_flush(&t);
+
+    ASSERT(list.logged == 2);
+    ASSERT(bench_barriers_logged(&list, 0, texture, BARRIERS_ALL,
+                                 BARRIERS_PIXEL_SHADER, BARRIERS_RENDER_TARGET, BARRIER_BEGIN));
+    ASSERT(bench_barriers_logged(&list, 1, texture, BARRIERS_ALL,
+                                 BARRIERS_PIXEL_SHADER, BARRIERS_RENDER_TARGET, BARRIER_END));
+    for (int mip = 0; mip < 4; mip++)
+        ASSERT(barriers_state(&t, tex, mip) == BARRIERS_RENDER_TARGET);
+
+    // Used in another state: the whole split ends, and then the one
+    // subresource moves on from there.
+    barriers_use(&t, tex, BARRIERS_ALL, BARRIERS_PIXEL_SHADER);
+    barriers_flush(&t);
+    list.logged = 0;
+
+    barriers_begin(&t, tex, BARRIERS_ALL, BARRIERS_RENDER_TARGET);
+    barriers_flush(&t);
+    barriers_use(&t, tex, 2, BARRIERS_COPY_DEST);
+    barriers_flush(&t);
+
+    ASSERT(list.logged == 3);
+    ASSERT(bench_barriers_logged(&list, 0, texture, BARRIERS_ALL,
+                                 BARRIERS_PIXEL_SHADER, BARRIERS_RENDER_TARGET, BARRIER_BEGIN));
+    ASSERT(bench_barriers_logged(&list, 1, texture, BARRIERS_ALL,
+                                 BARRIERS_PIXEL_SHADER, BARRIERS_RENDER_TARGET, BARRIER_END));
+    ASSERT(bench_barriers_logged(&list, 2, texture, 2,
+                                 BARRIERS_RENDER_TARGET, BARRIERS_COPY_DEST, BARRIER_FULL));
+    for (int mip = 0; mip < 4; mip++)
+        ASSERT(barriers_state(&t, tex, mip) == ((mip == 2) ? BARRIERS_COPY_DEST : BARRIERS_RENDER_TARGET));
+
+    printf("  split:   %d barriers, begun for all and ended for all\n", list.logged);
+    barriers_shutdown(&t);
+}
+
+static void bench_barriers_random(void)
+{
+    static BenchBarrierList list;
+    memset(&list, 0, sizeof(list));
+    list.replay = true;
+
+    BarrierDevice device = {&list, bench_barriers_emit};
+    Barriers t;
+    barriers_init(&t, &device);
+
+    // Mostly reads.
+    static uint32_t const states[] = {
+        BARRIERS_PIXEL_SHADER, BARRIERS_PIXEL_SHADER, BARRIERS_NON_PIXEL_SHADER,
+        BARRIERS_VERTEX_BUFFER, BARRIERS_INDEX_BUFFER, BARRIERS_COPY_SOURCE,
+        BARRIERS_RENDER_TARGET, BARRIERS_UNORDERED_ACCESS, BARRIERS_COPY_DEST,
+    };
+    int const state_count = (int)(sizeof(states) / sizeof(*states));
+
+    // A quarter of them buffers, the rest textures with mips.  Each one is
+    // mostly used one way, and now and then another.
+    uint32_t random = 11;
+    bool buffers[BENCH_BARRIERS_RESOURCES];
+    uint32_t usual[BENCH_BARRIERS_RESOURCES];
+    for (int i = 0; i < BENCH_BARRIERS_RESOURCES; i++) {
+        buffers[i] = bench_random(&random) % 4 == 0;
+        list.counts[i] = (buffers[i]) ? 1 : 1 + (int)(bench_random(&random) % BENCH_BARRIERS_SUBRESOURCES);
+        usual[i] = states[bench_random(&random) % state_count];
+        if (buffers[i] && usual[i] == BARRIERS_RENDER_TARGET)
+            usual[i] = BARRIERS_VERTEX_BUFFER;
+        barriers_track(&t, (void *)(uintptr_t)(i + 1), list.counts[i], buffers[i], BARRIERS_COMMON);
+    }
+
+    // What a barrier per changed state would take, one call each.
+    static uint32_t naive[BENCH_BARRIERS_RESOURCES][BENCH_BARRIERS_SUBRESOURCES];
+    uint64_t naive_barriers = 0;
+    uint64_t naive_calls = 0;
+
+    // Split barriers begun, and the draw that ends them.
+    int busy_until[BENCH_BARRIERS_RESOURCES] = {0};
+    struct { int id, draw; uint32_t sub, state; } splits[64];
+    int split_count = 0;
+
+    int const frames = 100;
+    int const draws = 1000;
+    double elapsed = 0.0;
+
+    for (int frame = 0; frame < frames; frame++) {
+        for (int draw = 0; draw < draws; draw++) {
+            int global = frame * draws + draw;
+            struct { int id; uint32_t sub, state; } uses[16];
+            int use_count = 0;
+
+            // The split barriers due now, and a few random uses.
+            for (int i = 0; i < split_count; i++) {
+                if (splits[i].draw == global) {
+                    uses[use_count].id = splits[i].id;
+                    uses[use_count].sub = splits[i].sub;
+                    uses[use_count].state = splits[i].state;
+                    use_count++;
+                    splits[i--] = splits[--split_count];
+                }
+            }
+
+            int wanted = use_count + 4 + (int)(bench_random(&random) % 5);
+            while (use_count < wanted) {
+                int id = (int)(bench_random(&random) % BENCH_BARRIERS_RESOURCES);
+                bool taken = busy_until[id] > global;
+                for (int i = 0; i < use_count; i++)
+                    taken = taken || uses[i].id == id;
+                if (taken)
+                    continue;
+
+                uint32_t state = usual[id];
+                if (bench_random(&random) % 8 == 0)
+                    state = states[bench_random(&random) % state_count];
+                if (buffers[id] && state == BARRIERS_RENDER_TARGET)
+                    state = BARRIERS_VERTEX_BUFFER;
+                uint32_t sub = BARRIERS_ALL;
+                if (list.counts[id] > 1 && bench_random(&random) % 4 == 0)
+                    sub = bench_random(&random) % list.counts[id];
+
+                uses[use_count].id = id;
+                uses[use_count].sub = sub;
+                uses[use_count].state = state;
+                use_count++;
+            }
+
+            // Now and then, something is known to be written a few draws on.
+            int begin_id = -1;
+            uint32_t begin_state = BARRIERS_RENDER_TARGET;
+            if (split_count < 64 && bench_random(&random) % 16 == 0) {
+                begin_id = (int)(bench_random(&random) % BENCH_BARRIERS_RESOURCES);
+                bool taken = busy_until[begin_id] > global || buffers[begin_id];
+                for (int i = 0; i < use_count; i++)
+                    taken = taken || uses[i].id == begin_id;
+                if (taken)
+                    begin_id = -1;
+            }
+
+            double t0 = seconds();
+            for (int i = 0; i < use_count; i++)
+                barriers_use(&t, uses[i].id, uses[i].sub, uses[i].state);
+            barriers_flush(&t);
+            if (begin_id >= 0)
+                barriers_begin(&t, begin_id, BARRIERS_ALL, begin_state);
+            elapsed += seconds() - t0;
+
+            if (begin_id >= 0) {
+                int due = global + 1 + (int)(bench_random(&random) % 8);
+                busy_until[begin_id] = due;
+                splits[split_count].id = begin_id;
+                splits[split_count].draw = due;
+                splits[split_count].sub = BARRIERS_ALL;
+                splits[split_count].state = begin_state;
+                split_count++;
+            }
+
+            // Every subresource used is where the draw needs it, and got
+            // there through the barriers, or a promotion.
+            for (int i = 0; i < use_count; i++) {
+                int id = uses[i].id;
+                int first = (uses[i].sub == BARRIERS_ALL) ? 0 : (int)uses[i].sub;
+                int end = (uses[i].sub == BARRIERS_ALL) ? list.counts[id] : first + 1;
+                uint32_t state = uses[i].state;
+
+                // One barrier for all of them when they were alike, one for
+                // each that changed otherwise.
+                bool alike = true;
+                for (int s = first; s < end; s++)
+                    alike = alike && naive[id][s] == naive[id][first];
+                int changed = 0;
+                for (int s = first; s < end; s++) {
+                    uint32_t tracked = barriers_state(&t, id, (uint32_t)s);
+                    uint32_t *seen = &list.states[id][s];
+                    ASSERT(tracked == state ||
+                           (barriers_read_only(state) && (tracked & state) == state));
+                    ASSERT(*seen == tracked || *seen == BARRIERS_COMMON ||
+                           (barriers_read_only(*seen) && (tracked & *seen) == *seen));
+                    *seen = tracked;
+
+                    changed += naive[id][s] != state;
+                    naive[id][s] = state;
+                }
+                // Unordered access takes a barrier even when it stays.
+                if (state == BARRIERS_UNORDERED_ACCESS && changed == 0)
+                    changed = 1;
+                naive_barriers += (alike && changed) ? 1 : changed;
+                naive_calls += changed > 0;
+            }
+        }
+
+        double t0 = seconds();
+        barriers_flush(&t);
+        barriers_submit(&t);
+        elapsed += seconds() - t0;
+
+        for (int id = 0; id < BENCH_BARRIERS_RESOURCES; id++) {
+            for (int s = 0; s < list.counts[id]; s++) {
+                if (!(list.states[id][s] & BENCH_BARRIERS_MOVING))
+                    list.states[id][s] = barriers_state(&t, id, (uint32_t)s);
+            }
+        }
+    }
+
+    BarrierStats stats = t.stats;
+    printf("  random:  %.1f M uses/s, %llu uses, %llu barriers in %llu calls (%.1f a call), "
+           "%llu elided (%llu promoted), %llu merged, %llu split\n",
+           (double)stats.uses / elapsed / 1e6, (unsigned long long)stats.uses,
+           (unsigned long long)stats.emitted, (unsigned long long)stats.calls,
+           (double)stats.emitted / (double)stats.calls, (unsigned long long)stats.elided,
+           (unsigned long long)stats.promoted, (unsigned long long)stats.merged,
+           (unsigned long long)stats.split);
+    printf("           a barrier per changed state: %llu barriers in %llu calls\n",
+           (unsigned long long)naive_barriers, (unsigned long long)naive_calls);
+
+    barriers_shutdown(&t);
+}
+
+static void bench_barriers(void)
+{
+    printf("barriers:\n");
+    bench_barriers_frame();
+    bench_barriers_split();
+    bench_barriers_random();
+}
+
+
+
+// Job System
+// A frame of draws recorded into a mock command list: every command costs
+// about what validating and encoding it costs a driver, and is written to
+// the list as it would be.  The frame is cut into ranges, each recorded
+// into a list of its own, in parallel on the job system and on the pool,
+// across thread counts.  The lists, submitted in order, have to come out
+// as the one recorded on a single thread.  Then a fork-join tree of jobs
+// that wait for the jobs they add, lopsided on purpose, to see them stolen.
+
+#define BENCH_JOBS_DRAWS    20000
+#define BENCH_JOBS_RANGE    250         // Draws per command list.
+
+typedef struct BenchCommand {
+    uint32_t    type;
+    uint32_t    args[3];
+} BenchCommand;
+
+typedef struct BenchCommandList {
+    BenchCommand    *commands;
+    int             count;
+    int             capacity;
+    uint32_t        encoded;        // So that encoding is not optimized away.
+} BenchCommandList;
+
+static void bench_jobs_command(BenchCommandList *list, uint32_t type, uint32_t a, uint32_t b, uint32_t c)
+{
+    // Validating and encoding it.
+    uint32_t hash = type * 2654435761u;
+    for (int i = 0; i < 64; i++)
+        hash = (hash ^ a ^ (b << i % 7)) * 16777619u + c;
+
+    if (list->count == list->capacity) {
+        list->capacity = (list->capacity) ? list->capacity * 2 : 1024;
+        list->commands = (BenchCommand *)realloc(list->commands, list->capacity * sizeof(BenchCommand));
+        ASSERT(list->commands);
+    }
+    BenchCommand command = {type, {a, b, c}};
+    list->commands[list->count++] = command;
+    list->encoded += hash;
+}
+
+// What every list starts with, and then its draws.
+static void bench_jobs_record(BenchCommandList *list, int first, int count)
+{
+    list->count = 0;
+    bench_jobs_command(list, 1, 0, 0, 0);               // Root signature.
+    bench_jobs_command(list, 2, 1920, 1080, 0);         // Viewport, scissor.
+    bench_jobs_command(list, 3, 0, 0, 0);               // Render target.
+
+    for (int i = first; i < first + count; i++) {
+        bench_jobs_command(list, 4, (uint32_t)i, (uint32_t)i * 3, 0);   // Root constants.
+        bench_jobs_command(list, 5, (uint32_t)i % 16, 0, 0);            // Vertex buffers.
+        bench_jobs_command(list, 6, 3, 16384, (uint32_t)i * 16384);     // Draw.
+    }
+}
+
+// "ExecuteCommandLists": the commands of the lists one after the other,
+// except for what every list starts with.
+static uint64_t bench_jobs_submit(BenchCommandList const *lists, int count)
+{
+    uint64_t hash = 14695981039346656037ull;
+    for (int l = 0; l < count; l++) {
+        for (int i = 3; i < lists[l].count; i++) {
+            BenchCommand const *c = &lists[l].commands[i];
+            hash = (hash ^ c->type) * 1099511628211ull;
+            for (int k = 0; k < 3; k++)
+                hash = (hash ^ c->args[k]) * 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+static BenchCommandList bench_jobs_lists[BENCH_JOBS_DRAWS / BENCH_JOBS_RANGE];
+
+static void bench_jobs_range(void *ctx, int index, int thread)
+{
+    bench_jobs_record(&bench_jobs_lists[index], index * BENCH_JOBS_RANGE, BENCH_JOBS_RANGE);
+}
+
+static void bench_jobs_recording(void)
+{
+    int const range_count = BENCH_JOBS_DRAWS / BENCH_JOBS_RANGE;
+    int const frames = 20;
+
+    // The one list a single thread records everything into.
+    BenchCommandList serial = {0};
+    bench_jobs_record(&serial, 0, BENCH_JOBS_DRAWS);
+    uint64_t expected = bench_jobs_submit(&serial, 1);
+
+    double t0 = seconds();
+    for (int frame = 0; frame < frames; frame++)
+        bench_jobs_record(&serial, 0, BENCH_JOBS_DRAWS);
+    double single = (seconds() - t0) / frames;
+    free(serial.commands);
+
+    printf("  recording %d draws in %d lists, 1 thread, one list: %.2f ms\n",
+           BENCH_JOBS_DRAWS, range_count, 1000.0 * single);
+
+    int max_threads = (int)std::thread::hardware_concurrency();
+    if (max_threads < 1)
+        max_threads = 1;
+
+    for (int threads = 1; threads <= max_threads; threads = (threads < max_threads && threads * 2 > max_threads) ?
+                                                            max_threads : threads * 2) {
+        Jobs jobs;
+        jobs_init(&jobs, threads);
+        Pool pool;
+        pool_init(&pool, threads);
+
+        double job_time = 0.0, pool_time = 0.0;
+        for (int frame = 0; frame < frames; frame++) {
+            JobCounter counter(0);
+            double t1 = seconds();
+            jobs_for(&jobs, 0, range_count, bench_jobs_range, NULL, &counter);
+            jobs_wait(&jobs, 0, &counter);
+            double t2 = seconds();
+            ASSERT(bench_jobs_submit(bench_jobs_lists, range_count) == expected);
+
+            double t3 = seconds();
+            pool_for(&pool, range_count, bench_jobs_range, NULL);
+            double t4 = seconds();
+            ASSERT(bench_jobs_submit(bench_jobs_lists, range_count) == expected);
+
+            job_time += t2 - t1;
+            pool_time += t4 - t3;
+        }
+        job_time /= frames;
+        pool_time /= frames;
+
+        JobStats stats = jobs_stats(&jobs);
+        printf("  %2d thread(s): jobs %.2f ms (%.2fx), %llu of %llu stolen; pool %.2f ms (%.2fx)\n",
+               threads, 1000.0 * job_time, single / job_time,
+               (unsigned long long)stats.stolen, (unsigned long long)stats.executed,
+               1000.0 * pool_time, single / pool_time);
+
+        pool_shutdown(&pool);
+        jobs_shutdown(&jobs);
+    }
+
+    for (int i = 0; i < range_count; i++) {
+        free(bench_jobs_lists[i].commands);
+        memset(&bench_jobs_lists[i], 0, sizeof(BenchCommandList));
+    }
+}
+
+// Sums [first, first + count) of a tree where the left half of every node
+// is three times as much work as the right one.
+typedef struct BenchJobsNode {
+    Jobs        *jobs;
+    int         first;
+    int         count;
+    uint64_t    sum;
+} BenchJobsNode;
+
+static void bench_jobs_node(void *ctx, int index, int thread)
+{
+    BenchJobsNode *node = (BenchJobsNode *)ctx;
+
+    if (node->count <= 64) {
+        uint64_t sum = 0;
+        for (int i = node->first; i < node->first + node->count; i++) {
+            uint64_t x = (uint64_t)i;
+            for (int k = 0; k < 32; k++)
+                x = x * 6364136223846793005ull + 1442695040888963407ull;
+            sum += x >> 32;
+        }
+        node->sum = sum;
+        return;
+    }
+
+    int left = node->count * 3 / 4;
+    BenchJobsNode children[2] = {
+        {node->jobs, node->first, left, 0},
+        {node->jobs, node->first + left, node->count - left, 0},
+    };
+
+    JobCounter counter(0);
+    jobs_add(node->jobs, thread, bench_jobs_node, &children[0], 0, &counter);
+    bench_jobs_node(&children[1], 0, thread);
+    jobs_wait(node->jobs, thread, &counter);
+
+    node->sum = children[0].sum + children[1].sum;
+}
+
+static void bench_jobs_fork_join(void)
+{
+    int const count = 1 << 20;
+
+    uint64_t expected = 0;
+    BenchJobsNode leaf = {NULL, 0, 64, 0};
+    for (int first = 0; first < count; first += 64) {
+        leaf.first = first;
+        bench_jobs_node(&leaf, 0, 0);
+        expected += leaf.sum;
+    }
+
+    // Four threads even on fewer cores, so that stealing happens anyway.
+    int threads = (int)std::thread::hardware_concurrency();
+    if (threads < 4)
+        threads = 4;
+
+    Jobs jobs;
+    jobs_init(&jobs, threads);
+
+    BenchJobsNode root = {&jobs, 0, count, 0};
+    double t0 = seconds();
+    bench_jobs_node(&root, 0, 0);
+    double t1 = seconds();
+    ASSERT(root.sum == expected);
+
+    JobStats stats = jobs_stats(&jobs);
+    printf("  fork-join, %d threads: %.2f ms, %llu jobs, %llu stolen, %llu run at once\n",
+           threads, 1000.0 * (t1 - t0), (unsigned long long)stats.executed,
+           (unsigned long long)stats.stolen, (unsigned long long)stats.inline_jobs);
+
+    jobs_shutdown(&jobs);
+}
+
+static void bench_jobs(void)
+{
+    printf("jobs:\n");
+    bench_jobs_recording();
+    bench_jobs_fork_join();
+}
+
+
+
+// Event Queue
+// A window thread sends what a user dragging a window about would: storms
+// of resizes, runs of mouse moves, keys going down and up, in bursts.  A
+// render thread polls once a frame, and now and then stalls as if it were
+// waiting on the GPU, so that the ring fills up.  Keys have to come out in
+// order, with gaps only for what was dropped; mouse moves never twice in a
+// row; and the size last applied has to be the one last sent.  Reports how
+// long events wait for the frame that takes them, and how long sending
+// one takes the window thread, which must never wait.
+
+#define BENCH_EVENTS_BURSTS     3000
+
+typedef struct BenchEventsWindow {
+    EventQueue  *queue;
+    int         width;              // The last size sent.
+    int         height;
+    double      send_max;
+} BenchEventsWindow;
+
+static void bench_events_window(BenchEventsWindow *window)
+{
+    uint32_t random = 12345;
+    int key = 0;
+
+    for (int burst = 0; burst < BENCH_EVENTS_BURSTS; burst++) {
+        uint32_t kind = bench_random(&random) % 3;
+        int count = 10 + (int)(bench_random(&random) % 90);
+
+        for (int i = 0; i < count; i++) {
+            double t0 = seconds();
+            if (kind == 0) {
+                window->width = 100 + (int)(bench_random(&random) % 3800);
+                window->height = 100 + (int)(bench_random(&random) % 2000);
+                events_send(window->queue, EVENT_RESIZE, window->width, window->height, t0);
+            } else if (kind == 1) {
+                events_send(window->queue, EVENT_MOUSE_MOVE, i, i * 2, t0);
+            } else {
+                events_send(window->queue, EVENT_KEY, key++, i & 1, t0);
+            }
+            double t1 = seconds();
+            if (t1 - t0 > window->send_max)
+                window->send_max = t1 - t0;
+        }
+
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    events_send(window->queue, EVENT_CLOSE, 0, 0, seconds());
+}
+
+static int bench_events_compare(void const *a, void const *b)
+{
+    double x = *(double const *)a;
+    double y = *(double const *)b;
+    return (x > y) - (x < y);
+}
+
+static void bench_events_run(char const *name, double frame, int stall_every, double stall)
+{
+    static EventQueue queue;
+    events_init(&queue);
+
+    BenchEventsWindow window = {&queue, 0, 0, 0.0};
+    std::thread thread(bench_events_window, &window);
+
+    static EventBatch batch;
+    int capacity = BENCH_EVENTS_BURSTS * 100 + 1;
+    double *latencies = (double *)malloc(capacity * sizeof(double));
+    int latency_count = 0;
+
+    int width = 0, height = 0;
+    int next_key = 0, skipped_keys = 0;
+    int frames = 0;
+    double t0 = seconds();
+
+    while (1) {
+        double now = seconds();
+        events_poll(&queue, now, &batch);
+
+        if (batch.resized) {
+            width = batch.width;
+            height = batch.height;
+            latencies[latency_count++] = now - batch.resize_time;
+        }
+        for (int i = 0; i < batch.input_count; i++) {
+            Event const *event = &batch.input[i];
+            ASSERT(latency_count < capacity);
+            latencies[latency_count++] = now - event->time;
+
+            if (event->type == EVENT_KEY) {
+                ASSERT(event->x >= next_key);
+                skipped_keys += event->x - next_key;
+                next_key = event->x + 1;
+            }
+            if (event->type == EVENT_MOUSE_MOVE)
+                ASSERT(i == 0 || batch.input[i - 1].type != EVENT_MOUSE_MOVE);
+        }
+        if (batch.closed)
+            break;
+
+        frames++;
+        spin((stall_every && frames % stall_every == 0) ? stall : frame);
+    }
+    double elapsed = seconds() - t0;
+
+    thread.join();
+    ASSERT(width == window.width && height == window.height);
+
+    EventStats stats = events_stats(&queue);
+    ASSERT(stats.received + stats.latched + stats.dropped == stats.sent);
+    ASSERT((uint64_t)skipped_keys <= stats.dropped);
+
+    qsort(latencies, latency_count, sizeof(double), bench_events_compare);
+    printf("  %-7s %d frames in %.2f s, %llu events sent, %llu coalesced, %llu latched, %llu dropped\n",
+           name, frames, elapsed, (unsigned long long)stats.sent, (unsigned long long)stats.coalesced,
+           (unsigned long long)stats.latched, (unsigned long long)stats.dropped);
+    printf("          to the frame: p50 %.3f ms, p99 %.3f ms, max %.3f ms; sending at most %.1f us\n",
+           1000.0 * latencies[latency_count / 2], 1000.0 * latencies[latency_count * 99 / 100],
+           1000.0 * latencies[latency_count - 1], 1e6 * window.send_max);
+
+    free(latencies);
+}
+
+static void bench_events(void)
+{
+    printf("events:\n");
+    bench_events_run("steady", 0.001, 0, 0.0);
+    bench_events_run("stalls", 0.001, 50, 0.100);
+}
+
+
+
+// Frame Pacing
+// Every mode against a simulated 60 Hz display, on a simulated clock: a
+// swap chain that holds so many frames, a GPU that works through them in
+// turn, a display that flips to the next one at every blank, and a timer
+// that wakes up to a millisecond late.  Frames take a few milliseconds on
+// the CPU and the GPU, give or take.  Reports how many frames were shown
+// and how long after their input was read, how evenly capped frames were
+// started, and how much time went into sleeping and spinning.  Then the
+// cap on the real clock, to see how well sleeping and spinning do here.
+
+#define BENCH_PACING_FRAMES     3000
+#define BENCH_PACING_QUEUE      8
+
+typedef struct BenchPacingFrame {
+    double      begin;              // When its input was read.
+    double      done;               // On the GPU.
+    int         interval;
+} BenchPacingFrame;
+
+typedef struct BenchDisplay {
+    double      now;
+    double      refresh;
+    double      timer;              // How late sleeps wake, at most.
+    int         latency;            // Frames the swap chain holds.
+    uint32_t    random;
+
+    BenchPacingFrame    queue[BENCH_PACING_QUEUE];
+    int         queued;
+    double      gpu_free;           // When the GPU is done with what it has.
+    double      vblank;             // The last one the display got to.
+
+    double      *latencies;
+    int         shown;
+    int         dropped;            // Replaced by a newer frame before a blank.
+    int         repeated;           // Blanks that showed no new frame.
+} BenchDisplay;
+
+// Flips at every blank up to now: to the oldest frame done in time, or with
+// a sync interval of 0, to the newest one.
+static void bench_display_advance(BenchDisplay *d)
+{
+    while (d->vblank + d->refresh <= d->now) {
+        double v = d->vblank += d->refresh;
+
+        int show = -1;
+        for (int i = 0; i < d->queued && d->queue[i].done <= v; i++) {
+            show = i;
+            if (d->queue[i].interval)
+                break;
+        }
+
+        if (show < 0) {
+            d->repeated++;
+            continue;
+        }
+        d->dropped += show;
+        d->latencies[d->shown++] = v - d->queue[show].begin;
+        memmove(d->queue, d->queue + show + 1, (d->queued - show - 1) * sizeof(BenchPacingFrame));
+        d->queued -= show + 1;
+    }
+}
+
+// Whether the swap chain has room for another frame.  Frames presented
+// without a sync interval only take room until the GPU is done with them.
+static bool bench_display_room(BenchDisplay const *d)
+{
+    int held = 0;
+    for (int i = 0; i < d->queued; i++)
+        held += d->queue[i].interval || d->queue[i].done > d->now;
+    return held < d->latency;
+}
+
+static void bench_display_run(BenchDisplay *d, double duration)
+{
+    d->now += duration;
+    bench_display_advance(d);
+}
+
+static double bench_display_now(void *ctx)
+{
+    // Reading the clock takes a little time too, or spinning never ends.
+    BenchDisplay *d = (BenchDisplay *)ctx;
+    bench_display_run(d, 1e-7);
+    return d->now;
+}
+
+static void bench_display_sleep(void *ctx, double duration)
+{
+    BenchDisplay *d = (BenchDisplay *)ctx;
+    bench_display_run(d, duration + d->timer * (double)(bench_random(&d->random) % 1000) / 1000.0);
+}
+
+static void bench_display_wait(void *ctx)
+{
+    BenchDisplay *d = (BenchDisplay *)ctx;
+    while (!bench_display_room(d)) {
+        double next = d->vblank + d->refresh;
+        for (int i = 0; i < d->queued; i++) {
+            if (d->queue[i].done > d->now && d->queue[i].done < next)
+                next = d->queue[i].done;
+        }
+        bench_display_run(d, next - d->now);
+    }
+}
+
+static bool bench_display_vblank(void *ctx, double now, double *next, double *period)
+{
+    BenchDisplay *d = (BenchDisplay *)ctx;
+    *next = d->vblank + d->refresh;
+    while (*next <= now)
+        *next += d->refresh;
+    *period = d->refresh;
+    return true;
+}
+
+// Present(): waits for room, and hands the frame to the GPU.
+static void bench_display_present(BenchDisplay *d, double begin, int interval, double gpu)
+{
+    bench_display_wait(d);
+    ASSERT(d->queued < BENCH_PACING_QUEUE);
+
+    double start = (d->gpu_free > d->now) ? d->gpu_free : d->now;
+    d->gpu_free = start + gpu;
+
+    BenchPacingFrame frame = {begin, d->gpu_free, interval};
+    d->queue[d->queued++] = frame;
+}
+
+static void bench_pacing_run(PacingMode mode, double cap, int latency)
+{
+    static double latencies[BENCH_PACING_FRAMES * 2];
+
+    BenchDisplay d;
+    memset(&d, 0, sizeof(d));
+    d.refresh = 1.0 / 60.0;
+    d.timer = 0.001;
+    d.latency = latency;
+    d.random = 777;
+    d.latencies = latencies;
+
+    PacingClock clock = {&d, bench_display_now, bench_display_sleep, bench_display_wait, bench_display_vblank};
+    Pacing pacing;
+    pacing_init(&pacing, mode, cap, &clock);
+
+    double start = d.now;
+    double last_begin = 0.0, jitter_max = 0.0;
+
+    for (int frame = 0; frame < BENCH_PACING_FRAMES; frame++) {
+        pacing_begin(&pacing);
+        double begin = d.now;
+
+        if (mode == PACING_CAPPED && frame > 0) {
+            double jitter = fabs(begin - last_begin - 1.0 / cap);
+            if (jitter > jitter_max)
+                jitter_max = jitter;
+        }
+        last_begin = begin;
+
+        double cpu = 0.002 + 0.002 * (double)(bench_random(&d.random) % 1000) / 1000.0;
+        double gpu = 0.003 + 0.002 * (double)(bench_random(&d.random) % 1000) / 1000.0;
+        bench_display_run(&d, cpu);
+
+        int interval = pacing_present(&pacing);
+        bench_display_present(&d, begin, interval, gpu);
+        pacing_gpu(&pacing, gpu);
+    }
+    double elapsed = d.now - start;
+
+    qsort(latencies, d.shown, sizeof(double), bench_events_compare);
+    double p50 = latencies[d.shown / 2];
+    double p99 = latencies[d.shown * 99 / 100];
+
+    char name[32];
+    if (mode == PACING_CAPPED)
+        snprintf(name, sizeof(name), "%s %.0f", pacing_mode_names[mode], cap);
+    else
+        snprintf(name, sizeof(name), "%s", pacing_mode_names[mode]);
+
+    PacingStats stats = pacing.stats;
+    printf("  %-12s %5.1f frames/s, %5.1f shown/s, %4d dropped, %4d repeated; "
+           "input to display p50 %5.2f ms, p99 %5.2f ms\n",
+           name, (double)BENCH_PACING_FRAMES / elapsed, (double)d.shown / elapsed, d.dropped, d.repeated,
+           1000.0 * p50, 1000.0 * p99);
+    if (mode == PACING_CAPPED || mode == PACING_LOW_LATENCY)
+        printf("               slept %.0f%%, spun %.1f%%, delayed %.0f%% of the time; "
+               "late %llu, starts off by %.1f us at most\n",
+               100.0 * stats.slept / elapsed, 100.0 * stats.spun / elapsed,
+               100.0 * stats.delayed / elapsed, (unsigned long long)stats.late, 1e6 * jitter_max);
+
+    // What each mode is for.
+    if (mode == PACING_CAPPED) {
+        ASSERT(fabs((double)BENCH_PACING_FRAMES / elapsed - cap) < cap * 0.01);
+        ASSERT(jitter_max < 2e-5);
+    }
+    if (mode == PACING_VSYNC || mode == PACING_LOW_LATENCY)
+        ASSERT(d.dropped == 0);
+    if (mode == PACING_LOW_LATENCY)
+        ASSERT(p99 < d.refresh);
+}
+
+static double bench_pacing_now(void *ctx)
+{
+    return seconds();
+}
+
+static void bench_pacing_sleep(void *ctx, double duration)
+{
+    std::this_thread::sleep_for(std::chrono::duration<double>(duration));
+}
+
+// Capped, on the real clock.
+static void bench_pacing_real(double cap)
+{
+    PacingClock clock = {NULL, bench_pacing_now, bench_pacing_sleep, NULL, NULL};
+    Pacing pacing;
+    pacing_init(&pacing, PACING_CAPPED, cap, &clock);
+
+    int const frames = 240;
+    double last = 0.0, sum = 0.0, max = 0.0;
+    double start = seconds();
+    for (int frame = 0; frame < frames; frame++) {
+        pacing_begin(&pacing);
+        double now = seconds();
+        if (frame > 0) {
+            double jitter = fabs(now - last - 1.0 / cap);
+            sum += jitter;
+            if (jitter > max)
+                max = jitter;
+        }
+        last = now;
+        spin(0.5 / cap);
+        pacing_present(&pacing);
+    }
+    double elapsed = seconds() - start;
+
+    PacingStats stats = pacing.stats;
+    printf("  real clock, capped %.0f: %.1f frames/s, starts off by %.1f us on average, %.1f us at most; "
+           "spun %.1f%%, woke up to %.0f us late\n",
+           cap, (double)frames / elapsed, 1e6 * sum / (frames - 1), 1e6 * max,
+           100.0 * stats.spun / elapsed, 1e6 * stats.oversleep_max);
+}
+
+static void bench_pacing(void)
+{
+    printf("pacing:\n");
+    bench_pacing_run(PACING_VSYNC, 0.0, 3);
+    bench_pacing_run(PACING_UNCAPPED, 0.0, 3);
+    bench_pacing_run(PACING_CAPPED, 60.0, 3);
+    bench_pacing_run(PACING_CAPPED, 100.0, 3);
+    bench_pacing_run(PACING_LOW_LATENCY, 0.0, 1);
+    bench_pacing_real(240.0);
+}
+
+
+
+// Placed Resources
+// A synthetic trace of what a game streams through GPU memory: buffers of
+// all sizes, textures of power-of-two sizes, some of them multisampled and
+// aligned to 4 MB, freed in random order while the number alive drifts up
+// and down.  Every so often, what is alive is checked for overlaps and
+// alignment.  Reports the cost of an allocation, how much memory the blocks
+// reserve against what is used, how fragmented it gets, and how many blocks
+// had to be created where committing resources would create one each.
+// Then frames of transient render targets, packed so that they alias.
+
+#define BENCH_HEAPS_OPS     200000
+#define BENCH_HEAPS_LIVE    4096
+
+typedef struct BenchHeapsBlock {
+    uint64_t    size;
+} BenchHeapsBlock;
+
+static bool bench_heaps_create(void *ctx, int pool, uint64_t size, void **block)
+{
+    BenchHeapsBlock *b = (BenchHeapsBlock *)malloc(sizeof(BenchHeapsBlock));
+    b->size = size;
+    *block = b;
+    return true;
+}
+
+static void bench_heaps_destroy(void *ctx, int pool, void *block)
+{
+    free(block);
+}
+
+typedef struct BenchHeapsLive {
+    HeapAllocation  allocation;
+    uint64_t        alignment;
+} BenchHeapsLive;
+
+static int bench_heaps_compare(void const *a, void const *b)
+{
+    HeapAllocation const *x = &((BenchHeapsLive const *)a)->allocation;
+    HeapAllocation const *y = &((BenchHeapsLive const *)b)->allocation;
+    if (x->block != y->block)
+        return ((uintptr_t)x->block > (uintptr_t)y->block) - ((uintptr_t)x->block < (uintptr_t)y->block);
+    return (x->offset > y->offset) - (x->offset < y->offset);
+}
+
+static void bench_heaps_check(BenchHeapsLive const *live, int count)
+{
+    static BenchHeapsLive sorted[BENCH_HEAPS_LIVE];
+    memcpy(sorted, live, count * sizeof(BenchHeapsLive));
+    qsort(sorted, count, sizeof(BenchHeapsLive), bench_heaps_compare);
+
+    for (int i = 0; i < count; i++) {
+        HeapAllocation const *a = &sorted[i].allocation;
+        ASSERT(a->offset % sorted[i].alignment == 0);
+        ASSERT(a->offset + a->size <= ((BenchHeapsBlock *)a->block)->size);
+        if (i > 0 && sorted[i - 1].allocation.block == a->block)
+            ASSERT(sorted[i - 1].allocation.offset + sorted[i - 1].allocation.size <= a->offset);
+    }
+}
+
+// Buffers spread evenly over orders of magnitude, from 4 KB to 8 MB, and
+// textures from 64 KB to 16 MB, some of them multisampled.
+static uint64_t bench_heaps_size(uint32_t *random, int *msaa)
+{
+    uint32_t kind = bench_random(random) % 100;
+    *msaa = kind < 5;
+    if (kind >= 40) {
+        int bits = 12 + (int)(bench_random(random) % 10);
+        return (1ull << bits) + bench_random(random) % (1ull << bits);
+    }
+    return 1ull << (16 + bench_random(random) % 9);
+}
+
+static void bench_heaps_trace(bool check)
+{
+    static BenchHeapsLive live[BENCH_HEAPS_LIVE];
+    int live_count = 0;
+
+    HeapDevice device = {NULL, bench_heaps_create, bench_heaps_destroy};
+    Heaps heaps;
+    heaps_init(&heaps, &device, 0, 256ull * 1024 * 1024);
+
+    uint32_t random = 2024;
+    uint64_t committed = 0, committed_peak = 0;
+    uint64_t reserved_peak = 0;
+    double fragmentation_sum = 0.0;
+    int samples = 0;
+
+    double t0 = seconds();
+    for (int op = 0; op < BENCH_HEAPS_OPS; op++) {
+        // How many are alive drifts between a few hundred and a thousand.
+        int target = 600 + (int)(400.0 * sin((double)op / 20000.0));
+        bool alloc = live_count == 0 ||
+                     (live_count < BENCH_HEAPS_LIVE && (int)(bench_random(&random) % 512) + live_count - target < 256);
+
+        if (alloc) {
+            int msaa;
+            uint64_t size = bench_heaps_size(&random, &msaa);
+            uint64_t alignment = (msaa) ? HEAPS_MSAA : HEAPS_GRANULARITY;
+
+            BenchHeapsLive *l = &live[live_count++];
+            l->allocation = heaps_alloc(&heaps, size, alignment);
+            l->alignment = alignment;
+            ASSERT(l->allocation.block && l->allocation.size >= size);
+
+            committed += (size + HEAPS_GRANULARITY - 1) & ~(HEAPS_GRANULARITY - 1);
+        } else {
+            int i = (int)(bench_random(&random) % (uint32_t)live_count);
+            committed -= live[i].allocation.size;
+            heaps_free(&heaps, &live[i].allocation);
+            live[i] = live[--live_count];
+        }
+
+        if (committed > committed_peak)
+            committed_peak = committed;
+        if (heaps.stats.reserved > reserved_peak)
+            reserved_peak = heaps.stats.reserved;
+
+        if (check && op % 1000 == 999) {
+            bench_heaps_check(live, live_count);
+            HeapStats stats = heaps_stats(&heaps);
+            ASSERT(stats.used + stats.free == stats.reserved);
+            fragmentation_sum += heaps_fragmentation(&stats);
+            samples++;
+        }
+    }
+    double elapsed = seconds() - t0;
+
+    HeapStats stats = heaps_stats(&heaps);
+    if (check) {
+        printf("  trace: %llu allocations in %llu blocks (%d left), reserved at most %.0f MB for %.0f MB used; "
+               "fragmentation %.2f on average, %d free ranges at the end\n",
+               (unsigned long long)stats.allocs, (unsigned long long)stats.blocks_created, stats.blocks,
+               (double)reserved_peak / (1 << 20), (double)stats.used_peak / (1 << 20),
+               fragmentation_sum / samples, stats.free_ranges);
+        printf("         committed one by one: %llu kernel allocations, %.0f MB at most\n",
+               (unsigned long long)stats.allocs, (double)committed_peak / (1 << 20));
+    } else {
+        printf("  %.0f ns per allocation or free\n", 1e9 * elapsed / BENCH_HEAPS_OPS);
+    }
+
+    for (int i = 0; i < live_count; i++)
+        heaps_free(&heaps, &live[i].allocation);
+    ASSERT(heaps.stats.used == 0 && heaps.stats.blocks == 1);
+    heaps_shutdown(&heaps);
+}
+
+// A frame of render targets at 1080p, by the passes they are used in.
+static void bench_heaps_frame(void)
+{
+    uint64_t const target = 1920ull * 1080 * 4;
+    HeapTransient resources[] = {
+        {4096ull * 4096 * 4,    0,          0, 1},      // Shadow map.
+        {target,                0,          1, 4},      // G-buffer.
+        {target,                0,          1, 4},
+        {target * 2,            0,          1, 4},
+        {target,                0,          1, 9},      // Depth.
+        {target / 4,            0,          3, 4},      // Ambient occlusion.
+        {target * 2,            0,          4, 7},      // Lit, in HDR.
+        {target * 4 * 2,        HEAPS_MSAA, 5, 6},      // Transparencies, 4x MSAA.
+        {target / 2,            0,          7, 8},      // Bloom.
+        {target / 8,            0,          7, 8},
+        {target / 32,           0,          7, 8},
+        {target,                0,          8, 9},      // Tone mapped.
+    };
+    int count = (int)(sizeof(resources) / sizeof(*resources));
+
+    uint64_t sum = 0;
+    for (int i = 0; i < count; i++)
+        sum += resources[i].size;
+
+    uint64_t size = heaps_pack(resources, count);
+    int aliased = 0;
+    for (int i = 0; i < count; i++)
+        aliased += resources[i].alias != HEAPS_NONE;
+
+    printf("  frame: %d render targets, %.1f MB on their own, %.1f MB aliased, %d taking over another's memory\n",
+           count, (double)sum / (1 << 20), (double)size / (1 << 20), aliased);
+    ASSERT(size < sum);
+}
+
+// Random frames, checked.
+static void bench_heaps_transients(void)
+{
+    int const frames = 2000;
+    HeapTransient resources[40];
+    uint32_t random = 99;
+
+    double packed = 0.0, separate = 0.0, time = 0.0;
+    for (int frame = 0; frame < frames; frame++) {
+        int count = 10 + (int)(bench_random(&random) % 30);
+        for (int i = 0; i < count; i++) {
+            int msaa;
+            resources[i].size = bench_heaps_size(&random, &msaa);
+            resources[i].alignment = (msaa) ? HEAPS_MSAA : 0;
+            resources[i].first = (int)(bench_random(&random) % 16);
+            resources[i].last = resources[i].first + (int)(bench_random(&random) % 6);
+            separate += (double)resources[i].size;
+        }
+
+        double t0 = seconds();
+        uint64_t size = heaps_pack(resources, count);
+        time += seconds() - t0;
+        packed += (double)size;
+
+        for (int i = 0; i < count; i++) {
+            HeapTransient const *r = &resources[i];
+            uint64_t align = (r->alignment > HEAPS_GRANULARITY) ? r->alignment : HEAPS_GRANULARITY;
+            ASSERT(r->offset % align == 0 && r->offset + r->size <= size);
+            for (int j = 0; j < count; j++)
+                ASSERT(j == i || !heaps_concurrent(r, &resources[j]) || !heaps_overlap(r, &resources[j]));
+            if (r->alias != HEAPS_NONE)
+                ASSERT(resources[r->alias].last < r->first && heaps_overlap(r, &resources[r->alias]));
+        }
+    }
+
+    printf("  %d random frames: aliased into %.0f%% of the memory, %.1f us to pack a frame\n",
+           frames, 100.0 * packed / separate, 1e6 * time / frames);
+}
+
+static void bench_heaps(void)
+{
+    printf("heaps:\n");
+    bench_heaps_trace(true);
+    bench_heaps_trace(false);
+    bench_heaps_frame();
+    bench_heaps_transients();
+}
+
+
+
+// Constants
+//
+// The C++ side of every cbuffer is checked against what HLSL makes of it:
+// the ones of shaders.hlsl, found next to bench.cpp, and one that packs
+// in every way HLSL does.  Then blocks are streamed into an upload ring as
+// fast as they go, with plain copies and with stores that go around the
+// caches.
+
+// Every way HLSL has of packing a member.  What C++ needs to match it is
+// spelled out in padding.
+static char const bench_constants_hlsl[] =
+    "cbuffer other : register(b2) { float4 nothing; };\n"
+    "cbuffer tricky : register(b3) {\n"
+    "    float2 a;           // A register of its own for now.\n"
+    "    float3 b;           // Would straddle: the next register.\n"
+    "    float c;            // Fills it.\n"
+    "    float4x4 m;         // Four registers.\n"
+    "    float d;\n"
+    "    float4 e[3];        // Arrays start a register.\n"
+    "    float2 f;\n"
+    "    uint g;\n"
+    "    float2 h[2];        // Every element a register, the last one cut short.\n"
+    "};\n";
+
+typedef struct BenchTricky {
+    Float2      a;
+    float       pad0[2];
+    Float3      b;
+    float       c;
+    Float4x4    m;
+    float       d;
+    float       pad1[3];
+    Float4      e[3];
+    Float2      f;
+    uint32_t    g;
+    float       pad2;
+    Float4      h[2];           // .xy of each.
+} BenchTricky;
+
+CONSTANTS_FIELD(BenchTricky, a);
+CONSTANTS_FIELD(BenchTricky, b);
+CONSTANTS_FIELD(BenchTricky, c);
+CONSTANTS_FIELD(BenchTricky, m);
+CONSTANTS_FIELD(BenchTricky, d);
+CONSTANTS_ARRAY(BenchTricky, e);
+CONSTANTS_FIELD(BenchTricky, f);
+CONSTANTS_FIELD(BenchTricky, g);
+CONSTANTS_ARRAY(BenchTricky, h);
+CONSTANTS_BLOCK(BenchTricky);
+
+// What C++ does on its own, and the macros refuse.
+static_assert(!constants_fits(8, sizeof(Float3)), "a float3 after a float2 straddles");
+static_assert(!constants_fits(4, sizeof(Float4x4)), "a matrix starts a register");
+static_assert(!constants_fits(8, sizeof(Float4[2])), "an array starts a register");
+static_assert(constants_fits(12, sizeof(float)), "a float ends a register");
+
+static void bench_constants_layout(void)
+{
+    ConstantsField hlsl[16];
+
+    ConstantsField tricky[] = {
+        CONSTANTS_MEMBER(BenchTricky, a), CONSTANTS_MEMBER(BenchTricky, pad0),
+        CONSTANTS_MEMBER(BenchTricky, b), CONSTANTS_MEMBER(BenchTricky, c),
+        CONSTANTS_MEMBER(BenchTricky, m), CONSTANTS_MEMBER(BenchTricky, d),
+        CONSTANTS_MEMBER(BenchTricky, pad1), CONSTANTS_MEMBER(BenchTricky, e),
+        CONSTANTS_MEMBER(BenchTricky, f), CONSTANTS_MEMBER(BenchTricky, g),
+        CONSTANTS_MEMBER(BenchTricky, pad2), CONSTANTS_MEMBER(BenchTricky, h),
+    };
+    int count = constants_parse(bench_constants_hlsl, "tricky", hlsl, 16);
+    ASSERT(count == 9);
+    ASSERT(hlsl[1].offset == 16 && hlsl[3].offset == 32 && hlsl[3].size == 64);
+    ASSERT(hlsl[5].offset == 112 && hlsl[5].size == 48 && hlsl[8].offset == 176 && hlsl[8].size == 24);
+    ASSERT(constants_check(hlsl, count, tricky, sizeof(tricky) / sizeof(*tricky)) == -1);
+
+    // The same members, laid out by C++ alone: wrong from `b` on.
+    typedef struct { Float2 a; Float3 b; } Naive;
+    ConstantsField naive[] = {CONSTANTS_MEMBER(Naive, a), CONSTANTS_MEMBER(Naive, b)};
+    ASSERT(constants_check(hlsl, count, naive, 2) == 1);
+    ASSERT(constants_parse(bench_constants_hlsl, "missing", hlsl, 16) == -1);
+    ASSERT(constants_parse(bench_constants_hlsl, "trick", hlsl, 16) == -1);
+    printf("  layout: %d members of a tricky cbuffer match\n", count);
+
+
+    // The shaders' own, next to this file wherever bench runs from.
+    char path[1024];
+    char const *slash = strrchr(__FILE__, '/');
+    char const *backslash = strrchr(__FILE__, '\\');
+    slash = (backslash > slash) ? backslash : slash;
+    int dir = (slash) ? (int)(slash - __FILE__ + 1) : 0;
+    snprintf(path, sizeof(path), "%.*sshaders.hlsl", dir, __FILE__);
+
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        fprintf(stderr, "constants: cannot open %s to check its cbuffers\n", path);
+        exit(1);
+    }
+    static char source[64 * 1024];
+    size_t size = fread(source, 1, sizeof(source) - 1, file);
+    source[size] = '\0';
+    fclose(file);
+
+    ConstantsField frame[] = {
+        CONSTANTS_MEMBER(FrameConstants, width), CONSTANTS_MEMBER(FrameConstants, height),
+        CONSTANTS_MEMBER(FrameConstants, aspect), CONSTANTS_MEMBER(FrameConstants, uptime),
+    };
+    count = constants_parse(source, "cbuffer0", hlsl, 16);
+    ASSERT(count > 0 && constants_check(hlsl, count, frame, 4) == -1);
+
+    ConstantsField draw[] = {
+        CONSTANTS_MEMBER(DrawConstants, tint), CONSTANTS_MEMBER(DrawConstants, fade_phase),
+        CONSTANTS_MEMBER(DrawConstants, position_scale), CONSTANTS_MEMBER(DrawConstants, pad),
+    };
+    count = constants_parse(source, "cbuffer1", hlsl, 16);
+    ASSERT(count > 0 && constants_check(hlsl, count, draw, 4) == -1);
+    printf("  layout: shaders.hlsl matches FrameConstants and DrawConstants\n");
+}
+
+// Blocks of `size` bytes into the ring, a frame of `per_frame` at a time,
+// copied by constants_push() or by memcpy().
+static void bench_constants_stream(uint64_t size, int per_frame, bool stream)
+{
+    BenchUpload b = {NULL, 0};
+    UploadDevice device = {
+        &b, bench_upload_create, bench_upload_destroy,
+        bench_upload_completed, bench_upload_wait
+    };
+
+    Upload upload;
+    bool ok = upload_init(&upload, &device, 16 * 1024 * 1024, 16 * 1024 * 1024);
+    ASSERT(ok);
+
+    // Blocks start up to 48 bytes in, and are up to CONSTANTS_ALIGN * 4 long.
+    static uint8_t data[CONSTANTS_ALIGN * 4 + 48];
+    for (size_t i = 0; i < sizeof(data); i++)
+        data[i] = (uint8_t)i;
+    ASSERT(size + 48 <= sizeof(data));
+
+    int frames = (int)(256 * 1024 * 1024 / (per_frame * CONSTANTS_ALIGN));
+    uint64_t fence = 0;
+    ConstantStats stats = {0};
+
+    double t0 = seconds();
+    for (int frame = 0; frame < frames; frame++) {
+        ConstantStream s;
+        constants_init(&s, &upload, 64 * 1024);
+        for (int i = 0; i < per_frame; i++) {
+            void const *block = data + (i % 4) * 16;
+            uint64_t gpu;
+            if (stream) {
+                gpu = constants_push(&s, block, size);
+            } else {
+                uint8_t *cpu;
+                gpu = constants_alloc(&s, size, &cpu);
+                memcpy(cpu, block, size);
+            }
+            ASSERT(gpu && gpu % CONSTANTS_ALIGN == 0);
+        }
+        constants_finish(&s);
+        upload_end_frame(&upload, ++fence);
+
+        stats.blocks += s.stats.blocks;
+        stats.bytes += s.stats.bytes;
+        stats.chunks += s.stats.chunks;
+    }
+    double elapsed = seconds() - t0;
+
+    // The last block is where it should be, whole.
+    uint64_t last = upload.head - upload_align(size, CONSTANTS_ALIGN);
+    uint8_t const *cpu = upload.buffer.cpu + last % upload.buffer.size;
+    ASSERT(memcmp(cpu, data + ((per_frame - 1) % 4) * 16, size) == 0);
+
+    printf("  %4d B blocks, %s: %6.1f M blocks/s, %5.2f GB/s of constants, %5.2f GB/s of blocks\n",
+           (int)size, (stream) ? "streamed" : "memcpy  ", stats.blocks / elapsed / 1e6,
+           (double)stats.blocks * size / elapsed / 1e9, stats.bytes / elapsed / 1e9);
+    upload_shutdown(&upload);
+}
+
+static void bench_constants(void)
+{
+    printf("constants:\n");
+    bench_constants_layout();
+
+    uint64_t sizes[] = {sizeof(DrawConstants), 256, 1024};
+    for (int i = 0; i < 3; i++) {
+        bench_constants_stream(sizes[i], 4096, false);
+        bench_constants_stream(sizes[i], 4096, true);
+    }
+}
+
+
+
+// Vertices
+//
+// Half floats are checked against every one there is, and against random
+// bits four at a time.  Then random meshes go into every format and back,
+// bit for bit the same whichever way they were packed, and off by no more
+// than the format can tell apart.
+
+static float bench_vertices_float(uint32_t *random, float lo, float hi)
+{
+    return lo + (hi - lo) * (float)(bench_random(random) & 0xffffff) / (float)0xffffff;
+}
+
+static void bench_vertices_halves(void)
+{
+    // Every half comes back as itself.
+    for (uint32_t h = 0; h < 0x10000; h++) {
+        if ((h & 0x7c00) == 0x7c00 && (h & 0x3ff))
+            continue;
+        ASSERT(vertices_half(vertices_unhalf((uint16_t)h)) == h);
+    }
+
+    // Halfway between two halves goes to the even one.
+    ASSERT(vertices_half(1.0f + 1.0f / 2048.0f) == 0x3c00);
+    ASSERT(vertices_half(1.0f + 3.0f / 2048.0f) == 0x3c02);
+    ASSERT(vertices_half(65519.0f) == 0x7bff && vertices_half(65520.0f) == 0x7c00);
+    ASSERT(vertices_half(-0.0f) == 0x8000 && vertices_half(1e-10f) == 0);
+
+    // Any bits at all, four at a time as one at a time, and within half a
+    // step of the half below or above.
+    uint32_t random = 17;
+    int const count = 1 << 22;
+    for (int i = 0; i < count; i += 4) {
+        alignas(16) uint32_t bits[4];
+        alignas(16) uint32_t halves[4];
+        for (int k = 0; k < 4; k++)
+            bits[k] = bench_random(&random) ^ (bench_random(&random) << 24);
+
+        __m128i packed = _mm_packs_epi32(vertices_half4(_mm_load_ps((float *)bits)), _mm_setzero_si128());
+        _mm_store_si128((__m128i *)halves, _mm_unpacklo_epi16(packed, _mm_setzero_si128()));
+
+        for (int k = 0; k < 4; k++) {
+            float f = vertices_from_bits(bits[k]);
+            uint16_t h = vertices_half(f);
+            ASSERT(halves[k] == h);
+            if (fabsf(f) < 65504.0f) {
+                float back = vertices_unhalf(h);
+                float step = fabsf(vertices_unhalf(h ^ 1) - back);
+                ASSERT(fabsf(back - f) <= 0.5f * step);
+            }
+        }
+    }
+    printf("  halves: all 63k of them round trip, %d M random floats convert alike 4 at a time\n", count >> 20);
+}
+
+static void bench_vertices_mesh(Vertex *mesh, int count, uint32_t *random)
+{
+    for (int i = 0; i < count; i++) {
+        Vertex *v = &mesh[i];
+        v->pos[0] = bench_vertices_float(random, -3.0f, 3.0f);
+        v->pos[1] = bench_vertices_float(random, -3.0f, 3.0f);
+        v->uv[0] = bench_vertices_float(random, -8.0f, 8.0f);
+        v->uv[1] = bench_vertices_float(random, 0.0f, 1e-4f);      // Denormal halves.
+        for (int c = 0; c < 4; c++)
+            v->color[c] = bench_vertices_float(random, -0.1f, 1.1f);
+    }
+    mesh[count / 2].pos[1] = -3.5f;                                 // The extent.
+}
+
+static void bench_vertices_round_trip(void)
+{
+    int const count = 100003;
+    Vertex *mesh = (Vertex *)malloc(count * sizeof(Vertex));
+    Vertex *back = (Vertex *)malloc(count * sizeof(Vertex));
+    uint8_t *simd = (uint8_t *)malloc(count * sizeof(Vertex));
+    uint8_t *scalar = (uint8_t *)malloc(count * sizeof(Vertex));
+    uint32_t random = 5;
+    bench_vertices_mesh(mesh, count, &random);
+
+    for (int format = 0; format < VERTICES_FORMATS; format++) {
+        float scale = vertices_scale(format, mesh, count);
+        uint32_t stride = vertices_formats[format].stride;
+
+        vertices_pack(format, mesh, count, scale, simd);
+        for (int i = 0; i < count; i++)
+            vertices_pack_one(format, &mesh[i], 32767.0f / scale, scalar + i * stride);
+        ASSERT(memcmp(simd, scalar, vertices_size(format, count)) == 0);
+
+        vertices_unpack(format, simd, count, scale, back);
+        double pos = 0.0, uv = 0.0, color = 0.0;
+        for (int i = 0; i < count; i++) {
+            for (int k = 0; k < 2; k++) {
+                pos = fmax(pos, fabs(back[i].pos[k] - mesh[i].pos[k]));
+                uv = fmax(uv, fabs(back[i].uv[k] - mesh[i].uv[k]) / fmax(fabs(mesh[i].uv[k]), 1.0 / 16384));
+            }
+            for (int k = 0; k < 4; k++) {
+                float expected = mesh[i].color[k];
+                if (format != VERTICES_FLOAT)
+                    expected = fminf(fmaxf(expected, 0.0f), 1.0f);
+                color = fmax(color, fabs(back[i].color[k] - expected));
+            }
+        }
+
+        // Half a step of each, and a little for the float arithmetic.
+        bool snorm = vertices_formats[format].elements[VERTICES_POSITION].type == VERTICES_SNORM16X2;
+        ASSERT(scale == (snorm ? 3.5f : 1.0f));
+        ASSERT(pos <= (snorm ? 0.5 * scale / 32767.0 + 4.0 * scale * FLT_EPSILON : 0.0));
+        ASSERT(uv <= (format == VERTICES_FLOAT ? 0.0 : 1.0 / 2048.0));
+        ASSERT(color <= (format == VERTICES_FLOAT ? 0.0 : 0.5 / 255.0 + 1e-6));
+
+        printf("  %-7s %2u bytes: worst error %.1e in positions, %.1e relative in UVs, %.1e in colors\n",
+               vertices_formats[format].name, stride, pos, uv, color);
+    }
+
+    free(scalar);
+    free(simd);
+    free(back);
+    free(mesh);
+}
+
+static void bench_vertices_throughput(void)
+{
+    int const count = 1 << 20;
+    int const rounds = 20;
+    Vertex *mesh = (Vertex *)malloc(count * sizeof(Vertex));
+    uint8_t *dst = (uint8_t *)malloc(count * sizeof(Vertex));
+    uint32_t random = 11;
+    bench_vertices_mesh(mesh, count, &random);
+
+    for (int format = VERTICES_PACKED; format < VERTICES_FORMATS; format++) {
+        float scale = vertices_scale(format, mesh, count);
+        uint32_t stride = vertices_formats[format].stride;
+
+        double t0 = seconds();
+        for (int r = 0; r < rounds; r++) {
+            for (int i = 0; i < count; i++)
+                vertices_pack_one(format, &mesh[i], 32767.0f / scale, dst + i * stride);
+        }
+        double one = (seconds() - t0) / rounds;
+
+        t0 = seconds();
+        for (int r = 0; r < rounds; r++)
+            vertices_pack(format, mesh, count, scale, dst);
+        double four = (seconds() - t0) / rounds;
+
+        printf("  %-7s: %6.1f M vertices/s one at a time, %6.1f M/s four at a time (%.1f GB/s in), %.0f%% of the bytes\n",
+               vertices_formats[format].name, count / one / 1e6, count / four / 1e6,
+               count * sizeof(Vertex) / four / 1e9, 100.0 * stride / sizeof(Vertex));
+    }
+
+    free(dst);
+    free(mesh);
+}
+
+static void bench_vertices(void)
+{
+    printf("vertices:\n");
+    bench_vertices_halves();
+    bench_vertices_round_trip();
+    bench_vertices_throughput();
+}
+
+
+
+// Asset Packs
+//
+// A pack of about 100 MB is written, read back and checked, and then
+// loaded into an upload ring: mapped and copied from, and read with stdio
+// into a staging buffer and copied from there, the way it would be without
+// a mapping.  Cold loads come after the file was dropped from the page
+// cache, which only Linux is asked to do here.
+
+static char const bench_pack_path[] = "bench.pack";
+
+// Returns false when the page cache cannot be told to let go of the file.
+static bool bench_pack_evict(char const *path)
+{
+#ifdef _WIN32
+    return false;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    fsync(fd);
+    bool ok = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+    close(fd);
+    return ok;
+#endif
+}
+
+static uint64_t bench_pack_write(Pool *pool)
+{
+    PackWriter w;
+    bool ok = pack_create(&w, bench_pack_path);
+    ASSERT(ok);
+
+    uint32_t random = 3;
+
+    // A mesh of a million vertices, and its indices.
+    int const vertex_count = 1 << 20;
+    Vertex *mesh = (Vertex *)malloc(vertex_count * sizeof(Vertex));
+    uint32_t *indices = (uint32_t *)malloc(3 * vertex_count * sizeof(uint32_t));
+    ASSERT(mesh && indices);
+    bench_vertices_mesh(mesh, vertex_count, &random);
+    for (int i = 0; i < 3 * vertex_count; i++)
+        indices[i] = bench_random(&random) % vertex_count;
+    pack_add_vertices(&w, "mesh", VERTICES_COMPACT, mesh, vertex_count);
+    pack_add_indices(&w, "mesh", indices, 3 * vertex_count);
+    free(indices);
+    free(mesh);
+
+    // Textures with every mip, of noise: 2048x2048 RGBA8, and as large in BC7.
+    int const size = 2048;
+    int const mip_count = texture_mip_count(size, size);
+    uint8_t *subresources[TEXTURE_MAX_MIPS];
+    for (int i = 0; i < mip_count; i++) {
+        int mip = texture_mip_size(size, i);
+        uint64_t bytes = texture_size(TEXTURE_RGBA8, mip, mip);
+        subresources[i] = (uint8_t *)malloc((size_t)bytes);
+        ASSERT(subresources[i]);
+        for (uint64_t b = 0; b < bytes; b++)
+            subresources[i][b] = (uint8_t)bench_random(&random);
+    }
+    for (int k = 0; k < 4; k++) {
+        char name[PACK_NAME];
+        snprintf(name, sizeof(name), "noise%d", k);
+        TextureDesc desc = {TEXTURE_RGBA8, size, size, 1, mip_count};
+        pack_add_texture(&w, pool, name, &desc, subresources);
+    }
+    for (int i = 0; i < mip_count; i++)
+        free(subresources[i]);
+
+    // Noise is BC7 too, of 4 times the size: every mip is as large as BC7
+    // has it, which the last ones, a block each, are not in RGBA8.
+    for (int i = 0; i < mip_count; i++) {
+        int mip = texture_mip_size(2 * size, i);
+        uint64_t bytes = texture_size(TEXTURE_BC7, mip, mip);
+        subresources[i] = (uint8_t *)malloc((size_t)bytes);
+        ASSERT(subresources[i]);
+        for (uint64_t b = 0; b < bytes; b++)
+            subresources[i][b] = (uint8_t)bench_random(&random);
+    }
+    {
+        TextureDesc desc = {TEXTURE_BC7, 2 * size, 2 * size, 1, mip_count};
+        pack_add_texture(&w, pool, "noise_bc7", &desc, subresources);
+    }
+    for (int i = 0; i < mip_count; i++)
+        free(subresources[i]);
+
+    ok = pack_finish(&w);
+    ASSERT(ok);
+
+    Pack pack;
+    ok = pack_open(&pack, bench_pack_path);
+    ASSERT(ok);
+    uint64_t bytes = pack.size;
+    pack_close(&pack);
+    return bytes;
+}
+
+static void bench_pack_check(void)
+{
+    Pack pack;
+    bool ok = pack_open(&pack, bench_pack_path);
+    ASSERT(ok);
+
+    ASSERT(pack.count == 7);
+    PackEntry const *vertices = pack_find(&pack, "mesh", PACK_VERTICES, VERTICES_COMPACT);
+    PackEntry const *indices = pack_find(&pack, "mesh", PACK_INDICES, 4);
+    PackEntry const *texture = pack_find(&pack, "noise2", PACK_TEXTURE, TEXTURE_RGBA8);
+    ASSERT(vertices && indices && texture);
+    ASSERT(!pack_find(&pack, "mesh", PACK_VERTICES, VERTICES_FLOAT));
+    ASSERT(vertices->count == 1 << 20 && vertices->scale == 3.5f);
+    ASSERT(texture->mip_levels == 12);
+
+    for (int i = 0; i < pack.count; i++) {
+        ASSERT(pack.entries[i].offset % PACK_ALIGN == 0);
+        ASSERT(pack_verify(&pack, &pack.entries[i]));
+    }
+
+    // Rows are at the pitch of the footprints: the 1x1 mip is 4 bytes,
+    // where the 2x2 one ended on its own.
+    TextureFootprint footprints[TEXTURE_MAX_MIPS];
+    uint64_t size = pack_footprints(texture, footprints);
+    ASSERT(size == texture->size && footprints[11].offset % TEXTURE_PLACEMENT_ALIGNMENT == 0);
+    ASSERT(footprints[0].row_pitch == 2048 * 4 && footprints[10].row_pitch == TEXTURE_PITCH_ALIGNMENT);
+
+    // A copy with a byte of its table of contents changed, or cut short, is
+    // not taken.
+    size_t file_size = pack.size;
+    uint8_t *copy = (uint8_t *)malloc(file_size);
+    ASSERT(copy);
+    memcpy(copy, pack.map, file_size);
+    uint64_t toc = ((PackHeader const *)pack.map)->toc_offset;
+    pack_close(&pack);
+
+    char const *bad = "bench-bad.pack";
+    for (int k = 0; k < 2; k++) {
+        if (k == 0)
+            copy[toc + 40] ^= 1;
+        FILE *file = fopen(bad, "wb");
+        ASSERT(file);
+        fwrite(copy, (k == 0) ? file_size : file_size - 100, 1, file);
+        fclose(file);
+        ASSERT(!pack_open(&pack, bad));
+    }
+    remove(bad);
+    free(copy);
+
+    printf("  %d assets check out, a changed or truncated pack does not\n", 7);
+}
+
+// Loads every asset into the ring.  Returns the bytes loaded.
+static uint64_t bench_pack_load(Upload *upload, bool mapped)
+{
+    uint64_t bytes = 0;
+
+    if (mapped) {
+        Pack pack;
+        bool ok = pack_open(&pack, bench_pack_path);
+        ASSERT(ok);
+        for (int i = 0; i < pack.count; i++) {
+            PackEntry const *e = &pack.entries[i];
+            UploadAllocation a;
+            ok = upload_alloc(upload, e->size, UPLOAD_ALIGN_TEXTURE, &a);
+            ASSERT(ok);
+            pack_prefetch(&pack, e);
+            memcpy(a.cpu, pack_data(&pack, e), (size_t)e->size);
+            bytes += e->size;
+        }
+        pack_close(&pack);
+        return bytes;
+    }
+
+    // Without the mapping, reading as much of the file as it has to.
+    FILE *file = fopen(bench_pack_path, "rb");
+    ASSERT(file);
+    PackHeader header;
+    size_t read = fread(&header, sizeof(header), 1, file);
+    ASSERT(read == 1);
+
+    PackEntry *entries = (PackEntry *)malloc(header.count * sizeof(PackEntry));
+    ASSERT(entries);
+    fseek(file, (long)header.toc_offset, SEEK_SET);
+    read = fread(entries, sizeof(PackEntry), header.count, file);
+    ASSERT(read == header.count);
+
+    for (uint32_t i = 0; i < header.count; i++) {
+        void *staging = malloc((size_t)entries[i].size);
+        ASSERT(staging);
+        fseek(file, (long)entries[i].offset, SEEK_SET);
+        read = fread(staging, (size_t)entries[i].size, 1, file);
+        ASSERT(read == 1);
+
+        UploadAllocation a;
+        bool ok = upload_alloc(upload, entries[i].size, UPLOAD_ALIGN_TEXTURE, &a);
+        ASSERT(ok);
+        memcpy(a.cpu, staging, (size_t)entries[i].size);
+        free(staging);
+        bytes += entries[i].size;
+    }
+
+    free(entries);
+    fclose(file);
+    return bytes;
+}
+
+static void bench_pack(void)
+{
+    printf("pack:\n");
+
+    Pool pool;
+    pool_init(&pool, 0);
+
+    double t0 = seconds();
+    uint64_t size = bench_pack_write(&pool);
+    printf("  written: %.1f MB in %.0f ms\n", size / 1e6, 1000.0 * (seconds() - t0));
+
+    bench_pack_check();
+
+    BenchUpload b = {NULL, 0};
+    UploadDevice device = {
+        &b, bench_upload_create, bench_upload_destroy,
+        bench_upload_completed, bench_upload_wait
+    };
+    Upload upload;
+    bool ok = upload_init(&upload, &device, 256 * 1024 * 1024, 256 * 1024 * 1024);
+    ASSERT(ok);
+
+    // Touch the ring once, so that neither way pays for faulting it in.
+    for (int mapped = 0; mapped < 2; mapped++) {
+        bench_pack_load(&upload, mapped != 0);
+        upload_end_frame(&upload, 0);
+    }
+
+    for (int mapped = 1; mapped >= 0; mapped--) {
+        char const *name = (mapped) ? "mapped" : "read  ";
+
+        char cold[64] = "cold skipped";
+        if (bench_pack_evict(bench_pack_path)) {
+            double t = seconds();
+            uint64_t bytes = bench_pack_load(&upload, mapped != 0);
+            upload_end_frame(&upload, 0);
+            snprintf(cold, sizeof(cold), "cold %6.0f MB/s", bytes / (seconds() - t) / 1e6);
+        }
+
+        double best = 1e9;
+        uint64_t bytes = 0;
+        for (int r = 0; r < 5; r++) {
+            double t = seconds();
+            bytes = bench_pack_load(&upload, mapped != 0);
+            upload_end_frame(&upload, 0);
+            double elapsed = seconds() - t;
+            best = (elapsed < best) ? elapsed : best;
+        }
+        printf("  %s: %s, warm %6.0f MB/s\n", name, cold, bytes / best / 1e6);
+    }
+
+    upload_shutdown(&upload);
+    remove(bench_pack_path);
+    pool_shutdown(&pool);
+}
+
+
+
+// Meshes
+//
+// A sphere of about 800k triangles comes in as a list of them in random
+// order, three vertices each, and goes through every stage of mesh.h: the
+// triangles must all still be there, and the cache must do better after
+// every stage that is about it.
+
+typedef struct BenchMeshVertex {
+    float pos[3];
+    float normal[3];
+    float uv[2];
+} BenchMeshVertex;
+
+// Returns how many vertices, three per triangle, there are in `*soup`.
+static int bench_mesh_sphere(int slices, int stacks, BenchMeshVertex **soup)
+{
+    int grid = (slices + 1) * (stacks + 1);
+    BenchMeshVertex *vertices = (BenchMeshVertex *)malloc(grid * sizeof(BenchMeshVertex));
+    for (int y = 0; y <= stacks; y++) {
+        for (int x = 0; x <= slices; x++) {
+            float theta = 3.14159265f * y / stacks;
+            float phi = 2.0f * 3.14159265f * x / slices;
+            BenchMeshVertex *v = &vertices[y * (slices + 1) + x];
+            v->normal[0] = sinf(theta) * cosf(phi);
+            v->normal[1] = cosf(theta);
+            v->normal[2] = sinf(theta) * sinf(phi);
+            for (int k = 0; k < 3; k++)
+                v->pos[k] = 2.0f * v->normal[k];
+            v->uv[0] = (float)x / slices;
+            v->uv[1] = (float)y / stacks;
+        }
+    }
+
+    int triangle_count = 2 * slices * stacks;
+    uint32_t *order = (uint32_t *)malloc(triangle_count * sizeof(uint32_t));
+    uint32_t random = 23;
+    for (int t = 0; t < triangle_count; t++)
+        order[t] = (uint32_t)t;
+    for (int t = triangle_count - 1; t > 0; t--) {
+        int other = (int)(bench_random(&random) % (uint32_t)(t + 1));
+        uint32_t swap = order[t];
+        order[t] = order[other];
+        order[other] = swap;
+    }
+
+    *soup = (BenchMeshVertex *)malloc(3 * triangle_count * sizeof(BenchMeshVertex));
+    for (int t = 0; t < triangle_count; t++) {
+        int quad = (int)order[t] / 2;
+        int x = quad % slices, y = quad / slices;
+        uint32_t a = y * (slices + 1) + x, b = a + 1, c = a + slices + 1, d = c + 1;
+        uint32_t corners[2][3] = {{a, c, b}, {b, c, d}};
+        for (int k = 0; k < 3; k++)
+            (*soup)[3 * t + k] = vertices[corners[order[t] & 1][k]];
+    }
+
+    free(order);
+    free(vertices);
+    return 3 * triangle_count;
+}
+
+static int bench_mesh_compare(void const *a, void const *b)
+{
+    uint64_t ka = *(uint64_t const *)a, kb = *(uint64_t const *)b;
+    return (ka < kb) ? -1 : (ka > kb) ? 1 : 0;
+}
+
+// The triangles, by what their corners are, in the order of the corners.
+static void bench_mesh_triangles(uint32_t const *indices, int count, BenchMeshVertex const *vertices,
+                                 uint64_t *keys)
+{
+    for (int t = 0; t < count / 3; t++) {
+        uint64_t key = 0;
+        for (int k = 0; k < 3; k++) {
+            uint32_t v = (indices) ? indices[3 * t + k] : (uint32_t)(3 * t + k);
+            key = key * 0x9e3779b97f4a7c15ull + mesh_hash(&vertices[v], sizeof(BenchMeshVertex));
+        }
+        keys[t] = key;
+    }
+    qsort(keys, count / 3, sizeof(uint64_t), bench_mesh_compare);
+}
+
+static void bench_mesh_report(char const *stage, double elapsed, int count, uint32_t const *indices,
+                              int vertex_count)
+{
+    char timing[64] = "";
+    if (elapsed > 0.0)
+        snprintf(timing, sizeof(timing), "%6.1f M triangles/s", count / 3 / elapsed / 1e6);
+    printf("  %-9s ACMR %.3f, ATVR %.3f (16 entries), ACMR %.3f (32)  %s\n", stage,
+           mesh_acmr(indices, count, vertex_count, 16), mesh_atvr(indices, count, vertex_count, 16),
+           mesh_acmr(indices, count, vertex_count, 32), timing);
+}
+
+static void bench_mesh(void)
+{
+    printf("mesh:\n");
+
+    ASSERT(mesh_index_size(0x10000) == 2 && mesh_index_size(0x10001) == 4);
+
+    BenchMeshVertex *soup;
+    int count = bench_mesh_sphere(768, 512, &soup);
+    size_t stride = sizeof(BenchMeshVertex);
+    int triangle_count = count / 3;
+
+    uint64_t *expected = (uint64_t *)malloc(triangle_count * sizeof(uint64_t));
+    uint64_t *keys = (uint64_t *)malloc(triangle_count * sizeof(uint64_t));
+    bench_mesh_triangles(NULL, count, soup, expected);
+
+    BenchMeshVertex *vertices = (BenchMeshVertex *)malloc(count * stride);
+    uint32_t *indices = (uint32_t *)malloc(count * sizeof(uint32_t));
+    uint32_t *clusters = (uint32_t *)malloc((triangle_count + 1) * sizeof(uint32_t));
+    BenchMeshVertex *fetched = (BenchMeshVertex *)malloc(count * stride);
+
+    double t0 = seconds();
+    int vertex_count = mesh_index(soup, count, stride, vertices, indices);
+    double indexing = seconds() - t0;
+
+    // The poles have a vertex for every slice, at the same place but with
+    // different UVs, so they stay apart.
+    ASSERT(vertex_count == 769 * 513);
+    bench_mesh_triangles(indices, count, vertices, keys);
+    ASSERT(memcmp(keys, expected, triangle_count * sizeof(uint64_t)) == 0);
+    printf("  %d triangles, %d vertices in the list, %d once indexed, in %d-byte indices\n",
+           triangle_count, count, vertex_count, mesh_index_size(vertex_count));
+    bench_mesh_report("indexed", indexing, count, indices, vertex_count);
+    double random_acmr = mesh_acmr(indices, count, vertex_count, MESH_CACHE);
+
+    t0 = seconds();
+    int cluster_count = mesh_order_cache(indices, count, vertex_count, MESH_CACHE, clusters);
+    double ordering = seconds() - t0;
+
+    bench_mesh_triangles(indices, count, vertices, keys);
+    ASSERT(memcmp(keys, expected, triangle_count * sizeof(uint64_t)) == 0);
+    double cache_acmr = mesh_acmr(indices, count, vertex_count, MESH_CACHE);
+    ASSERT(cache_acmr < 0.5 * random_acmr && cache_acmr < 1.0);
+    bench_mesh_report("cache", ordering, count, indices, vertex_count);
+
+    t0 = seconds();
+    int split_count = mesh_order_overdraw(indices, count, vertices, vertex_count, stride, 3, clusters,
+                                          cluster_count, MESH_CACHE, MESH_OVERDRAW);
+    double overdraw = seconds() - t0;
+
+    // Cutting into clusters costs the cache a little, at the edges.
+    bench_mesh_triangles(indices, count, vertices, keys);
+    ASSERT(memcmp(keys, expected, triangle_count * sizeof(uint64_t)) == 0);
+    ASSERT(mesh_acmr(indices, count, vertex_count, MESH_CACHE) < 1.2 * cache_acmr);
+    bench_mesh_report("overdraw", overdraw, count, indices, vertex_count);
+    printf("  %d clusters where the cache order jumps, %d once split\n", cluster_count, split_count);
+
+    t0 = seconds();
+    int used = mesh_order_fetch(indices, count, vertices, vertex_count, stride, fetched);
+    double fetching = seconds() - t0;
+
+    // Each vertex is first used after the one before it.
+    ASSERT(used == vertex_count);
+    uint32_t next = 0;
+    for (int i = 0; i < count; i++) {
+        ASSERT(indices[i] <= next);
+        next += (indices[i] == next);
+    }
+    bench_mesh_triangles(indices, count, fetched, keys);
+    ASSERT(memcmp(keys, expected, triangle_count * sizeof(uint64_t)) == 0);
+    bench_mesh_report("fetch", fetching, count, indices, vertex_count);
+
+    // All of it in one go, from the list, and narrowed.
+    t0 = seconds();
+    vertex_count = mesh_index(soup, count, stride, vertices, indices);
+    vertex_count = mesh_optimize(indices, count, vertices, vertex_count, stride, 3);
+    double all = seconds() - t0;
+    bench_mesh_triangles(indices, count, vertices, keys);
+    ASSERT(memcmp(keys, expected, triangle_count * sizeof(uint64_t)) == 0);
+    printf("  all of it: %.0f ms, %.1f M triangles/s\n", 1000.0 * all, triangle_count / all / 1e6);
+
+    uint16_t narrow[6];
+    uint32_t wide[6] = {0, 1, 2, 2, 1, 0xffff};
+    mesh_narrow(wide, 6, 2, narrow);
+    for (int i = 0; i < 6; i++)
+        ASSERT(narrow[i] == wide[i]);
+
+    free(fetched);
+    free(clusters);
+    free(indices);
+    free(vertices);
+    free(keys);
+    free(expected);
+    free(soup);
+}
+
+
+
+// Captures
+//
+// Frames shaped like the ones hello.cpp submits, their draws recorded into
+// several lists, are captured as fast as they go: what recording costs the
+// threads that record, and what handing the lists over costs the one that
+// submits them.  Then the capture is replayed with no backend, twice, and
+// must come out the same both times and the same as what went in.
+
+#define BENCH_CAPTURE_FRAMES    120
+#define BENCH_CAPTURE_DRAWS     1024
+#define BENCH_CAPTURE_LISTS     4
+#define BENCH_CAPTURE_INSTANCES 16      // Per draw.
+
+static char const *const bench_capture_path = "bench.capture";
+
+static uint64_t const bench_capture_mesh = 0x100000000ull;         // GPU addresses.
+static uint64_t const bench_capture_upload = 0x200000000ull;
+static uint64_t const bench_capture_texture = 7;
+static uint64_t const bench_capture_target = 8;
+
+// Where the frame's constants and instances are, by frame.
+static uint64_t bench_capture_constants(int frame, int draw)
+{
+    return bench_capture_upload + (uint64_t)(frame % 3) * 0x1000000 + 256 * (uint64_t)(draw + 1);
+}
+
+static uint64_t bench_capture_instances(int frame)
+{
+    return bench_capture_upload + (uint64_t)(frame % 3) * 0x1000000 + 0x800000;
+}
+
+static void bench_capture_draw_list(CaptureList *list, int frame, int first, int end)
+{
+    CaptureVertexBuffer views[2] = {
+        {bench_capture_mesh, 3 * 12, 12},
+        {bench_capture_instances(frame), BENCH_CAPTURE_DRAWS * BENCH_CAPTURE_INSTANCES * 48, 48},
+    };
+
+    capture_signature(list, 1);
+    capture_table(list, 0, bench_capture_texture);
+    capture_cbv(list, 1, bench_capture_constants(frame, -1));
+    capture_viewport(list, 0.0f, 0.0f, 720.0f, 480.0f, 0.0f, 1.0f);
+    capture_scissor(list, 0, 0, 720, 480);
+    capture_target(list, bench_capture_target);
+    capture_vertex_buffers(list, 0, 2, views);
+    capture_index_buffer(list, bench_capture_mesh + 64, 6, 2);
+    for (int i = first; i < end; i++) {
+        capture_cbv(list, 2, bench_capture_constants(frame, i));
+        capture_draw_indexed(list, 3, BENCH_CAPTURE_INSTANCES, 0, 0, i * BENCH_CAPTURE_INSTANCES);
+    }
+}
+
+// The upload of the assets, on the copy queue, before the first frame.
+static void bench_capture_assets(Capture *capture, CaptureList *list)
+{
+    uint8_t mesh[64 + 6];
+    for (int i = 0; i < (int)sizeof(mesh); i++)
+        mesh[i] = (uint8_t)i;
+
+    capture_list_reset(list);
+    capture_data(capture, bench_capture_upload, mesh, sizeof(mesh));
+    capture_copy_buffer(list, bench_capture_mesh, bench_capture_upload, sizeof(mesh));
+    capture_data(capture, bench_capture_upload + 4096, checkers, sizeof(checkers));
+    capture_texture(list, bench_capture_texture, TEXTURE_RGBA8, 2, 2, 1);
+    capture_copy_texture(list, bench_capture_texture, 0, bench_capture_upload + 4096, 256, 2, 2);
+    capture_submit(capture, CAPTURE_COPY, list);
+}
+
+static void bench_capture(void)
+{
+    printf("capture:\n");
+
+    // Memory crosses pages, and reads back zeros where it was not written.
+    {
+        CaptureMemory m = {0};
+        uint8_t in[3 * CAPTURE_PAGE], out[3 * CAPTURE_PAGE];
+        for (int i = 0; i < (int)sizeof(in); i++)
+            in[i] = (uint8_t)(i * 7 + 1);
+        capture_memory_write(&m, CAPTURE_PAGE - 100, in, sizeof(in));
+        capture_memory_copy(&m, 1ull << 40, CAPTURE_PAGE - 100, sizeof(in));
+        capture_memory_read(&m, (1ull << 40), sizeof(out), out);
+        ASSERT(memcmp(in, out, sizeof(in)) == 0);
+        capture_memory_read(&m, 5 * CAPTURE_PAGE, 16, out);
+        ASSERT(out[0] == 0 && out[15] == 0 && m.count == 7);
+        capture_memory_free(&m);
+    }
+
+    Capture capture;
+    bool ok = capture_open(&capture, bench_capture_path);
+    ASSERT(ok);
+
+    CaptureList lists[2 + BENCH_CAPTURE_LISTS];
+    memset(lists, 0, sizeof(lists));
+    bench_capture_assets(&capture, &lists[0]);
+
+    static BatchInstance instances[BENCH_CAPTURE_DRAWS * BENCH_CAPTURE_INSTANCES];
+    for (int i = 0; i < BENCH_CAPTURE_DRAWS * BENCH_CAPTURE_INSTANCES; i++) {
+        BatchInstance one = {{1.0f, 0.0f, 0.0f, 1.0f}, {(float)i, 0.0f}, {0.0f, 0.0f}, {1.0f, 1.0f, 1.0f, 1.0f}};
+        instances[i] = one;
+    }
+
+    double recording = 0.0, submitting = 0.0;
+    uint64_t records = 0;
+    for (int frame = 0; frame < BENCH_CAPTURE_FRAMES; frame++) {
+        double t0 = seconds();
+
+        CaptureList *begin = &lists[0], *end = &lists[1 + BENCH_CAPTURE_LISTS];
+        capture_list_reset(begin);
+        capture_barrier(begin, bench_capture_target, 0xffffffff, 0, 0, 0, 4);
+        capture_clear(begin, bench_capture_target, background);
+        for (int l = 0; l < BENCH_CAPTURE_LISTS; l++) {
+            capture_list_reset(&lists[1 + l]);
+            bench_capture_draw_list(&lists[1 + l], frame, BENCH_CAPTURE_DRAWS * l / BENCH_CAPTURE_LISTS,
+                                    BENCH_CAPTURE_DRAWS * (l + 1) / BENCH_CAPTURE_LISTS);
+        }
+        capture_list_reset(end);
+        capture_barrier(end, bench_capture_target, 0xffffffff, 0, 0, 4, 0);
+
+        double t1 = seconds();
+
+        // What the lists read, then the lists.
+        capture_frame(&capture, (uint64_t)frame);
+        FrameConstants consts = {720.0f, 480.0f, 480.0f / 720.0f, frame / 60.0f};
+        capture_data(&capture, bench_capture_constants(frame, -1), &consts, sizeof(consts));
+        for (int i = 0; i < BENCH_CAPTURE_DRAWS; i++) {
+            DrawConstants draw = draw_constants_default;
+            draw.fade_phase = (float)(frame * BENCH_CAPTURE_DRAWS + i);
+            capture_data(&capture, bench_capture_constants(frame, i), &draw, sizeof(draw));
+        }
+        capture_data(&capture, bench_capture_instances(frame), instances, sizeof(instances));
+        for (int l = 0; l < 2 + BENCH_CAPTURE_LISTS; l++) {
+            capture_submit(&capture, CAPTURE_DIRECT, &lists[l]);
+            records += lists[l].records;
+        }
+
+        double t2 = seconds();
+        recording += t1 - t0;
+        submitting += t2 - t1;
+    }
+
+    double t0 = seconds();
+    ok = capture_close(&capture);
+    double closing = seconds() - t0;
+    ASSERT(ok);
+
+    for (int l = 0; l < 2 + BENCH_CAPTURE_LISTS; l++)
+        capture_list_free(&lists[l]);
+
+    printf("  recorded: %.1f ns per record, on the threads that record the lists\n", 1e9 * recording / records);
+    printf("  submitted: %.1f us per frame of %.0f KB, %.1f ms waiting for the writer, %.1f ms to close\n",
+           1e6 * submitting / BENCH_CAPTURE_FRAMES, capture.bytes / 1e3 / BENCH_CAPTURE_FRAMES,
+           1000.0 * capture.stalled, 1000.0 * closing);
+
+
+    // Replayed twice, with nothing behind it.
+    CaptureReader reader;
+    ok = capture_load(&reader, bench_capture_path);
+    ASSERT(ok);
+    ASSERT(reader.header.frames == BENCH_CAPTURE_FRAMES && reader.header.size == capture.bytes);
+
+    CaptureReplay replays[2];
+    double elapsed[2];
+    for (int i = 0; i < 2; i++) {
+        capture_replay_init(&replays[i]);
+        double t = seconds();
+        ok = capture_replay(&reader, &replays[i], NULL);
+        elapsed[i] = seconds() - t;
+        ASSERT(ok);
+    }
+
+    uint64_t replayed = 0;
+    for (int op = 0; op < CAPTURE_OPS; op++) {
+        ASSERT(replays[0].counts[op] == replays[1].counts[op]);
+        replayed += replays[0].counts[op];
+    }
+    ASSERT(replayed == reader.header.records);
+    ASSERT(replays[0].counts[CAPTURE_DRAW_INDEXED] == (uint64_t)BENCH_CAPTURE_FRAMES * BENCH_CAPTURE_DRAWS);
+    ASSERT(replays[0].counts[CAPTURE_FRAME] == BENCH_CAPTURE_FRAMES);
+    ASSERT(replays[0].lists[0] == (uint64_t)BENCH_CAPTURE_FRAMES * (2 + BENCH_CAPTURE_LISTS));
+    ASSERT(replays[0].lists[1] == 1);
+    ASSERT(replays[0].instances == (uint64_t)BENCH_CAPTURE_FRAMES * BENCH_CAPTURE_DRAWS * BENCH_CAPTURE_INSTANCES);
+
+    // The memory holds what the last frames wrote, and the copied mesh.
+    for (int frame = BENCH_CAPTURE_FRAMES - 3; frame < BENCH_CAPTURE_FRAMES; frame++) {
+        for (int i = 0; i < BENCH_CAPTURE_DRAWS; i += 97) {
+            DrawConstants draw;
+            capture_memory_read(&replays[1].memory, bench_capture_constants(frame, i), sizeof(draw), &draw);
+            ASSERT(draw.fade_phase == (float)(frame * BENCH_CAPTURE_DRAWS + i));
+        }
+    }
+    uint8_t mesh[70];
+    capture_memory_read(&replays[1].memory, bench_capture_mesh, sizeof(mesh), mesh);
+    for (int i = 0; i < (int)sizeof(mesh); i++)
+        ASSERT(mesh[i] == (uint8_t)i);
+
+    double best = (elapsed[0] < elapsed[1]) ? elapsed[0] : elapsed[1];
+    printf("  replayed: %.1f ns per record, %.3f ms per frame, %.1f M records/s, the same both times\n",
+           1e9 * best / replayed, 1000.0 * best / BENCH_CAPTURE_FRAMES, replayed / best / 1e6);
+
+    capture_replay_free(&replays[0]);
+    capture_replay_free(&replays[1]);
+    capture_unload(&reader);
+    remove(bench_capture_path);
+}
+
+
+
+// Reloading
+//
+// A stand-in compiler takes a while to build a "pipeline" out of a file
+// that the bench rewrites under it, while frames keep going with fences that
+// lag two frames behind.  Saves must be swapped in, failures must leave the
+// last pipeline in place, bursts of saves must end up with the last one, and
+// no pipeline may be released while a frame in flight could still use it.
+
+#define BENCH_RELOAD_COST   0.02        // Seconds to build a pipeline.
+#define BENCH_RELOAD_FRAMES 2           // In flight.
+
+static char const *const bench_reload_path = "bench.hlsl";
+
+typedef struct BenchPipeline {
+    uint64_t    hash;       // Of the source it was built from.
+    uint64_t    used;       // The last fence value of a frame that drew with it.
+} BenchPipeline;
+
+typedef struct BenchReload {
+    double      cost;
+    int         live;       // Pipelines not yet released.
+    uint64_t    completed;  // What the stand-in fence has reached.
+} BenchReload;
+
+// Anything with "error" in it does not compile.
+static void *bench_reload_build(void *ctx, char const *source, size_t size, char *error, size_t error_size)
+{
+    BenchReload *br = (BenchReload *)ctx;
+    std::this_thread::sleep_for(std::chrono::duration<double>(br->cost));
+
+    for (size_t i = 0; i + 5 <= size; i++) {
+        if (!memcmp(source + i, "error", 5)) {
+            snprintf(error, error_size, "%s(1): error: does not compile", bench_reload_path);
+            return NULL;
+        }
+    }
+
+    BenchPipeline *pipeline = (BenchPipeline *)malloc(sizeof(BenchPipeline));
+    ASSERT(pipeline);
+    pipeline->hash = reload_hash(source, size);
+    pipeline->used = 0;
+    __atomic_add_fetch(&br->live, 1, __ATOMIC_RELAXED);
+    return pipeline;
+}
+
+static void bench_reload_release(void *ctx, void *pipeline)
+{
+    BenchReload *br = (BenchReload *)ctx;
+    BenchPipeline *p = (BenchPipeline *)pipeline;
+    ASSERT(p->used <= __atomic_load_n(&br->completed, __ATOMIC_RELAXED));
+    __atomic_sub_fetch(&br->live, 1, __ATOMIC_RELAXED);
+    free(p);
+}
+
+// Every version is a different size, so that saves in quick succession
+// still look different from the outside.
+static uint64_t bench_reload_write(char const *text, int version)
+{
+    char source[256];
+    int size = snprintf(source, sizeof(source), "// version %d\n%s\n%*s", version, text, version % 64, "");
+    FILE *file = fopen(bench_reload_path, "wb");
+    ASSERT(file);
+    fwrite(source, 1, (size_t)size, file);
+    fclose(file);
+    return reload_hash(source, (size_t)size);
+}
+
+typedef struct BenchReloadFrames {
+    uint64_t    submitted;
+    int         frames;
+    double      slowest;    // Seconds reload_frame() took at most.
+} BenchReloadFrames;
+
+// One frame: the fence catches up to all but the frames in flight, the
+// pipeline is picked, and the frame is submitted with it.
+static BenchPipeline *bench_reload_frame(Reload *reload, BenchReload *br, BenchReloadFrames *f)
+{
+    uint64_t completed = (f->submitted > BENCH_RELOAD_FRAMES) ? f->submitted - BENCH_RELOAD_FRAMES : 0;
+    __atomic_store_n(&br->completed, completed, __ATOMIC_RELAXED);
+
+    double t = seconds();
+    BenchPipeline *pipeline = (BenchPipeline *)reload_frame(reload, completed, f->submitted);
+    t = seconds() - t;
+    f->slowest = (t > f->slowest) ? t : f->slowest;
+
+    pipeline->used = ++f->submitted;
+    f->frames++;
+    std::this_thread::sleep_for(std::chrono::microseconds(500));
+    return pipeline;
+}
+
+// Runs frames until they draw with what `hash` built, or for a second.
+// Returns the frames it took, or -1.
+static int bench_reload_until(Reload *reload, BenchReload *br, BenchReloadFrames *f, uint64_t hash)
+{
+    double end = seconds() + 1.0;
+    for (int n = 1; seconds() < end; n++) {
+        if (bench_reload_frame(reload, br, f)->hash == hash)
+            return n;
+    }
+    return -1;
+}
+
+static void bench_reload(void)
+{
+    printf("reload: a %.0f ms build, %d frames in flight\n", 1000.0 * BENCH_RELOAD_COST, BENCH_RELOAD_FRAMES);
+
+    BenchReload br = {BENCH_RELOAD_COST, 0, 0};
+    ReloadDevice device = {&br, bench_reload_build, bench_reload_release};
+    char error[RELOAD_ERROR];
+
+    // Without a thread: a save is only built once it has settled, and the
+    // text it already built is not built again.
+    {
+        bench_reload_write("float4 ps() { return 0; }", 1);
+        Reload reload;
+        char none[1] = "";
+        reload_start(&reload, bench_reload_path, device, bench_reload_build(&br, none, 0, error, sizeof(error)), 0.0);
+        ASSERT(!reload_check(&reload));
+
+        uint64_t hash = bench_reload_write("float4 ps() { return 1; }", 2);
+        ASSERT(!reload_check(&reload));
+        ASSERT(reload_check(&reload));
+        ASSERT(!reload_check(&reload));
+
+        BenchReloadFrames f = {0};
+        ASSERT(bench_reload_frame(&reload, &br, &f)->hash == hash);
+
+        bench_reload_write("float4 ps() { return 1; }", 2);
+        reload.built.time--;    // As if the save had changed the time alone.
+        reload_check(&reload);
+        ASSERT(!reload_check(&reload));
+        ASSERT(reload_stats(&reload).unchanged == 1 && reload_stats(&reload).builds == 1);
+
+        br.completed = f.submitted;
+        reload_stop(&reload);
+        bench_reload_release(&br, reload.current);
+        ASSERT(br.live == 0);
+    }
+
+    // With a thread looking every 2 ms, while frames go on.
+    {
+        uint64_t hash = bench_reload_write("float4 ps() { return 0; }", 1);
+        Reload reload;
+        char none[1] = "";
+        void *first = bench_reload_build(&br, none, 0, error, sizeof(error));
+        ((BenchPipeline *)first)->hash = hash;
+        reload_start(&reload, bench_reload_path, device, first, 0.002);
+
+        BenchReloadFrames f = {0};
+        double latency = 0.0;
+        int frames = 0;
+        int saves = 8;
+        for (int i = 0; i < saves; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            hash = bench_reload_write("float4 ps() { return 2; }", 10 + i);
+            int n = bench_reload_until(&reload, &br, &f, hash);
+            ASSERT(n > 0);
+            frames += n;
+            latency += reload_stats(&reload).latency;
+        }
+        printf("  saves: %d swapped in, %.1f frames and %.1f ms after each was noticed\n",
+               saves, (double)frames / saves, 1000.0 * latency / saves);
+
+        // What does not compile is reported, and the last pipeline stays.
+        ReloadStats before = reload_stats(&reload);
+        bench_reload_write("float4 ps() { error }", 100);
+        double end = seconds() + 1.0;
+        while (!reload_failed(&reload, error, sizeof(error)) && seconds() < end)
+            ASSERT(bench_reload_frame(&reload, &br, &f)->hash == hash);
+        ASSERT(strstr(error, "does not compile"));
+        for (int i = 0; i < 20; i++)
+            ASSERT(bench_reload_frame(&reload, &br, &f)->hash == hash);
+        ReloadStats after = reload_stats(&reload);
+        ASSERT(after.failures == before.failures + 1 && after.swaps == before.swaps);
+        printf("  a failed build: reported, and frames went on with the last one that built\n");
+
+        // Fixing it brings the next one in.
+        hash = bench_reload_write("float4 ps() { return 3; }", 101);
+        ASSERT(bench_reload_until(&reload, &br, &f, hash) > 0);
+
+        // A burst of saves, faster than they build, ends with the last.
+        for (int i = 0; i < 10; i++) {
+            hash = bench_reload_write("float4 ps() { return 4; }", 200 + i);
+            std::this_thread::sleep_for(std::chrono::milliseconds(3));
+        }
+        ASSERT(bench_reload_until(&reload, &br, &f, hash) > 0);
+        for (int i = 0; i < 50; i++)
+            ASSERT(bench_reload_frame(&reload, &br, &f)->hash == hash);
+
+        ReloadStats stats = reload_stats(&reload);
+        printf("  %d frames: %d builds, %d failed, %d swaps, %d overtaken, %d released by fence\n",
+               f.frames, stats.builds, stats.failures, stats.swaps, stats.dropped, stats.released);
+        printf("  reload_frame(): %.1f us at most, while builds went on\n", 1e6 * f.slowest);
+        ASSERT(stats.swaps + stats.dropped + stats.failures == stats.builds);
+        ASSERT(f.slowest < BENCH_RELOAD_COST / 2);
+
+        // Once the GPU is idle, everything goes.
+        br.completed = f.submitted;
+        reload_stop(&reload);
+        bench_reload_release(&br, reload.current);
+        ASSERT(br.live == 0);
+    }
+
+    remove(bench_reload_path);
+}
+
+
+
+// Pipelines
+//
+// Keys must not change with where a desc is in memory, and must change with
+// every field that goes into a pipeline.  Then threads ask for variants of
+// a pipeline all at once, each more than once, from a stand-in creator that
+// takes a while: every variant must be created exactly once, and the
+// requests must not wait for it.  A second "run" finds them all in the
+// stand-in's library.
+
+#define BENCH_PIPELINES_COST        0.004   // Seconds to create a pipeline.
+#define BENCH_PIPELINES_VARIANTS    64
+#define BENCH_PIPELINES_THREADS     4       // Asking at once.
+#define BENCH_PIPELINES_LIBRARY     256
+
+typedef struct BenchPipelines {
+    std::mutex          mutex;
+    char                library[BENCH_PIPELINES_LIBRARY][PIPELINES_NAME];
+    int                 library_count;
+    std::atomic<int>    created;
+    std::atomic<int>    live;
+} BenchPipelines;
+
+// Pipelines without a pixel shader do not create.  Ones in the library load
+// ten times as fast as they create.
+static void *bench_pipelines_create(void *ctx, PipelineDesc const *desc, char const *name, bool *loaded)
+{
+    BenchPipelines *bp = (BenchPipelines *)ctx;
+    if (desc->ps_size == 0)
+        return NULL;
+
+    bool found = false;
+    {
+        std::unique_lock<std::mutex> lock(bp->mutex);
+        for (int i = 0; i < bp->library_count && !found; i++)
+            found = !strcmp(bp->library[i], name);
+    }
+
+    *loaded = found;
+    std::this_thread::sleep_for(std::chrono::duration<double>(BENCH_PIPELINES_COST / ((found) ? 10 : 1)));
+
+    if (!found) {
+        std::unique_lock<std::mutex> lock(bp->mutex);
+        ASSERT(bp->library_count < BENCH_PIPELINES_LIBRARY);
+        strcpy(bp->library[bp->library_count++], name);
+    }
+
+    PipelineKey *pipeline = (PipelineKey *)malloc(sizeof(PipelineKey));
+    ASSERT(pipeline);
+    *pipeline = pipelines_key(desc);
+    bp->created++;
+    bp->live++;
+    return pipeline;
+}
+
+static void bench_pipelines_release(void *ctx, void *pipeline)
+{
+    BenchPipelines *bp = (BenchPipelines *)ctx;
+    bp->live--;
+    free(pipeline);
+}
+
+static uint8_t bench_pipelines_vs[4096];
+static uint8_t bench_pipelines_ps[2048];
+
+// A desc shaped like the one hello.cpp draws with, made into variant `v`
+// by its blending, culling and target format.
+static void bench_pipelines_desc(PipelineDesc *desc, int v)
+{
+    static char const *const semantics[] = {
+        "POSITION", "TEXCOORD", "COLOR",
+        "INSTANCE_TRANSFORM", "INSTANCE_OFFSET", "INSTANCE_UV", "INSTANCE_COLOR",
+    };
+
+    memset(desc, 0, sizeof(*desc));
+    desc->signature = NULL;
+    desc->signature_key = 0x5157a7e5;
+    desc->vs = bench_pipelines_vs;
+    desc->vs_size = sizeof(bench_pipelines_vs);
+    desc->ps = bench_pipelines_ps;
+    desc->ps_size = sizeof(bench_pipelines_ps);
+
+    desc->input_count = 7;
+    for (int i = 0; i < desc->input_count; i++) {
+        PipelineInput *input = &desc->inputs[i];
+        input->semantic = semantics[i];
+        input->format = (i < 3) ? 35 : 2;
+        input->slot = (i < 3) ? 0 : 1;
+        input->offset = 8 * (uint32_t)(i % 3);
+        input->step = (i < 3) ? 0 : 1;
+    }
+
+    desc->fill = 3;
+    desc->cull = 1 + (uint32_t)(v % 3);
+    desc->topology = 3;
+    desc->samples = 1;
+    desc->target_count = 1;
+    desc->formats[0] = ((v / 3) % 2) ? 29 : 28;
+    desc->blend[0] = {(uint32_t)(v / 6) % 2, 5, 6, 1, 5, 6, 1, 15};
+    desc->blend[0].op = 1 + (uint32_t)(v / 12);
+}
+
+typedef struct BenchPipelinesAsk {
+    Pipelines       *p;
+    PipelineEntry   *entries[BENCH_PIPELINES_THREADS][BENCH_PIPELINES_VARIANTS];
+} BenchPipelinesAsk;
+
+// Every thread asks for every variant twice, starting from a different one.
+static void bench_pipelines_ask(BenchPipelinesAsk *ask, int thread)
+{
+    for (int n = 0; n < 2 * BENCH_PIPELINES_VARIANTS; n++) {
+        int v = (n + thread * 17) % BENCH_PIPELINES_VARIANTS;
+        PipelineDesc desc;
+        bench_pipelines_desc(&desc, v);
+
+        PipelineEntry *entry = pipelines_request(ask->p, &desc);
+
+        ASSERT(n < BENCH_PIPELINES_VARIANTS || ask->entries[thread][v] == entry);
+        ask->entries[thread][v] = entry;
+    }
+}
+
+// Asks for the variants from several threads at once, and waits for them.
+// Returns the seconds it all took.
+static double bench_pipelines_run(BenchPipelines *bp, int workers, bool report)
+{
+    Pipelines p;
+    PipelineCreator creator = {bp, bench_pipelines_create, bench_pipelines_release};
+    pipelines_init(&p, creator, workers);
+
+    BenchPipelinesAsk ask;
+    ask.p = &p;
+
+    double t = seconds();
+    std::thread threads[BENCH_PIPELINES_THREADS];
+    for (int i = 0; i < BENCH_PIPELINES_THREADS; i++)
+        threads[i] = std::thread(bench_pipelines_ask, &ask, i);
+    for (int i = 0; i < BENCH_PIPELINES_THREADS; i++)
+        threads[i].join();
+    double asked = seconds() - t;
+
+    for (int v = 0; v < BENCH_PIPELINES_VARIANTS; v++) {
+        PipelineKey *pipeline = (PipelineKey *)pipelines_wait(&p, ask.entries[0][v]);
+        ASSERT(pipeline);
+
+        PipelineDesc desc;
+        bench_pipelines_desc(&desc, v);
+        ASSERT(pipelines_key_equal(*pipeline, pipelines_key(&desc)));
+        for (int i = 1; i < BENCH_PIPELINES_THREADS; i++)
+            ASSERT(ask.entries[i][v] == ask.entries[0][v]);
+    }
+    t = seconds() - t;
+
+    PipelineStats stats = pipelines_stats(&p);
+    ASSERT(stats.created == BENCH_PIPELINES_VARIANTS && stats.failed == 0);
+    ASSERT(stats.requests == 2 * BENCH_PIPELINES_THREADS * BENCH_PIPELINES_VARIANTS);
+    ASSERT(stats.hits + stats.joined + stats.created == stats.requests);
+    ASSERT(asked < BENCH_PIPELINES_COST * BENCH_PIPELINES_VARIANTS / 4);
+
+    if (report) {
+        printf("  %d workers: %d requests, %d created (%d loaded, %d by waiting threads), %d joined, %d hits\n",
+               workers, stats.requests, stats.created, stats.loaded, stats.helped, stats.joined, stats.hits);
+        printf("    %.1f ms to ask, %.1f us per request, %.1f ms until all were ready\n",
+               1000.0 * asked, 1e6 * asked / stats.requests, 1000.0 * t);
+    }
+
+    int loaded = stats.loaded;
+    pipelines_shutdown(&p);
+    ASSERT(bp->live == 0);
+    return (report) ? t : (double)loaded;
+}
+
+static void bench_pipelines(void)
+{
+    printf("pipelines: %d variants, %.0f ms to create each, asked for by %d threads\n",
+           BENCH_PIPELINES_VARIANTS, 1000.0 * BENCH_PIPELINES_COST, BENCH_PIPELINES_THREADS);
+
+    for (int i = 0; i < (int)sizeof(bench_pipelines_vs); i++)
+        bench_pipelines_vs[i] = (uint8_t)(i * 31 + 7);
+    for (int i = 0; i < (int)sizeof(bench_pipelines_ps); i++)
+        bench_pipelines_ps[i] = (uint8_t)(i * 17 + 3);
+
+    // Keys go by what is in a desc, not where it is.
+    {
+        PipelineDesc a, b;
+        bench_pipelines_desc(&a, 5);
+        bench_pipelines_desc(&b, 5);
+
+        static uint8_t vs[sizeof(bench_pipelines_vs)];
+        char semantic[] = "POSITION";
+        memcpy(vs, bench_pipelines_vs, sizeof(vs));
+        b.vs = vs;
+        b.inputs[0].semantic = semantic;
+        b.signature = &b;
+        b.inputs[10].format = 99;           // Beyond the counts.
+        b.blend[3].enable = 1;
+        b.formats[5] = 7;
+        ASSERT(pipelines_key_equal(pipelines_key(&a), pipelines_key(&b)));
+
+        // Every field counts.
+        PipelineKey key = pipelines_key(&a);
+        int changes = 0;
+        for (int field = 0; field < 12; field++) {
+            b = a;
+            switch (field) {
+            case 0: b.signature_key++; break;
+            case 1: b.vs_size--; break;
+            case 2: vs[100] ^= 1; b.vs = vs; break;
+            case 3: semantic[0] = 'Q'; b.inputs[0].semantic = semantic; break;
+            case 4: b.inputs[6].step = 2; break;
+            case 5: b.input_count--; break;
+            case 6: b.cull++; break;
+            case 7: b.depth = 1; break;
+            case 8: b.formats[0]++; break;
+            case 9: b.blend[0].write_mask = 7; break;
+            case 10: b.target_count = 2; break;
+            case 11: b.samples = 4; break;
+            }
+            changes += !pipelines_key_equal(key, pipelines_key(&b));
+        }
+        ASSERT(changes == 12);
+
+        int variants = 0;
+        for (int v = 0; v < BENCH_PIPELINES_VARIANTS; v++) {
+            bench_pipelines_desc(&b, v);
+            PipelineKey k = pipelines_key(&b);
+            bool unique = true;
+            for (int w = 0; w < v; w++) {
+                bench_pipelines_desc(&a, w);
+                unique = unique && !pipelines_key_equal(k, pipelines_key(&a));
+            }
+            variants += unique;
+        }
+        ASSERT(variants == BENCH_PIPELINES_VARIANTS);
+
+        int count = 100000;
+        double t = seconds();
+        uint64_t sum = 0;
+        for (int i = 0; i < count; i++)
+            sum += pipelines_key(&a).lo;
+        t = seconds() - t;
+        printf("  keys: the same wherever a desc is, different for every field, %.0f ns each (%llx)\n",
+               1e9 * t / count, (unsigned long long)(sum & 0xf));
+    }
+
+    // What does not create is reported, once, and asked about again quickly.
+    {
+        BenchPipelines bp;
+        bp.library_count = 0;
+        bp.created = 0;
+        bp.live = 0;
+
+        Pipelines p;
+        PipelineCreator creator = {&bp, bench_pipelines_create, bench_pipelines_release};
+        pipelines_init(&p, creator, 1);
+        PipelineDesc desc;
+        bench_pipelines_desc(&desc, 0);
+        desc.ps_size = 0;
+        PipelineEntry *entry = pipelines_request(&p, &desc);
+        ASSERT(!pipelines_wait(&p, entry) && !pipelines_get(entry));
+        ASSERT(pipelines_request(&p, &desc) == entry);
+        PipelineStats stats = pipelines_stats(&p);
+        ASSERT(stats.failed == 1 && stats.hits == 1);
+        pipelines_shutdown(&p);
+    }
+
+    // Serially, then in parallel, then loaded from the library the last run
+    // left behind.
+    BenchPipelines *bp = new BenchPipelines;
+    double serial = 0.0;
+    for (int workers = 1; workers <= 4; workers *= 2) {
+        bp->library_count = 0;
+        bp->created = 0;
+        bp->live = 0;
+        double t = bench_pipelines_run(bp, workers, true);
+        serial = (workers == 1) ? t : serial;
+        ASSERT(bp->created == BENCH_PIPELINES_VARIANTS);
+    }
+
+    bp->created = 0;
+    int loaded = (int)bench_pipelines_run(bp, 4, false);
+    ASSERT(loaded == BENCH_PIPELINES_VARIANTS && bp->created == BENCH_PIPELINES_VARIANTS);
+    double t = bench_pipelines_run(bp, 4, true);
+    printf("  from the library: %.1f times as fast as creating them on one worker\n", serial / t);
+    delete bp;
+}
+
+
+
+// Indirect Draws
+// A million objects strewn at random, culled against the screen of the 2D
+// scene and against a 3D frustum, one at a time and with SIMD: both have to
+// leave exactly the same objects, in the same order.  Then the instances of
+// the grid are grouped into objects, and culled at a few points of the
+// animation: no instance vs() would put on screen may be left out, and the
+// commands written are weighed against the instances batch_pack() writes.
+
+static void bench_indirect_random(void)
+{
+    int const count = 1000000;
+    int const rounds = 20;
+
+    IndirectScene scene;
+    indirect_init(&scene);
+    uint32_t state = 7;
+    for (int i = 0; i < count; i++) {
+        float x = (float)bench_random(&state) / 16777216.0f * 8.0f - 4.0f;
+        float y = (float)bench_random(&state) / 16777216.0f * 8.0f - 4.0f;
+        float z = (float)bench_random(&state) / 16777216.0f * 120.0f - 10.0f;
+        float r = (float)bench_random(&state) / 16777216.0f * 0.05f;
+        indirect_add(&scene, x, y, z, r, (uint32_t)i, 1);
+    }
+
+    Pool pool;
+    pool_init(&pool, 0);
+
+    printf("indirect: %d objects, %d-wide SIMD, %d thread(s)\n", count, BATCH_LANES, pool.thread_count);
+
+    IndirectView views[2];
+    float consts[4] = {1280.0f, 720.0f, 720.0f / 1280.0f, 1.57f};
+    indirect_view_2d(consts, &views[0]);
+    indirect_view_frustum(1.0f, 1280.0f / 720.0f, 0.1f, 100.0f, &views[1]);
+    char const *names[2] = {"screen", "frustum"};
+
+    int *scalar = (int *)malloc(count * sizeof(int));
+    ASSERT(scalar);
+
+    for (int v = 0; v < 2; v++) {
+        int scalar_count = 0;
+        double t0 = seconds();
+        for (int round = 0; round < rounds; round++) {
+            scalar_count = 0;
+            for (int i = 0; i < count; i++) {
+                if (indirect_visible(&views[v], scene.fields[INDIRECT_X][i], scene.fields[INDIRECT_Y][i],
+                                     scene.fields[INDIRECT_Z][i], scene.fields[INDIRECT_RADIUS][i]))
+                    scalar[scalar_count++] = i;
+            }
+        }
+        double t1 = seconds();
+        for (int round = 0; round < rounds; round++)
+            indirect_cull(&scene, NULL, &views[v]);
+        double t2 = seconds();
+        for (int round = 0; round < rounds; round++)
+            indirect_cull(&scene, &pool, &views[v]);
+        double t3 = seconds();
+
+        ASSERT(scene.visible_count == scalar_count);
+        ASSERT(!memcmp(scene.visible, scalar, scalar_count * sizeof(int)));
+        ASSERT(scalar_count > 0 && scalar_count < count);
+
+        double total = (double)count * rounds;
+        printf("  %-7s: %6d left, %7.1f Mobjects/s plain, %7.1f Mobjects/s SIMD, %7.1f Mobjects/s pooled\n",
+               names[v], scalar_count,
+               total / (t1 - t0) / 1e6, total / (t2 - t1) / 1e6, total / (t3 - t2) / 1e6);
+    }
+
+    // Writing the commands for what is left.
+    IndirectCommand *commands = (IndirectCommand *)malloc(scene.visible_count * sizeof(IndirectCommand));
+    ASSERT(commands);
+    uint64_t constants[4] = {0x1000, 0x1100, 0x1200, 0x1300};
+    double t = seconds();
+    for (int round = 0; round < rounds; round++)
+        indirect_write(&scene, 3, constants, 4, commands);
+    t = seconds() - t;
+    for (int k = 0; k < scene.visible_count; k++) {
+        int i = scene.visible[k];
+        ASSERT(commands[k].constants == constants[i % 4]);
+        ASSERT(commands[k].index_count == 3 && commands[k].first_index == 0 && commands[k].base_vertex == 0);
+        ASSERT(commands[k].first_instance == (uint32_t)i && commands[k].instance_count == 1);
+    }
+    printf("  written: %.1f Mcommands/s\n", (double)scene.visible_count * rounds / t / 1e6);
+
+    free(commands);
+    free(scalar);
+    pool_shutdown(&pool);
+    indirect_free(&scene);
+}
+
+// Whether vs() puts a grouped instance on screen, with `margin` to spare,
+// in double precision.
+static bool bench_indirect_instance(BatchInstance const *instance, float mesh_radius,
+                                    float const consts[4], double margin)
+{
+    float view[4];
+    batch_view(consts, view);
+
+    float const *m = instance->transform;
+    double r = (double)mesh_radius * sqrt((double)m[0] * m[0] + (double)m[1] * m[1] +
+                                          (double)m[2] * m[2] + (double)m[3] * m[3]);
+    double x = instance->offset[0];
+    double y = instance->offset[1];
+
+    double cx = (double)view[0] * x + (double)view[1] * y;
+    double cy = (double)view[2] * x + (double)view[3] * y;
+    double rx = r * sqrt((double)view[0] * view[0] + (double)view[1] * view[1]);
+    double ry = r * sqrt((double)view[2] * view[2] + (double)view[3] * view[3]);
+
+    return fabs(cx) - rx < 1.0 - margin && fabs(cy) - ry < 1.0 - margin;
+}
+
+static void bench_indirect_grouped(void)
+{
+    int const count = 250000;
+
+    Batch batch;
+    batch_init(&batch, triangle, (int)(sizeof(triangle) / sizeof(*triangle)));
+    batch_grid(&batch, count);
+
+    IndirectScene scene;
+    indirect_init(&scene);
+    double t = seconds();
+    indirect_group(&scene, &batch);
+    t = seconds() - t;
+
+    // Every instance is in exactly one object, and inside its sphere.
+    ASSERT(scene.instance_count == count);
+    uint32_t next = 0;
+    for (int i = 0; i < scene.object_count; i++) {
+        ASSERT(scene.first[i] == next && scene.count[i] > 0 && scene.count[i] <= INDIRECT_GROUP);
+        next += scene.count[i];
+        for (uint32_t k = scene.first[i]; k < scene.first[i] + scene.count[i]; k++) {
+            BatchInstance const *instance = &scene.instances[k];
+            float const *m = instance->transform;
+            double r = (double)batch.mesh_radius * sqrt((double)m[0] * m[0] + (double)m[1] * m[1] +
+                                                        (double)m[2] * m[2] + (double)m[3] * m[3]);
+            double dx = instance->offset[0] - scene.fields[INDIRECT_X][i];
+            double dy = instance->offset[1] - scene.fields[INDIRECT_Y][i];
+            ASSERT(sqrt(dx * dx + dy * dy) + r <= scene.fields[INDIRECT_RADIUS][i]);
+        }
+    }
+    ASSERT(next == (uint32_t)count);
+    printf("  grouped: %d instances into %d objects in %.1f ms\n",
+           count, scene.object_count, 1e3 * t);
+
+    BatchInstance *packed = (BatchInstance *)malloc(count * sizeof(BatchInstance));
+    IndirectCommand *commands = (IndirectCommand *)malloc(scene.object_count * sizeof(IndirectCommand));
+    bool *drawn = (bool *)malloc(count * sizeof(bool));
+    ASSERT(packed && commands && drawn);
+    uint64_t constants[1] = {0};
+
+    float const uptimes[] = {0.0f, 1.57f, 3.14f};
+    for (int u = 0; u < 3; u++) {
+        float consts[4] = {1280.0f, 720.0f, 720.0f / 1280.0f, uptimes[u]};
+        IndirectView view;
+        indirect_view_2d(consts, &view);
+
+        double t0 = seconds();
+        int visible = indirect_cull(&scene, NULL, &view);
+        indirect_write(&scene, 3, constants, 1, commands);
+        double t1 = seconds();
+        int packed_count = batch_pack(&batch, NULL, consts, packed);
+        double t2 = seconds();
+
+        // Culled by object, nothing on screen may be missing.
+        memset(drawn, 0, count * sizeof(bool));
+        int instances = 0;
+        for (int k = 0; k < visible; k++) {
+            for (uint32_t i = 0; i < commands[k].instance_count; i++)
+                drawn[commands[k].first_instance + i] = true;
+            instances += commands[k].instance_count;
+        }
+        for (int i = 0; i < count; i++)
+            ASSERT(drawn[i] || !bench_indirect_instance(&scene.instances[i], batch.mesh_radius, consts, -1e-4));
+        ASSERT(instances >= packed_count);
+
+        printf("  uptime %.2f: %5d objects, %6d instances drawn for %6d on screen, "
+               "%7.1f KB in %.2f ms against %7.1f KB in %.2f ms packed\n",
+               uptimes[u], visible, instances, packed_count,
+               visible * sizeof(IndirectCommand) / 1024.0, 1e3 * (t1 - t0),
+               packed_count * sizeof(BatchInstance) / 1024.0, 1e3 * (t2 - t1));
+    }
+
+    free(drawn);
+    free(commands);
+    free(packed);
+    indirect_free(&scene);
+    batch_free(&batch);
+}
+
+static void bench_indirect(void)
+{
+    bench_indirect_random();
+    bench_indirect_grouped();
+}
+
+
+
+// Dynamic Resolution
+// A GPU made up for the controller: a frame takes a fixed part, plus a part
+// proportional to the area drawn times how heavy the scene is, give or take
+// some noise, and the time comes back two frames late.  Scenes that come
+// and go, that cannot be drawn in time at any scale, that hover around the
+// budget, and that hitch now and then, each checked for what the controller
+// should make of them, and compared with drawing at the full size.
+
+#define BENCH_RESOLUTION_FRAMES 1200
+#define BENCH_RESOLUTION_DELAY  2
+
+typedef struct BenchResolutionRun {
+    float       scales[BENCH_RESOLUTION_FRAMES];
+    double      times[BENCH_RESOLUTION_FRAMES];
+    int         over;           // Frames over budget.
+    int         fixed_over;     // The same, at the full size.
+    double      mean_scale;
+    ResolutionStats stats;
+} BenchResolutionRun;
+
+// `load[i]` is how long frame i would take at the full size, in budgets.
+static void bench_resolution_run(char const *name, double const *load, double noise, BenchResolutionRun *run)
+{
+    double const budget = 1.0 / 60.0;
+    double const fixed = 0.1 * budget;
+
+    ResolutionConfig config = resolution_config(budget);
+    Resolution r;
+    resolution_init(&r, &config);
+
+    uint32_t state = 11;
+    double pending[BENCH_RESOLUTION_DELAY];
+    int pending_count = 0;
+    float scale = r.scale;
+
+    run->over = 0;
+    run->fixed_over = 0;
+    run->mean_scale = 0.0;
+    for (int i = 0; i < BENCH_RESOLUTION_FRAMES; i++) {
+        double jitter = 1.0 + noise * ((double)bench_random(&state) / 16777216.0 * 2.0 - 1.0);
+        double full = load[i] * budget;
+        double t = (fixed + (full - fixed) * scale * scale) * jitter;
+
+        run->scales[i] = scale;
+        run->times[i] = t;
+        run->over += (t > budget) ? 1 : 0;
+        run->fixed_over += (full * jitter > budget) ? 1 : 0;
+        run->mean_scale += scale;
+
+        // The slot comes around again before its time can be read.
+        if (pending_count == BENCH_RESOLUTION_DELAY) {
+            scale = resolution_update(&r, pending[0]);
+            memmove(pending, pending + 1, (BENCH_RESOLUTION_DELAY - 1) * sizeof(double));
+            pending_count--;
+        }
+        pending[pending_count++] = t;
+    }
+    run->mean_scale /= BENCH_RESOLUTION_FRAMES;
+    run->stats = resolution_stats(&r);
+
+    printf("  %-10s %4d over budget (%4d at full size), scale %.2f on average, %.2f to %.2f, %3d changes\n",
+           name, run->over, run->fixed_over, run->mean_scale, run->stats.lowest, run->stats.highest,
+           run->stats.changes);
+}
+
+// Frames from `first` on, up to `end`, that are over budget.
+static int bench_resolution_over(BenchResolutionRun const *run, int first, int end)
+{
+    int over = 0;
+    for (int i = first; i < end; i++)
+        over += (run->times[i] > 1.0 / 60.0) ? 1 : 0;
+    return over;
+}
+
+static void bench_resolution(void)
+{
+    static double load[BENCH_RESOLUTION_FRAMES];
+    static BenchResolutionRun run;
+
+    printf("resolution: %d frames at a 16.7 ms budget, times %d frames late\n",
+           BENCH_RESOLUTION_FRAMES, BENCH_RESOLUTION_DELAY);
+
+    // Light enough to draw at the full size: left there, untouched.
+    for (int i = 0; i < BENCH_RESOLUTION_FRAMES; i++)
+        load[i] = 0.6;
+    bench_resolution_run("light", load, 0.02, &run);
+    ASSERT(run.stats.changes == 0 && run.over == 0 && run.mean_scale == 1.0);
+
+    // Twice as heavy for a while: within half a second the frames are back
+    // under budget, at about 1/sqrt(2) of the size, and then stay there;
+    // once it is light again, the full size comes back.
+    for (int i = 0; i < BENCH_RESOLUTION_FRAMES; i++)
+        load[i] = (i >= 300 && i < 800) ? 1.8 : 0.6;
+    bench_resolution_run("step", load, 0.02, &run);
+    ASSERT(bench_resolution_over(&run, 330, 800) == 0);
+    ASSERT(run.scales[790] > 0.6f && run.scales[790] < 0.8f);
+    ASSERT(run.scales[BENCH_RESOLUTION_FRAMES - 1] == 1.0f);
+    ASSERT(run.over < run.fixed_over / 10);
+
+    // Too heavy to draw in time at any scale: the smallest, and nothing
+    // wound up, so it comes back as soon as the scene does.
+    for (int i = 0; i < BENCH_RESOLUTION_FRAMES; i++)
+        load[i] = (i >= 300 && i < 800) ? 6.0 : 0.6;
+    bench_resolution_run("too heavy", load, 0.02, &run);
+    ASSERT(run.scales[799] == 0.5f);
+    ASSERT(run.scales[900] == 1.0f);
+
+    // Just over the budget, noisily: settles below it, and then holds.
+    for (int i = 0; i < BENCH_RESOLUTION_FRAMES; i++)
+        load[i] = 1.15;
+    bench_resolution_run("hovering", load, 0.04, &run);
+    ASSERT(bench_resolution_over(&run, 60, BENCH_RESOLUTION_FRAMES) == 0);
+    ASSERT(run.stats.changes <= 8);
+    ASSERT(run.scales[BENCH_RESOLUTION_FRAMES - 1] >= 0.8f);
+
+    // Light, with a frame four times as slow every so often: those frames
+    // are missed whatever the scale, so it is left as it is.
+    for (int i = 0; i < BENCH_RESOLUTION_FRAMES; i++)
+        load[i] = (i % 97 == 50) ? 3.0 : 0.8;
+    bench_resolution_run("hitches", load, 0.02, &run);
+    ASSERT(run.stats.changes == 0);
+
+    // A scene that gets heavier and lighter, slowly, around the budget.
+    for (int i = 0; i < BENCH_RESOLUTION_FRAMES; i++)
+        load[i] = 1.2 + 0.6 * sin((double)i * 2.0 * BATCH_PI / 600.0);
+    bench_resolution_run("waves", load, 0.03, &run);
+    ASSERT(run.over < run.fixed_over / 10);
+}
+
+
+
+// All of Them
+
+static struct {
+    char const  *name;
+    void        (*run)(void);
+} benches[] = {
+    {"frames",  bench_frames},
+    {"upload",  bench_upload},
+    {"transfer", bench_transfer},
+    {"texture", bench_texture},
+    {"bcn",     bench_bcn},
+    {"cache",   bench_cache},
+    {"tasks",   bench_tasks},
+    {"profile", bench_profile},
+    {"batch",   bench_batch},
+    {"descriptors", bench_descriptors},
+    {"barriers", bench_barriers},
+    {"jobs",    bench_jobs},
+    {"events",  bench_events},
+    {"pacing",  bench_pacing},
+    {"heaps",   bench_heaps},
+    {"constants", bench_constants},
+    {"vertices", bench_vertices},
+    {"pack",    bench_pack},
+    {"mesh",    bench_mesh},
+    {"capture", bench_capture},
+    {"reload",  bench_reload},
+    {"pipelines", bench_pipelines},
+    {"indirect", bench_indirect},
+    {"resolution", bench_resolution},
+};
+
+int main(int argc, char **argv)
+{
+    int count = (int)(sizeof(benches) / sizeof(*benches));
+
+    for (int i = 1; i < argc; i++) {
+        bool found = false;
+        for (int k = 0; k < count; k++)
+            found = found || !strcmp(argv[i], benches[k].name);
+
+        if (!found) {
+            fprintf(stderr, "unknown benchmark: %s\navailable:", argv[i]);
+            for (int k = 0; k < count; k++)
+                fprintf(stderr, " %s", benches[k].name);
+            fprintf(stderr, "\n");
+            return 1;
+        }
+    }
+
+    for (int k = 0; k < count; k++) {
+        bool run = (argc == 1);
+        for (int i = 1; i < argc; i++)
+            run = run || !strcmp(argv[i], benches[k].name);
+
+        if (run) {
+            benches[k].run();
+            printf("\n");
+        }
+    }
+
+    return 0;
+}
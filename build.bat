@@ -1,6 +1,10 @@
 @echo off
 
-cl /nologo /Zi /W3 hello.cpp
+cl /nologo /Zi /W3 /O2 /EHsc /arch:AVX2 hello.cpp
+cl /nologo /Zi /W3 /O2 /EHsc /arch:AVX2 soft.cpp
+cl /nologo /Zi /W3 /O2 /EHsc /arch:AVX2 bench.cpp
+cl /nologo /Zi /W3 /O2 /EHsc /arch:AVX2 packer.cpp
+cl /nologo /Zi /W3 /O2 /EHsc /arch:AVX2 replay.cpp
 
 doskey clean=del *.exe *.obj *.pdb *.ilk
 
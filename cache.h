@@ -0,0 +1,570 @@
+// A cache of compiled shaders on disk.
+//
+// Compiling HLSL takes long enough to be felt at startup, so the bytecode is
+// kept in a file from one run to the next.  Every shader is found by a key:
+// a 128-bit hash of everything the compiler would see, that is the source,
+// the text of every file it includes, the defines, the entry point, the
+// profile and the flags.  Change any of those and the key changes with it,
+// so nothing ever has to be invalidated by hand.
+//
+// The file is a header followed by records appended one after the other.
+// It is memory mapped when the cache is opened, and the bytecode of a hit is
+// handed out straight from the mapping.  New records are appended to the file
+// as they are compiled.
+//
+// The header names the version of the file format and of the compiler; if
+// either differs, the file is started over.  Every record carries a checksum,
+// and the first one that does not match ends the file as far as the cache is
+// concerned: whatever was written after it is overwritten by the next record.
+//
+// The compiler is a callback, so that the cache can be tried out with a
+// stand-in where there is no D3DCompile().
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#ifndef ASSERT
+#define ASSERT(expr)    assert(expr)
+#endif
+
+
+
+#define CACHE_MAGIC             0x43444853u     // "SHDC"
+#define CACHE_VERSION           1
+#define CACHE_MAX_INCLUDE_DEPTH 8
+
+
+
+// Hashing
+// Two 64-bit FNV-1a lanes with different seeds, each finished with an
+// avalanche, make up a key.  Nothing here has to stand up to an attacker.
+
+typedef struct CacheKey {
+    uint64_t    lo;
+    uint64_t    hi;
+} CacheKey;
+
+static void cache_hash(CacheKey *h, void const *data, size_t size)
+{
+    uint8_t const *bytes = (uint8_t const *)data;
+    uint64_t lo = h->lo;
+    uint64_t hi = h->hi;
+    for (size_t i = 0; i < size; i++) {
+        lo = (lo ^ bytes[i]) * 0x100000001b3ull;
+        hi = (hi ^ bytes[i]) * 0x00000100000001b3ull + 0x9e3779b97f4a7c15ull;
+    }
+    h->lo = lo;
+    h->hi = hi;
+}
+
+// Strings are hashed along with their length, so that "ab" followed by "c"
+// does not hash the same as "a" followed by "bc".
+static void cache_hash_string(CacheKey *h, char const *string, size_t size)
+{
+    uint64_t length = size;
+    cache_hash(h, &length, sizeof(length));
+    cache_hash(h, string, size);
+}
+
+static uint64_t cache_mix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+static CacheKey cache_hash_begin(void)
+{
+    CacheKey h = {0xcbf29ce484222325ull, 0x84222325cbf29ce4ull};
+    return h;
+}
+
+static CacheKey cache_hash_end(CacheKey h)
+{
+    CacheKey key = {cache_mix(h.lo ^ h.hi), cache_mix(h.hi + 0x9e3779b97f4a7c15ull)};
+    if (key.lo == 0 && key.hi == 0)
+        key.lo = 1;     // {0, 0} marks an empty slot.
+    return key;
+}
+
+static uint64_t cache_checksum(void const *data, size_t size)
+{
+    CacheKey h = cache_hash_begin();
+    cache_hash(&h, data, size);
+    return cache_hash_end(h).lo;
+}
+
+
+
+// Requests
+
+typedef struct CacheDefine {
+    char const  *name;
+    char const  *value;
+} CacheDefine;
+
+typedef struct CacheRequest {
+    char const          *path;      // What includes are found relative to.
+    char const          *source;
+    size_t              source_size;
+    CacheDefine const   *defines;
+    int                 define_count;
+    char const          *entry;
+    char const          *profile;
+    uint32_t            flags;
+} CacheRequest;
+
+typedef struct CacheCompiler {
+    void    *ctx;
+
+    // Returns the bytecode in memory from malloc(), or NULL if the source
+    // does not compile.  Reporting why is up to the compiler.
+    void    *(*compile)(void *ctx, CacheRequest const *request, size_t *size);
+
+    // Returns the contents of a file from malloc(), or NULL if there is no
+    // such file.  NULL reads it with stdio.
+    char    *(*read)(void *ctx, char const *path, size_t *size);
+} CacheCompiler;
+
+static char *cache_read_file(void *ctx, char const *path, size_t *size)
+{
+    (void)ctx;
+
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return NULL;
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *data = (char *)malloc((length > 0) ? (size_t)length : 1);
+    if (data && fread(data, 1, (size_t)length, file) != (size_t)length) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+
+    *size = (size_t)length;
+    return data;
+}
+
+// Hashes the text of every file included with #include "name", found next
+// to the file that includes it.  Includes that cannot be read are hashed by
+// name alone, and left for the compiler to complain about.
+static void cache_hash_includes(CacheKey *h, CacheCompiler const *compiler,
+                                char const *path, char const *source, size_t size, int depth)
+{
+    if (depth >= CACHE_MAX_INCLUDE_DEPTH)
+        return;
+
+    // The directory of `path`, with its separator.
+    size_t dir = 0;
+    for (size_t i = 0; path && path[i]; i++) {
+        if (path[i] == '/' || path[i] == '\\')
+            dir = i + 1;
+    }
+
+    size_t i = 0;
+    while (i < size) {
+        size_t line = i;
+        while (i < size && source[i] != '\n')
+            i++;
+        size_t end = i++;
+
+        size_t at = line;
+        while (at < end && (source[at] == ' ' || source[at] == '\t'))
+            at++;
+        if (end - at < 8 || memcmp(source + at, "#include", 8) != 0)
+            continue;
+
+        at += 8;
+        while (at < end && source[at] != '"')
+            at++;
+        size_t name = ++at;
+        while (at < end && source[at] != '"')
+            at++;
+        if (at >= end)
+            continue;
+
+        char included[512];
+        size_t length = dir + (at - name);
+        if (length >= sizeof(included))
+            continue;
+        memcpy(included, path, dir);
+        memcpy(included + dir, source + name, at - name);
+        included[length] = 0;
+
+        cache_hash_string(h, included, length);
+
+        size_t text_size = 0;
+        char *text = compiler->read ?
+            compiler->read(compiler->ctx, included, &text_size) :
+            cache_read_file(NULL, included, &text_size);
+        if (text) {
+            cache_hash_string(h, text, text_size);
+            cache_hash_includes(h, compiler, included, text, text_size, depth + 1);
+            free(text);
+        }
+    }
+}
+
+static CacheKey cache_key(CacheRequest const *request, CacheCompiler const *compiler)
+{
+    CacheKey h = cache_hash_begin();
+
+    cache_hash_string(&h, request->source, request->source_size);
+    cache_hash_includes(&h, compiler, request->path, request->source, request->source_size, 0);
+
+    for (int i = 0; i < request->define_count; i++) {
+        CacheDefine const *d = &request->defines[i];
+        cache_hash_string(&h, d->name, strlen(d->name));
+        cache_hash_string(&h, d->value ? d->value : "", d->value ? strlen(d->value) : 0);
+    }
+
+    cache_hash_string(&h, request->entry, strlen(request->entry));
+    cache_hash_string(&h, request->profile, strlen(request->profile));
+    cache_hash(&h, &request->flags, sizeof(request->flags));
+
+    return cache_hash_end(h);
+}
+
+
+
+// The File
+
+typedef struct CacheHeader {
+    uint32_t    magic;
+    uint32_t    version;
+    uint32_t    compiler;   // Whatever the caller uses to tell compilers apart.
+    uint32_t    reserved;
+    uint64_t    checksum;   // Of the fields above.
+} CacheHeader;
+
+// Followed by `size` bytes of bytecode, padded to a multiple of 8.
+typedef struct CacheRecord {
+    CacheKey    key;
+    uint64_t    size;
+    uint64_t    checksum;   // Of the key, the size and the bytecode.
+} CacheRecord;
+
+typedef struct CacheEntry {
+    CacheKey    key;        // {0, 0} for an empty slot.
+    void const  *code;
+    size_t      size;
+} CacheEntry;
+
+typedef struct CacheStats {
+    int         loaded;     // Records read from the file.
+    int         dropped;    // Bytes found past a bad record, 0 if none.
+    int         hits;
+    int         misses;
+    int         failures;   // Misses that did not compile.
+} CacheStats;
+
+typedef struct Cache {
+    char        path[512];
+    uint32_t    compiler;
+
+    // The file as it was when the cache was opened.
+#ifdef _WIN32
+    HANDLE      file;
+    HANDLE      mapping;
+#endif
+    uint8_t     *map;
+    size_t      map_size;
+
+    // Where the next record goes.
+    uint64_t    end;
+
+    // Open addressing, with a power of two of slots.
+    CacheEntry  *entries;
+    int         capacity;
+    int         count;
+
+    // Bytecode compiled this run, to free at the end.
+    void        **owned;
+    int         owned_count;
+    int         owned_capacity;
+
+    CacheStats  stats;
+} Cache;
+
+static uint64_t cache_header_checksum(CacheHeader const *header)
+{
+    return cache_checksum(header, offsetof(CacheHeader, checksum));
+}
+
+static uint64_t cache_record_checksum(CacheRecord const *record, void const *code)
+{
+    CacheKey h = cache_hash_begin();
+    cache_hash(&h, &record->key, sizeof(record->key));
+    cache_hash(&h, &record->size, sizeof(record->size));
+    cache_hash(&h, code, (size_t)record->size);
+    return cache_hash_end(h).lo;
+}
+
+static void cache_insert(Cache *cache, CacheKey key, void const *code, size_t size)
+{
+    if (2 * (cache->count + 1) > cache->capacity) {
+        int capacity = (cache->capacity > 0) ? 2 * cache->capacity : 64;
+        CacheEntry *entries = (CacheEntry *)calloc(capacity, sizeof(CacheEntry));
+        ASSERT(entries);
+
+        for (int i = 0; i < cache->capacity; i++) {
+            CacheEntry const *e = &cache->entries[i];
+            if (e->key.lo == 0 && e->key.hi == 0)
+                continue;
+            int slot = (int)(e->key.lo & (capacity - 1));
+            while (entries[slot].key.lo != 0 || entries[slot].key.hi != 0)
+                slot = (slot + 1) & (capacity - 1);
+            entries[slot] = *e;
+        }
+
+        free(cache->entries);
+        cache->entries = entries;
+        cache->capacity = capacity;
+    }
+
+    int slot = (int)(key.lo & (cache->capacity - 1));
+    while (cache->entries[slot].key.lo != 0 || cache->entries[slot].key.hi != 0) {
+        if (cache->entries[slot].key.lo == key.lo && cache->entries[slot].key.hi == key.hi)
+            break;
+        slot = (slot + 1) & (cache->capacity - 1);
+    }
+
+    if (cache->entries[slot].key.lo == 0 && cache->entries[slot].key.hi == 0)
+        cache->count++;
+    cache->entries[slot].key = key;
+    cache->entries[slot].code = code;
+    cache->entries[slot].size = size;
+}
+
+static CacheEntry const *cache_find(Cache const *cache, CacheKey key)
+{
+    if (cache->capacity == 0)
+        return NULL;
+
+    int slot = (int)(key.lo & (cache->capacity - 1));
+    while (cache->entries[slot].key.lo != 0 || cache->entries[slot].key.hi != 0) {
+        if (cache->entries[slot].key.lo == key.lo && cache->entries[slot].key.hi == key.hi)
+            return &cache->entries[slot];
+        slot = (slot + 1) & (cache->capacity - 1);
+    }
+    return NULL;
+}
+
+static bool cache_map(Cache *cache)
+{
+#ifdef _WIN32
+    cache->file = CreateFileA(cache->path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                              NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (cache->file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(cache->file, &size) || size.QuadPart == 0) {
+        CloseHandle(cache->file);
+        return false;
+    }
+
+    cache->mapping = CreateFileMappingA(cache->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!cache->mapping) {
+        CloseHandle(cache->file);
+        return false;
+    }
+
+    cache->map = (uint8_t *)MapViewOfFile(cache->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!cache->map) {
+        CloseHandle(cache->mapping);
+        CloseHandle(cache->file);
+        return false;
+    }
+    cache->map_size = (size_t)size.QuadPart;
+#else
+    int fd = open(cache->path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    cache->map = (uint8_t *)map;
+    cache->map_size = (size_t)st.st_size;
+#endif
+    return true;
+}
+
+static void cache_unmap(Cache *cache)
+{
+    if (!cache->map)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(cache->map);
+    CloseHandle(cache->mapping);
+    CloseHandle(cache->file);
+#else
+    munmap(cache->map, cache->map_size);
+#endif
+    cache->map = NULL;
+    cache->map_size = 0;
+}
+
+// Starts the file over with nothing but a header.
+static void cache_reset(Cache *cache)
+{
+    CacheHeader header = {CACHE_MAGIC, CACHE_VERSION, cache->compiler, 0, 0};
+    header.checksum = cache_header_checksum(&header);
+
+    FILE *file = fopen(cache->path, "wb");
+    if (file) {
+        fwrite(&header, sizeof(header), 1, file);
+        fclose(file);
+    }
+    cache->end = sizeof(header);
+}
+
+// Opens the cache kept in the file at `path`, creating it if need be.
+// `compiler` is a version number: a file written by another compiler is
+// started over.  Never fails; without a usable file, shaders are compiled
+// every time.
+static void cache_open(Cache *cache, char const *path, uint32_t compiler)
+{
+    memset(cache, 0, sizeof(*cache));
+    ASSERT(strlen(path) < sizeof(cache->path));
+    strcpy(cache->path, path);
+    cache->compiler = compiler;
+
+    if (!cache_map(cache)) {
+        cache_reset(cache);
+        return;
+    }
+
+    CacheHeader header;
+    bool valid = cache->map_size >= sizeof(header);
+    if (valid) {
+        memcpy(&header, cache->map, sizeof(header));
+        valid = header.magic == CACHE_MAGIC && header.version == CACHE_VERSION &&
+            header.compiler == compiler && header.checksum == cache_header_checksum(&header);
+    }
+    if (!valid) {
+        cache_unmap(cache);
+        cache_reset(cache);
+        return;
+    }
+
+    uint64_t at = sizeof(header);
+    while (at + sizeof(CacheRecord) <= cache->map_size) {
+        CacheRecord record;
+        memcpy(&record, cache->map + at, sizeof(record));
+
+        uint64_t padded = (record.size + 7) & ~(uint64_t)7;
+        if (record.size == 0 || padded > cache->map_size - at - sizeof(record))
+            break;
+
+        void const *code = cache->map + at + sizeof(record);
+        if (record.checksum != cache_record_checksum(&record, code))
+            break;
+
+        cache_insert(cache, record.key, code, (size_t)record.size);
+        cache->stats.loaded++;
+        at += sizeof(record) + padded;
+    }
+
+    cache->end = at;
+    cache->stats.dropped = (int)(cache->map_size - at);
+}
+
+static void cache_close(Cache *cache)
+{
+    for (int i = 0; i < cache->owned_count; i++)
+        free(cache->owned[i]);
+    free(cache->owned);
+    free(cache->entries);
+    cache_unmap(cache);
+    memset(cache, 0, sizeof(*cache));
+}
+
+// Adds bytecode from malloc() to the cache, which takes it over, and writes
+// it to the file.
+static void cache_put(Cache *cache, CacheKey key, void *code, size_t size)
+{
+    if (cache->owned_count == cache->owned_capacity) {
+        cache->owned_capacity = (cache->owned_capacity > 0) ? 2 * cache->owned_capacity : 16;
+        cache->owned = (void **)realloc(cache->owned, cache->owned_capacity * sizeof(void *));
+        ASSERT(cache->owned);
+    }
+    cache->owned[cache->owned_count++] = code;
+    cache_insert(cache, key, code, size);
+
+    CacheRecord record = {key, size, 0};
+    record.checksum = cache_record_checksum(&record, code);
+
+    static uint8_t const zeros[8] = {0};
+    size_t padding = (size_t)(((size + 7) & ~(size_t)7) - size);
+
+    // Written where the last good record ended, over anything found bad.
+    FILE *file = fopen(cache->path, "r+b");
+    if (!file)
+        return;
+    if (fseek(file, (long)cache->end, SEEK_SET) == 0 &&
+        fwrite(&record, sizeof(record), 1, file) == 1 &&
+        fwrite(code, 1, size, file) == size &&
+        fwrite(zeros, 1, padding, file) == padding) {
+        cache->end += sizeof(record) + size + padding;
+    }
+    fclose(file);
+}
+
+// The bytecode for a request: from the cache if it is there, otherwise from
+// the compiler, and then added to the cache.  Returns NULL if it does not
+// compile.  The bytecode stays valid until the cache is closed.
+static void const *cache_compile(Cache *cache, CacheRequest const *request,
+                                 CacheCompiler const *compiler, size_t *size)
+{
+    CacheKey key = cache_key(request, compiler);
+
+    CacheEntry const *entry = cache_find(cache, key);
+    if (entry) {
+        cache->stats.hits++;
+        *size = entry->size;
+        return entry->code;
+    }
+
+    cache->stats.misses++;
+
+    void *code = compiler->compile(compiler->ctx, request, size);
+    if (!code) {
+        cache->stats.failures++;
+        return NULL;
+    }
+
+    cache_put(cache, key, code, *size);
+    return code;
+}
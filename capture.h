@@ -0,0 +1,897 @@
+// Captures of what the frames ask of the GPU, and replaying them.
+//
+// Every command list records what it is asked to do into a CaptureList of
+// its own, as it goes: root signature and arguments, barriers, viewports,
+// render targets, vertex and index buffers, draws and copies, each as a
+// small record of plain values.  Lists are recorded on whatever thread
+// records the command list, and cost nothing more than appending to a
+// buffer.
+//
+// Once a frame, the thread that submits the lists hands them to the
+// Capture in the order they run, along with the contents of the memory
+// they read: upload memory by GPU address, as it was written.  The
+// Capture copies them into chunks, and a thread of its own writes the
+// chunks out, so that the file system never holds up a frame.
+//
+// A capture replays the same way every time.  capture_replay() reads the
+// records in order, keeps what the GPU memory they refer to holds, and
+// hands each one to a CaptureBackend: none at all, to time the records on
+// their own, or a stand-in for the GPU.  replay.cpp does either on Linux.
+//
+// Nothing here talks to Direct3D 12: resources are whatever 64-bit values
+// the caller tells them apart by, and states, formats and barriers are
+// passed through as the numbers it uses.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#ifndef ASSERT
+#define ASSERT(expr)    assert(expr)
+#endif
+
+
+
+#define CAPTURE_MAGIC       0x54504143u     // "CAPT"
+#define CAPTURE_VERSION     1
+#define CAPTURE_CHUNK       (1024 * 1024)   // Bytes handed to the writer at a time.
+#define CAPTURE_QUEUE       64              // Chunks it may fall behind by.
+#define CAPTURE_PAGE        65536           // Of replayed GPU memory.
+
+enum {
+    CAPTURE_FRAME,          // CaptureFrame: what follows is one frame.
+    CAPTURE_LIST,           // CaptureListBegin: then the records of a list.
+    CAPTURE_DATA,           // CaptureData, then the bytes.
+    CAPTURE_SIGNATURE,      // CaptureObject.
+    CAPTURE_PIPELINE,       // CaptureObject.
+    CAPTURE_TABLE,          // CaptureTable.
+    CAPTURE_CBV,            // CaptureCbv.
+    CAPTURE_CONSTANTS,      // CaptureConstants, then the values.
+    CAPTURE_BARRIER,        // CaptureBarrier.
+    CAPTURE_VIEWPORT,       // CaptureViewport.
+    CAPTURE_SCISSOR,        // CaptureScissor.
+    CAPTURE_TARGET,         // CaptureObject.
+    CAPTURE_CLEAR,          // CaptureClear.
+    CAPTURE_VERTEX_BUFFERS, // CaptureVertexBuffers, then the views.
+    CAPTURE_INDEX_BUFFER,   // CaptureIndexBuffer.
+    CAPTURE_DRAW,           // CaptureDraw.
+    CAPTURE_DRAW_INDEXED,   // CaptureDrawIndexed.
+    CAPTURE_COPY_BUFFER,    // CaptureCopyBuffer.
+    CAPTURE_TEXTURE,        // CaptureTexture.
+    CAPTURE_COPY_TEXTURE,   // CaptureCopyTexture.
+    CAPTURE_OPS
+};
+
+static char const *const capture_names[CAPTURE_OPS] = {
+    "frame", "list", "data", "signature", "pipeline", "table", "cbv", "constants",
+    "barrier", "viewport", "scissor", "target", "clear", "vertex buffers",
+    "index buffer", "draw", "draw indexed", "copy buffer", "texture", "copy texture",
+};
+
+enum {
+    CAPTURE_DIRECT,
+    CAPTURE_COPY,
+};
+
+
+
+// The File
+//
+// A header, then records, each one a CaptureRecord and `size` bytes of
+// what it says, padded to 8.
+
+typedef struct CaptureHeader {
+    uint32_t    magic;
+    uint32_t    version;
+    uint64_t    frames;
+    uint64_t    records;
+    uint64_t    size;       // Of the file, header and all.
+} CaptureHeader;
+
+typedef struct CaptureRecord {
+    uint16_t    op;
+    uint16_t    reserved;
+    uint32_t    size;       // Of what follows, before padding.
+} CaptureRecord;
+
+typedef struct CaptureFrame {
+    uint64_t    index;
+} CaptureFrame;
+
+typedef struct CaptureListBegin {
+    uint32_t    queue;      // CAPTURE_DIRECT or CAPTURE_COPY.
+    uint32_t    records;
+} CaptureListBegin;
+
+typedef struct CaptureData {
+    uint64_t    address;
+} CaptureData;
+
+typedef struct CaptureObject {
+    uint64_t    id;
+} CaptureObject;
+
+typedef struct CaptureTable {
+    uint32_t    slot;
+    uint32_t    reserved;
+    uint64_t    resource;   // What the table views.
+} CaptureTable;
+
+typedef struct CaptureCbv {
+    uint32_t    slot;
+    uint32_t    reserved;
+    uint64_t    address;
+} CaptureCbv;
+
+typedef struct CaptureConstants {
+    uint32_t    slot;
+    uint32_t    first;
+    uint32_t    count;
+    uint32_t    reserved;
+} CaptureConstants;
+
+typedef struct CaptureBarrier {
+    uint64_t    resource;
+    uint32_t    subresource;
+    uint32_t    type;
+    uint32_t    flags;
+    uint32_t    before;
+    uint32_t    after;
+    uint32_t    reserved;
+} CaptureBarrier;
+
+typedef struct CaptureViewport {
+    float       x, y, width, height;
+    float       min_depth, max_depth;
+} CaptureViewport;
+
+typedef struct CaptureScissor {
+    int32_t     left, top, right, bottom;
+} CaptureScissor;
+
+typedef struct CaptureClear {
+    uint64_t    resource;
+    float       color[4];
+} CaptureClear;
+
+typedef struct CaptureVertexBuffer {
+    uint64_t    address;
+    uint32_t    size;
+    uint32_t    stride;
+} CaptureVertexBuffer;
+
+typedef struct CaptureVertexBuffers {
+    uint32_t    first;
+    uint32_t    count;
+} CaptureVertexBuffers;
+
+typedef struct CaptureIndexBuffer {
+    uint64_t    address;
+    uint32_t    size;
+    uint32_t    index_size;
+} CaptureIndexBuffer;
+
+typedef struct CaptureDraw {
+    uint32_t    vertex_count;
+    uint32_t    instance_count;
+    uint32_t    first_vertex;
+    uint32_t    first_instance;
+} CaptureDraw;
+
+typedef struct CaptureDrawIndexed {
+    uint32_t    index_count;
+    uint32_t    instance_count;
+    uint32_t    first_index;
+    int32_t     base_vertex;
+    uint32_t    first_instance;
+    uint32_t    reserved;
+} CaptureDrawIndexed;
+
+typedef struct CaptureCopyBuffer {
+    uint64_t    dst;
+    uint64_t    src;
+    uint64_t    size;
+} CaptureCopyBuffer;
+
+typedef struct CaptureTexture {
+    uint64_t    resource;
+    uint32_t    format;     // Whatever the caller tells formats apart by.
+    uint32_t    width;
+    uint32_t    height;
+    uint32_t    mip_levels;
+} CaptureTexture;
+
+typedef struct CaptureCopyTexture {
+    uint64_t    resource;
+    uint64_t    src;
+    uint32_t    subresource;
+    uint32_t    row_pitch;
+    uint32_t    width;      // In texels.
+    uint32_t    height;
+} CaptureCopyTexture;
+
+static_assert(sizeof(CaptureHeader) == 32, "CaptureHeader is padded");
+static_assert(sizeof(CaptureBarrier) == 32, "CaptureBarrier is padded");
+static_assert(sizeof(CaptureDrawIndexed) == 24, "CaptureDrawIndexed is padded");
+
+static size_t capture_padded(size_t size)
+{
+    return (size + 7) & ~(size_t)7;
+}
+
+
+
+// Recording
+// A list of records, grown as needed and reused from frame to frame.
+
+typedef struct CaptureList {
+    uint8_t     *data;
+    size_t      size;
+    size_t      capacity;
+    uint32_t    records;
+} CaptureList;
+
+static void capture_list_free(CaptureList *list)
+{
+    free(list->data);
+    memset(list, 0, sizeof(*list));
+}
+
+static void capture_list_reset(CaptureList *list)
+{
+    list->size = 0;
+    list->records = 0;
+}
+
+// Room for a record and `size` bytes of it, to be filled in.
+static void *capture_record(CaptureList *list, int op, size_t size)
+{
+    size_t needed = list->size + sizeof(CaptureRecord) + capture_padded(size);
+    if (needed > list->capacity) {
+        size_t capacity = (list->capacity) ? 2 * list->capacity : 4096;
+        while (capacity < needed)
+            capacity *= 2;
+        list->data = (uint8_t *)realloc(list->data, capacity);
+        ASSERT(list->data);
+        list->capacity = capacity;
+    }
+
+    CaptureRecord *record = (CaptureRecord *)(list->data + list->size);
+    record->op = (uint16_t)op;
+    record->reserved = 0;
+    record->size = (uint32_t)size;
+    list->size = needed;
+    list->records++;
+
+    void *payload = record + 1;
+    if (capture_padded(size) != size)
+        memset((uint8_t *)payload + capture_padded(size) - 8, 0, 8);
+    return payload;
+}
+
+static void capture_object(CaptureList *list, int op, uint64_t id)
+{
+    CaptureObject *r = (CaptureObject *)capture_record(list, op, sizeof(CaptureObject));
+    r->id = id;
+}
+
+static void capture_signature(CaptureList *list, uint64_t signature)
+{
+    capture_object(list, CAPTURE_SIGNATURE, signature);
+}
+
+static void capture_pipeline(CaptureList *list, uint64_t pipeline)
+{
+    capture_object(list, CAPTURE_PIPELINE, pipeline);
+}
+
+static void capture_target(CaptureList *list, uint64_t resource)
+{
+    capture_object(list, CAPTURE_TARGET, resource);
+}
+
+static void capture_table(CaptureList *list, uint32_t slot, uint64_t resource)
+{
+    CaptureTable *r = (CaptureTable *)capture_record(list, CAPTURE_TABLE, sizeof(CaptureTable));
+    r->slot = slot;
+    r->reserved = 0;
+    r->resource = resource;
+}
+
+static void capture_cbv(CaptureList *list, uint32_t slot, uint64_t address)
+{
+    CaptureCbv *r = (CaptureCbv *)capture_record(list, CAPTURE_CBV, sizeof(CaptureCbv));
+    r->slot = slot;
+    r->reserved = 0;
+    r->address = address;
+}
+
+static void capture_constants(CaptureList *list, uint32_t slot, uint32_t first,
+                              uint32_t count, void const *values)
+{
+    CaptureConstants *r = (CaptureConstants *)capture_record(
+        list, CAPTURE_CONSTANTS, sizeof(CaptureConstants) + 4 * count);
+    r->slot = slot;
+    r->first = first;
+    r->count = count;
+    r->reserved = 0;
+    memcpy(r + 1, values, 4 * count);
+}
+
+static void capture_barrier(CaptureList *list, uint64_t resource, uint32_t subresource, uint32_t type,
+                            uint32_t flags, uint32_t before, uint32_t after)
+{
+    CaptureBarrier *r = (CaptureBarrier *)capture_record(list, CAPTURE_BARRIER, sizeof(CaptureBarrier));
+    r->resource = resource;
+    r->subresource = subresource;
+    r->type = type;
+    r->flags = flags;
+    r->before = before;
+    r->after = after;
+    r->reserved = 0;
+}
+
+static void capture_viewport(CaptureList *list, float x, float y, float width, float height,
+                             float min_depth, float max_depth)
+{
+    CaptureViewport *r = (CaptureViewport *)capture_record(list, CAPTURE_VIEWPORT, sizeof(CaptureViewport));
+    r->x = x;
+    r->y = y;
+    r->width = width;
+    r->height = height;
+    r->min_depth = min_depth;
+    r->max_depth = max_depth;
+}
+
+static void capture_scissor(CaptureList *list, int32_t left, int32_t top, int32_t right, int32_t bottom)
+{
+    CaptureScissor *r = (CaptureScissor *)capture_record(list, CAPTURE_SCISSOR, sizeof(CaptureScissor));
+    r->left = left;
+    r->top = top;
+    r->right = right;
+    r->bottom = bottom;
+}
+
+static void capture_clear(CaptureList *list, uint64_t resource, float const color[4])
+{
+    CaptureClear *r = (CaptureClear *)capture_record(list, CAPTURE_CLEAR, sizeof(CaptureClear));
+    r->resource = resource;
+    memcpy(r->color, color, sizeof(r->color));
+}
+
+static void capture_vertex_buffers(CaptureList *list, uint32_t first, uint32_t count,
+                                   CaptureVertexBuffer const *views)
+{
+    CaptureVertexBuffers *r = (CaptureVertexBuffers *)capture_record(
+        list, CAPTURE_VERTEX_BUFFERS, sizeof(CaptureVertexBuffers) + count * sizeof(CaptureVertexBuffer));
+    r->first = first;
+    r->count = count;
+    memcpy(r + 1, views, count * sizeof(CaptureVertexBuffer));
+}
+
+static void capture_index_buffer(CaptureList *list, uint64_t address, uint32_t size, uint32_t index_size)
+{
+    CaptureIndexBuffer *r = (CaptureIndexBuffer *)capture_record(
+        list, CAPTURE_INDEX_BUFFER, sizeof(CaptureIndexBuffer));
+    r->address = address;
+    r->size = size;
+    r->index_size = index_size;
+}
+
+static void capture_draw(CaptureList *list, uint32_t vertex_count, uint32_t instance_count,
+                         uint32_t first_vertex, uint32_t first_instance)
+{
+    CaptureDraw *r = (CaptureDraw *)capture_record(list, CAPTURE_DRAW, sizeof(CaptureDraw));
+    r->vertex_count = vertex_count;
+    r->instance_count = instance_count;
+    r->first_vertex = first_vertex;
+    r->first_instance = first_instance;
+}
+
+static void capture_draw_indexed(CaptureList *list, uint32_t index_count, uint32_t instance_count,
+                                 uint32_t first_index, int32_t base_vertex, uint32_t first_instance)
+{
+    CaptureDrawIndexed *r = (CaptureDrawIndexed *)capture_record(
+        list, CAPTURE_DRAW_INDEXED, sizeof(CaptureDrawIndexed));
+    r->index_count = index_count;
+    r->instance_count = instance_count;
+    r->first_index = first_index;
+    r->base_vertex = base_vertex;
+    r->first_instance = first_instance;
+    r->reserved = 0;
+}
+
+static void capture_copy_buffer(CaptureList *list, uint64_t dst, uint64_t src, uint64_t size)
+{
+    CaptureCopyBuffer *r = (CaptureCopyBuffer *)capture_record(
+        list, CAPTURE_COPY_BUFFER, sizeof(CaptureCopyBuffer));
+    r->dst = dst;
+    r->src = src;
+    r->size = size;
+}
+
+// What a texture is, ahead of what is copied into it.
+static void capture_texture(CaptureList *list, uint64_t resource, uint32_t format,
+                            uint32_t width, uint32_t height, uint32_t mip_levels)
+{
+    CaptureTexture *r = (CaptureTexture *)capture_record(list, CAPTURE_TEXTURE, sizeof(CaptureTexture));
+    r->resource = resource;
+    r->format = format;
+    r->width = width;
+    r->height = height;
+    r->mip_levels = mip_levels;
+}
+
+static void capture_copy_texture(CaptureList *list, uint64_t resource, uint32_t subresource,
+                                 uint64_t src, uint32_t row_pitch, uint32_t width, uint32_t height)
+{
+    CaptureCopyTexture *r = (CaptureCopyTexture *)capture_record(
+        list, CAPTURE_COPY_TEXTURE, sizeof(CaptureCopyTexture));
+    r->resource = resource;
+    r->src = src;
+    r->subresource = subresource;
+    r->row_pitch = row_pitch;
+    r->width = width;
+    r->height = height;
+}
+
+
+
+// Writing
+// The chunks the submitting thread fills, and the thread that writes them.
+
+typedef struct CaptureChunk {
+    struct CaptureChunk *next;
+    size_t              size;
+    uint8_t             data[CAPTURE_CHUNK];
+} CaptureChunk;
+
+typedef struct Capture {
+    FILE                        *file;
+    std::thread                 thread;
+    std::mutex                  mutex;
+    std::condition_variable     changed;
+    bool                        quit;
+    bool                        failed;
+
+    CaptureChunk                *chunk;     // Being filled.
+    CaptureChunk                *queue[CAPTURE_QUEUE];
+    uint64_t                    head;       // Next to write.
+    uint64_t                    tail;       // Next free.
+    CaptureChunk                *spare;     // Written, to be filled again.
+
+    // Totals, for reports.
+    uint64_t                    frames;
+    uint64_t                    records;
+    uint64_t                    bytes;
+    double                      stalled;    // Seconds spent waiting for the writer.
+} Capture;
+
+static void capture_run(Capture *capture)
+{
+    while (1) {
+        CaptureChunk *chunk;
+        {
+            std::unique_lock<std::mutex> lock(capture->mutex);
+            while (!capture->quit && capture->head == capture->tail)
+                capture->changed.wait(lock);
+            if (capture->head == capture->tail)
+                return;
+            chunk = capture->queue[capture->head % CAPTURE_QUEUE];
+        }
+
+        bool ok = fwrite(chunk->data, 1, chunk->size, capture->file) == chunk->size;
+
+        {
+            std::unique_lock<std::mutex> lock(capture->mutex);
+            capture->failed = capture->failed || !ok;
+            capture->head++;
+            chunk->next = capture->spare;
+            capture->spare = chunk;
+            capture->changed.notify_all();
+        }
+    }
+}
+
+static bool capture_open(Capture *capture, char const *path)
+{
+    capture->file = fopen(path, "wb");
+    if (!capture->file)
+        return false;
+
+    // Filled in once the capture is closed.
+    CaptureHeader header = {0};
+    if (fwrite(&header, sizeof(header), 1, capture->file) != 1) {
+        fclose(capture->file);
+        return false;
+    }
+
+    capture->quit = false;
+    capture->failed = false;
+    capture->chunk = (CaptureChunk *)malloc(sizeof(CaptureChunk));
+    ASSERT(capture->chunk);
+    capture->chunk->size = 0;
+    capture->head = 0;
+    capture->tail = 0;
+    capture->spare = NULL;
+    capture->frames = 0;
+    capture->records = 0;
+    capture->bytes = sizeof(header);
+    capture->stalled = 0.0;
+    capture->thread = std::thread(capture_run, capture);
+    return true;
+}
+
+// Hands the chunk being filled to the writer, and takes an empty one.
+static void capture_flush(Capture *capture)
+{
+    if (capture->chunk->size == 0)
+        return;
+
+    std::unique_lock<std::mutex> lock(capture->mutex);
+    if (capture->tail - capture->head == CAPTURE_QUEUE) {
+        auto t0 = std::chrono::steady_clock::now();
+        while (capture->tail - capture->head == CAPTURE_QUEUE)
+            capture->changed.wait(lock);
+        capture->stalled += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    }
+    capture->queue[capture->tail++ % CAPTURE_QUEUE] = capture->chunk;
+    capture->changed.notify_all();
+
+    if (capture->spare) {
+        capture->chunk = capture->spare;
+        capture->spare = capture->spare->next;
+    } else {
+        capture->chunk = (CaptureChunk *)malloc(sizeof(CaptureChunk));
+        ASSERT(capture->chunk);
+    }
+    capture->chunk->size = 0;
+}
+
+static void capture_write(Capture *capture, void const *data, size_t size)
+{
+    uint8_t const *bytes = (uint8_t const *)data;
+    capture->bytes += size;
+
+    while (size > 0) {
+        CaptureChunk *chunk = capture->chunk;
+        size_t n = CAPTURE_CHUNK - chunk->size;
+        n = (n < size) ? n : size;
+        memcpy(chunk->data + chunk->size, bytes, n);
+        chunk->size += n;
+        bytes += n;
+        size -= n;
+        if (chunk->size == CAPTURE_CHUNK)
+            capture_flush(capture);
+    }
+}
+
+static void capture_write_record(Capture *capture, int op, void const *head, size_t head_size,
+                                 void const *data, size_t size)
+{
+    static uint8_t const zeros[8] = {0};
+    CaptureRecord record = {(uint16_t)op, 0, (uint32_t)(head_size + size)};
+    capture_write(capture, &record, sizeof(record));
+    capture_write(capture, head, head_size);
+    capture_write(capture, data, size);
+    capture_write(capture, zeros, capture_padded(head_size + size) - (head_size + size));
+    capture->records++;
+}
+
+// Everything from here to the next frame is one frame.  The capture
+// functions that follow are all called from one thread at a time.
+static void capture_frame(Capture *capture, uint64_t index)
+{
+    CaptureFrame frame = {index};
+    capture_write_record(capture, CAPTURE_FRAME, &frame, sizeof(frame), NULL, 0);
+    capture->frames++;
+}
+
+// What the GPU reads at `address`, as it is when the lists that follow
+// are submitted.
+static void capture_data(Capture *capture, uint64_t address, void const *data, size_t size)
+{
+    CaptureData head = {address};
+    capture_write_record(capture, CAPTURE_DATA, &head, sizeof(head), data, size);
+}
+
+// A list, as it is submitted to `queue`, after those submitted before it.
+static void capture_submit(Capture *capture, uint32_t queue, CaptureList const *list)
+{
+    CaptureListBegin begin = {queue, list->records};
+    capture_write_record(capture, CAPTURE_LIST, &begin, sizeof(begin), NULL, 0);
+    capture_write(capture, list->data, list->size);
+    capture->records += list->records;
+}
+
+// Waits for the writer, and fills in the header.  Returns false if any of
+// it could not be written.
+static bool capture_close(Capture *capture)
+{
+    capture_flush(capture);
+    {
+        std::unique_lock<std::mutex> lock(capture->mutex);
+        capture->quit = true;
+        capture->changed.notify_all();
+    }
+    capture->thread.join();
+
+    CaptureHeader header = {
+        CAPTURE_MAGIC, CAPTURE_VERSION, capture->frames, capture->records, capture->bytes
+    };
+    bool ok = !capture->failed;
+    ok = ok && fseek(capture->file, 0, SEEK_SET) == 0;
+    ok = ok && fwrite(&header, sizeof(header), 1, capture->file) == 1;
+    ok = (fclose(capture->file) == 0) && ok;
+
+    free(capture->chunk);
+    while (capture->spare) {
+        CaptureChunk *next = capture->spare->next;
+        free(capture->spare);
+        capture->spare = next;
+    }
+    return ok;
+}
+
+
+
+// Reading
+
+typedef struct CaptureReader {
+    uint8_t         *data;
+    size_t          size;
+    CaptureHeader   header;
+} CaptureReader;
+
+static bool capture_load(CaptureReader *reader, char const *path)
+{
+    memset(reader, 0, sizeof(*reader));
+
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return false;
+
+    bool ok = fread(&reader->header, sizeof(CaptureHeader), 1, file) == 1;
+    ok = ok && reader->header.magic == CAPTURE_MAGIC && reader->header.version == CAPTURE_VERSION;
+    ok = ok && reader->header.size >= sizeof(CaptureHeader);
+    if (ok) {
+        reader->size = (size_t)reader->header.size;
+        reader->data = (uint8_t *)malloc(reader->size);
+        ok = reader->data && fseek(file, 0, SEEK_SET) == 0 &&
+             fread(reader->data, 1, reader->size, file) == reader->size;
+    }
+    fclose(file);
+
+    if (!ok) {
+        free(reader->data);
+        memset(reader, 0, sizeof(*reader));
+    }
+    return ok;
+}
+
+static void capture_unload(CaptureReader *reader)
+{
+    free(reader->data);
+    memset(reader, 0, sizeof(*reader));
+}
+
+// The record at `*at`, and where the next one is.  Returns false at the
+// end, or at a record that does not fit in what is left.
+static bool capture_next(CaptureReader const *reader, size_t *at, CaptureRecord const **record,
+                         void const **payload)
+{
+    if (*at + sizeof(CaptureRecord) > reader->size)
+        return false;
+    CaptureRecord const *r = (CaptureRecord const *)(reader->data + *at);
+    size_t size = sizeof(CaptureRecord) + capture_padded(r->size);
+    if (r->op >= CAPTURE_OPS || size > reader->size - *at)
+        return false;
+
+    *record = r;
+    *payload = r + 1;
+    *at += size;
+    return true;
+}
+
+
+
+// GPU Memory, as Replayed
+// Pages of it, found by address, made as they are first written.
+
+typedef struct CaptureMemory {
+    uint64_t    *pages;     // Page number plus 1, 0 when free.
+    uint8_t     **data;
+    uint32_t    count;
+    uint32_t    capacity;
+} CaptureMemory;
+
+static void capture_memory_free(CaptureMemory *m)
+{
+    for (uint32_t i = 0; i < m->capacity; i++)
+        free(m->data[i]);
+    free(m->pages);
+    free(m->data);
+    memset(m, 0, sizeof(*m));
+}
+
+static uint32_t capture_memory_slot(CaptureMemory const *m, uint64_t page)
+{
+    uint32_t slot = (uint32_t)((page + 1) * 0x9e3779b97f4a7c15ull >> 32) & (m->capacity - 1);
+    while (m->pages[slot] != 0 && m->pages[slot] != page + 1)
+        slot = (slot + 1) & (m->capacity - 1);
+    return slot;
+}
+
+static uint8_t *capture_memory_page(CaptureMemory *m, uint64_t page, bool create)
+{
+    if (m->capacity > 0) {
+        uint32_t slot = capture_memory_slot(m, page);
+        if (m->pages[slot] != 0)
+            return m->data[slot];
+    }
+    if (!create)
+        return NULL;
+
+    if (2 * (m->count + 1) > m->capacity) {
+        CaptureMemory grown;
+        grown.capacity = (m->capacity) ? 2 * m->capacity : 64;
+        grown.count = m->count;
+        grown.pages = (uint64_t *)calloc(grown.capacity, sizeof(uint64_t));
+        grown.data = (uint8_t **)calloc(grown.capacity, sizeof(uint8_t *));
+        ASSERT(grown.pages && grown.data);
+        for (uint32_t i = 0; i < m->capacity; i++) {
+            if (m->pages[i]) {
+                uint32_t slot = capture_memory_slot(&grown, m->pages[i] - 1);
+                grown.pages[slot] = m->pages[i];
+                grown.data[slot] = m->data[i];
+            }
+        }
+        free(m->pages);
+        free(m->data);
+        *m = grown;
+    }
+
+    uint32_t slot = capture_memory_slot(m, page);
+    m->pages[slot] = page + 1;
+    m->data[slot] = (uint8_t *)calloc(1, CAPTURE_PAGE);
+    ASSERT(m->data[slot]);
+    m->count++;
+    return m->data[slot];
+}
+
+static void capture_memory_write(CaptureMemory *m, uint64_t address, void const *data, size_t size)
+{
+    uint8_t const *src = (uint8_t const *)data;
+    while (size > 0) {
+        size_t offset = (size_t)(address % CAPTURE_PAGE);
+        size_t n = CAPTURE_PAGE - offset;
+        n = (n < size) ? n : size;
+        memcpy(capture_memory_page(m, address / CAPTURE_PAGE, true) + offset, src, n);
+        address += n;
+        src += n;
+        size -= n;
+    }
+}
+
+// What was never written reads as zeros.
+static void capture_memory_read(CaptureMemory *m, uint64_t address, size_t size, void *data)
+{
+    uint8_t *dst = (uint8_t *)data;
+    while (size > 0) {
+        size_t offset = (size_t)(address % CAPTURE_PAGE);
+        size_t n = CAPTURE_PAGE - offset;
+        n = (n < size) ? n : size;
+        uint8_t const *page = capture_memory_page(m, address / CAPTURE_PAGE, false);
+        if (page)
+            memcpy(dst, page + offset, n);
+        else
+            memset(dst, 0, n);
+        address += n;
+        dst += n;
+        size -= n;
+    }
+}
+
+static void capture_memory_copy(CaptureMemory *m, uint64_t dst, uint64_t src, uint64_t size)
+{
+    uint8_t bounce[4096];
+    for (uint64_t done = 0; done < size; done += sizeof(bounce)) {
+        size_t n = (size - done < sizeof(bounce)) ? (size_t)(size - done) : sizeof(bounce);
+        capture_memory_read(m, src + done, n, bounce);
+        capture_memory_write(m, dst + done, bounce, n);
+    }
+}
+
+
+
+// Replaying
+
+typedef struct CaptureReplay CaptureReplay;
+
+// Called for every record, once the memory has what it says.
+typedef void CaptureExecute(void *ctx, CaptureReplay *replay, int op, void const *payload, uint32_t size);
+
+typedef struct CaptureBackend {
+    void            *ctx;
+    CaptureExecute  *execute;
+} CaptureBackend;
+
+struct CaptureReplay {
+    CaptureMemory   memory;
+
+    uint64_t        counts[CAPTURE_OPS];
+    uint64_t        lists[2];       // By queue.
+    uint64_t        instances;
+    uint64_t        primitives;     // Triangles, as drawn as a list.
+    uint64_t        data_bytes;
+    uint64_t        copy_bytes;
+};
+
+static void capture_replay_init(CaptureReplay *replay)
+{
+    memset(replay, 0, sizeof(*replay));
+}
+
+static void capture_replay_free(CaptureReplay *replay)
+{
+    capture_memory_free(&replay->memory);
+}
+
+// Replays every record, with `backend` when not NULL.  Returns false if
+// the capture ends in the middle of a record.
+static bool capture_replay(CaptureReader const *reader, CaptureReplay *replay, CaptureBackend const *backend)
+{
+    size_t at = sizeof(CaptureHeader);
+    CaptureRecord const *record;
+    void const *payload;
+
+    while (capture_next(reader, &at, &record, &payload)) {
+        int op = record->op;
+        replay->counts[op]++;
+
+        switch (op) {
+        case CAPTURE_LIST:
+            replay->lists[((CaptureListBegin const *)payload)->queue == CAPTURE_COPY]++;
+            break;
+        case CAPTURE_DATA: {
+            size_t size = record->size - sizeof(CaptureData);
+            capture_memory_write(&replay->memory, ((CaptureData const *)payload)->address,
+                                 (CaptureData const *)payload + 1, size);
+            replay->data_bytes += size;
+            break;
+        }
+        case CAPTURE_COPY_BUFFER: {
+            CaptureCopyBuffer const *copy = (CaptureCopyBuffer const *)payload;
+            capture_memory_copy(&replay->memory, copy->dst, copy->src, copy->size);
+            replay->copy_bytes += copy->size;
+            break;
+        }
+        case CAPTURE_DRAW: {
+            CaptureDraw const *draw = (CaptureDraw const *)payload;
+            replay->instances += draw->instance_count;
+            replay->primitives += (uint64_t)draw->instance_count * (draw->vertex_count / 3);
+            break;
+        }
+        case CAPTURE_DRAW_INDEXED: {
+            CaptureDrawIndexed const *draw = (CaptureDrawIndexed const *)payload;
+            replay->instances += draw->instance_count;
+            replay->primitives += (uint64_t)draw->instance_count * (draw->index_count / 3);
+            break;
+        }
+        }
+
+        if (backend)
+            backend->execute(backend->ctx, replay, op, payload, record->size);
+    }
+    return at == reader->size;
+}
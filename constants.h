@@ -0,0 +1,339 @@
+// Constant buffers: laid out in C++ as HLSL lays them out, and streamed
+// into upload memory a block per draw.
+//
+// HLSL packs a cbuffer into registers of 16 bytes.  A member never
+// straddles two of them; arrays, structs and matrices start on a register
+// of their own, and every element of an array takes a whole one.  C++ packs
+// by alignment instead, and the two disagree as soon as, say, a float3
+// follows a float2.  So structs meant to be seen as a cbuffer list their
+// members with CONSTANTS_FIELD(), which fails to compile when one would
+// end up elsewhere in HLSL, and CONSTANTS_BLOCK(), which checks the whole.
+// Arrays are only allowed of 16-byte elements, which both agree on.
+// constants_parse() works out the HLSL side from the source, to check
+// both against each other by name.
+//
+// Every draw's constants are a block of their own, 256-byte aligned as
+// root CBVs require, written into the frame's upload memory with
+// non-temporal stores: upload heaps are write-combined, and never read.
+//
+// Nothing here talks to Direct3D 12: the blocks come out of an Upload
+// ring, which bench.cpp stands in for with plain memory.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include <immintrin.h>
+
+#include "upload.h"
+
+#ifndef ASSERT
+#define ASSERT(expr)    assert(expr)
+#endif
+
+
+
+#define CONSTANTS_REGISTER  16
+#define CONSTANTS_ALIGN     UPLOAD_ALIGN_CONSTANTS
+#define CONSTANTS_MAX_SIZE  (4096 * CONSTANTS_REGISTER)     // D3D12_REQ_CONSTANT_BUFFER_ELEMENT_COUNT
+
+// HLSL's vector and matrix types, as they are in a cbuffer.
+typedef struct Float2 { float x, y; } Float2;
+typedef struct Float3 { float x, y, z; } Float3;
+typedef struct Float4 { float x, y, z, w; } Float4;
+typedef struct Float4x4 { float m[4][4]; } Float4x4;   // Column major, as HLSL has them.
+
+// Whether a member at `offset` of `size` bytes is where HLSL puts it, given
+// that it comes right after the one before: within one register, or at the
+// start of one if it is larger.
+static constexpr bool constants_fits(size_t offset, size_t size)
+{
+    return (size <= CONSTANTS_REGISTER) ? offset / CONSTANTS_REGISTER ==
+                                              (offset + size - 1) / CONSTANTS_REGISTER
+                                        : offset % CONSTANTS_REGISTER == 0 && size % CONSTANTS_REGISTER == 0;
+}
+
+#define CONSTANTS_FIELD(type, member)                                                   \
+    static_assert(constants_fits(offsetof(type, member), sizeof(((type *)0)->member)),  \
+                  #type "::" #member " straddles a register, or does not start one")
+
+#define CONSTANTS_ARRAY(type, member)                                                   \
+    CONSTANTS_FIELD(type, member);                                                      \
+    static_assert(sizeof(((type *)0)->member[0]) % CONSTANTS_REGISTER == 0,             \
+                  #type "::" #member " has elements HLSL would pad")
+
+#define CONSTANTS_BLOCK(type)                                                           \
+    static_assert(sizeof(type) % CONSTANTS_REGISTER == 0 && sizeof(type) <= CONSTANTS_MAX_SIZE, \
+                  #type " is not a whole number of registers")
+
+
+
+// Layouts
+// A member of a cbuffer, as HLSL lays it out or as a C++ struct has it.
+
+#define CONSTANTS_NAME      32
+
+typedef struct ConstantsField {
+    char        name[CONSTANTS_NAME];
+    uint32_t    offset;
+    uint32_t    size;
+} ConstantsField;
+
+#define CONSTANTS_MEMBER(type, member) \
+    {#member, (uint32_t)offsetof(type, member), (uint32_t)sizeof(((type *)0)->member)}
+
+// The size of a scalar, vector or matrix type of 32-bit components, in
+// rows of `*columns`, or 0 if it is none of those.
+static int constants_type(char const *type, int length, int *columns)
+{
+    static char const *const scalars[] = {"float", "int", "uint", "bool", "dword"};
+
+    for (int i = 0; i < (int)(sizeof(scalars) / sizeof(*scalars)); i++) {
+        int n = (int)strlen(scalars[i]);
+        if (length < n || strncmp(type, scalars[i], n) != 0)
+            continue;
+
+        char const *rest = type + n;
+        int left = length - n;
+        if (left == 0) {
+            *columns = 1;
+            return 1;
+        }
+        if (left == 1 && rest[0] >= '1' && rest[0] <= '4') {
+            *columns = rest[0] - '0';
+            return 1;
+        }
+        // Matrices are column major: a register per column.
+        if (left == 3 && rest[0] >= '1' && rest[0] <= '4' && rest[1] == 'x' && rest[2] >= '1' && rest[2] <= '4') {
+            *columns = rest[0] - '0';
+            return rest[2] - '0';
+        }
+    }
+    return 0;
+}
+
+// Lays out the members of `cbuffer name { ... }` in `source` by HLSL's
+// rules.  Returns how many there are, or -1 when it is not found or has a
+// type that is not understood here.
+static int constants_parse(char const *source, char const *name, ConstantsField *fields, int max)
+{
+    size_t name_length = strlen(name);
+    char const *at = source;
+    while ((at = strstr(at, "cbuffer")) != NULL) {
+        at += 7;
+        while (isspace((unsigned char)*at))
+            at++;
+        if (strncmp(at, name, name_length) == 0 && !isalnum((unsigned char)at[name_length]) &&
+            at[name_length] != '_')
+            break;
+    }
+    if (!at)
+        return -1;
+
+    at = strchr(at, '{');
+    if (!at)
+        return -1;
+    at++;
+
+    int count = 0;
+    uint32_t offset = 0;
+    while (1) {
+        while (isspace((unsigned char)*at))
+            at++;
+        if (*at == '}')
+            return count;
+        if (*at == '\0' || count == max)
+            return -1;
+
+        // Skip comments.
+        if (at[0] == '/' && at[1] == '/') {
+            at = strchr(at, '\n');
+            if (!at)
+                return -1;
+            continue;
+        }
+
+        char const *type = at;
+        while (isalnum((unsigned char)*at) || *at == '_')
+            at++;
+        int type_length = (int)(at - type);
+
+        while (isspace((unsigned char)*at))
+            at++;
+        char const *member = at;
+        while (isalnum((unsigned char)*at) || *at == '_')
+            at++;
+        int member_length = (int)(at - member);
+        if (member_length == 0 || member_length >= CONSTANTS_NAME)
+            return -1;
+
+        int elements = 0;
+        while (isspace((unsigned char)*at))
+            at++;
+        if (*at == '[') {
+            elements = (int)strtol(at + 1, (char **)&at, 10);
+            if (*at != ']' || elements <= 0)
+                return -1;
+            at++;
+        }
+        while (isspace((unsigned char)*at))
+            at++;
+        if (*at != ';')
+            return -1;
+        at++;
+
+        int columns;
+        int rows = constants_type(type, type_length, &columns);
+        if (rows == 0)
+            return -1;
+
+        uint32_t size;
+        if (rows > 1 || elements > 0) {
+            // A register of its own for every column of every element, the
+            // last one only as far as it is used.
+            offset = (offset + CONSTANTS_REGISTER - 1) & ~(CONSTANTS_REGISTER - 1);
+            int registers = rows * ((elements > 0) ? elements : 1);
+            size = (registers - 1) * CONSTANTS_REGISTER + columns * 4;
+        } else {
+            size = columns * 4;
+            if (offset / CONSTANTS_REGISTER != (offset + size - 1) / CONSTANTS_REGISTER)
+                offset = (offset + CONSTANTS_REGISTER - 1) & ~(CONSTANTS_REGISTER - 1);
+        }
+
+        ConstantsField *field = &fields[count++];
+        memcpy(field->name, member, member_length);
+        field->name[member_length] = '\0';
+        field->offset = offset;
+        field->size = size;
+        offset += size;
+    }
+}
+
+// Checks a C++ struct, given by its CONSTANTS_MEMBER()s, against what the
+// shader has.  Padding members, named `pad` and on, need not be in HLSL.
+// Returns the index of the first member that does not match, or -1.
+static int constants_check(ConstantsField const *hlsl, int hlsl_count, ConstantsField const *cpp, int cpp_count)
+{
+    int h = 0;
+    for (int c = 0; c < cpp_count; c++) {
+        if (strncmp(cpp[c].name, "pad", 3) == 0)
+            continue;
+        if (h == hlsl_count || strcmp(hlsl[h].name, cpp[c].name) != 0 || hlsl[h].offset != cpp[c].offset)
+            return c;
+
+        // HLSL leaves off what the last register of an array does not use.
+        if (hlsl[h].size > cpp[c].size || cpp[c].size - hlsl[h].size >= CONSTANTS_REGISTER)
+            return c;
+        h++;
+    }
+    return (h == hlsl_count) ? -1 : cpp_count;
+}
+
+
+
+// Streaming
+// Blocks of constants, one after the other in a chunk of upload memory
+// taken from the ring a few at a time.  Only one thread may write into a
+// stream; threads that record draws each take a stream of their own.
+
+typedef struct ConstantStats {
+    uint64_t    blocks;
+    uint64_t    bytes;              // Taken up, padding included.
+    uint64_t    chunks;             // Taken from the ring.
+} ConstantStats;
+
+typedef struct ConstantStream {
+    Upload          *upload;
+    uint64_t        chunk_size;
+
+    uint8_t         *cpu;
+    uint64_t        gpu;
+    uint64_t        used;
+    uint64_t        size;
+
+    ConstantStats   stats;
+} ConstantStream;
+
+static void constants_init(ConstantStream *stream, Upload *upload, uint64_t chunk_size)
+{
+    ASSERT(chunk_size % CONSTANTS_ALIGN == 0);
+
+    memset(stream, 0, sizeof(*stream));
+    stream->upload = upload;
+    stream->chunk_size = chunk_size;
+}
+
+// Copies whole registers with stores that go around the caches, and fills
+// the rest of the last cache line with zeros: a line written only in part
+// costs as much as if it were read too.  `dst` is aligned to 64 bytes, and
+// has room up to the end of the line; `src` need not be aligned.
+static void constants_copy(uint8_t *dst, void const *src, size_t size)
+{
+    ASSERT(((uintptr_t)dst & 63) == 0 && size % CONSTANTS_REGISTER == 0);
+
+    uint8_t const *from = (uint8_t const *)src;
+    size_t i = 0;
+#if defined(__AVX2__)
+    if (((uintptr_t)dst & 31) == 0) {
+        for (; i + 32 <= size; i += 32)
+            _mm256_stream_si256((__m256i *)(dst + i), _mm256_loadu_si256((__m256i const *)(from + i)));
+    }
+#endif
+    for (; i < size; i += 16)
+        _mm_stream_si128((__m128i *)(dst + i), _mm_loadu_si128((__m128i const *)(from + i)));
+    for (; i & 63; i += 16)
+        _mm_stream_si128((__m128i *)(dst + i), _mm_setzero_si128());
+}
+
+// Room for a block of `size` bytes.  Returns its GPU address, and where to
+// write it in `*cpu`, or 0 when the ring is out of memory.
+static uint64_t constants_alloc(ConstantStream *stream, uint64_t size, uint8_t **cpu)
+{
+    uint64_t block = (size + CONSTANTS_ALIGN - 1) & ~(uint64_t)(CONSTANTS_ALIGN - 1);
+
+    if (stream->used + block > stream->size) {
+        uint64_t chunk = (block > stream->chunk_size) ? block : stream->chunk_size;
+        UploadAllocation allocation;
+        if (!upload_alloc(stream->upload, chunk, CONSTANTS_ALIGN, &allocation))
+            return 0;
+
+        stream->cpu = allocation.cpu;
+        stream->gpu = allocation.gpu;
+        stream->used = 0;
+        stream->size = chunk;
+        stream->stats.chunks++;
+    }
+
+    *cpu = stream->cpu + stream->used;
+    uint64_t gpu = stream->gpu + stream->used;
+    stream->used += block;
+
+    stream->stats.blocks++;
+    stream->stats.bytes += block;
+    return gpu;
+}
+
+// Writes a block, returns its GPU address for a root CBV.  `size` is a whole
+// number of registers, as CONSTANTS_BLOCK() structs are.
+static uint64_t constants_push(ConstantStream *stream, void const *data, uint64_t size)
+{
+    uint8_t *cpu;
+    uint64_t gpu = constants_alloc(stream, size, &cpu);
+    if (gpu)
+        constants_copy(cpu, data, (size_t)size);
+    return gpu;
+}
+
+// Once the frame's blocks are written: the GPU only sees what the
+// non-temporal stores wrote after a fence.  What is left of the chunk is
+// given up.
+static void constants_finish(ConstantStream *stream)
+{
+    _mm_sfence();
+    stream->used = stream->size;
+}
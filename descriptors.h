@@ -0,0 +1,362 @@
+// An allocator for descriptor heaps.
+//
+// One heap is handed out in ranges of descriptors, a single one for a
+// texture or a whole descriptor table at once, from a sorted list of free
+// ranges that merge again as they are given back.  What is handed out is a
+// handle rather than an index: it carries a generation, which changes when
+// the range is freed, so a handle that outlived its descriptors is caught.
+//
+// Freed ranges are only reused once the fence value they were freed with
+// has passed, as the GPU may still be reading them until then.
+//
+// Descriptors are meant to be written into a heap only the CPU sees, and
+// copied into the shader-visible one: the copies are queued, and go out
+// in as few runs of neighbouring descriptors as they can be merged into.
+//
+// Nothing here talks to Direct3D 12.  Copying goes through DescriptorDevice,
+// which bench.cpp stands in for with plain memory.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#ifndef ASSERT
+#define ASSERT(expr)    assert(expr)
+#endif
+
+
+
+// A handle is the index of the first descriptor in the low bits, and its
+// generation in the high ones.  0 is never a valid handle.
+#define DESCRIPTORS_INDEX_BITS  20
+#define DESCRIPTORS_MAX         (1u << DESCRIPTORS_INDEX_BITS)
+#define DESCRIPTORS_NONE        0u
+
+typedef uint32_t DescriptorHandle;
+
+typedef struct DescriptorCopy {
+    uint32_t    dst;            // In the heap copied into.
+    uint32_t    src;            // In the heap copied from.
+    uint32_t    count;
+    uint32_t    order;          // Queued, so that of two into the same place the later wins.
+} DescriptorCopy;
+
+typedef struct DescriptorDevice {
+    void        *ctx;
+    void        (*copy)(void *ctx, DescriptorCopy const *copies, int count);
+} DescriptorDevice;
+
+typedef struct DescriptorRange {
+    uint32_t    first;
+    uint32_t    count;
+} DescriptorRange;
+
+typedef struct DescriptorPending {
+    DescriptorRange range;
+    uint64_t        fence;
+} DescriptorPending;
+
+typedef struct DescriptorStats {
+    uint32_t    used;           // Descriptors handed out, or freed but pending.
+    uint32_t    largest_free;   // The most that one allocation could get.
+    int         free_ranges;
+    uint64_t    allocs;
+    uint64_t    failures;       // Allocations there was no room for.
+    uint64_t    copies;         // Queued.
+    uint64_t    copy_runs;      // What they were merged into.
+} DescriptorStats;
+
+typedef struct Descriptors {
+    DescriptorDevice    device;
+    uint32_t            capacity;
+
+    // Per descriptor: the generation, and for the first of a range in use,
+    // how many descriptors it has (0 otherwise).
+    uint16_t            *generations;
+    uint32_t            *counts;
+
+    // Sorted by first, the highest first, never touching one another.  The
+    // front of the heap is at the back of the list, where it is cheapest
+    // to take from.
+    DescriptorRange     *free;
+    int                 free_count;
+    int                 free_capacity;
+
+    // Freed ranges, in the order of the fence values that retire them.
+    DescriptorPending   *pending;
+    int                 pending_first;
+    int                 pending_count;
+    int                 pending_capacity;
+
+    DescriptorCopy      *copies;
+    int                 copy_count;
+    int                 copy_capacity;
+
+    DescriptorStats     stats;
+} Descriptors;
+
+
+
+// `device` may be NULL for a heap nothing is ever copied into.
+static bool descriptors_init(Descriptors *heap, uint32_t capacity, DescriptorDevice const *device)
+{
+    ASSERT(capacity > 0 && capacity <= DESCRIPTORS_MAX);
+
+    memset(heap, 0, sizeof(*heap));
+    if (device)
+        heap->device = *device;
+    heap->capacity = capacity;
+
+    heap->generations = (uint16_t *)malloc(capacity * sizeof(uint16_t));
+    heap->counts = (uint32_t *)calloc(capacity, sizeof(uint32_t));
+    heap->free_capacity = 16;
+    heap->free = (DescriptorRange *)malloc(heap->free_capacity * sizeof(DescriptorRange));
+    if (!heap->generations || !heap->counts || !heap->free)
+        return false;
+
+    for (uint32_t i = 0; i < capacity; i++)
+        heap->generations[i] = 1;
+
+    heap->free[0].first = 0;
+    heap->free[0].count = capacity;
+    heap->free_count = 1;
+    return true;
+}
+
+static void descriptors_shutdown(Descriptors *heap)
+{
+    free(heap->generations);
+    free(heap->counts);
+    free(heap->free);
+    free(heap->pending);
+    free(heap->copies);
+    memset(heap, 0, sizeof(*heap));
+}
+
+static uint32_t descriptors_generation_bits(uint16_t generation)
+{
+    return (uint32_t)(generation & ((1u << (32 - DESCRIPTORS_INDEX_BITS)) - 1));
+}
+
+static bool descriptors_valid(Descriptors const *heap, DescriptorHandle handle)
+{
+    uint32_t index = handle & (DESCRIPTORS_MAX - 1);
+    return handle != DESCRIPTORS_NONE && index < heap->capacity && heap->counts[index] > 0 &&
+           (handle >> DESCRIPTORS_INDEX_BITS) == descriptors_generation_bits(heap->generations[index]);
+}
+
+// The index of the first descriptor, for CPU and GPU descriptor handles.
+static uint32_t descriptors_index(Descriptors const *heap, DescriptorHandle handle)
+{
+    ASSERT(descriptors_valid(heap, handle));
+    return handle & (DESCRIPTORS_MAX - 1);
+}
+
+// Returns DESCRIPTORS_NONE when no free range is large enough.
+static DescriptorHandle descriptors_alloc(Descriptors *heap, uint32_t count)
+{
+    ASSERT(count > 0);
+
+    // The first range that fits, so that the front of the heap fills up
+    // and the back stays in one piece for large tables.
+    int i = heap->free_count - 1;
+    while (i >= 0 && heap->free[i].count < count)
+        i--;
+    if (i < 0) {
+        heap->stats.failures++;
+        return DESCRIPTORS_NONE;
+    }
+
+    uint32_t first = heap->free[i].first;
+    heap->free[i].first += count;
+    heap->free[i].count -= count;
+    if (heap->free[i].count == 0) {
+        memmove(&heap->free[i], &heap->free[i + 1], (heap->free_count - i - 1) * sizeof(DescriptorRange));
+        heap->free_count--;
+    }
+
+    heap->counts[first] = count;
+    heap->stats.used += count;
+    heap->stats.allocs++;
+
+    // Generations skip whatever would make the handle 0.
+    uint32_t handle = (descriptors_generation_bits(heap->generations[first]) << DESCRIPTORS_INDEX_BITS) | first;
+    ASSERT(handle != DESCRIPTORS_NONE);
+    return handle;
+}
+
+// Puts a range back in the list of free ones, merging it with its
+// neighbours.
+static void descriptors_release(Descriptors *heap, DescriptorRange range)
+{
+    // The ranges above this one come before it in the list.
+    int lo = 0;
+    int hi = heap->free_count;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (heap->free[mid].first > range.first)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    bool above = lo > 0 && range.first + range.count == heap->free[lo - 1].first;
+    bool below = lo < heap->free_count && heap->free[lo].first + heap->free[lo].count == range.first;
+
+    if (above && below) {
+        heap->free[lo].count += range.count + heap->free[lo - 1].count;
+        memmove(&heap->free[lo - 1], &heap->free[lo], (heap->free_count - lo) * sizeof(DescriptorRange));
+        heap->free_count--;
+    } else if (above) {
+        heap->free[lo - 1].first = range.first;
+        heap->free[lo - 1].count += range.count;
+    } else if (below) {
+        heap->free[lo].count += range.count;
+    } else {
+        if (heap->free_count == heap->free_capacity) {
+            heap->free_capacity *= 2;
+            heap->free = (DescriptorRange *)realloc(heap->free, heap->free_capacity * sizeof(DescriptorRange));
+            ASSERT(heap->free);
+        }
+        memmove(&heap->free[lo + 1], &heap->free[lo], (heap->free_count - lo) * sizeof(DescriptorRange));
+        heap->free[lo] = range;
+        heap->free_count++;
+    }
+
+    heap->stats.used -= range.count;
+}
+
+// The handle is invalid from now on, but the descriptors are only reused
+// once the fence has passed `fence`.  With 0, they are reused right away.
+static void descriptors_free(Descriptors *heap, DescriptorHandle handle, uint64_t fence)
+{
+    uint32_t index = descriptors_index(heap, handle);
+
+    DescriptorRange range = {index, heap->counts[index]};
+    heap->counts[index] = 0;
+
+    heap->generations[index]++;
+    if (descriptors_generation_bits(heap->generations[index]) == 0)
+        heap->generations[index]++;
+
+    if (fence == 0) {
+        descriptors_release(heap, range);
+        return;
+    }
+
+    if (heap->pending_first + heap->pending_count == heap->pending_capacity) {
+        // Slide what is left to the front before growing.
+        if (heap->pending_count > 0) {
+            memmove(heap->pending, heap->pending + heap->pending_first,
+                    heap->pending_count * sizeof(DescriptorPending));
+        }
+        heap->pending_first = 0;
+
+        if (heap->pending_count * 2 >= heap->pending_capacity) {
+            heap->pending_capacity = (heap->pending_capacity) ? heap->pending_capacity * 2 : 64;
+            heap->pending = (DescriptorPending *)realloc(
+                heap->pending, heap->pending_capacity * sizeof(DescriptorPending));
+            ASSERT(heap->pending);
+        }
+    }
+
+    int i = heap->pending_first + heap->pending_count++;
+    ASSERT(heap->pending_count == 1 || heap->pending[i - 1].fence <= fence);
+    heap->pending[i].range = range;
+    heap->pending[i].fence = fence;
+}
+
+// Reuses whatever was freed with fence values up to `completed`.
+static void descriptors_retire(Descriptors *heap, uint64_t completed)
+{
+    while (heap->pending_count > 0 && heap->pending[heap->pending_first].fence <= completed) {
+        descriptors_release(heap, heap->pending[heap->pending_first].range);
+        heap->pending_first++;
+        heap->pending_count--;
+    }
+    if (heap->pending_count == 0)
+        heap->pending_first = 0;
+}
+
+
+
+// Copies
+
+// Queues a copy of `count` descriptors from another heap into this one.
+static void descriptors_copy(Descriptors *heap, uint32_t dst, uint32_t src, uint32_t count)
+{
+    ASSERT(dst + count <= heap->capacity);
+
+    heap->stats.copies++;
+
+    // Most copies follow the one before, in both heaps.
+    if (heap->copy_count > 0) {
+        DescriptorCopy *last = &heap->copies[heap->copy_count - 1];
+        if (last->dst + last->count == dst && last->src + last->count == src) {
+            last->count += count;
+            return;
+        }
+    }
+
+    if (heap->copy_count == heap->copy_capacity) {
+        heap->copy_capacity = (heap->copy_capacity) ? heap->copy_capacity * 2 : 64;
+        heap->copies = (DescriptorCopy *)realloc(heap->copies, heap->copy_capacity * sizeof(DescriptorCopy));
+        ASSERT(heap->copies);
+    }
+    DescriptorCopy copy = {dst, src, count, (uint32_t)heap->copy_count};
+    heap->copies[heap->copy_count++] = copy;
+}
+
+// By destination, and then in the order they were queued: qsort() is not
+// stable, and the later of two copies into the same place must win.
+static int descriptors_compare_copies(void const *a, void const *b)
+{
+    DescriptorCopy const *x = (DescriptorCopy const *)a;
+    DescriptorCopy const *y = (DescriptorCopy const *)b;
+    if (x->dst != y->dst)
+        return (x->dst > y->dst) - (x->dst < y->dst);
+    return (x->order > y->order) - (x->order < y->order);
+}
+
+// Does the queued copies, in as few runs as they merge into once sorted.
+// Returns how many runs that took.
+static int descriptors_flush(Descriptors *heap)
+{
+    if (heap->copy_count == 0)
+        return 0;
+    ASSERT(heap->device.copy);
+
+    qsort(heap->copies, heap->copy_count, sizeof(DescriptorCopy), descriptors_compare_copies);
+
+    int runs = 0;
+    for (int i = 0; i < heap->copy_count; i++) {
+        DescriptorCopy const *copy = &heap->copies[i];
+        DescriptorCopy *last = (runs > 0) ? &heap->copies[runs - 1] : NULL;
+
+        if (last && last->dst + last->count == copy->dst && last->src + last->count == copy->src)
+            last->count += copy->count;
+        else
+            heap->copies[runs++] = *copy;
+    }
+
+    heap->device.copy(heap->device.ctx, heap->copies, runs);
+
+    heap->stats.copy_runs += runs;
+    heap->copy_count = 0;
+    return runs;
+}
+
+static DescriptorStats descriptors_stats(Descriptors const *heap)
+{
+    DescriptorStats stats = heap->stats;
+    stats.largest_free = 0;
+    for (int i = 0; i < heap->free_count; i++) {
+        if (heap->free[i].count > stats.largest_free)
+            stats.largest_free = heap->free[i].count;
+    }
+    stats.free_ranges = heap->free_count;
+    return stats;
+}
@@ -0,0 +1,241 @@
+// A queue of window events, from the thread that pumps messages to the
+// thread that renders.
+//
+// There is one producer and one consumer, so the queue is a ring with an
+// index for each of them and no lock: neither thread ever waits for the
+// other.  The consumer drains it once a frame, and coalesces what it finds:
+// of a storm of resizes only the last size is applied, and runs of mouse
+// moves become the last position.  Keys and buttons come through one by
+// one, in order.
+//
+// Should the renderer fall so far behind that the ring fills up, input is
+// dropped and counted, but resizes and closing are latched on the side, so
+// those are never lost.
+//
+// Nothing here knows about Win32: events carry two numbers and the time
+// they were sent, on whatever clock the caller uses.
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include <atomic>
+
+#ifndef ASSERT
+#define ASSERT(expr)    assert(expr)
+#endif
+
+
+
+#define EVENTS_CAPACITY 1024        // A power of two.
+#define EVENTS_BATCH    256         // Input events taken per poll at most.
+
+typedef enum EventType {
+    EVENT_RESIZE,                   // x, y: the new width and height.
+    EVENT_CLOSE,
+    EVENT_KEY,                      // x: the key, y: whether it went down.
+    EVENT_MOUSE_MOVE,               // x, y: where to.
+    EVENT_MOUSE_BUTTON,             // x: the button, y: whether it went down.
+} EventType;
+
+typedef struct Event {
+    uint32_t    type;
+    uint32_t    serial;             // Counts every event sent, from 1.
+    int32_t     x;
+    int32_t     y;
+    double      time;               // When it was sent.
+} Event;
+
+// What one poll found.
+typedef struct EventBatch {
+    bool        resized;
+    int         width;
+    int         height;
+    double      resize_time;
+    bool        closed;
+
+    Event       input[EVENTS_BATCH];
+    int         input_count;
+} EventBatch;
+
+typedef struct EventStats {
+    uint64_t    sent;
+    uint64_t    dropped;            // Input that found the ring full.
+    uint64_t    latched;            // Resizes and closes that did.
+    uint64_t    received;
+    uint64_t    coalesced;          // Folded into a later event.
+    double      latency_sum;        // From sending to polling, in seconds.
+    double      latency_max;
+} EventStats;
+
+typedef struct EventQueue {
+    Event                       slots[EVENTS_CAPACITY];
+
+    // The producer's.
+    alignas(64) std::atomic<uint32_t>   tail;
+    uint32_t                    head_seen;
+    uint32_t                    serial;
+    std::atomic<uint64_t>       sent;
+    std::atomic<uint64_t>       dropped;
+    std::atomic<uint64_t>       latched;
+
+    // What did not fit: the serial of a resize and its size, and closing.
+    alignas(64) std::atomic<uint64_t>   latched_resize;
+    std::atomic<bool>           latched_close;
+
+    // The consumer's.
+    alignas(64) std::atomic<uint32_t>   head;
+    uint32_t                    tail_seen;
+    uint32_t                    resize_serial;
+    uint64_t                    received;
+    uint64_t                    coalesced;
+    double                      latency_sum;
+    double                      latency_max;
+} EventQueue;
+
+
+
+static void events_init(EventQueue *q)
+{
+    q->tail = 0;
+    q->head_seen = 0;
+    q->serial = 0;
+    q->sent = 0;
+    q->dropped = 0;
+    q->latched = 0;
+    q->latched_resize = 0;
+    q->latched_close = false;
+    q->head = 0;
+    q->tail_seen = 0;
+    q->resize_serial = 0;
+    q->received = 0;
+    q->coalesced = 0;
+    q->latency_sum = 0.0;
+    q->latency_max = 0.0;
+}
+
+// From the producer.  Returns false when input was dropped.
+static bool events_send(EventQueue *q, EventType type, int x, int y, double time)
+{
+    uint32_t serial = ++q->serial;
+    q->sent.store(q->sent.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+    uint32_t tail = q->tail.load(std::memory_order_relaxed);
+    if (tail - q->head_seen == EVENTS_CAPACITY)
+        q->head_seen = q->head.load(std::memory_order_acquire);
+
+    if (tail - q->head_seen == EVENTS_CAPACITY) {
+        if (type == EVENT_RESIZE) {
+            ASSERT(x >= 0 && x <= 0xffff && y >= 0 && y <= 0xffff);
+            q->latched_resize.store(((uint64_t)serial << 32) | ((uint64_t)x << 16) | (uint64_t)y,
+                                    std::memory_order_release);
+        } else if (type == EVENT_CLOSE) {
+            q->latched_close.store(true, std::memory_order_release);
+        } else {
+            q->dropped.store(q->dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return false;
+        }
+        q->latched.store(q->latched.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    Event *event = &q->slots[tail & (EVENTS_CAPACITY - 1)];
+    event->type = (uint32_t)type;
+    event->serial = serial;
+    event->x = x;
+    event->y = y;
+    event->time = time;
+
+    q->tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+static void events_resize(EventQueue *q, EventBatch *batch, uint32_t serial, int width, int height)
+{
+    if (batch->resized)
+        q->coalesced++;
+
+    batch->resized = true;
+    batch->width = width;
+    batch->height = height;
+    q->resize_serial = serial;
+}
+
+// From the consumer, once a frame: takes what was sent, coalesced, into
+// `batch`.  `now` is on the clock the events were sent with.
+static void events_poll(EventQueue *q, double now, EventBatch *batch)
+{
+    batch->resized = false;
+    batch->closed = false;
+    batch->input_count = 0;
+
+    uint32_t head = q->head.load(std::memory_order_relaxed);
+    if (head == q->tail_seen)
+        q->tail_seen = q->tail.load(std::memory_order_acquire);
+
+    while (head != q->tail_seen) {
+        Event const *event = &q->slots[head & (EVENTS_CAPACITY - 1)];
+
+        if (event->type == EVENT_RESIZE) {
+            events_resize(q, batch, event->serial, event->x, event->y);
+            batch->resize_time = event->time;
+        } else if (event->type == EVENT_CLOSE) {
+            batch->closed = true;
+        } else {
+            Event *last = (batch->input_count > 0) ? &batch->input[batch->input_count - 1] : NULL;
+            if (event->type == EVENT_MOUSE_MOVE && last && last->type == EVENT_MOUSE_MOVE) {
+                *last = *event;
+                q->coalesced++;
+            } else if (batch->input_count < EVENTS_BATCH) {
+                batch->input[batch->input_count++] = *event;
+            } else {
+                // The rest waits for the next poll.
+                break;
+            }
+        }
+
+        double latency = now - event->time;
+        q->latency_sum += latency;
+        if (latency > q->latency_max)
+            q->latency_max = latency;
+        q->received++;
+
+        head++;
+        if (head == q->tail_seen)
+            q->tail_seen = q->tail.load(std::memory_order_acquire);
+    }
+
+    q->head.store(head, std::memory_order_release);
+
+    // What was latched came after all that was in the ring, so it waits
+    // until that is all taken.  A resize is applied only when nothing newer
+    // came through the ring in the meantime.
+    if (head != q->tail_seen)
+        return;
+
+    uint64_t latched = q->latched_resize.exchange(0, std::memory_order_acquire);
+    if (latched && (uint32_t)(latched >> 32) > q->resize_serial) {
+        events_resize(q, batch, (uint32_t)(latched >> 32),
+                      (int)((latched >> 16) & 0xffff), (int)(latched & 0xffff));
+        batch->resize_time = now;
+    }
+    if (q->latched_close.exchange(false, std::memory_order_acquire))
+        batch->closed = true;
+}
+
+// Only the consumer sees it all exactly; what the producer counts may be
+// a little behind.
+static EventStats events_stats(EventQueue const *q)
+{
+    EventStats stats;
+    stats.sent = q->sent.load(std::memory_order_relaxed);
+    stats.dropped = q->dropped.load(std::memory_order_relaxed);
+    stats.latched = q->latched.load(std::memory_order_relaxed);
+    stats.received = q->received;
+    stats.coalesced = q->coalesced;
+    stats.latency_sum = q->latency_sum;
+    stats.latency_max = q->latency_max;
+    return stats;
+}
@@ -0,0 +1,184 @@
+// A stand-in for a Direct3D 12 command queue and its fences.
+//
+// The queue runs on a thread of its own and works through what it is given in
+// order, just like the real one: "executing" a command list sleeps for as
+// long as that list is declared to take on the GPU, Signal sets a fence once
+// everything before it has executed, and Wait holds the queue until a fence
+// reaches a value.  That is enough to exercise and time the CPU-side logic
+// that schedules work on a GPU, on machines that do not have one.
+
+#pragma once
+
+#include <stdint.h>
+#include <assert.h>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+
+#ifndef ASSERT
+#define ASSERT(expr)    assert(expr)
+#endif
+
+
+
+// Fences
+
+typedef struct FakeFence {
+    std::atomic<uint64_t>       completed;
+    std::mutex                  mutex;
+    std::condition_variable     changed;
+} FakeFence;
+
+static void fake_fence_init(FakeFence *fence, uint64_t value)
+{
+    fence->completed = value;
+}
+
+// ID3D12Fence::GetCompletedValue().
+static uint64_t fake_fence_completed(FakeFence *fence)
+{
+    return fence->completed.load(std::memory_order_acquire);
+}
+
+// ID3D12Fence::Signal(), from the CPU.
+static void fake_fence_signal(FakeFence *fence, uint64_t value)
+{
+    std::unique_lock<std::mutex> lock(fence->mutex);
+    fence->completed.store(value, std::memory_order_release);
+    fence->changed.notify_all();
+}
+
+// SetEventOnCompletion() followed by WaitForSingleObject().
+static void fake_fence_wait(FakeFence *fence, uint64_t value)
+{
+    if (fake_fence_completed(fence) >= value)
+        return;
+
+    std::unique_lock<std::mutex> lock(fence->mutex);
+    while (fake_fence_completed(fence) < value)
+        fence->changed.wait(lock);
+}
+
+
+
+// The Queue
+
+#define FAKE_QUEUE_CAPACITY     1024
+
+enum {
+    FAKE_EXECUTE,
+    FAKE_SIGNAL,
+    FAKE_WAIT,
+};
+
+typedef struct FakeCommand {
+    int         type;
+    double      cost;       // FAKE_EXECUTE: seconds of GPU time.
+    FakeFence   *fence;     // FAKE_SIGNAL, FAKE_WAIT.
+    uint64_t    value;
+} FakeCommand;
+
+typedef struct FakeQueue {
+    std::thread                 thread;
+    std::mutex                  mutex;
+    std::condition_variable     changed;
+    bool                        quit;
+
+    FakeCommand                 commands[FAKE_QUEUE_CAPACITY];
+    uint64_t                    head;   // Next to run.
+    uint64_t                    tail;   // Next free.
+
+    // Totals, for reports.
+    double                      busy;       // Seconds spent executing.
+    uint64_t                    executed;   // Command lists executed.
+} FakeQueue;
+
+static void fake_queue_run(FakeQueue *queue)
+{
+    while (1) {
+        FakeCommand cmd;
+        {
+            std::unique_lock<std::mutex> lock(queue->mutex);
+            while (!queue->quit && queue->head == queue->tail)
+                queue->changed.wait(lock);
+            if (queue->head == queue->tail)
+                return;
+            cmd = queue->commands[queue->head % FAKE_QUEUE_CAPACITY];
+        }
+
+        switch (cmd.type) {
+        case FAKE_EXECUTE:
+            // The GPU works on its own, it does not hold a CPU core.
+            std::this_thread::sleep_for(std::chrono::duration<double>(cmd.cost));
+            queue->busy += cmd.cost;
+            queue->executed++;
+            break;
+        case FAKE_SIGNAL:
+            fake_fence_signal(cmd.fence, cmd.value);
+            break;
+        case FAKE_WAIT:
+            fake_fence_wait(cmd.fence, cmd.value);
+            break;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(queue->mutex);
+            queue->head++;
+            queue->changed.notify_all();
+        }
+    }
+}
+
+static void fake_queue_init(FakeQueue *queue)
+{
+    queue->quit = false;
+    queue->head = 0;
+    queue->tail = 0;
+    queue->busy = 0.0;
+    queue->executed = 0;
+    queue->thread = std::thread(fake_queue_run, queue);
+}
+
+// Lets the queue finish what it was given, then stops it.
+static void fake_queue_shutdown(FakeQueue *queue)
+{
+    {
+        std::unique_lock<std::mutex> lock(queue->mutex);
+        queue->quit = true;
+        queue->changed.notify_all();
+    }
+    queue->thread.join();
+}
+
+static void fake_queue_push(FakeQueue *queue, FakeCommand cmd)
+{
+    std::unique_lock<std::mutex> lock(queue->mutex);
+    while (queue->tail - queue->head == FAKE_QUEUE_CAPACITY)
+        queue->changed.wait(lock);
+    queue->commands[queue->tail++ % FAKE_QUEUE_CAPACITY] = cmd;
+    queue->changed.notify_all();
+}
+
+// ExecuteCommandLists() with a list that takes `cost` seconds to run.
+static void fake_queue_execute(FakeQueue *queue, double cost)
+{
+    FakeCommand cmd = {FAKE_EXECUTE, cost, NULL, 0};
+    fake_queue_push(queue, cmd);
+}
+
+// ID3D12CommandQueue::Signal().
+static void fake_queue_signal(FakeQueue *queue, FakeFence *fence, uint64_t value)
+{
+    FakeCommand cmd = {FAKE_SIGNAL, 0.0, fence, value};
+    fake_queue_push(queue, cmd);
+}
+
+// ID3D12CommandQueue::Wait().
+static void fake_queue_wait(FakeQueue *queue, FakeFence *fence, uint64_t value)
+{
+    FakeCommand cmd = {FAKE_WAIT, 0.0, fence, value};
+    fake_queue_push(queue, cmd);
+}
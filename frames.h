@@ -0,0 +1,66 @@
+// Bookkeeping for several frames in flight.
+//
+// Every frame slot owns the resources the CPU writes while recording a frame
+// (a command allocator, to begin with) and remembers the fence value that the
+// queue signals once it is done with that frame.  Before a slot is recorded
+// into again, only that value needs to be waited on, so the CPU can be up to
+// `count` frames ahead of the GPU instead of waiting for it every frame.
+//
+// Nothing here talks to Direct3D 12: the caller does the Signal and the wait
+// with whatever values these functions return, which lets the same logic run
+// against the stand-in queue of fake.h.
+
+#pragma once
+
+#include <stdint.h>
+#include <assert.h>
+
+#ifndef ASSERT
+#define ASSERT(expr)    assert(expr)
+#endif
+
+
+
+#define FRAMES_MAX  4
+
+typedef struct Frames {
+    int         count;                  // Frames in flight, 1 to FRAMES_MAX.
+    int         index;                  // The slot being recorded.
+    uint64_t    value;                  // The last fence value handed out.
+    uint64_t    values[FRAMES_MAX];     // What retires each slot, 0 if nothing.
+} Frames;
+
+// The fence is expected to start at 0, values handed out start at 1.
+static void frames_init(Frames *frames, int count)
+{
+    ASSERT(count >= 1 && count <= FRAMES_MAX);
+
+    frames->count = count;
+    frames->index = 0;
+    frames->value = 0;
+    for (int i = 0; i < FRAMES_MAX; i++)
+        frames->values[i] = 0;
+}
+
+// The fence value to wait for before the current slot can be reused.
+static uint64_t frames_begin(Frames const *frames)
+{
+    return frames->values[frames->index];
+}
+
+// Call once the frame has been submitted.  Returns the fence value to
+// signal, and moves on to the next slot.
+static uint64_t frames_end(Frames *frames)
+{
+    uint64_t value = ++frames->value;
+    frames->values[frames->index] = value;
+    frames->index = (frames->index + 1) % frames->count;
+    return value;
+}
+
+// The fence value to wait for before the GPU is idle, e.g. before the swap
+// chain buffers are resized or anything is released.
+static uint64_t frames_drain(Frames const *frames)
+{
+    return frames->value;
+}
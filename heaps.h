@@ -0,0 +1,561 @@
+// An allocator for GPU memory, to place resources in.
+//
+// Rather than every resource being committed on its own, which takes a trip
+// to the kernel and at least 64 KB each, memory is reserved in large blocks
+// (ID3D12Heaps), and resources are placed at offsets in them.  Each pool of
+// blocks is for one kind of heap, as Direct3D 12 wants buffers, textures
+// and render targets in heaps of their own on some hardware.
+//
+// Offsets are handed out by a two-level segregated fit allocator (TLSF):
+// free ranges are kept in lists by size class, a power of two split in 16,
+// and two levels of bitmaps find a list with a range large enough in
+// constant time.  Freed ranges merge with free neighbours at once.  Sizes
+// and offsets are in units of the pool's granularity, 64 KB, which is what
+// resources are aligned to; MSAA textures want 4 MB, which is taken care
+// of by splitting off what comes before the aligned offset.
+//
+// Resources used only in part of a frame can share memory with each other:
+// heaps_pack() lays them out in one heap so that those in use at the same
+// time never overlap, and tells which one each has to alias from.
+//
+// Nothing here talks to Direct3D 12.  Blocks are created through HeapDevice,
+// which bench.cpp stands in for with nothing at all.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#ifndef ASSERT
+#define ASSERT(expr)    assert(expr)
+#endif
+
+
+
+#define HEAPS_SL_BITS       4
+#define HEAPS_SL            (1 << HEAPS_SL_BITS)
+#define HEAPS_FL            32
+#define HEAPS_NONE          (-1)
+
+#define HEAPS_GRANULARITY   (64ull * 1024)              // D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT
+#define HEAPS_MSAA          (4ull * 1024 * 1024)        // D3D12_DEFAULT_MSAA_RESOURCE_PLACEMENT_ALIGNMENT
+
+typedef struct HeapDevice {
+    void        *ctx;
+    // Creates a block of `size` bytes for pool `pool`.
+    bool        (*create)(void *ctx, int pool, uint64_t size, void **block);
+    void        (*destroy)(void *ctx, int pool, void *block);
+} HeapDevice;
+
+// Where a resource goes.
+typedef struct HeapAllocation {
+    void        *block;             // What HeapDevice created, NULL on failure.
+    uint64_t    offset;             // In bytes.
+    uint64_t    size;
+    int         range;              // For heaps_free().
+} HeapAllocation;
+
+// A range of a block, free or not, in granules.
+typedef struct HeapRange {
+    uint32_t    offset;
+    uint32_t    size;
+    int         block;
+    bool        free;
+    int         prev;               // The neighbours in the block, by offset.
+    int         next;
+    int         prev_free;          // In its free list; next_free also links
+    int         next_free;          // unused HeapRanges.
+} HeapRange;
+
+typedef struct HeapBlock {
+    void        *block;             // NULL for an unused HeapBlock.
+    uint32_t    size;
+    uint32_t    used;
+} HeapBlock;
+
+typedef struct HeapStats {
+    uint64_t    reserved;           // In blocks, in bytes.
+    uint64_t    used;
+    uint64_t    used_peak;
+    uint64_t    largest_free;
+    uint64_t    free;
+    int         free_ranges;
+    int         blocks;
+    int         allocations;
+    uint64_t    allocs;             // Ever.
+    uint64_t    blocks_created;
+    uint64_t    failures;
+} HeapStats;
+
+typedef struct Heaps {
+    HeapDevice  device;
+    int         pool;               // Passed on to the device.
+    uint64_t    granularity;
+    uint32_t    block_size;         // In granules.
+
+    HeapRange   *ranges;
+    int         range_count;
+    int         range_capacity;
+    int         range_unused;
+
+    HeapBlock   *blocks;
+    int         block_count;
+
+    // Which first levels have any free lists that are not empty, and which
+    // second levels of each.
+    uint32_t    fl_bitmap;
+    uint32_t    sl_bitmap[HEAPS_FL];
+    int         heads[HEAPS_FL][HEAPS_SL];
+
+    HeapStats   stats;
+} Heaps;
+
+
+
+// Size Classes
+
+static int heaps_log2(uint32_t x)
+{
+    int n = 0;
+    while (x >>= 1)
+        n++;
+    return n;
+}
+
+static int heaps_lowest(uint32_t x)
+{
+    int n = 0;
+    while (!(x & 1)) {
+        x >>= 1;
+        n++;
+    }
+    return n;
+}
+
+// The list a free range of `size` granules goes in.
+static void heaps_class(uint32_t size, int *fl, int *sl)
+{
+    *fl = heaps_log2(size);
+    if (*fl >= HEAPS_SL_BITS)
+        *sl = (int)((size >> (*fl - HEAPS_SL_BITS)) ^ HEAPS_SL);
+    else
+        *sl = (int)((size << (HEAPS_SL_BITS - *fl)) ^ HEAPS_SL);
+}
+
+static void heaps_link(Heaps *heaps, int r)
+{
+    HeapRange *range = &heaps->ranges[r];
+    int fl, sl;
+    heaps_class(range->size, &fl, &sl);
+
+    range->free = true;
+    range->prev_free = HEAPS_NONE;
+    range->next_free = heaps->heads[fl][sl];
+    if (range->next_free != HEAPS_NONE)
+        heaps->ranges[range->next_free].prev_free = r;
+    heaps->heads[fl][sl] = r;
+
+    heaps->fl_bitmap |= 1u << fl;
+    heaps->sl_bitmap[fl] |= 1u << sl;
+}
+
+static void heaps_unlink(Heaps *heaps, int r)
+{
+    HeapRange *range = &heaps->ranges[r];
+    int fl, sl;
+    heaps_class(range->size, &fl, &sl);
+
+    if (range->prev_free != HEAPS_NONE)
+        heaps->ranges[range->prev_free].next_free = range->next_free;
+    else
+        heaps->heads[fl][sl] = range->next_free;
+    if (range->next_free != HEAPS_NONE)
+        heaps->ranges[range->next_free].prev_free = range->prev_free;
+
+    if (heaps->heads[fl][sl] == HEAPS_NONE) {
+        heaps->sl_bitmap[fl] &= ~(1u << sl);
+        if (!heaps->sl_bitmap[fl])
+            heaps->fl_bitmap &= ~(1u << fl);
+    }
+    range->free = false;
+}
+
+// A free range of at least `size` granules, from a list whose ranges are
+// all large enough, or HEAPS_NONE.
+static int heaps_find(Heaps const *heaps, uint32_t size)
+{
+    // Up to the next class, so that any range in it will do.
+    int fl = heaps_log2(size);
+    if (fl >= HEAPS_SL_BITS) {
+        uint64_t rounded = (uint64_t)size + (1u << (fl - HEAPS_SL_BITS)) - 1;
+        if (rounded > 0xffffffffu)
+            return HEAPS_NONE;
+        size = (uint32_t)rounded;
+    }
+
+    int sl;
+    heaps_class(size, &fl, &sl);
+
+    uint32_t sl_map = heaps->sl_bitmap[fl] & (~0u << sl);
+    if (!sl_map) {
+        uint32_t fl_map = (fl + 1 < HEAPS_FL) ? heaps->fl_bitmap & (~0u << (fl + 1)) : 0;
+        if (!fl_map)
+            return HEAPS_NONE;
+        fl = heaps_lowest(fl_map);
+        sl_map = heaps->sl_bitmap[fl];
+    }
+    return heaps->heads[fl][heaps_lowest(sl_map)];
+}
+
+
+
+// Ranges and Blocks
+
+static int heaps_new_range(Heaps *heaps)
+{
+    if (heaps->range_unused != HEAPS_NONE) {
+        int r = heaps->range_unused;
+        heaps->range_unused = heaps->ranges[r].next_free;
+        return r;
+    }
+
+    if (heaps->range_count == heaps->range_capacity) {
+        heaps->range_capacity = (heaps->range_capacity) ? heaps->range_capacity * 2 : 256;
+        heaps->ranges = (HeapRange *)realloc(heaps->ranges, heaps->range_capacity * sizeof(HeapRange));
+        ASSERT(heaps->ranges);
+    }
+    return heaps->range_count++;
+}
+
+static void heaps_delete_range(Heaps *heaps, int r)
+{
+    heaps->ranges[r].block = HEAPS_NONE;
+    heaps->ranges[r].next_free = heaps->range_unused;
+    heaps->range_unused = r;
+}
+
+// Splits `size` granules off the front of range `r`, and returns the rest.
+static int heaps_split(Heaps *heaps, int r, uint32_t size)
+{
+    int rest = heaps_new_range(heaps);
+    HeapRange *range = &heaps->ranges[r];
+    HeapRange *after = &heaps->ranges[rest];
+
+    after->offset = range->offset + size;
+    after->size = range->size - size;
+    after->block = range->block;
+    after->free = false;
+    after->prev = r;
+    after->next = range->next;
+    if (range->next != HEAPS_NONE)
+        heaps->ranges[range->next].prev = rest;
+
+    range->size = size;
+    range->next = rest;
+    return rest;
+}
+
+// Folds range `b`, right after `a`, into it.
+static void heaps_merge(Heaps *heaps, int a, int b)
+{
+    HeapRange *range = &heaps->ranges[a];
+    HeapRange *after = &heaps->ranges[b];
+    ASSERT(range->offset + range->size == after->offset);
+
+    range->size += after->size;
+    range->next = after->next;
+    if (after->next != HEAPS_NONE)
+        heaps->ranges[after->next].prev = a;
+    heaps_delete_range(heaps, b);
+}
+
+static bool heaps_add_block(Heaps *heaps, uint32_t size)
+{
+    void *block;
+    if (!heaps->device.create(heaps->device.ctx, heaps->pool, (uint64_t)size * heaps->granularity, &block))
+        return false;
+
+    int b = 0;
+    while (b < heaps->block_count && heaps->blocks[b].block)
+        b++;
+    if (b == heaps->block_count) {
+        heaps->blocks = (HeapBlock *)realloc(heaps->blocks, (heaps->block_count + 1) * sizeof(HeapBlock));
+        ASSERT(heaps->blocks);
+        heaps->block_count++;
+    }
+    heaps->blocks[b].block = block;
+    heaps->blocks[b].size = size;
+    heaps->blocks[b].used = 0;
+
+    int r = heaps_new_range(heaps);
+    HeapRange *range = &heaps->ranges[r];
+    range->offset = 0;
+    range->size = size;
+    range->block = b;
+    range->prev = HEAPS_NONE;
+    range->next = HEAPS_NONE;
+    heaps_link(heaps, r);
+
+    heaps->stats.reserved += (uint64_t)size * heaps->granularity;
+    heaps->stats.blocks++;
+    heaps->stats.blocks_created++;
+    return true;
+}
+
+static void heaps_remove_block(Heaps *heaps, int b, int r)
+{
+    HeapBlock *block = &heaps->blocks[b];
+    ASSERT(block->used == 0);
+
+    heaps_unlink(heaps, r);
+    heaps_delete_range(heaps, r);
+
+    heaps->device.destroy(heaps->device.ctx, heaps->pool, block->block);
+    heaps->stats.reserved -= (uint64_t)block->size * heaps->granularity;
+    heaps->stats.blocks--;
+    block->block = NULL;
+}
+
+
+
+// Allocating
+
+// Blocks are `block_size` bytes, or whatever an allocation larger than that
+// needs.  `pool` is only passed on to the device.
+static void heaps_init(Heaps *heaps, HeapDevice const *device, int pool, uint64_t block_size)
+{
+    ASSERT(block_size % HEAPS_GRANULARITY == 0);
+
+    memset(heaps, 0, sizeof(*heaps));
+    heaps->device = *device;
+    heaps->pool = pool;
+    heaps->granularity = HEAPS_GRANULARITY;
+    heaps->block_size = (uint32_t)(block_size / HEAPS_GRANULARITY);
+    heaps->range_unused = HEAPS_NONE;
+
+    for (int fl = 0; fl < HEAPS_FL; fl++) {
+        for (int sl = 0; sl < HEAPS_SL; sl++)
+            heaps->heads[fl][sl] = HEAPS_NONE;
+    }
+}
+
+// Whatever is still allocated goes with the blocks.
+static void heaps_shutdown(Heaps *heaps)
+{
+    for (int b = 0; b < heaps->block_count; b++) {
+        if (heaps->blocks[b].block)
+            heaps->device.destroy(heaps->device.ctx, heaps->pool, heaps->blocks[b].block);
+    }
+    free(heaps->blocks);
+    free(heaps->ranges);
+    memset(heaps, 0, sizeof(*heaps));
+}
+
+// `alignment` is a power of two; anything up to the granularity comes for
+// free.  Returns an allocation with a NULL block when no block could be
+// created for it.
+static HeapAllocation heaps_alloc(Heaps *heaps, uint64_t size, uint64_t alignment)
+{
+    ASSERT(size > 0 && (alignment & (alignment - 1)) == 0);
+
+    HeapAllocation allocation = {NULL, 0, 0, HEAPS_NONE};
+    uint64_t granules = (size + heaps->granularity - 1) / heaps->granularity;
+    uint64_t align = (alignment > heaps->granularity) ? alignment / heaps->granularity : 1;
+    if (granules + align - 1 > 0xffffffffu) {
+        heaps->stats.failures++;
+        return allocation;
+    }
+
+    // Room for the range wherever in a range it has to start.
+    uint32_t needed = (uint32_t)(granules + align - 1);
+    int r = heaps_find(heaps, needed);
+    if (r == HEAPS_NONE) {
+        uint32_t block_size = (needed > heaps->block_size) ? needed : heaps->block_size;
+        if (!heaps_add_block(heaps, block_size)) {
+            heaps->stats.failures++;
+            return allocation;
+        }
+        r = heaps_find(heaps, needed);
+        ASSERT(r != HEAPS_NONE);
+    }
+    heaps_unlink(heaps, r);
+
+    // What comes before the aligned offset stays free.
+    uint32_t offset = heaps->ranges[r].offset;
+    uint32_t pad = (uint32_t)(((offset + align - 1) & ~(align - 1)) - offset);
+    if (pad) {
+        int front = r;
+        r = heaps_split(heaps, front, pad);
+        heaps_link(heaps, front);
+    }
+    if (heaps->ranges[r].size > granules)
+        heaps_link(heaps, heaps_split(heaps, r, (uint32_t)granules));
+
+    HeapRange *range = &heaps->ranges[r];
+    HeapBlock *block = &heaps->blocks[range->block];
+    block->used += range->size;
+
+    heaps->stats.used += (uint64_t)range->size * heaps->granularity;
+    if (heaps->stats.used > heaps->stats.used_peak)
+        heaps->stats.used_peak = heaps->stats.used;
+    heaps->stats.allocations++;
+    heaps->stats.allocs++;
+
+    allocation.block = block->block;
+    allocation.offset = (uint64_t)range->offset * heaps->granularity;
+    allocation.size = (uint64_t)range->size * heaps->granularity;
+    allocation.range = r;
+    return allocation;
+}
+
+// Frees right away: whatever was placed there has to be released, and the
+// GPU done with it.  A block that ends up empty is given back, unless it is
+// the only one left.
+static void heaps_free(Heaps *heaps, HeapAllocation const *allocation)
+{
+    int r = allocation->range;
+    ASSERT(r >= 0 && r < heaps->range_count);
+
+    HeapRange *range = &heaps->ranges[r];
+    ASSERT(!range->free && range->block != HEAPS_NONE);
+    ASSERT(heaps->blocks[range->block].block == allocation->block);
+
+    int b = range->block;
+    heaps->blocks[b].used -= range->size;
+    heaps->stats.used -= (uint64_t)range->size * heaps->granularity;
+    heaps->stats.allocations--;
+
+    if (range->next != HEAPS_NONE && heaps->ranges[range->next].free) {
+        heaps_unlink(heaps, range->next);
+        heaps_merge(heaps, r, range->next);
+    }
+    if (range->prev != HEAPS_NONE && heaps->ranges[range->prev].free) {
+        int prev = range->prev;
+        heaps_unlink(heaps, prev);
+        heaps_merge(heaps, prev, r);
+        r = prev;
+    }
+    heaps_link(heaps, r);
+
+    if (heaps->blocks[b].used == 0 && heaps->stats.blocks > 1)
+        heaps_remove_block(heaps, b, r);
+}
+
+// How fragmented the free memory is: 0 when it is all in one range, close
+// to 1 when it is in many small ones.
+static double heaps_fragmentation(HeapStats const *stats)
+{
+    return (stats->free) ? 1.0 - (double)stats->largest_free / (double)stats->free : 0.0;
+}
+
+static HeapStats heaps_stats(Heaps const *heaps)
+{
+    HeapStats stats = heaps->stats;
+    stats.free = 0;
+    stats.largest_free = 0;
+    stats.free_ranges = 0;
+
+    for (int fl = 0; fl < HEAPS_FL; fl++) {
+        for (int sl = 0; sl < HEAPS_SL; sl++) {
+            for (int r = heaps->heads[fl][sl]; r != HEAPS_NONE; r = heaps->ranges[r].next_free) {
+                uint64_t size = (uint64_t)heaps->ranges[r].size * heaps->granularity;
+                stats.free += size;
+                if (size > stats.largest_free)
+                    stats.largest_free = size;
+                stats.free_ranges++;
+            }
+        }
+    }
+    return stats;
+}
+
+
+
+// Transient Resources
+// Resources that only live for some of the passes of a frame, laid out in
+// one heap of their own.  Those used in passes that overlap never share
+// memory; others may, one after another, with an aliasing barrier between.
+
+typedef struct HeapTransient {
+    uint64_t    size;
+    uint64_t    alignment;
+    int         first;              // The first and last pass it is used in.
+    int         last;
+
+    // Set by heaps_pack().
+    uint64_t    offset;
+    int         alias;              // Whose memory it takes over last, or HEAPS_NONE.
+} HeapTransient;
+
+static bool heaps_overlap(HeapTransient const *a, HeapTransient const *b)
+{
+    return a->offset < b->offset + b->size && b->offset < a->offset + a->size;
+}
+
+static bool heaps_concurrent(HeapTransient const *a, HeapTransient const *b)
+{
+    return a->first <= b->last && b->first <= a->last;
+}
+
+// Places every resource at the lowest offset where it overlaps nothing it
+// is used at the same time as.  Returns the size of the heap they need.
+static uint64_t heaps_pack(HeapTransient *resources, int count)
+{
+    // Largest first: small ones fill in around them better than the other
+    // way around.  There are never many.
+    int *order = (int *)malloc(count * sizeof(int));
+    ASSERT(order || count == 0);
+    for (int i = 0; i < count; i++) {
+        int k = i;
+        while (k > 0 && resources[order[k - 1]].size < resources[i].size) {
+            order[k] = order[k - 1];
+            k--;
+        }
+        order[k] = i;
+    }
+
+    uint64_t total = 0;
+    for (int i = 0; i < count; i++) {
+        HeapTransient *r = &resources[order[i]];
+        uint64_t align = (r->alignment > HEAPS_GRANULARITY) ? r->alignment : HEAPS_GRANULARITY;
+
+        // It goes at 0, or right after something placed already.
+        uint64_t best = UINT64_MAX;
+        for (int k = -1; k < i; k++) {
+            uint64_t at = (k < 0) ? 0 : resources[order[k]].offset + resources[order[k]].size;
+            at = (at + align - 1) & ~(align - 1);
+            if (at >= best)
+                continue;
+
+            r->offset = at;
+            bool fits = true;
+            for (int j = 0; j < i && fits; j++) {
+                HeapTransient const *other = &resources[order[j]];
+                fits = !heaps_concurrent(r, other) || !heaps_overlap(r, other);
+            }
+            if (fits)
+                best = at;
+        }
+
+        r->offset = best;
+        if (r->offset + r->size > total)
+            total = r->offset + r->size;
+    }
+
+    // Each takes over from the last of those before it in its memory.
+    for (int i = 0; i < count; i++) {
+        HeapTransient *r = &resources[i];
+        r->alias = HEAPS_NONE;
+        for (int j = 0; j < count; j++) {
+            HeapTransient const *other = &resources[j];
+            if (j != i && other->last < r->first && heaps_overlap(r, other) &&
+                (r->alias == HEAPS_NONE || other->last > resources[r->alias].last))
+                r->alias = j;
+        }
+    }
+
+    free(order);
+    return total;
+}
@@ -7,6 +7,7 @@
 #include <d3d12.h>
 #include <dxgi1_4.h>
 #include <d3dcompiler.h>
+#include <dwmapi.h>
 
 #include <stdlib.h>
 #include <stdint.h>
@@ -17,6 +18,7 @@
 #pragma comment (lib, "d3d12.lib")
 #pragma comment (lib, "dxgi.lib")
 #pragma comment (lib, "d3dcompiler.lib")
+#pragma comment (lib, "dwmapi.lib")
 
 
 
@@ -25,468 +27,2238 @@
 
 
 
+#include "scene.h"
+#include "frames.h"
+#include "upload.h"
+#include "transfer.h"
+#include "threads.h"
+#include "texture.h"
+#include "bcn.h"
+#include "cache.h"
+#include "tasks.h"
+#include "profile.h"
+#include "batch.h"
+#include "descriptors.h"
+#include "barriers.h"
+#include "jobs.h"
+#include "events.h"
+#include "pacing.h"
+#include "heaps.h"
+#include "constants.h"
+#include "vertices.h"
+#include "pack.h"
+#include "mesh.h"
+#include "capture.h"
+#include "reload.h"
+#include "pipelines.h"
+#include "indirect.h"
+#include "resolution.h"
+
+
+
 // Window Properties
 
-static wchar_t const    *window_title       = L"Hello Triangle in D3D12";
+static wchar_t const    *window_title       = L"Hello Triangle in D3D12";
+
+// These are updated by the render thread every time the window has been
+// resized.
+static int              window_width        = 720;
+static int              window_height       = 480;
+static float            window_aspect       = (float)window_height /
+                                                (float)window_width;
+static bool             window_resized      = false;
+
+// What the window thread sends the render thread.
+static EventQueue       window_events;
+
+// Sent to the window by the render thread once it is done with it.
+#define WM_RENDER_DONE  (WM_APP + 1)
+
+
+
+// How many frames the CPU may record ahead of the GPU (1 to FRAMES_MAX).
+// With 1, the CPU waits for the GPU to finish every frame.
+
+static int              frames_in_flight    = 2;
+
+
+
+// When frames start, and how they are presented: PACING_VSYNC waits for the
+// display, PACING_UNCAPPED does not, PACING_CAPPED starts no more than
+// `pacing_cap` frames a second, and PACING_LOW_LATENCY keeps a single frame
+// queued and starts it as late as it can still make the next refresh.
+
+static PacingMode       pacing_mode         = PACING_VSYNC;
+static double           pacing_cap          = 120.0;
+
+
+
+// How many triangles to draw.  With 1, it is the triangle as it always was;
+// with more, a grid of them fills the scene (try 250000).
+
+static int              instance_count      = 1;
+
+
+
+// Whether the instances are uploaded once, in groups, and drawn by one
+// ExecuteIndirect() a frame with a command for every group on screen;
+// otherwise the instances on screen are packed into every frame.
+
+static bool             draw_indirect       = true;
+
+#define INDIRECT_TINTS      16      // Blocks of constants the groups take turns with.
+
+
+
+// How many command lists the draws of a frame are spread across, each one
+// recorded by whichever thread of the job system gets to it first.  They
+// are submitted in order, in one go (1 to RECORD_LISTS_MAX).
+
+#define RECORD_LISTS_MAX    8
+
+static int              record_lists        = 4;
+
+
+
+// How many frames to capture into hello.capture, from the first one on,
+// for replay.cpp to replay anywhere (0 captures none).
+
+static int              capture_frames      = 0;
+
+
+
+// How often, in seconds, shaders.hlsl is looked at for changes while the
+// program runs (0 does not look).  A save is compiled on a thread of its
+// own, and the frames go on with the pipeline they have until it is built.
+
+static double           shader_reload       = 0.25;
+
+
+
+// How many seconds of GPU time a frame may take before the scene is drawn
+// smaller, into a target of its own, and stretched over the window (0
+// always draws at the size of the window; try 1.0 / 60.0).
+
+static double           resolution_budget   = 0.0;
+
+
+
+// Texture Properties
+// The format the texture is kept in on the GPU, and how hard the CPU tries
+// when it compresses it into one of the block formats.
+
+static int              texture_format      = TEXTURE_BC7;
+static int              texture_quality     = BCN_NORMAL;
+
+static DXGI_FORMAT const texture_dxgi_formats[TEXTURE_FORMATS] = {
+    DXGI_FORMAT_R8G8B8A8_UNORM,
+    DXGI_FORMAT_BC1_UNORM,
+    DXGI_FORMAT_BC3_UNORM,
+    DXGI_FORMAT_BC7_UNORM,
+};
+
+
+
+// Vertex Properties
+// The format the mesh is kept in on the GPU.
+
+static int              vertex_format       = VERTICES_COMPACT;
+
+static DXGI_FORMAT const vertex_dxgi_types[VERTICES_TYPES] = {
+    DXGI_FORMAT_R32G32_FLOAT,
+    DXGI_FORMAT_R32G32B32A32_FLOAT,
+    DXGI_FORMAT_R16G16_FLOAT,
+    DXGI_FORMAT_R16G16_SNORM,
+    DXGI_FORMAT_R8G8B8A8_UNORM,
+};
+
+// The input elements of the mesh, from the first vertex buffer.
+static void vertex_input_elements(int format, D3D12_INPUT_ELEMENT_DESC elements[VERTICES_ELEMENTS])
+{
+    for (int i = 0; i < VERTICES_ELEMENTS; i++) {
+        elements[i].SemanticName = vertices_semantics[i];
+        elements[i].SemanticIndex = 0;
+        elements[i].Format = vertex_dxgi_types[vertices_formats[format].elements[i].type];
+        elements[i].InputSlot = 0;
+        elements[i].AlignedByteOffset = vertices_formats[format].elements[i].offset;
+        elements[i].InputSlotClass = D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA;
+        elements[i].InstanceDataStepRate = 0;
+    }
+}
+
+
+
+// The Window Procedure
+// It runs on the window thread, and only passes what happens on to the
+// render thread, stamped with the time it happened at.
+
+static double window_clock(void)
+{
+    LARGE_INTEGER tick, freq;
+    QueryPerformanceCounter(&tick);
+    QueryPerformanceFrequency(&freq);
+    return (double)tick.QuadPart / (double)freq.QuadPart;
+}
+
+static LRESULT CALLBACK window_proc(HWND window, UINT message, WPARAM wp, LPARAM lp)
+{
+    LRESULT lr = 0;
+
+    switch (message) {
+    case WM_SIZE:
+        events_send(&window_events, EVENT_RESIZE, LOWORD(lp), HIWORD(lp), window_clock());
+        break;
+    case WM_KEYDOWN:
+    case WM_KEYUP:
+        events_send(&window_events, EVENT_KEY, (int)wp, message == WM_KEYDOWN, window_clock());
+        break;
+    case WM_MOUSEMOVE:
+        events_send(&window_events, EVENT_MOUSE_MOVE, (short)LOWORD(lp), (short)HIWORD(lp), window_clock());
+        break;
+    case WM_LBUTTONDOWN:
+    case WM_LBUTTONUP:
+        events_send(&window_events, EVENT_MOUSE_BUTTON, 0, message == WM_LBUTTONDOWN, window_clock());
+        break;
+    case WM_RBUTTONDOWN:
+    case WM_RBUTTONUP:
+        events_send(&window_events, EVENT_MOUSE_BUTTON, 1, message == WM_RBUTTONDOWN, window_clock());
+        break;
+    case WM_CLOSE:
+        // The window stays until the render thread is done with it.
+        events_send(&window_events, EVENT_CLOSE, 0, 0, window_clock());
+        break;
+    case WM_RENDER_DONE:
+        DestroyWindow(window);
+        break;
+    case WM_DESTROY:
+        PostQuitMessage(0);
+        break;
+    default:
+        lr = DefWindowProcW(window, message, wp, lp);
+        break;
+    }
+    return lr;
+}
+
+
+
+// The Window Thread
+// The window belongs to the thread that creates it, which then does nothing
+// but pump its messages.  So the frames go on while the window is dragged
+// or resized, which Windows does in a loop of its own, and the render
+// thread never waits for messages, nor messages for a frame.
+
+typedef struct WindowThread {
+    HINSTANCE   instance;
+    int         cmd_show;
+    HWND        window;
+    HANDLE      created;
+} WindowThread;
+
+static void window_thread(WindowThread *wt)
+{
+    WNDCLASSEXW wc = {0};
+    wc.cbSize = sizeof(WNDCLASSEXW);
+    wc.lpfnWndProc = window_proc;
+    wc.hInstance = wt->instance;
+    wc.hIcon = LoadIcon(NULL, IDI_APPLICATION);
+    wc.hCursor = LoadCursor(NULL, IDC_ARROW);
+    wc.lpszClassName = window_title;
+
+    if (!RegisterClassExW(&wc))
+        ASSERT(0);
+
+    DWORD style = WS_OVERLAPPEDWINDOW;
+    DWORD style_ex = WS_EX_APPWINDOW | WS_EX_NOREDIRECTIONBITMAP;
+
+    wt->window = CreateWindowExW(
+        style_ex, wc.lpszClassName, window_title, style,
+        CW_USEDEFAULT, CW_USEDEFAULT, window_width, window_height,
+        NULL, NULL, wc.hInstance, NULL);
+    ASSERT(wt->window);
+
+    // Showing the window here is a bad idea in a real program.
+    // It is better to do it after D3D12 has been fully initialized.
+    ShowWindow(wt->window, wt->cmd_show);
+    SetEvent(wt->created);
+
+    MSG msg;
+    while (GetMessageW(&msg, NULL, 0, 0) > 0) {
+        TranslateMessage(&msg);
+        DispatchMessageW(&msg);
+    }
+}
+
+
+
+// Waiting for the GPU
+
+static void wait_for_fence(ID3D12Fence *fence, UINT64 value, HANDLE event)
+{
+    if (fence->GetCompletedValue() < value) {
+        HRESULT hr = fence->SetEventOnCompletion(value, event);
+        ASSERT_HR(hr);
+
+        WaitForSingleObject(event, INFINITE);
+    }
+}
+
+
+
+// GPU Memory
+// Resources are placed in heaps, from a pool for each kind: upload buffers,
+// buffers in video memory, and textures.  Startup stages and the upload
+// rings allocate from several threads, hence the lock.
+
+enum {
+    POOL_UPLOAD,
+    POOL_BUFFERS,
+    POOL_TEXTURES,
+    POOL_TARGETS,
+    POOLS
+};
+
+static D3D12_HEAP_TYPE const pool_types[POOLS] = {
+    D3D12_HEAP_TYPE_UPLOAD, D3D12_HEAP_TYPE_DEFAULT, D3D12_HEAP_TYPE_DEFAULT, D3D12_HEAP_TYPE_DEFAULT
+};
+
+static D3D12_HEAP_FLAGS const pool_flags[POOLS] = {
+    D3D12_HEAP_FLAG_ALLOW_ONLY_BUFFERS,
+    D3D12_HEAP_FLAG_ALLOW_ONLY_BUFFERS,
+    D3D12_HEAP_FLAG_ALLOW_ONLY_NON_RT_DS_TEXTURES,
+    D3D12_HEAP_FLAG_ALLOW_ONLY_RT_DS_TEXTURES,
+};
+
+static uint64_t const pool_block_sizes[POOLS] = {
+    64ull * 1024 * 1024, 16ull * 1024 * 1024, 64ull * 1024 * 1024, 32ull * 1024 * 1024
+};
+
+typedef struct GpuMemory {
+    ID3D12Device    *device;
+    IDXGIAdapter3   *adapter;       // For the budget.
+    Heaps           pools[POOLS];
+    std::mutex      lock;
+} GpuMemory;
+
+static GpuMemory        gpu_memory;
+
+static bool create_heap_block(void *ctx, int pool, uint64_t size, void **block)
+{
+    GpuMemory *memory = (GpuMemory *)ctx;
+
+    D3D12_HEAP_DESC desc = {0};
+    desc.SizeInBytes = size;
+    desc.Properties.Type = pool_types[pool];
+    desc.Alignment = 0;
+    desc.Flags = pool_flags[pool];
+
+    ID3D12Heap *heap;
+    HRESULT hr = memory->device->CreateHeap(&desc, IID_PPV_ARGS(&heap));
+    if (FAILED(hr))
+        return false;
+
+    *block = heap;
+    return true;
+}
+
+static void destroy_heap_block(void *ctx, int pool, void *block)
+{
+    ((ID3D12Heap *)block)->Release();
+}
+
+static void init_gpu_memory(GpuMemory *memory, ID3D12Device *device)
+{
+    memory->device = device;
+
+    HeapDevice heap_device = {memory, create_heap_block, destroy_heap_block};
+    for (int pool = 0; pool < POOLS; pool++)
+        heaps_init(&memory->pools[pool], &heap_device, pool, pool_block_sizes[pool]);
+
+    IDXGIFactory4 *dxgi;
+    HRESULT hr = CreateDXGIFactory2(0, IID_PPV_ARGS(&dxgi));
+    ASSERT_HR(hr);
+
+    hr = dxgi->EnumAdapterByLuid(device->GetAdapterLuid(), IID_PPV_ARGS(&memory->adapter));
+    if (FAILED(hr))
+        memory->adapter = NULL;
+    dxgi->Release();
+}
+
+static void shutdown_gpu_memory(GpuMemory *memory)
+{
+    for (int pool = 0; pool < POOLS; pool++)
+        heaps_shutdown(&memory->pools[pool]);
+    if (memory->adapter)
+        memory->adapter->Release();
+}
+
+// Creates a resource where there is room for it in the pool.
+static HeapAllocation create_placed_resource(GpuMemory *memory, int pool, D3D12_RESOURCE_DESC const *desc,
+                                             D3D12_RESOURCE_STATES state, ID3D12Resource **resource)
+{
+    D3D12_RESOURCE_ALLOCATION_INFO info = memory->device->GetResourceAllocationInfo(0, 1, desc);
+
+    HeapAllocation allocation;
+    {
+        std::lock_guard<std::mutex> guard(memory->lock);
+        allocation = heaps_alloc(&memory->pools[pool], info.SizeInBytes, info.Alignment);
+    }
+    if (!allocation.block)
+        return allocation;
+
+    HRESULT hr = memory->device->CreatePlacedResource(
+        (ID3D12Heap *)allocation.block, allocation.offset, desc, state, NULL, IID_PPV_ARGS(resource));
+    ASSERT_HR(hr);
+    return allocation;
+}
+
+// Once the GPU is done with it.
+static void release_placed_resource(GpuMemory *memory, int pool, ID3D12Resource *resource,
+                                    HeapAllocation const *allocation)
+{
+    resource->Release();
+
+    std::lock_guard<std::mutex> guard(memory->lock);
+    heaps_free(&memory->pools[pool], allocation);
+}
+
+static void report_gpu_memory(GpuMemory *memory)
+{
+    static char const *const names[POOLS] = {"upload", "buffers", "textures", "targets"};
+
+    char report[512];
+    for (int pool = 0; pool < POOLS; pool++) {
+        HeapStats stats = heaps_stats(&memory->pools[pool]);
+        snprintf(report, sizeof(report),
+                 "%-8s %d blocks, %.1f MB reserved, %.1f MB used (%.1f MB at most), "
+                 "%d free ranges, fragmentation %.2f\n",
+                 names[pool], stats.blocks, (double)stats.reserved / (1 << 20), (double)stats.used / (1 << 20),
+                 (double)stats.used_peak / (1 << 20), stats.free_ranges, heaps_fragmentation(&stats));
+        OutputDebugStringA(report);
+    }
+
+    DXGI_QUERY_VIDEO_MEMORY_INFO local;
+    if (memory->adapter &&
+        SUCCEEDED(memory->adapter->QueryVideoMemoryInfo(0, DXGI_MEMORY_SEGMENT_GROUP_LOCAL, &local))) {
+        snprintf(report, sizeof(report), "video memory: %.1f MB of a budget of %.1f MB in use\n",
+                 (double)local.CurrentUsage / (1 << 20), (double)local.Budget / (1 << 20));
+        OutputDebugStringA(report);
+    }
+}
+
+
+
+// Upload Memory
+// What the upload ring needs to create its buffers and to follow the GPU.
+
+typedef struct UploadContext {
+    ID3D12Device    *device;
+    ID3D12Fence     *fence;
+    HANDLE          fence_event;
+} UploadContext;
+
+static bool create_upload_buffer(void *ctx, uint64_t size, UploadBuffer *buffer)
+{
+    UploadContext *upload = (UploadContext *)ctx;
+    HRESULT hr;
+
+
+    D3D12_RESOURCE_DESC desc = {0};
+    desc.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+    desc.Alignment = 0;
+    desc.Width = size;
+    desc.Height = 1;
+    desc.DepthOrArraySize = 1;
+    desc.MipLevels = 1;
+    desc.Format = DXGI_FORMAT_UNKNOWN;
+    desc.SampleDesc = {1, 0};
+    desc.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+    desc.Flags = D3D12_RESOURCE_FLAG_NONE;
+
+    ID3D12Resource *resource;
+    HeapAllocation *allocation = (HeapAllocation *)malloc(sizeof(HeapAllocation));
+    ASSERT(allocation);
+    *allocation = create_placed_resource(
+        &gpu_memory, POOL_UPLOAD, &desc, D3D12_RESOURCE_STATE_GENERIC_READ, &resource);
+    if (!allocation->block) {
+        free(allocation);
+        return false;
+    }
+
+
+    // Upload heaps may stay mapped for as long as they live.
+    // The CPU never reads from them, hence the empty range.
+    D3D12_RANGE read = {0, 0};
+    hr = resource->Map(0, &read, (void **)&buffer->cpu);
+    ASSERT_HR(hr);
+
+    buffer->resource = resource;
+    buffer->gpu = resource->GetGPUVirtualAddress();
+    buffer->size = size;
+    buffer->memory = allocation;
+    return true;
+}
+
+static void destroy_upload_buffer(void *ctx, UploadBuffer *buffer)
+{
+    HeapAllocation *allocation = (HeapAllocation *)buffer->memory;
+    release_placed_resource(&gpu_memory, POOL_UPLOAD, (ID3D12Resource *)buffer->resource, allocation);
+    free(allocation);
+}
+
+static uint64_t completed_upload(void *ctx)
+{
+    UploadContext *upload = (UploadContext *)ctx;
+    return upload->fence->GetCompletedValue();
+}
+
+static void wait_upload(void *ctx, uint64_t value)
+{
+    UploadContext *upload = (UploadContext *)ctx;
+    wait_for_fence(upload->fence, value, upload->fence_event);
+}
+
+
+
+// Descriptor Heaps
+// A heap along with the allocator that hands it out.  Views are created in
+// a heap only the CPU sees, and copied into the one the shaders see.
+
+typedef struct DescriptorHeap {
+    ID3D12Device                *device;
+    ID3D12DescriptorHeap        *heap;
+    D3D12_DESCRIPTOR_HEAP_TYPE  type;
+    UINT                        stride;
+    D3D12_CPU_DESCRIPTOR_HANDLE cpu;
+    D3D12_GPU_DESCRIPTOR_HANDLE gpu;
+    Descriptors                 alloc;
+
+    // What copies into a shader-visible heap come from.
+    struct DescriptorHeap       *staging;
+} DescriptorHeap;
+
+static void copy_descriptors(void *ctx, DescriptorCopy const *copies, int count)
+{
+    DescriptorHeap *heap = (DescriptorHeap *)ctx;
+
+    D3D12_CPU_DESCRIPTOR_HANDLE dst[64];
+    D3D12_CPU_DESCRIPTOR_HANDLE src[64];
+    UINT sizes[64];
+
+    for (int i = 0; i < count; i += _countof(sizes)) {
+        UINT n = (UINT)((count - i < _countof(sizes)) ? count - i : _countof(sizes));
+        for (UINT k = 0; k < n; k++) {
+            dst[k].ptr = heap->cpu.ptr + (SIZE_T)copies[i + k].dst * heap->stride;
+            src[k].ptr = heap->staging->cpu.ptr + (SIZE_T)copies[i + k].src * heap->stride;
+            sizes[k] = copies[i + k].count;
+        }
+        heap->device->CopyDescriptors(n, dst, sizes, n, src, sizes, heap->type);
+    }
+}
+
+// With `staging`, the heap is shader-visible, and copied into from there.
+static void create_descriptor_heap(DescriptorHeap *heap, ID3D12Device *device,
+                                   D3D12_DESCRIPTOR_HEAP_TYPE type, UINT capacity,
+                                   DescriptorHeap *staging)
+{
+    HRESULT hr;
+
+    D3D12_DESCRIPTOR_HEAP_DESC _heap = {0};
+    _heap.Type = type;
+    _heap.NumDescriptors = capacity;
+    _heap.Flags = (staging) ?
+        D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE : D3D12_DESCRIPTOR_HEAP_FLAG_NONE;
+
+    hr = device->CreateDescriptorHeap(&_heap, IID_PPV_ARGS(&heap->heap));
+    ASSERT_HR(hr);
+
+    heap->device = device;
+    heap->type = type;
+    heap->stride = device->GetDescriptorHandleIncrementSize(type);
+    heap->cpu = heap->heap->GetCPUDescriptorHandleForHeapStart();
+    heap->gpu.ptr = 0;
+    if (staging)
+        heap->gpu = heap->heap->GetGPUDescriptorHandleForHeapStart();
+    heap->staging = staging;
+
+    DescriptorDevice copier = {heap, copy_descriptors};
+    bool ok = descriptors_init(&heap->alloc, capacity, (staging) ? &copier : NULL);
+    ASSERT(ok);
+}
+
+static void destroy_descriptor_heap(DescriptorHeap *heap)
+{
+    descriptors_shutdown(&heap->alloc);
+    heap->heap->Release();
+}
+
+static D3D12_CPU_DESCRIPTOR_HANDLE cpu_descriptor(DescriptorHeap const *heap,
+                                                  DescriptorHandle handle, UINT offset)
+{
+    D3D12_CPU_DESCRIPTOR_HANDLE cpu = heap->cpu;
+    cpu.ptr += (SIZE_T)(descriptors_index(&heap->alloc, handle) + offset) * heap->stride;
+    return cpu;
+}
+
+static D3D12_GPU_DESCRIPTOR_HANDLE gpu_descriptor(DescriptorHeap const *heap,
+                                                  DescriptorHandle handle, UINT offset)
+{
+    D3D12_GPU_DESCRIPTOR_HANDLE gpu = heap->gpu;
+    gpu.ptr += (UINT64)(descriptors_index(&heap->alloc, handle) + offset) * heap->stride;
+    return gpu;
+}
+
+
+
+// Resource Barriers
+// What the barrier tracker hands out, as it goes into the command list.
+
+static_assert(BARRIERS_RENDER_TARGET == D3D12_RESOURCE_STATE_RENDER_TARGET &&
+              BARRIERS_PIXEL_SHADER == D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE &&
+              BARRIERS_COPY_SOURCE == D3D12_RESOURCE_STATE_COPY_SOURCE &&
+              BARRIERS_ALL == D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES &&
+              BARRIER_UAV == D3D12_RESOURCE_BARRIER_TYPE_UAV &&
+              BARRIER_END == D3D12_RESOURCE_BARRIER_FLAG_END_ONLY,
+              "barriers.h is out of step with Direct3D 12");
+
+// The command list that barriers go into for now, and what it is captured
+// into, when it is.
+typedef struct BarrierList {
+    ID3D12GraphicsCommandList   *list;
+    CaptureList                 *capture;
+} BarrierList;
+
+static void emit_barriers(void *ctx, Barrier const *barriers, int count)
+{
+    BarrierList const *target = (BarrierList const *)ctx;
+    ID3D12GraphicsCommandList *cmd_list = target->list;
+
+    for (int i = 0; target->capture && i < count; i++) {
+        Barrier const *b = &barriers[i];
+        capture_barrier(target->capture, (uint64_t)(uintptr_t)b->resource, b->subresource,
+                        b->type, b->flags, b->before, b->after);
+    }
+
+    D3D12_RESOURCE_BARRIER out[64];
+
+    for (int i = 0; i < count; i += _countof(out)) {
+        UINT n = (UINT)((count - i < _countof(out)) ? count - i : _countof(out));
+        for (UINT k = 0; k < n; k++) {
+            Barrier const *b = &barriers[i + k];
+            out[k].Type = (D3D12_RESOURCE_BARRIER_TYPE)b->type;
+            out[k].Flags = (D3D12_RESOURCE_BARRIER_FLAGS)b->flags;
+            if (b->type == BARRIER_UAV) {
+                out[k].UAV.pResource = (ID3D12Resource *)b->resource;
+            } else {
+                out[k].Transition.pResource = (ID3D12Resource *)b->resource;
+                out[k].Transition.Subresource = b->subresource;
+                out[k].Transition.StateBefore = (D3D12_RESOURCE_STATES)b->before;
+                out[k].Transition.StateAfter = (D3D12_RESOURCE_STATES)b->after;
+            }
+        }
+        cmd_list->ResourceBarrier(n, out);
+    }
+}
+
+
+
+// Recording Draws
+// Everything a list of draws needs to be recorded on its own.  Each job
+// records its share of the draws into a list of its own, with an allocator
+// of its own for the frame slot.
+
+typedef struct RecordDraws {
+    ID3D12CommandAllocator      **allocs;
+    ID3D12GraphicsCommandList   **lists;
+    int                         list_count;
+
+    ID3D12PipelineState         *pipeline;
+    ID3D12RootSignature         *signature;
+    ID3D12DescriptorHeap        *srv_heap;
+    UINT                        table_slot;
+    D3D12_GPU_DESCRIPTOR_HANDLE table;
+    UINT                        frame_slot;
+    UINT                        draw_slot;
+    UINT64                      frame_constants;
+    UINT64 const                *draw_constants;    // One block per draw.
+    D3D12_VIEWPORT              viewport;
+    D3D12_RECT                  scissor;
+    D3D12_CPU_DESCRIPTOR_HANDLE rtv;
+    D3D12_VERTEX_BUFFER_VIEW    views[2];
+    D3D12_INDEX_BUFFER_VIEW     index_view;
+    UINT                        index_count;
+
+    BatchDraw const             *draws;
+    int                         draw_count;
+
+    // Or, with a command signature, the commands of an ExecuteIndirect()
+    // in upload memory, which are read back from there when capturing.
+    ID3D12CommandSignature      *command_signature;
+    ID3D12Resource              *commands;
+    UINT64                      commands_offset;
+    IndirectCommand const       *command_data;
+    int                         command_count;
+
+    // One per list, when the frame is captured, and what the captures need
+    // that the lists are not told.
+    CaptureList                 *captures;
+    ID3D12Resource              *texture;
+    ID3D12Resource              *target;
+} RecordDraws;
+
+static void record_draws(void *ctx, int index, int thread)
+{
+    RecordDraws const *r = (RecordDraws const *)ctx;
+    ID3D12GraphicsCommandList *list = r->lists[index];
+    HRESULT hr;
+
+    hr = r->allocs[index]->Reset();
+    ASSERT_HR(hr);
+
+    hr = list->Reset(r->allocs[index], r->pipeline);
+    ASSERT_HR(hr);
+
+    // Command lists start out with no state at all.
+    list->SetGraphicsRootSignature(r->signature);
+    ID3D12DescriptorHeap *heap = r->srv_heap;
+    list->SetDescriptorHeaps(1, &heap);
+    list->SetGraphicsRootDescriptorTable(r->table_slot, r->table);
+    list->SetGraphicsRootConstantBufferView(r->frame_slot, r->frame_constants);
+    list->RSSetViewports(1, &r->viewport);
+    list->RSSetScissorRects(1, &r->scissor);
+    list->OMSetRenderTargets(1, &r->rtv, FALSE, NULL);
+    list->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    list->IASetVertexBuffers(0, 2, r->views);
+    list->IASetIndexBuffer(&r->index_view);
+
+    CaptureList *capture = (r->captures) ? &r->captures[index] : NULL;
+    if (capture) {
+        capture_list_reset(capture);
+        capture_signature(capture, (uint64_t)(uintptr_t)r->signature);
+        capture_pipeline(capture, (uint64_t)(uintptr_t)r->pipeline);
+        capture_table(capture, r->table_slot, (uint64_t)(uintptr_t)r->texture);
+        capture_cbv(capture, r->frame_slot, r->frame_constants);
+        capture_viewport(capture, r->viewport.TopLeftX, r->viewport.TopLeftY, r->viewport.Width,
+                         r->viewport.Height, r->viewport.MinDepth, r->viewport.MaxDepth);
+        capture_scissor(capture, r->scissor.left, r->scissor.top, r->scissor.right, r->scissor.bottom);
+        capture_target(capture, (uint64_t)(uintptr_t)r->target);
+
+        CaptureVertexBuffer views[2];
+        for (int i = 0; i < 2; i++) {
+            views[i].address = r->views[i].BufferLocation;
+            views[i].size = r->views[i].SizeInBytes;
+            views[i].stride = r->views[i].StrideInBytes;
+        }
+        capture_vertex_buffers(capture, 0, 2, views);
+        capture_index_buffer(capture, r->index_view.BufferLocation, r->index_view.SizeInBytes,
+                             (r->index_view.Format == DXGI_FORMAT_R16_UINT) ? 2 : 4);
+    }
+
+    if (r->command_signature) {
+        int first = r->command_count * index / r->list_count;
+        int end = r->command_count * (index + 1) / r->list_count;
+        list->ExecuteIndirect(r->command_signature, end - first, r->commands,
+                              r->commands_offset + first * sizeof(IndirectCommand), NULL, 0);
+
+        // The captures have no ExecuteIndirect(), so every command goes in
+        // as the root CBV and the draw it stands for.
+        for (int i = first; capture && i < end; i++) {
+            IndirectCommand const *command = &r->command_data[i];
+            capture_cbv(capture, r->draw_slot, command->constants);
+            capture_draw_indexed(capture, command->index_count, command->instance_count, command->first_index,
+                                 command->base_vertex, command->first_instance);
+        }
+    } else {
+        int first = r->draw_count * index / r->list_count;
+        int end = r->draw_count * (index + 1) / r->list_count;
+        for (int i = first; i < end; i++) {
+            list->SetGraphicsRootConstantBufferView(r->draw_slot, r->draw_constants[i]);
+            list->DrawIndexedInstanced(r->index_count, r->draws[i].count, 0, 0, r->draws[i].first);
+            if (capture) {
+                capture_cbv(capture, r->draw_slot, r->draw_constants[i]);
+                capture_draw_indexed(capture, r->index_count, r->draws[i].count, 0, 0, r->draws[i].first);
+            }
+        }
+    }
+
+    hr = list->Close();
+    ASSERT_HR(hr);
+}
+
+
+
+// Shader Compilation
+// What the shader cache falls back on when it does not have a shader yet.
+// Complaints go to the debugger, or into ShaderErrors if there is a ctx.
+
+typedef struct ShaderErrors {
+    char    *text;
+    size_t  size;
+} ShaderErrors;
+
+static void *compile_shader(void *ctx, CacheRequest const *request, size_t *size)
+{
+    D3D_SHADER_MACRO macros[16 + 1] = {0};
+    ASSERT(request->define_count < _countof(macros));
+    for (int i = 0; i < request->define_count; i++) {
+        macros[i].Name = request->defines[i].name;
+        macros[i].Definition = request->defines[i].value;
+    }
+
+    ID3DBlob *code;
+    ID3DBlob *error;
+    HRESULT hr = D3DCompile(
+        request->source, request->source_size, request->path, macros,
+        D3D_COMPILE_STANDARD_FILE_INCLUDE, request->entry, request->profile,
+        request->flags, 0, &code, &error);
+    if (FAILED(hr)) {
+        const char *message = (const char *)error->GetBufferPointer();
+        if (ctx) {
+            ShaderErrors *errors = (ShaderErrors *)ctx;
+            snprintf(errors->text, errors->size, "%s", message);
+        } else {
+            OutputDebugStringA(message);
+        }
+        error->Release();
+        return NULL;
+    }
+
+    *size = code->GetBufferSize();
+    void *copy = malloc(*size);
+    ASSERT(copy);
+    memcpy(copy, code->GetBufferPointer(), *size);
+    code->Release();
+    return copy;
+}
+
+
+
+// Pipelines
+// Pipelines are created by pipelines.h on threads of their own, and kept in
+// pipelines.cache between runs, in a pipeline library, so that a later run
+// only loads them.  There is one pipeline to begin with, built at startup
+// and again whenever shaders.hlsl is saved, by reload.h.
+
+// The pipeline everything is drawn with, out of the given shaders.
+static void pipeline_desc(PipelineDesc *desc, ID3D12RootSignature *signature, uint64_t signature_key,
+                          void const *vs, size_t vs_size, void const *ps, size_t ps_size)
+{
+    memset(desc, 0, sizeof(*desc));
+    desc->signature = signature;
+    desc->signature_key = signature_key;
+    desc->vs = vs;
+    desc->vs_size = vs_size;
+    desc->ps = ps;
+    desc->ps_size = ps_size;
+
+    // The mesh comes from the first vertex buffer, in vertex_format, the
+    // instances from the second.
+    D3D12_INPUT_ELEMENT_DESC mesh_elements[VERTICES_ELEMENTS];
+    vertex_input_elements(vertex_format, mesh_elements);
+    for (int i = 0; i < VERTICES_ELEMENTS; i++) {
+        desc->inputs[i] = {
+            mesh_elements[i].SemanticName, mesh_elements[i].SemanticIndex, (uint32_t)mesh_elements[i].Format,
+            mesh_elements[i].InputSlot, mesh_elements[i].AlignedByteOffset, 0
+        };
+    }
+
+    PipelineInput const instance_inputs[] = {
+        {"INSTANCE_TRANSFORM", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, offsetof(BatchInstance, transform), 1},
+        {"INSTANCE_OFFSET",    0, DXGI_FORMAT_R32G32_FLOAT,       1, offsetof(BatchInstance, offset),    1},
+        {"INSTANCE_UV",        0, DXGI_FORMAT_R32G32_FLOAT,       1, offsetof(BatchInstance, uv_offset), 1},
+        {"INSTANCE_COLOR",     0, DXGI_FORMAT_R32G32B32A32_FLOAT, 1, offsetof(BatchInstance, color),     1},
+    };
+    for (int i = 0; i < _countof(instance_inputs); i++)
+        desc->inputs[VERTICES_ELEMENTS + i] = instance_inputs[i];
+    desc->input_count = VERTICES_ELEMENTS + _countof(instance_inputs);
+
+    desc->fill = D3D12_FILL_MODE_SOLID;
+    desc->cull = D3D12_CULL_MODE_NONE;
+    desc->depth = FALSE;
+    desc->topology = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
+    desc->samples = 1;
+
+    // Alpha blending, into one target.
+    desc->target_count = 1;
+    desc->formats[0] = DXGI_FORMAT_R8G8B8A8_UNORM;
+    desc->blend[0] = {
+        TRUE,
+        D3D12_BLEND_SRC_ALPHA, D3D12_BLEND_INV_SRC_ALPHA, D3D12_BLEND_OP_ADD,
+        D3D12_BLEND_SRC_ALPHA, D3D12_BLEND_INV_SRC_ALPHA, D3D12_BLEND_OP_ADD,
+        D3D12_COLOR_WRITE_ENABLE_ALL
+    };
+}
+
+typedef struct PipelineLibrary {
+    ID3D12Device                *device;
+    ID3D12PipelineLibrary       *library;   // NULL where the driver has none.
+    void                        *blob;      // What it was made from, which must outlive it.
+    std::atomic<int>            stored;     // Pipelines added to it this run.
+} PipelineLibrary;
+
+// Starts over with an empty library when there is no file yet, or it was
+// written by another driver or for another GPU.
+static void open_pipeline_library(PipelineLibrary *l, ID3D12Device *device, char const *path)
+{
+    l->device = device;
+    l->library = NULL;
+    l->blob = NULL;
+    l->stored = 0;
+
+    ID3D12Device1 *device1;
+    if (FAILED(device->QueryInterface(IID_PPV_ARGS(&device1))))
+        return;
+
+    size_t size;
+    l->blob = cache_read_file(NULL, path, &size);
+    if (!l->blob || FAILED(device1->CreatePipelineLibrary(l->blob, size, IID_PPV_ARGS(&l->library)))) {
+        free(l->blob);
+        l->blob = NULL;
+        if (FAILED(device1->CreatePipelineLibrary(NULL, 0, IID_PPV_ARGS(&l->library))))
+            l->library = NULL;
+    }
+    device1->Release();
+}
+
+// Writes the library out, if anything was added to it.
+static void close_pipeline_library(PipelineLibrary *l, char const *path)
+{
+    if (!l->library)
+        return;
+
+    if (l->stored > 0) {
+        size_t size = l->library->GetSerializedSize();
+        void *data = malloc(size);
+        ASSERT(data);
+        if (SUCCEEDED(l->library->Serialize(data, size))) {
+            FILE *file = fopen(path, "wb");
+            if (file) {
+                fwrite(data, 1, size, file);
+                fclose(file);
+            }
+        }
+        free(data);
+    }
+
+    l->library->Release();
+    free(l->blob);
+}
+
+// Loads the pipeline from the library, or creates it and adds it there.
+static void *create_pipeline(void *ctx, PipelineDesc const *desc, char const *name, bool *loaded)
+{
+    PipelineLibrary *l = (PipelineLibrary *)ctx;
+
+    D3D12_INPUT_ELEMENT_DESC input_elements[PIPELINES_INPUTS];
+    for (int i = 0; i < desc->input_count; i++) {
+        PipelineInput const *input = &desc->inputs[i];
+        input_elements[i] = {
+            input->semantic, input->index, (DXGI_FORMAT)input->format, input->slot, input->offset,
+            (input->step) ? D3D12_INPUT_CLASSIFICATION_PER_INSTANCE_DATA : D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA,
+            input->step
+        };
+    }
+
+    D3D12_BLEND_DESC blend = {0};
+    blend.IndependentBlendEnable = desc->target_count > 1;
+    for (int i = 0; i < desc->target_count; i++) {
+        PipelineBlend const *b = &desc->blend[i];
+        blend.RenderTarget[i].BlendEnable = b->enable;
+        blend.RenderTarget[i].SrcBlend = (D3D12_BLEND)b->src;
+        blend.RenderTarget[i].DestBlend = (D3D12_BLEND)b->dst;
+        blend.RenderTarget[i].BlendOp = (D3D12_BLEND_OP)b->op;
+        blend.RenderTarget[i].SrcBlendAlpha = (D3D12_BLEND)b->src_alpha;
+        blend.RenderTarget[i].DestBlendAlpha = (D3D12_BLEND)b->dst_alpha;
+        blend.RenderTarget[i].BlendOpAlpha = (D3D12_BLEND_OP)b->op_alpha;
+        blend.RenderTarget[i].RenderTargetWriteMask = (UINT8)b->write_mask;
+    }
+
+    D3D12_RASTERIZER_DESC rasterizer = {0};
+    rasterizer.FillMode = (D3D12_FILL_MODE)desc->fill;
+    rasterizer.CullMode = (D3D12_CULL_MODE)desc->cull;
+
+    D3D12_DEPTH_STENCIL_DESC depth_stencil = {0};
+    depth_stencil.DepthEnable = desc->depth;
+    depth_stencil.StencilEnable = FALSE;
+
+
+    D3D12_GRAPHICS_PIPELINE_STATE_DESC _pipeline = {0};
+    _pipeline.pRootSignature = (ID3D12RootSignature *)desc->signature;
+    _pipeline.VS = {desc->vs, desc->vs_size};
+    _pipeline.PS = {desc->ps, desc->ps_size};
+    _pipeline.BlendState = blend;
+    _pipeline.SampleMask = UINT_MAX;
+    _pipeline.RasterizerState = rasterizer;
+    _pipeline.DepthStencilState = depth_stencil;
+    _pipeline.InputLayout = {input_elements, (UINT)desc->input_count};
+    _pipeline.PrimitiveTopologyType = (D3D12_PRIMITIVE_TOPOLOGY_TYPE)desc->topology;
+    _pipeline.NumRenderTargets = (UINT)desc->target_count;
+    for (int i = 0; i < desc->target_count; i++)
+        _pipeline.RTVFormats[i] = (DXGI_FORMAT)desc->formats[i];
+    _pipeline.SampleDesc = {desc->samples, 0};
+
+    wchar_t wide_name[PIPELINES_NAME];
+    for (int i = 0; i < PIPELINES_NAME; i++)
+        wide_name[i] = (wchar_t)name[i];
+
+    ID3D12PipelineState *pipeline;
+    if (l->library && SUCCEEDED(l->library->LoadGraphicsPipeline(wide_name, &_pipeline, IID_PPV_ARGS(&pipeline)))) {
+        *loaded = true;
+        return pipeline;
+    }
+
+    HRESULT hr = l->device->CreateGraphicsPipelineState(&_pipeline, IID_PPV_ARGS(&pipeline));
+    if (FAILED(hr))
+        return NULL;
+
+    if (l->library && SUCCEEDED(l->library->StorePipeline(wide_name, pipeline)))
+        l->stored++;
+    return pipeline;
+}
+
+// What the reload thread builds pipelines with.  The shader cache is its
+// alone once startup is done, so saved shaders are also cached for the next
+// run, and going back to an earlier version does not compile anything.
+typedef struct PipelineBuilder {
+    Pipelines               *pipelines;
+    ID3D12RootSignature     *signature;
+    uint64_t                signature_key;
+    Cache                   *cache;
+} PipelineBuilder;
+
+static void *build_pipeline(void *ctx, char const *source, size_t size, char *error, size_t error_size)
+{
+    PipelineBuilder *b = (PipelineBuilder *)ctx;
+
+    ShaderErrors errors = {error, error_size};
+    CacheCompiler compiler = {&errors, compile_shader, NULL};
+    CacheRequest vs_request = {"shaders.hlsl", source, size, NULL, 0, "vs", "vs_5_0", 0};
+    CacheRequest ps_request = {"shaders.hlsl", source, size, NULL, 0, "ps", "ps_5_0", 0};
+
+    size_t vs_size, ps_size;
+    void const *vs = cache_compile(b->cache, &vs_request, &compiler, &vs_size);
+    void const *ps = (vs) ? cache_compile(b->cache, &ps_request, &compiler, &ps_size) : NULL;
+    if (!vs || !ps)
+        return NULL;
+
+    PipelineDesc desc;
+    pipeline_desc(&desc, b->signature, b->signature_key, vs, vs_size, ps, ps_size);
+    ID3D12PipelineState *pipeline = (ID3D12PipelineState *)pipelines_wait(
+        b->pipelines, pipelines_request(b->pipelines, &desc));
+    if (!pipeline) {
+        snprintf(error, error_size, "shaders.hlsl: the pipeline could not be created\n");
+        return NULL;
+    }
+
+    // The frames hold a reference of their own, as they do to the first.
+    pipeline->AddRef();
+    return pipeline;
+}
+
+// Gives up a reference, both for the frames and for the pipeline cache.
+static void release_pipeline(void *ctx, void *pipeline)
+{
+    (void)ctx;
+    ((ID3D12PipelineState *)pipeline)->Release();
+}
+
+
+
+// Startup
+// The stages the program starts up with.  Each one is a task that fills in
+// its part of Startup, and runs as soon as the stages it needs are done.
+
+typedef struct Startup {
+    // The stages that spread their own work across threads use this pool.
+    // Only one of them may at a time, so they must depend on one another.
+    Pool                        *pool;
+
+    ID3D12Device                *device;
+    ID3D12CommandQueue          *cmd_queue;
+    ID3D12CommandQueue          *copy_queue;
+
+    ID3D12RootSignature         *signature;
+    uint64_t                    signature_key;
+    UINT                        table_slot;
+    UINT                        frame_slot;
+    UINT                        draw_slot;
+    UINT                        blit_slot;
+    ID3D12CommandSignature      *command_signature;
+
+    Cache                       shader_cache;
+    char                        *shader_source;
+    void const                  *vs;
+    void const                  *ps;
+    size_t                      vs_size;
+    size_t                      ps_size;
+    void const                  *blit_vs;   // With resolution_budget.
+    void const                  *blit_ps;
+    size_t                      blit_vs_size;
+    size_t                      blit_ps_size;
+
+    ID3D12PipelineState         *pipeline;
+    ID3D12PipelineState         *blit_pipeline;
+
+    ID3D12CommandAllocator      *cmd_allocs[FRAMES_MAX];
+    ID3D12GraphicsCommandList   *cmd_list;
+    ID3D12CommandAllocator      *draw_allocs[FRAMES_MAX][RECORD_LISTS_MAX];
+    ID3D12GraphicsCommandList   *draw_lists[RECORD_LISTS_MAX];
+    ID3D12CommandAllocator      *end_allocs[FRAMES_MAX];
+    ID3D12GraphicsCommandList   *end_list;
+
+    Transfer                    transfer;
+    ID3D12CommandAllocator      *copy_allocs[FRAMES_MAX];
+    ID3D12GraphicsCommandList   *copy_list;
+
+    ID3D12Fence                 *fence;
+    Frames                      frames;
+    HANDLE                      fence_event;
+    ID3D12Fence                 *copy_fence;
+    HANDLE                      copy_event;
+
+    ID3D12QueryHeap             *timestamps;
+    ID3D12Resource              *timestamp_readback;
+    UINT64                      timestamp_frequency;
+
+    UploadContext               upload_ctx;
+    Upload                      upload;
+    UploadContext               frame_upload_ctx;
+    Upload                      frame_upload;
+
+    Batch                       batch;
+    IndirectScene               scene;      // With draw_indirect.
+
+    // The triangle, indexed and in the order the GPU draws it best.
+    Vertex                      *mesh_vertices;
+    int                         mesh_vertex_count;
+    uint32_t                    *mesh_indices;
+    int                         mesh_index_count;
+
+    // Its vertices, then its indices, then the instances with draw_indirect.
+    ID3D12Resource              *vertex_buffer;
+    HeapAllocation              vertex_memory;
+    D3D12_VERTEX_BUFFER_VIEW    vbv;
+    D3D12_INDEX_BUFFER_VIEW     ibv;
+    D3D12_VERTEX_BUFFER_VIEW    instances_view;
+    float                       vertex_scale;
+
+    // What is in assets.pack, when there is one, and has the formats in use.
+    Pack                        pack;
+    PackEntry const             *pack_vertices;
+    PackEntry const             *pack_indices;
+    PackEntry const             *pack_checkers;
+
+    TextureImage                checkers_mips[TEXTURE_MAX_MIPS];
+    uint8_t                     *checkers_data[TEXTURE_MAX_MIPS];
+    int                         checkers_mip_count;
+
+    ID3D12Resource              *checkers_texture;
+    HeapAllocation              checkers_memory;
+
+    DescriptorHeap              staging_heap;
+    DescriptorHeap              srv_heap;
+    DescriptorHeap              rtv_heap;
+    DescriptorHandle            checkers_staging;
+    DescriptorHandle            checkers_srv;
+
+    UINT64                      assets_ticket;
+
+    // The capture the uploads go into, when there is one.
+    Capture                     *capture;
+
+    // Where pipelines are created, and the library they are kept in.
+    Pipelines                   *pipelines;
+    PipelineLibrary             *pipeline_library;
+} Startup;
+
+
+
+// Compile the shaders.
+// They are only compiled when the cache from previous runs does not have
+// them: the first time, or after anything they depend on has changed.
+
+static void startup_shaders(void *ctx)
+{
+    Startup *s = (Startup *)ctx;
+
+    cache_open(&s->shader_cache, "shaders.cache", D3D_COMPILER_VERSION);
+
+    size_t source_size;
+    s->shader_source = cache_read_file(NULL, "shaders.hlsl", &source_size);
+    ASSERT(s->shader_source);
+
+    CacheCompiler compiler = {NULL, compile_shader, NULL};
+    CacheRequest vs_request = {"shaders.hlsl", s->shader_source, source_size, NULL, 0, "vs", "vs_5_0", 0};
+    CacheRequest ps_request = {"shaders.hlsl", s->shader_source, source_size, NULL, 0, "ps", "ps_5_0", 0};
+
+    s->vs = cache_compile(&s->shader_cache, &vs_request, &compiler, &s->vs_size);
+    s->ps = cache_compile(&s->shader_cache, &ps_request, &compiler, &s->ps_size);
+    ASSERT(s->vs && s->ps);
+
+    if (resolution_budget > 0.0) {
+        CacheRequest blit_vs_request = {"shaders.hlsl", s->shader_source, source_size, NULL, 0, "blit_vs", "vs_5_0", 0};
+        CacheRequest blit_ps_request = {"shaders.hlsl", s->shader_source, source_size, NULL, 0, "blit_ps", "ps_5_0", 0};
+
+        s->blit_vs = cache_compile(&s->shader_cache, &blit_vs_request, &compiler, &s->blit_vs_size);
+        s->blit_ps = cache_compile(&s->shader_cache, &blit_ps_request, &compiler, &s->blit_ps_size);
+        ASSERT(s->blit_vs && s->blit_ps);
+    }
+}
+
+
+
+// Index the triangle, and put its triangles and vertices in the order the
+// GPU goes through them fastest, as packer.cpp does before it writes them.
+
+static void startup_mesh(void *ctx)
+{
+    Startup *s = (Startup *)ctx;
+
+    int count = _countof(triangle);
+    s->mesh_vertices = (Vertex *)malloc(count * sizeof(Vertex));
+    s->mesh_indices = (uint32_t *)malloc(count * sizeof(uint32_t));
+    ASSERT(s->mesh_vertices && s->mesh_indices);
+
+    int vertex_count = mesh_index(triangle, count, sizeof(Vertex), s->mesh_vertices, s->mesh_indices);
+    s->mesh_vertex_count = mesh_optimize(
+        s->mesh_indices, count, s->mesh_vertices, vertex_count, sizeof(Vertex), 2);
+    s->mesh_index_count = count;
+}
+
+
+
+// Map the pack of assets that packer.cpp writes.  Whatever it has is
+// uploaded straight from it, and whatever it does not is made from scene.h.
+
+static void startup_pack(void *ctx)
+{
+    Startup *s = (Startup *)ctx;
+
+    if (pack_open(&s->pack, "assets.pack")) {
+        int index_size = mesh_index_size(s->mesh_vertex_count);
+        s->pack_vertices = pack_find(&s->pack, "triangle", PACK_VERTICES, vertex_format);
+        s->pack_indices = pack_find(&s->pack, "triangle", PACK_INDICES, index_size);
+        s->pack_checkers = pack_find(&s->pack, "checkers", PACK_TEXTURE, texture_format);
+
+        // The vertices only go with the indices they were written with.
+        if (!s->pack_vertices || !s->pack_indices ||
+            s->pack_vertices->count != (uint32_t)s->mesh_vertex_count ||
+            s->pack_indices->count != (uint32_t)s->mesh_index_count) {
+            s->pack_vertices = NULL;
+            s->pack_indices = NULL;
+        }
+    }
+}
+
+
+
+// Generate the mip chain of the texture, and compress every level of it
+// if it is to be kept in a block format.  A texture from the pack has all
+// that done already.
+
+static void startup_texels(void *ctx)
+{
+    Startup *s = (Startup *)ctx;
+    TextureImage *mips = s->checkers_mips;
+
+    if (s->pack_checkers) {
+        mips[0].width = (int)s->pack_checkers->width;
+        mips[0].height = (int)s->pack_checkers->height;
+        s->checkers_mip_count = (int)s->pack_checkers->mip_levels;
+        return;
+    }
+
+    int bw = texture_formats[texture_format].block_width;
+    int bh = texture_formats[texture_format].block_height;
+    int width = (int)checkers_width;
+    int height = (int)checkers_height;
+
+    // The top level of a block-compressed texture must be made of whole
+    // blocks.  Repeating every texel keeps it looking the same to the
+    // point sampler.
+    int scale = 1;
+    while ((width * scale) % bw != 0 || (height * scale) % bh != 0)
+        scale *= 2;
+
+    mips[0].width = width * scale;
+    mips[0].height = height * scale;
+    mips[0].texels = (uint32_t *)checkers;     // Only ever read.
+
+    if (scale > 1) {
+        uint32_t *texels = (uint32_t *)malloc(
+            (size_t)mips[0].width * mips[0].height * sizeof(uint32_t));
+        ASSERT(texels);
+        for (int y = 0; y < mips[0].height; y++) {
+            for (int x = 0; x < mips[0].width; x++)
+                texels[y * mips[0].width + x] = checkers[(y / scale) * width + x / scale];
+        }
+        mips[0].texels = texels;
+    }
+
+    s->checkers_mip_count = texture_mip_count(mips[0].width, mips[0].height);
+    texture_mips(s->pool, mips, s->checkers_mip_count, TEXTURE_BOX, false);
+
+    for (int i = 0; i < s->checkers_mip_count; i++) {
+        if (texture_format == TEXTURE_RGBA8) {
+            s->checkers_data[i] = (uint8_t *)mips[i].texels;
+        } else {
+            s->checkers_data[i] = (uint8_t *)malloc(
+                texture_size(texture_format, mips[i].width, mips[i].height));
+            ASSERT(s->checkers_data[i]);
+            bcn_encode(s->pool, texture_format, texture_quality, &mips[i], s->checkers_data[i]);
+        }
+    }
+}
+
+
+
+// Create a device that represents the default adapter.
+// Create a command queue for this device, and a copy queue that uploads
+// data alongside the rendering.
+
+static void startup_device(void *ctx)
+{
+    Startup *s = (Startup *)ctx;
+    HRESULT hr;
+
+    hr = D3D12CreateDevice(NULL, D3D_FEATURE_LEVEL_11_0, IID_PPV_ARGS(&s->device));
+    ASSERT_HR(hr);
+
+    init_gpu_memory(&gpu_memory, s->device);
+
+    D3D12_COMMAND_QUEUE_DESC _cmd_queue = {0};
+    _cmd_queue.Type = D3D12_COMMAND_LIST_TYPE_DIRECT;
+
+    hr = s->device->CreateCommandQueue(&_cmd_queue, IID_PPV_ARGS(&s->cmd_queue));
+    ASSERT_HR(hr);
+
+    D3D12_COMMAND_QUEUE_DESC _copy_queue = {0};
+    _copy_queue.Type = D3D12_COMMAND_LIST_TYPE_COPY;
+
+    hr = s->device->CreateCommandQueue(&_copy_queue, IID_PPV_ARGS(&s->copy_queue));
+    ASSERT_HR(hr);
+}
+
+
+
+// Create the root signature.
+
+static void startup_signature(void *ctx)
+{
+    Startup *s = (Startup *)ctx;
+    HRESULT hr;
+
+
+    D3D12_DESCRIPTOR_RANGE range = {0};
+    range.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_SRV;
+    range.NumDescriptors = 1;
+    range.OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND;
+
+    D3D12_ROOT_PARAMETER table = {0};
+    table.ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
+    table.DescriptorTable.NumDescriptorRanges = 1;
+    table.DescriptorTable.pDescriptorRanges = &range;
+    table.ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
+
+    // The constants are in upload memory, a block for the frame and one for
+    // each draw, bound straight from the root.
+    D3D12_ROOT_PARAMETER frame = {0};
+    frame.ParameterType = D3D12_ROOT_PARAMETER_TYPE_CBV;
+    frame.Descriptor.ShaderRegister = 0;
+    frame.ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+
+    D3D12_ROOT_PARAMETER draw = {0};
+    draw.ParameterType = D3D12_ROOT_PARAMETER_TYPE_CBV;
+    draw.Descriptor.ShaderRegister = 1;
+    draw.ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
+
+    // The upscale pass takes where to sample the scene from as constants.
+    D3D12_ROOT_PARAMETER blit = {0};
+    blit.ParameterType = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS;
+    blit.Constants.ShaderRegister = 2;
+    blit.Constants.Num32BitValues = 4;
+    blit.ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
+
+    D3D12_ROOT_PARAMETER params[] = {table, frame, draw, blit};
+    s->table_slot = 0;
+    s->frame_slot = 1;
+    s->draw_slot = 2;
+    s->blit_slot = 3;
+
+
+    D3D12_STATIC_SAMPLER_DESC sampler = {0};
+    sampler.Filter = D3D12_FILTER_MIN_MAG_MIP_POINT;
+    sampler.AddressU = D3D12_TEXTURE_ADDRESS_MODE_WRAP;
+    sampler.AddressV = D3D12_TEXTURE_ADDRESS_MODE_WRAP;
+    sampler.AddressW = D3D12_TEXTURE_ADDRESS_MODE_WRAP;
+    sampler.ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
+
+    // The scene is stretched over the window filtered, and never wraps.
+    D3D12_STATIC_SAMPLER_DESC stretch = sampler;
+    stretch.Filter = D3D12_FILTER_MIN_MAG_MIP_LINEAR;
+    stretch.AddressU = D3D12_TEXTURE_ADDRESS_MODE_CLAMP;
+    stretch.AddressV = D3D12_TEXTURE_ADDRESS_MODE_CLAMP;
+    stretch.AddressW = D3D12_TEXTURE_ADDRESS_MODE_CLAMP;
+    stretch.ShaderRegister = 1;
+
+    D3D12_STATIC_SAMPLER_DESC samplers[] = {sampler, stretch};
+
+
+    D3D12_ROOT_SIGNATURE_DESC _signature = {0};
+    _signature.NumParameters = _countof(params);
+    _signature.pParameters = params;
+    _signature.NumStaticSamplers = _countof(samplers);
+    _signature.pStaticSamplers = samplers;
+    _signature.Flags = D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT;
+
+    ID3DBlob *blob;
+    hr = D3D12SerializeRootSignature(
+        &_signature, D3D_ROOT_SIGNATURE_VERSION_1, &blob, NULL);
+    ASSERT_HR(hr);
+
+    hr = s->device->CreateRootSignature(
+        0, blob->GetBufferPointer(), blob->GetBufferSize(), IID_PPV_ARGS(&s->signature));
+    ASSERT_HR(hr);
+
+    // Pipelines tell it apart by what it is, not where.
+    CacheKey key = cache_hash_begin();
+    cache_hash(&key, blob->GetBufferPointer(), blob->GetBufferSize());
+    s->signature_key = cache_hash_end(key).lo;
+
+    blob->Release();
+
+
+    // What ExecuteIndirect() reads for every draw: the root CBV of its
+    // constants, then the arguments of an indexed draw.
+    s->command_signature = NULL;
+    if (draw_indirect) {
+        D3D12_INDIRECT_ARGUMENT_DESC arguments[2] = {};
+        arguments[0].Type = D3D12_INDIRECT_ARGUMENT_TYPE_CONSTANT_BUFFER_VIEW;
+        arguments[0].ConstantBufferView.RootParameterIndex = s->draw_slot;
+        arguments[1].Type = D3D12_INDIRECT_ARGUMENT_TYPE_DRAW_INDEXED;
+
+        D3D12_COMMAND_SIGNATURE_DESC command = {0};
+        command.ByteStride = sizeof(IndirectCommand);
+        command.NumArgumentDescs = _countof(arguments);
+        command.pArgumentDescs = arguments;
+
+        hr = s->device->CreateCommandSignature(&command, s->signature, IID_PPV_ARGS(&s->command_signature));
+        ASSERT_HR(hr);
+    }
+}
+
+
+
+// Create the Pipeline State Object.
+
+static void startup_pipeline(void *ctx)
+{
+    Startup *s = (Startup *)ctx;
+
+    open_pipeline_library(s->pipeline_library, s->device, "pipelines.cache");
+    PipelineCreator creator = {s->pipeline_library, create_pipeline, release_pipeline};
+    pipelines_init(s->pipelines, creator, 0);
+
+    PipelineDesc desc;
+    pipeline_desc(&desc, s->signature, s->signature_key, s->vs, s->vs_size, s->ps, s->ps_size);
+    s->pipeline = (ID3D12PipelineState *)pipelines_wait(s->pipelines, pipelines_request(s->pipelines, &desc));
+    ASSERT(s->pipeline);
+
+    // The frames hold a reference of their own, which reload.h gives up
+    // once they are done with it.
+    s->pipeline->AddRef();
+
+    // The upscale pass draws a triangle over the window, out of nothing.
+    s->blit_pipeline = NULL;
+    if (s->blit_vs) {
+        pipeline_desc(&desc, s->signature, s->signature_key, s->blit_vs, s->blit_vs_size, s->blit_ps, s->blit_ps_size);
+        desc.input_count = 0;
+        desc.blend[0].enable = FALSE;
+        s->blit_pipeline = (ID3D12PipelineState *)pipelines_wait(s->pipelines, pipelines_request(s->pipelines, &desc));
+        ASSERT(s->blit_pipeline);
+    }
+
+    // The bytecode lives in the cache, which stays open for reloading.
+    free(s->shader_source);
+}
+
+
+
+// Create a command allocator for every frame in flight, and a command list.
+// The list can be reset as soon as it has been submitted, but an allocator
+// only once the GPU is done with what was recorded into it.
+
+static void startup_commands(void *ctx)
+{
+    Startup *s = (Startup *)ctx;
+    HRESULT hr;
+
+    for (int i = 0; i < frames_in_flight; i++) {
+        hr = s->device->CreateCommandAllocator(
+            D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&s->cmd_allocs[i]));
+        ASSERT_HR(hr);
+    }
+
+    hr = s->device->CreateCommandList(
+        0, D3D12_COMMAND_LIST_TYPE_DIRECT,
+        s->cmd_allocs[0], s->pipeline, IID_PPV_ARGS(&s->cmd_list));
+    ASSERT_HR(hr);
+
+    hr = s->cmd_list->Close();
+    ASSERT_HR(hr);
+
+
+    // The lists the draws are recorded into, and one for the end of the
+    // frame, which comes after all of them.
+    for (int l = 0; l < record_lists; l++) {
+        for (int i = 0; i < frames_in_flight; i++) {
+            hr = s->device->CreateCommandAllocator(
+                D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&s->draw_allocs[i][l]));
+            ASSERT_HR(hr);
+        }
+
+        hr = s->device->CreateCommandList(
+            0, D3D12_COMMAND_LIST_TYPE_DIRECT,
+            s->draw_allocs[0][l], s->pipeline, IID_PPV_ARGS(&s->draw_lists[l]));
+        ASSERT_HR(hr);
+
+        hr = s->draw_lists[l]->Close();
+        ASSERT_HR(hr);
+    }
+
+    for (int i = 0; i < frames_in_flight; i++) {
+        hr = s->device->CreateCommandAllocator(
+            D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&s->end_allocs[i]));
+        ASSERT_HR(hr);
+    }
+
+    hr = s->device->CreateCommandList(
+        0, D3D12_COMMAND_LIST_TYPE_DIRECT,
+        s->end_allocs[0], NULL, IID_PPV_ARGS(&s->end_list));
+    ASSERT_HR(hr);
+
+    hr = s->end_list->Close();
+    ASSERT_HR(hr);
+}
+
+
+
+// Likewise for the copy queue.  Copies are submitted in batches, and each
+// batch records into the next copy allocator in turn.
+
+static void startup_copies(void *ctx)
+{
+    Startup *s = (Startup *)ctx;
+    HRESULT hr;
+
+    transfer_init(&s->transfer, 2, 256, 32 * 1024 * 1024);
+
+    for (int i = 0; i < s->transfer.lists.count; i++) {
+        hr = s->device->CreateCommandAllocator(
+            D3D12_COMMAND_LIST_TYPE_COPY, IID_PPV_ARGS(&s->copy_allocs[i]));
+        ASSERT_HR(hr);
+    }
+
+    hr = s->device->CreateCommandList(
+        0, D3D12_COMMAND_LIST_TYPE_COPY,
+        s->copy_allocs[0], NULL, IID_PPV_ARGS(&s->copy_list));
+    ASSERT_HR(hr);
 
-// These are updated every time the window has been resized.
-static int              window_width        = 720;
-static int              window_height       = 480;
-static float            window_aspect       = (float)window_height /
-                                                (float)window_width;
-static bool             window_resized      = false;
+    hr = s->copy_list->Close();
+    ASSERT_HR(hr);
+}
 
 
 
-// What We Seek to Draw
+// Create a fence, and keep track of which value retires which frame.
+// Create another for the copy queue, which retires batches of copies.
 
-typedef struct Vertex {
-    float pos[2];
-    float uv[2];
-    float color[4];
-} Vertex;
+static void startup_fences(void *ctx)
+{
+    Startup *s = (Startup *)ctx;
+    HRESULT hr;
 
-static Vertex triangle[] = {
-    {{-0.0f,  0.7f}, {1.5f, 0.0f}, {1.0f, 0.0f, 0.0f, 1.0f}},
-    {{ 0.7f, -0.7f}, {3.0f, 3.0f}, {0.0f, 1.0f, 0.0f, 1.0f}},
-    {{-0.7f, -0.7f}, {0.0f, 3.0f}, {0.0f, 0.0f, 1.0f, 1.0f}},
-};
+    hr = s->device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&s->fence));
+    ASSERT_HR(hr);
 
-// Checkerboard texture with 32% transparency.
-static uint32_t checkers[] = {
-    0x20000000, 0x20ffffff,
-    0x20ffffff, 0x20000000,
-};
-static size_t checkers_width = 2;
-static size_t checkers_height = 2;
+    frames_init(&s->frames, frames_in_flight);
+
+    s->fence_event = CreateEventW(NULL, FALSE, FALSE, NULL);
+    ASSERT(s->fence_event);
 
-static float background[] = {0.117f, 0.117f, 0.120f, 1.0f};
+    hr = s->device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&s->copy_fence));
+    ASSERT_HR(hr);
 
+    s->copy_event = CreateEventW(NULL, FALSE, FALSE, NULL);
+    ASSERT(s->copy_event);
+}
 
 
-// The Window Procedure
 
-static LRESULT CALLBACK window_proc(HWND window, UINT message, WPARAM wp, LPARAM lp)
+// Create a query heap for two timestamps per frame in flight, which the GPU
+// writes as it begins and finishes the frame, and a buffer they are resolved
+// into for the CPU to read back.
+
+static void startup_timestamps(void *ctx)
 {
-    LRESULT lr = 0;
+    Startup *s = (Startup *)ctx;
+    HRESULT hr;
 
-    switch (message) {
-    case WM_SIZE:
-        window_width = LOWORD(lp);
-        window_height = HIWORD(lp);
-        window_aspect = (float)window_height / (float)window_width;
-        window_resized = true;
-        break;
-    case WM_DESTROY:
-        PostQuitMessage(0);
-        break;
-    default:
-        lr = DefWindowProcW(window, message, wp, lp);
-        break;
-    }
-    return lr;
+
+    D3D12_QUERY_HEAP_DESC _timestamps = {0};
+    _timestamps.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+    _timestamps.Count = 2 * FRAMES_MAX;
+
+    hr = s->device->CreateQueryHeap(&_timestamps, IID_PPV_ARGS(&s->timestamps));
+    ASSERT_HR(hr);
+
+
+    D3D12_HEAP_PROPERTIES heap = {0};
+    heap.Type = D3D12_HEAP_TYPE_READBACK;
+
+    D3D12_RESOURCE_DESC buffer = {0};
+    buffer.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+    buffer.Alignment = 0;
+    buffer.Width = 2 * FRAMES_MAX * sizeof(UINT64);
+    buffer.Height = 1;
+    buffer.DepthOrArraySize = 1;
+    buffer.MipLevels = 1;
+    buffer.Format = DXGI_FORMAT_UNKNOWN;
+    buffer.SampleDesc = {1, 0};
+    buffer.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+    buffer.Flags = D3D12_RESOURCE_FLAG_NONE;
+
+    hr = s->device->CreateCommittedResource(
+        &heap, D3D12_HEAP_FLAG_NONE,
+        &buffer, D3D12_RESOURCE_STATE_COPY_DEST,
+        NULL, IID_PPV_ARGS(&s->timestamp_readback));
+    ASSERT_HR(hr);
+
+
+    hr = s->cmd_queue->GetTimestampFrequency(&s->timestamp_frequency);
+    ASSERT_HR(hr);
 }
 
 
 
-// main()
-// Everything takes places inside here.
+// Create an upload ring: upload memory that stays mapped, is handed out a
+// piece at a time, and is recycled once the copy queue is done with each
+// piece.
 
-int WINAPI WinMain(HINSTANCE instance, HINSTANCE instance_p, LPSTR cmd_line, int cmd_show)
+static void startup_upload(void *ctx)
 {
-    // Create a window.
+    Startup *s = (Startup *)ctx;
 
-    HWND window;
-    {
-        WNDCLASSEXW wc = {0};
-        wc.cbSize = sizeof(WNDCLASSEXW);
-        wc.lpfnWndProc = window_proc;
-        wc.hInstance = instance;
-        wc.hIcon = LoadIcon(NULL, IDI_APPLICATION);
-        wc.hCursor = LoadCursor(NULL, IDC_ARROW);
-        wc.lpszClassName = window_title;
+    s->upload_ctx.device = s->device;
+    s->upload_ctx.fence = s->copy_fence;
+    s->upload_ctx.fence_event = s->copy_event;
 
-        if (!RegisterClassExW(&wc))
-            ASSERT(0);
+    UploadDevice upload_device = {
+        &s->upload_ctx, create_upload_buffer, destroy_upload_buffer,
+        completed_upload, wait_upload
+    };
 
-        DWORD style = WS_OVERLAPPEDWINDOW;
-        DWORD style_ex = WS_EX_APPWINDOW | WS_EX_NOREDIRECTIONBITMAP;
+    bool ok = upload_init(&s->upload, &upload_device, 64 * 1024, 64 * 1024 * 1024);
+    ASSERT(ok);
 
-        window = CreateWindowExW(
-            style_ex, wc.lpszClassName, window_title, style,
-            CW_USEDEFAULT, CW_USEDEFAULT, window_width, window_height,
-            NULL, NULL, wc.hInstance, NULL);
-        ASSERT(window);
 
-        // Showing the window here is a bad idea in a real program.
-        // It is better to do it after D3D12 has been fully initialized.
-        ShowWindow(window, cmd_show);
-    }
+    // Another ring for what every frame writes for itself, which the direct
+    // queue's fence retires.
+    s->frame_upload_ctx.device = s->device;
+    s->frame_upload_ctx.fence = s->fence;
+    s->frame_upload_ctx.fence_event = s->fence_event;
 
+    UploadDevice frame_upload_device = {
+        &s->frame_upload_ctx, create_upload_buffer, destroy_upload_buffer,
+        completed_upload, wait_upload
+    };
 
+    ok = upload_init(&s->frame_upload, &frame_upload_device, 64 * 1024, 256 * 1024 * 1024);
+    ASSERT(ok);
+}
 
-    // Create a device that represents the default adapter.
-    // Create a command queue for this device.
 
-    ID3D12Device *device;
-    ID3D12CommandQueue *cmd_queue;
-    {
-        HRESULT hr;
 
-        hr = D3D12CreateDevice(NULL, D3D_FEATURE_LEVEL_11_0, IID_PPV_ARGS(&device));
-        ASSERT_HR(hr);
+// Lay out the instances of the triangle, and group them by where they are
+// when they are drawn indirectly.
 
-        D3D12_COMMAND_QUEUE_DESC _cmd_queue = {0};
-        _cmd_queue.Type = D3D12_COMMAND_LIST_TYPE_DIRECT;
+static void startup_instances(void *ctx)
+{
+    Startup *s = (Startup *)ctx;
 
-        hr = device->CreateCommandQueue(&_cmd_queue, IID_PPV_ARGS(&cmd_queue));
-        ASSERT_HR(hr);
-    }
+    batch_init(&s->batch, triangle, _countof(triangle));
+    batch_grid(&s->batch, instance_count);
 
+    indirect_init(&s->scene);
+    if (draw_indirect)
+        indirect_group(&s->scene, &s->batch);
+}
 
 
-    // Create the swap chain.
 
-    IDXGISwapChain3 *swapchain;
-    UINT buffer_count = 2;
-    {
-        IDXGIFactory2 *dxgi;
-        HRESULT hr;
+// Create a vertex buffer, with the indices after the vertices: 16 bits
+// each, unless there are too many vertices for that.  The grouped instances
+// go after the indices.
 
-        hr = CreateDXGIFactory2(0, IID_PPV_ARGS(&dxgi));
-        ASSERT_HR(hr);
+static uint64_t mesh_indices_offset(Startup const *s)
+{
+    return (vertices_size(vertex_format, s->mesh_vertex_count) + 3) & ~(uint64_t)3;
+}
 
-        DXGI_SWAP_CHAIN_DESC1 _swapchain = {0};
-        _swapchain.Width = 0;
-        _swapchain.Height = 0;
-        _swapchain.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-        _swapchain.SampleDesc = {1, 0};
-        _swapchain.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
-        _swapchain.BufferCount = buffer_count;
-        _swapchain.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
+static uint64_t mesh_indices_size(Startup const *s)
+{
+    return (uint64_t)s->mesh_index_count * mesh_index_size(s->mesh_vertex_count);
+}
 
-        hr = dxgi->CreateSwapChainForHwnd(
-            (IUnknown *)cmd_queue, window, &_swapchain,
-            NULL, NULL, (IDXGISwapChain1 **)&swapchain);
-        ASSERT_HR(hr);
+static uint64_t mesh_instances_offset(Startup const *s)
+{
+    return (mesh_indices_offset(s) + mesh_indices_size(s) + 15) & ~(uint64_t)15;
+}
 
-        dxgi->Release();
-    }
+static uint64_t mesh_instances_size(Startup const *s)
+{
+    return (uint64_t)s->scene.instance_count * sizeof(BatchInstance);
+}
+
+static void startup_vertices(void *ctx)
+{
+    Startup *s = (Startup *)ctx;
+
+
+    D3D12_RESOURCE_DESC buffer = {0};
+    buffer.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
+    buffer.Alignment = 0;
+    buffer.Width = mesh_instances_offset(s) + mesh_instances_size(s);
+    buffer.Height = 1;
+    buffer.DepthOrArraySize = 1;
+    buffer.MipLevels = 1;
+    buffer.Format = DXGI_FORMAT_UNKNOWN;
+    buffer.SampleDesc = {1, 0};
+    buffer.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
+    buffer.Flags = D3D12_RESOURCE_FLAG_NONE;
+
+    // Buffers in the COMMON state are promoted to whatever state they are
+    // used in, on any queue, and decay back to it once the copy queue is
+    // done with them.  So no barriers are needed around the upload.
+    s->vertex_memory = create_placed_resource(
+        &gpu_memory, POOL_BUFFERS, &buffer, D3D12_RESOURCE_STATE_COMMON, &s->vertex_buffer);
+    ASSERT(s->vertex_memory.block);
+
+
+    s->vbv.BufferLocation = s->vertex_buffer->GetGPUVirtualAddress();
+    s->vbv.StrideInBytes = vertices_formats[vertex_format].stride;
+    s->vbv.SizeInBytes = (UINT)vertices_size(vertex_format, s->mesh_vertex_count);
+    s->vertex_scale = (s->pack_vertices) ? s->pack_vertices->scale
+                                         : vertices_scale(vertex_format, s->mesh_vertices, s->mesh_vertex_count);
+
+    s->ibv.BufferLocation = s->vbv.BufferLocation + mesh_indices_offset(s);
+    s->ibv.SizeInBytes = (UINT)mesh_indices_size(s);
+    s->ibv.Format = (mesh_index_size(s->mesh_vertex_count) == 2) ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
+
+    s->instances_view.BufferLocation = s->vbv.BufferLocation + mesh_instances_offset(s);
+    s->instances_view.StrideInBytes = sizeof(BatchInstance);
+    s->instances_view.SizeInBytes = (UINT)mesh_instances_size(s);
+}
 
 
 
-    // Create the root signature.
+// Create the descriptor heaps: one the shaders see and one to create views
+// in before they are copied there, and one for render target views, which
+// are made again in the same descriptors whenever the window is resized.
 
-    ID3D12RootSignature *signature;
-    UINT table_slot;
-    UINT consts_slot;
-    {
-        HRESULT hr;
+static void startup_descriptors(void *ctx)
+{
+    Startup *s = (Startup *)ctx;
+
+    create_descriptor_heap(&s->staging_heap, s->device, D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV, 4096, NULL);
+    create_descriptor_heap(&s->srv_heap, s->device, D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV, 4096, &s->staging_heap);
+    create_descriptor_heap(&s->rtv_heap, s->device, D3D12_DESCRIPTOR_HEAP_TYPE_RTV, 16, NULL);
+}
 
 
-        D3D12_DESCRIPTOR_RANGE range = {0};
-        range.RangeType = D3D12_DESCRIPTOR_RANGE_TYPE_SRV;
-        range.NumDescriptors = 1;
-        range.OffsetInDescriptorsFromTableStart = D3D12_DESCRIPTOR_RANGE_OFFSET_APPEND;
 
-        D3D12_ROOT_PARAMETER table = {0};
-        table.ParameterType = D3D12_ROOT_PARAMETER_TYPE_DESCRIPTOR_TABLE;
-        table.DescriptorTable.NumDescriptorRanges = 1;
-        table.DescriptorTable.pDescriptorRanges = &range;
-        table.ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
+// Create a texture resource.
+
+static void startup_texture(void *ctx)
+{
+    Startup *s = (Startup *)ctx;
+
+
+    D3D12_RESOURCE_DESC texture = {0};
+    texture.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+    texture.Alignment = 0;
+    texture.Width = (UINT)s->checkers_mips[0].width;
+    texture.Height = (UINT)s->checkers_mips[0].height;
+    texture.DepthOrArraySize = 1;
+    texture.MipLevels = (UINT16)s->checkers_mip_count;
+    texture.Format = texture_dxgi_formats[texture_format];
+    texture.SampleDesc = {1, 0};
+    texture.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN;
+    texture.Flags = D3D12_RESOURCE_FLAG_NONE;
+
+    // The same goes for textures, as long as they are only copied to and
+    // then read by shaders.
+    s->checkers_memory = create_placed_resource(
+        &gpu_memory, POOL_TEXTURES, &texture, D3D12_RESOURCE_STATE_COMMON, &s->checkers_texture);
+    ASSERT(s->checkers_memory.block);
+
+
+    // Create its view where only the CPU sees it, then copy it over to
+    // where the shaders do.
+    s->checkers_staging = descriptors_alloc(&s->staging_heap.alloc, 1);
+    s->checkers_srv = descriptors_alloc(&s->srv_heap.alloc, 1);
+    ASSERT(s->checkers_staging != DESCRIPTORS_NONE && s->checkers_srv != DESCRIPTORS_NONE);
+
+    s->device->CreateShaderResourceView(
+        s->checkers_texture, NULL, cpu_descriptor(&s->staging_heap, s->checkers_staging, 0));
+
+    descriptors_copy(&s->srv_heap.alloc,
+                     descriptors_index(&s->srv_heap.alloc, s->checkers_srv),
+                     descriptors_index(&s->staging_heap.alloc, s->checkers_staging), 1);
+    descriptors_flush(&s->srv_heap.alloc);
+}
 
-        D3D12_ROOT_PARAMETER consts = {0};
-        consts.ParameterType = D3D12_ROOT_PARAMETER_TYPE_32BIT_CONSTANTS;
-        consts.Constants.Num32BitValues = 4;
-        consts.ShaderVisibility = D3D12_SHADER_VISIBILITY_ALL;
 
-        D3D12_ROOT_PARAMETER params[] = {table, consts};
-        table_slot = 0;
-        consts_slot = 1;
 
+// Upload the vertex data and the texture on the copy queue.
+// The frame loop starts drawing with them once the ticket is ready.
 
-        D3D12_STATIC_SAMPLER_DESC sampler = {0};
-        sampler.Filter = D3D12_FILTER_MIN_MAG_MIP_POINT;
-        sampler.AddressU = D3D12_TEXTURE_ADDRESS_MODE_WRAP;
-        sampler.AddressV = D3D12_TEXTURE_ADDRESS_MODE_WRAP;
-        sampler.AddressW = D3D12_TEXTURE_ADDRESS_MODE_WRAP;
-        sampler.ShaderVisibility = D3D12_SHADER_VISIBILITY_PIXEL;
+static void startup_assets(void *ctx)
+{
+    Startup *s = (Startup *)ctx;
+    HRESULT hr;
+    bool ok;
 
-        D3D12_STATIC_SAMPLER_DESC samplers[] = {sampler};
 
+    UINT64 wait;
+    if (transfer_begin(&s->transfer, &wait)) {
+        wait_for_fence(s->copy_fence, wait, s->copy_event);
 
-        D3D12_ROOT_SIGNATURE_DESC _signature = {0};
-        _signature.NumParameters = _countof(params);
-        _signature.pParameters = params;
-        _signature.NumStaticSamplers = _countof(samplers);
-        _signature.pStaticSamplers = samplers;
-        _signature.Flags = D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT;
+        ID3D12CommandAllocator *copy_alloc = s->copy_allocs[s->transfer.lists.index];
 
-        ID3DBlob *blob;
-        hr = D3D12SerializeRootSignature(
-            &_signature, D3D_ROOT_SIGNATURE_VERSION_1, &blob, NULL);
+        hr = copy_alloc->Reset();
         ASSERT_HR(hr);
 
-        hr = device->CreateRootSignature(
-            0, blob->GetBufferPointer(), blob->GetBufferSize(), IID_PPV_ARGS(&signature));
+        hr = s->copy_list->Reset(copy_alloc, NULL);
         ASSERT_HR(hr);
+    }
+
 
-        blob->Release();
+    // Transfer vertex data, indices and instances to the vertex buffer by
+    // way of upload memory, converted to the formats they are kept in on the
+    // way, unless the pack has them that way already.
+
+    uint64_t vertices_bytes = vertices_size(vertex_format, s->mesh_vertex_count);
+    uint64_t indices_offset = mesh_indices_offset(s);
+    uint64_t mesh_bytes = mesh_instances_offset(s) + mesh_instances_size(s);
+    UploadAllocation vertices;
+    ok = upload_alloc(&s->upload, mesh_bytes, UPLOAD_ALIGN_VERTEX, &vertices);
+    ASSERT(ok);
+
+    uint8_t *indices = (uint8_t *)vertices.cpu + indices_offset;
+    if (s->pack_vertices) {
+        pack_prefetch(&s->pack, s->pack_vertices);
+        pack_prefetch(&s->pack, s->pack_indices);
+        memcpy(vertices.cpu, pack_data(&s->pack, s->pack_vertices), vertices_bytes);
+        memcpy(indices, pack_data(&s->pack, s->pack_indices), mesh_indices_size(s));
+    } else {
+        vertices_pack(vertex_format, s->mesh_vertices, s->mesh_vertex_count, s->vertex_scale, vertices.cpu);
+        mesh_narrow(s->mesh_indices, s->mesh_index_count, mesh_index_size(s->mesh_vertex_count), indices);
     }
+    if (draw_indirect)
+        memcpy((uint8_t *)vertices.cpu + mesh_instances_offset(s), s->scene.instances, mesh_instances_size(s));
 
+    s->copy_list->CopyBufferRegion(
+        s->vertex_buffer, 0, (ID3D12Resource *)vertices.resource,
+        vertices.offset, mesh_bytes);
 
+    transfer_add(&s->transfer, mesh_bytes);
 
-    // Create the Pipeline State Object.
+    // The copies go into the capture as they are, along with what they copy.
+    CaptureList copies = {0};
+    if (s->capture) {
+        capture_data(s->capture, vertices.gpu, vertices.cpu, mesh_bytes);
+        capture_copy_buffer(&copies, s->vertex_buffer->GetGPUVirtualAddress(), vertices.gpu, mesh_bytes);
+    }
 
-    ID3D12PipelineState *pipeline;
-    {
-        ID3DBlob *vs, *ps;
-        ID3DBlob *error;
-        HRESULT hr;
 
+    // Transfer every mip of the texture to the texture resource by way of
+    // upload memory, laid out row by row at the pitch the GPU expects.  The
+    // pack has them laid out so, and is copied as it is.
 
-        hr = D3DCompileFromFile(L"shaders.hlsl", NULL, NULL, "vs", "vs_5_0", 0, 0, &vs, &error);
-        if (FAILED(hr)) {
-            const char *message = (const char *)error->GetBufferPointer();
-            OutputDebugStringA(message);
-            ASSERT(0);
-        }
+    int mip_count = s->checkers_mip_count;
+    TextureDesc desc = {
+        texture_format, s->checkers_mips[0].width, s->checkers_mips[0].height, 1, mip_count
+    };
+    TextureFootprint footprints[TEXTURE_MAX_MIPS];
+    UINT64 size = texture_footprints(&desc, 0, mip_count, 0, footprints);
 
-        hr = D3DCompileFromFile(L"shaders.hlsl", NULL, NULL, "ps", "ps_5_0", 0, 0, &ps, &error);
-        if (FAILED(hr)) {
-            const char *message = (const char *)error->GetBufferPointer();
-            OutputDebugStringA(message);
-            ASSERT(0);
-        }
+    UploadAllocation texels;
+    ok = upload_alloc(&s->upload, size, UPLOAD_ALIGN_TEXTURE, &texels);
+    ASSERT(ok);
 
-        D3D12_INPUT_ELEMENT_DESC input_elements[] = {
-            {"POSITION",    0, DXGI_FORMAT_R32G32_FLOAT,        0, offsetof(Vertex, pos),   D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0},
-            {"TEXCOORD",    0, DXGI_FORMAT_R32G32_FLOAT,        0, offsetof(Vertex, uv),    D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0},
-            {"COLOR",       0, DXGI_FORMAT_R32G32B32A32_FLOAT,  0, offsetof(Vertex, color), D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0}
-        };
+    if (s->pack_checkers) {
+        ASSERT(s->pack_checkers->size == size);
+        pack_prefetch(&s->pack, s->pack_checkers);
+        memcpy(texels.cpu, pack_data(&s->pack, s->pack_checkers), size);
+    } else {
+        texture_pack(s->pool, footprints, mip_count, s->checkers_data, texels.cpu);
+    }
 
-        // Enable alpha blending.
-        D3D12_BLEND_DESC blend = {0};
-        blend.RenderTarget[0].BlendEnable = TRUE;
-        blend.RenderTarget[0].SrcBlend = D3D12_BLEND_SRC_ALPHA;
-        blend.RenderTarget[0].DestBlend = D3D12_BLEND_INV_SRC_ALPHA;
-        blend.RenderTarget[0].BlendOp = D3D12_BLEND_OP_ADD;
-        blend.RenderTarget[0].SrcBlendAlpha = D3D12_BLEND_SRC_ALPHA;
-        blend.RenderTarget[0].DestBlendAlpha = D3D12_BLEND_INV_SRC_ALPHA;
-        blend.RenderTarget[0].BlendOpAlpha = D3D12_BLEND_OP_ADD;
-        blend.RenderTarget[0].RenderTargetWriteMask = D3D12_COLOR_WRITE_ENABLE_ALL;
-
-        D3D12_RASTERIZER_DESC rasterizer = {0};
-        rasterizer.FillMode = D3D12_FILL_MODE_SOLID;
-        rasterizer.CullMode = D3D12_CULL_MODE_NONE;
-
-        D3D12_DEPTH_STENCIL_DESC depth_stencil = {0};
-        depth_stencil.DepthEnable = FALSE;
-        depth_stencil.StencilEnable = FALSE;
-
-
-        D3D12_GRAPHICS_PIPELINE_STATE_DESC _pipeline = {0};
-        _pipeline.pRootSignature = signature;
-        _pipeline.VS = {vs->GetBufferPointer(), vs->GetBufferSize()};
-        _pipeline.PS = {ps->GetBufferPointer(), ps->GetBufferSize()};
-        _pipeline.BlendState = blend;
-        _pipeline.SampleMask = UINT_MAX;
-        _pipeline.RasterizerState = rasterizer;
-        _pipeline.DepthStencilState = depth_stencil;
-        _pipeline.InputLayout = {input_elements, _countof(input_elements)};
-        _pipeline.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
-        _pipeline.NumRenderTargets = 1;
-        _pipeline.RTVFormats[0] = DXGI_FORMAT_R8G8B8A8_UNORM;
-        _pipeline.SampleDesc = {1, 0};
-
-        hr = device->CreateGraphicsPipelineState(&_pipeline, IID_PPV_ARGS(&pipeline));
-        ASSERT_HR(hr);
+    if (s->capture) {
+        capture_data(s->capture, texels.gpu, texels.cpu, size);
+        capture_texture(&copies, (uint64_t)(uintptr_t)s->checkers_texture, texture_format,
+                        desc.width, desc.height, mip_count);
+        for (int i = 0; i < mip_count; i++) {
+            capture_copy_texture(&copies, (uint64_t)(uintptr_t)s->checkers_texture, i,
+                                 texels.gpu + footprints[i].offset, footprints[i].row_pitch,
+                                 footprints[i].width, footprints[i].height);
+        }
+        capture_submit(s->capture, CAPTURE_COPY, &copies);
+        capture_list_free(&copies);
+    }
+
+    for (int i = 0; i < mip_count; i++) {
+        D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint = {0};
+        footprint.Offset = texels.offset + footprints[i].offset;
+        footprint.Footprint.Format = texture_dxgi_formats[texture_format];
+        footprint.Footprint.Width = footprints[i].width;
+        footprint.Footprint.Height = footprints[i].height;
+        footprint.Footprint.Depth = 1;
+        footprint.Footprint.RowPitch = footprints[i].row_pitch;
+
+#ifndef NDEBUG
+        // The footprints must be the ones the device would have given.
+        D3D12_PLACED_SUBRESOURCE_FOOTPRINT expected;
+        s->device->GetCopyableFootprints(
+            &s->checkers_texture->GetDesc(), i, 1, footprint.Offset,
+            &expected, NULL, NULL, NULL);
+        ASSERT(expected.Footprint.RowPitch == footprint.Footprint.RowPitch);
+        ASSERT(expected.Footprint.Width == footprint.Footprint.Width);
+        ASSERT(expected.Footprint.Height == footprint.Footprint.Height);
+#endif
+
+        D3D12_TEXTURE_COPY_LOCATION src = {0};
+        src.pResource = (ID3D12Resource *)texels.resource;
+        src.Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT;
+        src.PlacedFootprint = footprint;
+
+        D3D12_TEXTURE_COPY_LOCATION dst = {0};
+        dst.pResource = s->checkers_texture;
+        dst.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
+        dst.SubresourceIndex = i;
+
+        s->copy_list->CopyTextureRegion(&dst, 0, 0, 0, &src, NULL);
+    }
 
+    s->assets_ticket = transfer_add(&s->transfer, size);
 
-        vs->Release();
-        ps->Release();
+    // The texels are in upload memory now.
+    if (!s->pack_checkers) {
+        if (texture_format != TEXTURE_RGBA8) {
+            for (int i = 0; i < mip_count; i++)
+                free(s->checkers_data[i]);
+        }
+        texture_free_mips(s->checkers_mips, mip_count);
+        if (s->checkers_mips[0].texels != checkers)
+            free(s->checkers_mips[0].texels);
     }
+    pack_close(&s->pack);
+    s->pack_vertices = NULL;
+    s->pack_indices = NULL;
+    s->pack_checkers = NULL;
 
+    free(s->mesh_vertices);
+    free(s->mesh_indices);
+    s->mesh_vertices = NULL;
+    s->mesh_indices = NULL;
 
 
-    // Create a command allocator and a command list.
+    // Submit the batch.
 
-    ID3D12CommandAllocator *cmd_alloc;
-    ID3D12GraphicsCommandList *cmd_list;
-    {
-        HRESULT hr;
+    hr = s->copy_list->Close();
+    ASSERT_HR(hr);
 
-        hr = device->CreateCommandAllocator(
-            D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&cmd_alloc));
-        ASSERT_HR(hr);
+    s->copy_queue->ExecuteCommandLists(1, (ID3D12CommandList **)&s->copy_list);
 
-        hr = device->CreateCommandList(
-            0, D3D12_COMMAND_LIST_TYPE_DIRECT,
-            cmd_alloc, pipeline, IID_PPV_ARGS(&cmd_list));
-        ASSERT_HR(hr);
+    UINT64 value = transfer_submit(&s->transfer);
 
-        hr = cmd_list->Close();
-        ASSERT_HR(hr);
-    }
+    hr = s->copy_queue->Signal(s->copy_fence, value);
+    ASSERT_HR(hr);
 
+    upload_end_frame(&s->upload, value);
+}
 
 
-    // Create an upload buffer.
 
-    ID3D12Resource *upload_buffer;
-    SIZE_T triangle_offset;
-    SIZE_T checkers_offset;
-    {
-        HRESULT hr;
+// Frame Profiling
+// The profiler, and the clock it runs on: seconds since the program loop
+// started, which the GPU's timestamps are converted to as well.
 
+static Profile          profile;
 
-        D3D12_HEAP_PROPERTIES heap = {0};
-        heap.Type = D3D12_HEAP_TYPE_UPLOAD;
-
-        D3D12_RESOURCE_DESC buffer = {0};
-        buffer.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
-        buffer.Alignment = 0;
-        buffer.Width = 64 * 1024; // Buffer alignment.
-        buffer.Height = 1;
-        buffer.DepthOrArraySize = 1;
-        buffer.MipLevels = 1;
-        buffer.Format = DXGI_FORMAT_UNKNOWN;
-        buffer.SampleDesc = {1, 0};
-        buffer.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
-        buffer.Flags = D3D12_RESOURCE_FLAG_NONE;
-
-        hr = device->CreateCommittedResource(
-            &heap, D3D12_HEAP_FLAG_NONE,
-            &buffer, D3D12_RESOURCE_STATE_GENERIC_READ,
-            NULL, IID_PPV_ARGS(&upload_buffer));
-        ASSERT_HR(hr);
+static double elapsed(LARGE_INTEGER tick_0, LARGE_INTEGER freq)
+{
+    LARGE_INTEGER tick;
+    QueryPerformanceCounter(&tick);
+    return (double)(tick.QuadPart - tick_0.QuadPart) / (double)freq.QuadPart;
+}
 
 
-        // Upload the data.
 
-        uint8_t *p;
-        hr = upload_buffer->Map(0, NULL, (void **)&p);
-        ASSERT_HR(hr);
-        {
-            // Vertex data.
+// Frame Pacing
+// The clock the pacing runs on is the profiler's.  Sleeps go through a high
+// resolution timer, and the display's refresh comes from the compositor.
 
-            triangle_offset = 0;
+typedef struct PacingContext {
+    LARGE_INTEGER   tick_0;
+    LARGE_INTEGER   freq;
+    HANDLE          timer;
+    HANDLE          waitable;       // The swap chain's, NULL if not waitable.
+} PacingContext;
 
-            memcpy(p, triangle, sizeof(triangle));
+static double pacing_now(void *ctx)
+{
+    PacingContext *pc = (PacingContext *)ctx;
+    return elapsed(pc->tick_0, pc->freq);
+}
 
+static void pacing_sleep(void *ctx, double duration)
+{
+    PacingContext *pc = (PacingContext *)ctx;
 
-            // Texture data.
+    // In units of 100 ns, negative for a time relative to now.
+    LARGE_INTEGER due;
+    due.QuadPart = -(LONGLONG)(duration * 1e7);
+    if (SetWaitableTimerEx(pc->timer, &due, 0, NULL, NULL, NULL, 0))
+        WaitForSingleObject(pc->timer, INFINITE);
+}
 
-            checkers_offset = D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT;
+static void pacing_wait_frame(void *ctx)
+{
+    PacingContext *pc = (PacingContext *)ctx;
+    if (pc->waitable)
+        WaitForSingleObjectEx(pc->waitable, 1000, TRUE);
+}
 
-            p += checkers_offset;
-            size_t stride = checkers_width * sizeof(*checkers);
+static bool pacing_vblank(void *ctx, double now, double *next, double *period)
+{
+    PacingContext *pc = (PacingContext *)ctx;
+
+    DWM_TIMING_INFO info = {0};
+    info.cbSize = sizeof(info);
+    if (FAILED(DwmGetCompositionTimingInfo(NULL, &info)) || info.qpcRefreshPeriod == 0)
+        return false;
+
+    *period = (double)info.qpcRefreshPeriod / (double)pc->freq.QuadPart;
+    *next = (double)((INT64)info.qpcVBlank - pc->tick_0.QuadPart) / (double)pc->freq.QuadPart;
+    while (*next <= now)
+        *next += *period;
+    return true;
+}
 
-            for (size_t i = 0; i < sizeof(checkers); i += stride) {
-                memcpy(p, (uint8_t *)checkers + i, stride);
-                p += D3D12_TEXTURE_DATA_PITCH_ALIGNMENT;
-            }
-        }
-        upload_buffer->Unmap(0, NULL);
-    }
 
 
+// main()
+// Everything takes place inside here, but for the stages of startup, which
+// run on a task graph.  This thread renders, and the window has a thread
+// of its own.
 
-    // Create a vertex buffer.
+int WINAPI WinMain(HINSTANCE instance, HINSTANCE instance_p, LPSTR cmd_line, int cmd_show)
+{
+    // Create a window, on the thread that pumps its messages.
 
-    ID3D12Resource *vertex_buffer;
-    D3D12_VERTEX_BUFFER_VIEW vbv;
-    {
-        HRESULT hr;
+    events_init(&window_events);
 
+    WindowThread wt = {instance, cmd_show, NULL, NULL};
+    wt.created = CreateEventW(NULL, FALSE, FALSE, NULL);
+    ASSERT(wt.created);
 
-        D3D12_HEAP_PROPERTIES heap = {0};
-        heap.Type = D3D12_HEAP_TYPE_DEFAULT;
-
-        D3D12_RESOURCE_DESC buffer = {0};
-        buffer.Dimension = D3D12_RESOURCE_DIMENSION_BUFFER;
-        buffer.Alignment = 0;
-        buffer.Width = sizeof(triangle);
-        buffer.Height = 1;
-        buffer.DepthOrArraySize = 1;
-        buffer.MipLevels = 1;
-        buffer.Format = DXGI_FORMAT_UNKNOWN;
-        buffer.SampleDesc = {1, 0};
-        buffer.Layout = D3D12_TEXTURE_LAYOUT_ROW_MAJOR;
-        buffer.Flags = D3D12_RESOURCE_FLAG_NONE;
-
-        hr = device->CreateCommittedResource(
-            &heap, D3D12_HEAP_FLAG_NONE,
-            &buffer, D3D12_RESOURCE_STATE_COPY_DEST,
-            NULL, IID_PPV_ARGS(&vertex_buffer));
-        ASSERT_HR(hr);
+    std::thread window_pump(window_thread, &wt);
+    WaitForSingleObject(wt.created, INFINITE);
+    CloseHandle(wt.created);
 
+    HWND window = wt.window;
 
-        vbv.BufferLocation = vertex_buffer->GetGPUVirtualAddress();
-        vbv.StrideInBytes = sizeof(Vertex);
-        vbv.SizeInBytes = sizeof(triangle);
-    }
 
 
+    // Start the worker threads that CPU-heavy work is spread across.
 
-    // Create a texture resource.
+    Pool pool;
+    pool_init(&pool, 0);
 
-    ID3D12Resource *checkers_texture;
-    ID3D12DescriptorHeap *srv_heap;
-    {
-        HRESULT hr;
+    // And the job system that command lists are recorded on.
+    Jobs jobs;
+    jobs_init(&jobs, 0);
 
 
-        D3D12_HEAP_PROPERTIES heap = {0};
-        heap.Type = D3D12_HEAP_TYPE_DEFAULT;
-
-        D3D12_RESOURCE_DESC texture = {0};
-        texture.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
-        texture.Alignment = 0;
-        texture.Width = (UINT)checkers_width;
-        texture.Height = (UINT)checkers_height;
-        texture.DepthOrArraySize = 1;
-        texture.MipLevels = 1;
-        texture.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
-        texture.SampleDesc = {1, 0};
-        texture.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN;
-        texture.Flags = D3D12_RESOURCE_FLAG_NONE;
-
-        hr = device->CreateCommittedResource(
-            &heap, D3D12_HEAP_FLAG_NONE,
-            &texture, D3D12_RESOURCE_STATE_COPY_DEST,
-            NULL, IID_PPV_ARGS(&checkers_texture));
-        ASSERT_HR(hr);
 
+    // Run the startup stages, each as soon as the ones it needs are done.
+    // Compiling the shaders and preparing the texture need no device, and
+    // most of what needs one needs nothing else.  The stages run on threads
+    // of their own, since some of them spread their work across the pool.
 
-        D3D12_DESCRIPTOR_HEAP_DESC _srv_heap = {0};
-        _srv_heap.Type = D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV;
-        _srv_heap.NumDescriptors = 1;
-        _srv_heap.Flags = D3D12_DESCRIPTOR_HEAP_FLAG_SHADER_VISIBLE;
+    // The first frames are captured when asked to, from the uploads on.
+    Capture capture;
+    bool capturing = capture_frames > 0 && capture_open(&capture, "hello.capture");
+    int captured = 0;
 
-        hr = device->CreateDescriptorHeap(&_srv_heap, IID_PPV_ARGS(&srv_heap));
-        ASSERT_HR(hr);
+    Pipelines pipelines;
+    PipelineLibrary pipeline_library;
 
-        device->CreateShaderResourceView(
-            checkers_texture, NULL, srv_heap->GetCPUDescriptorHandleForHeapStart());
+    Startup startup;
+    memset(&startup, 0, sizeof(startup));
+    startup.pool = &pool;
+    startup.capture = (capturing) ? &capture : NULL;
+    startup.pipelines = &pipelines;
+    startup.pipeline_library = &pipeline_library;
+    {
+        Tasks tasks;
+        tasks_init(&tasks);
+
+        Startup *s = &startup;
+        int shaders     = tasks_add(&tasks, "shaders",        startup_shaders,   s);
+        int mesh        = tasks_add(&tasks, "mesh",           startup_mesh,      s);
+        int pack        = tasks_add(&tasks, "asset pack",     startup_pack,      s);
+        int texels      = tasks_add(&tasks, "texture data",   startup_texels,    s);
+        int device      = tasks_add(&tasks, "device",         startup_device,    s);
+        int signature   = tasks_add(&tasks, "root signature", startup_signature, s);
+        int pipeline    = tasks_add(&tasks, "pipeline",       startup_pipeline,  s);
+        int commands    = tasks_add(&tasks, "command lists",  startup_commands,  s);
+        int copies      = tasks_add(&tasks, "copy lists",     startup_copies,    s);
+        int fences      = tasks_add(&tasks, "fences",         startup_fences,    s);
+        int timestamps  = tasks_add(&tasks, "timestamps",     startup_timestamps, s);
+        int upload      = tasks_add(&tasks, "upload ring",    startup_upload,    s);
+        int instances   = tasks_add(&tasks, "instances",      startup_instances, s);
+        int vertices    = tasks_add(&tasks, "vertex buffer",  startup_vertices,  s);
+        int descriptors = tasks_add(&tasks, "descriptors",    startup_descriptors, s);
+        int texture     = tasks_add(&tasks, "texture",        startup_texture,   s);
+        int assets      = tasks_add(&tasks, "assets",         startup_assets,    s);
+
+        tasks_after(&tasks, signature, device);
+        tasks_after(&tasks, pipeline, shaders);
+        tasks_after(&tasks, pipeline, signature);
+        tasks_after(&tasks, commands, pipeline);
+        tasks_after(&tasks, copies, device);
+        tasks_after(&tasks, fences, device);
+        tasks_after(&tasks, timestamps, device);
+        tasks_after(&tasks, upload, fences);
+        tasks_after(&tasks, vertices, device);
+        tasks_after(&tasks, vertices, pack);
+        tasks_after(&tasks, vertices, instances);
+        tasks_after(&tasks, pack, mesh);
+        tasks_after(&tasks, texels, pack);
+        tasks_after(&tasks, texture, texels);
+        tasks_after(&tasks, texture, device);
+        tasks_after(&tasks, descriptors, device);
+        tasks_after(&tasks, texture, descriptors);
+        tasks_after(&tasks, assets, copies);
+        tasks_after(&tasks, assets, upload);
+        tasks_after(&tasks, assets, vertices);
+        tasks_after(&tasks, assets, texture);
+
+        Pool stages;
+        pool_init(&stages, 4);
+        tasks_run(&tasks, &stages);
+        pool_shutdown(&stages);
+
+        char report[4096];
+        tasks_report(&tasks, report, sizeof(report));
+        OutputDebugStringA(report);
     }
 
+    ID3D12Device *device = startup.device;
+    ID3D12CommandQueue *cmd_queue = startup.cmd_queue;
+    ID3D12CommandQueue *copy_queue = startup.copy_queue;
+    ID3D12RootSignature *signature = startup.signature;
+    UINT table_slot = startup.table_slot;
+    UINT frame_slot = startup.frame_slot;
+    UINT draw_slot = startup.draw_slot;
+    UINT blit_slot = startup.blit_slot;
+    ID3D12CommandSignature *command_signature = startup.command_signature;
+    ID3D12PipelineState *pipeline = startup.pipeline;
+    ID3D12PipelineState *blit_pipeline = startup.blit_pipeline;
+    ID3D12CommandAllocator **cmd_allocs = startup.cmd_allocs;
+    ID3D12GraphicsCommandList *cmd_list = startup.cmd_list;
+    ID3D12CommandAllocator *(*draw_allocs)[RECORD_LISTS_MAX] = startup.draw_allocs;
+    ID3D12GraphicsCommandList **draw_lists = startup.draw_lists;
+    ID3D12CommandAllocator **end_allocs = startup.end_allocs;
+    ID3D12GraphicsCommandList *end_list = startup.end_list;
+    Transfer &transfer = startup.transfer;
+    ID3D12CommandAllocator **copy_allocs = startup.copy_allocs;
+    ID3D12GraphicsCommandList *copy_list = startup.copy_list;
+    ID3D12Fence *fence = startup.fence;
+    Frames &frames = startup.frames;
+    HANDLE fence_event = startup.fence_event;
+    ID3D12Fence *copy_fence = startup.copy_fence;
+    HANDLE copy_event = startup.copy_event;
+    ID3D12QueryHeap *timestamps = startup.timestamps;
+    ID3D12Resource *timestamp_readback = startup.timestamp_readback;
+    UINT64 timestamp_frequency = startup.timestamp_frequency;
+    Upload &upload = startup.upload;
+    Upload &frame_upload = startup.frame_upload;
+    Batch &batch = startup.batch;
+    IndirectScene &scene = startup.scene;
+    ID3D12Resource *vertex_buffer = startup.vertex_buffer;
+    D3D12_VERTEX_BUFFER_VIEW vbv = startup.vbv;
+    D3D12_INDEX_BUFFER_VIEW ibv = startup.ibv;
+    D3D12_VERTEX_BUFFER_VIEW instances_view = startup.instances_view;
+    UINT index_count = startup.mesh_index_count;
+    float vertex_scale = startup.vertex_scale;
+    ID3D12Resource *checkers_texture = startup.checkers_texture;
+    DescriptorHeap &srv_heap = startup.srv_heap;
+    DescriptorHeap &rtv_heap = startup.rtv_heap;
+    DescriptorHandle checkers_srv = startup.checkers_srv;
+    UINT64 assets_ticket = startup.assets_ticket;
+
+
+    // Rebuild the pipeline whenever shaders.hlsl is saved.
+    PipelineBuilder pipeline_builder = {&pipelines, signature, startup.signature_key, &startup.shader_cache};
+    ReloadDevice reload_device = {&pipeline_builder, build_pipeline, release_pipeline};
+    Reload reload;
+    reload_start(&reload, "shaders.hlsl", reload_device, pipeline, shader_reload);
 
 
-    // Create a fence.
 
-    ID3D12Fence *fence;
-    UINT64 fence_value;
-    HANDLE fence_event;
+    // Create the swap chain.
+    // DXGI may send the window messages while it is at it, which its thread
+    // is there to take.  For low latency, the swap chain holds a single
+    // frame, and tells when it has room for the next one.
+
+    IDXGISwapChain3 *swapchain;
+    UINT buffer_count = 2;
+    UINT swapchain_flags = (pacing_mode == PACING_LOW_LATENCY) ?
+        DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT : 0;
+    HANDLE frame_waitable = NULL;
     {
+        IDXGIFactory2 *dxgi;
         HRESULT hr;
-        hr = device->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&fence));
+
+        hr = CreateDXGIFactory2(0, IID_PPV_ARGS(&dxgi));
+        ASSERT_HR(hr);
+
+        DXGI_SWAP_CHAIN_DESC1 _swapchain = {0};
+        _swapchain.Width = 0;
+        _swapchain.Height = 0;
+        _swapchain.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+        _swapchain.SampleDesc = {1, 0};
+        _swapchain.BufferUsage = DXGI_USAGE_RENDER_TARGET_OUTPUT;
+        _swapchain.BufferCount = buffer_count;
+        _swapchain.SwapEffect = DXGI_SWAP_EFFECT_FLIP_DISCARD;
+        _swapchain.Flags = swapchain_flags;
+
+        hr = dxgi->CreateSwapChainForHwnd(
+            (IUnknown *)cmd_queue, window, &_swapchain,
+            NULL, NULL, (IDXGISwapChain1 **)&swapchain);
         ASSERT_HR(hr);
 
-        fence_value = 0;
+        if (swapchain_flags & DXGI_SWAP_CHAIN_FLAG_FRAME_LATENCY_WAITABLE_OBJECT) {
+            hr = swapchain->SetMaximumFrameLatency(1);
+            ASSERT_HR(hr);
+            frame_waitable = swapchain->GetFrameLatencyWaitableObject();
+        }
 
-        fence_event = CreateEventW(NULL, FALSE, FALSE, NULL);
-        ASSERT(fence_event);
+        dxgi->Release();
     }
 
 
@@ -495,9 +2267,52 @@ int WINAPI WinMain(HINSTANCE instance, HINSTANCE instance_p, LPSTR cmd_line, int
 
 
     ID3D12Resource *render_targets[2]; // buffer_count
-    ID3D12DescriptorHeap *rtv_heap = NULL;
-    D3D12_CPU_DESCRIPTOR_HANDLE rtv_base;
-    UINT rtv_stride;
+    bool render_targets_created = false;
+
+    // Their views outlive them, in the same descriptors.
+    DescriptorHandle rtvs = descriptors_alloc(&rtv_heap.alloc, buffer_count);
+    ASSERT(rtvs != DESCRIPTORS_NONE);
+
+    // The barrier tracker knows what state every resource the frames use is
+    // in.  The assets get promoted out of COMMON and decay back into it, so
+    // they never take a barrier; the render targets are the same two
+    // resources after every resize, as far as it is concerned.
+    BarrierList barrier_list = {cmd_list, NULL};
+    Barriers barriers;
+    BarrierDevice barrier_device = {&barrier_list, emit_barriers};
+    barriers_init(&barriers, &barrier_device);
+
+    int vertex_barriers = barriers_track(&barriers, vertex_buffer, 1, true, BARRIERS_COMMON);
+    int checkers_barriers = barriers_track(
+        &barriers, checkers_texture, startup.checkers_mip_count, false, BARRIERS_COMMON);
+
+    int render_target_barriers[2]; // buffer_count
+    for (UINT i = 0; i < buffer_count; i++)
+        render_target_barriers[i] = barriers_track(&barriers, NULL, 1, false, BARRIERS_PRESENT);
+
+
+    // With a budget, the scene is drawn into a target of its own, as large
+    // as the window, at the scale the controller picks from the GPU times,
+    // and stretched over the back buffer at the end of the frame.  The
+    // target is made again whenever the window is resized, and its
+    // shader-visible descriptor with it: the old one is freed with the fence
+    // value of the last frame that read it.
+    Resolution resolution;
+    ResolutionConfig resolution_settings = resolution_config((resolution_budget > 0.0) ? resolution_budget : 1.0);
+    resolution_init(&resolution, &resolution_settings);
+
+    ID3D12Resource *scene_target = NULL;
+    HeapAllocation scene_target_memory = {0};
+    DescriptorHandle scene_rtv = DESCRIPTORS_NONE;
+    DescriptorHandle scene_staging = DESCRIPTORS_NONE;
+    DescriptorHandle scene_srv = DESCRIPTORS_NONE;
+    int scene_target_barriers = -1;
+    if (blit_pipeline) {
+        scene_rtv = descriptors_alloc(&rtv_heap.alloc, 1);
+        scene_staging = descriptors_alloc(&startup.staging_heap.alloc, 1);
+        ASSERT(scene_rtv != DESCRIPTORS_NONE && scene_staging != DESCRIPTORS_NONE);
+        scene_target_barriers = barriers_track(&barriers, NULL, 1, false, BARRIERS_RENDER_TARGET);
+    }
 
     // To create render targets the first time the program runs.
     window_resized = true;
@@ -514,19 +2329,85 @@ int WINAPI WinMain(HINSTANCE instance, HINSTANCE instance_p, LPSTR cmd_line, int
     double uptime = 0.0;
     int frame_count = 0;
 
+    bool assets_ready = false;
+    int draw_list_count = 0;
+
+    // What the frame records, as it is captured: the list the frame starts
+    // with, the draw lists, and the one it ends with.
+    bool capturing_frame = false;
+    CaptureList capture_lists[2 + RECORD_LISTS_MAX];
+    memset(capture_lists, 0, sizeof(capture_lists));
+    CaptureList *capture_begin = &capture_lists[0];
+    CaptureList *capture_draws = &capture_lists[1];
+    CaptureList *capture_end = &capture_lists[1 + RECORD_LISTS_MAX];
+
+    // Where each draw's constants are, for the frame being recorded.
+    UINT64 *draw_constants = NULL;
+    int draw_constants_capacity = 0;
+
+
+    // Where GPU timestamps are on the clock of the profiler.
+    double gpu_offset;
+    {
+        UINT64 gpu_tick, cpu_tick;
+        HRESULT hr = cmd_queue->GetClockCalibration(&gpu_tick, &cpu_tick);
+        ASSERT_HR(hr);
+
+        gpu_offset = (double)((INT64)cpu_tick - tick_0.QuadPart) / (double)freq.QuadPart -
+                     (double)gpu_tick / (double)timestamp_frequency;
+    }
+
+    // The profiler's frame that used each frame slot last, plus 1.
+    uint64_t timestamp_frames[FRAMES_MAX] = {0};
+
+    profile_init(&profile);
+    uint64_t frame_index = profile_begin_frame(&profile, 0.0);
+
+    PacingContext pacing_context = {tick_0, freq, NULL, frame_waitable};
+    pacing_context.timer = CreateWaitableTimerExW(
+        NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (!pacing_context.timer) // Before Windows 10, version 1803.
+        pacing_context.timer = CreateWaitableTimerExW(NULL, NULL, 0, TIMER_ALL_ACCESS);
+    ASSERT(pacing_context.timer);
+
+    PacingClock pacing_clock = {&pacing_context, pacing_now, pacing_sleep, pacing_wait_frame, pacing_vblank};
+    Pacing pacing;
+    pacing_init(&pacing, pacing_mode, pacing_cap, &pacing_clock);
 
-    bool first_time = true;
 
 
+    static EventBatch window_batch;
 
     while (1) {
-        MSG msg;
-        if (PeekMessageW(&msg, NULL, 0, 0, PM_REMOVE)) {
-            if (msg.message == WM_QUIT)
+        // Wait until the frame is due, before anything it does.
+        pacing_begin(&pacing);
+        profile_mark(&profile, PROFILE_PACE, elapsed(tick_0, freq));
+
+
+        // Take what the window thread sent since the last frame.  Of all
+        // the sizes it went through, only the last one matters.  Minimized,
+        // the window is 0x0, which nothing can be drawn at, so the frames go
+        // on at the last size until it is restored.
+        {
+            events_poll(&window_events, window_clock(), &window_batch);
+
+            if (window_batch.resized && window_batch.width > 0 && window_batch.height > 0) {
+                window_width = window_batch.width;
+                window_height = window_batch.height;
+                window_aspect = (float)window_height / (float)window_width;
+                window_resized = true;
+            }
+
+            bool closed = window_batch.closed;
+            for (int i = 0; i < window_batch.input_count; i++) {
+                Event const *event = &window_batch.input[i];
+                if (event->type == EVENT_KEY && event->x == VK_ESCAPE && event->y)
+                    closed = true;
+            }
+
+            profile_mark(&profile, PROFILE_PUMP, elapsed(tick_0, freq));
+            if (closed)
                 break;
-            TranslateMessage(&msg);
-            DispatchMessageW(&msg);
-            continue;
         }
 
 
@@ -537,11 +2418,13 @@ int WINAPI WinMain(HINSTANCE instance, HINSTANCE instance_p, LPSTR cmd_line, int
             window_resized = false;
 
 
-            if (rtv_heap) {
+            // The render targets may still be in use by frames in flight.
+            wait_for_fence(fence, frames_drain(&frames), fence_event);
+
+            if (render_targets_created) {
                 cmd_list->ClearState(NULL);
                 for (UINT i = 0; i < buffer_count; i++)
                     render_targets[i]->Release();
-                rtv_heap->Release();
             }
 
 
@@ -549,30 +2432,56 @@ int WINAPI WinMain(HINSTANCE instance, HINSTANCE instance_p, LPSTR cmd_line, int
 
 
             hr = swapchain->ResizeBuffers(
-                buffer_count, window_width, window_height, DXGI_FORMAT_UNKNOWN, 0);
-            ASSERT_HR(hr);
-
-
-            D3D12_DESCRIPTOR_HEAP_DESC _rtv_heap = {0};
-            _rtv_heap.Type = D3D12_DESCRIPTOR_HEAP_TYPE_RTV;
-            _rtv_heap.NumDescriptors = buffer_count;
-
-            hr = device->CreateDescriptorHeap(&_rtv_heap, IID_PPV_ARGS(&rtv_heap));
+                buffer_count, window_width, window_height, DXGI_FORMAT_UNKNOWN, swapchain_flags);
             ASSERT_HR(hr);
 
-            rtv_base = rtv_heap->GetCPUDescriptorHandleForHeapStart();
-            rtv_stride = device->GetDescriptorHandleIncrementSize(
-                D3D12_DESCRIPTOR_HEAP_TYPE_RTV);
-
-
-            D3D12_CPU_DESCRIPTOR_HANDLE rtv_handle = rtv_base;
 
             for (UINT i = 0; i < buffer_count; i++) {
                 hr = swapchain->GetBuffer(i, IID_PPV_ARGS(&render_targets[i]));
                 ASSERT_HR(hr);
 
-                device->CreateRenderTargetView(render_targets[i], NULL, rtv_handle);
-                rtv_handle.ptr += rtv_stride;
+                device->CreateRenderTargetView(
+                    render_targets[i], NULL, cpu_descriptor(&rtv_heap, rtvs, i));
+
+                barriers_rebind(&barriers, render_target_barriers[i], render_targets[i], BARRIERS_PRESENT);
+            }
+            render_targets_created = true;
+
+
+            if (blit_pipeline) {
+                if (scene_target) {
+                    release_placed_resource(&gpu_memory, POOL_TARGETS, scene_target, &scene_target_memory);
+                    scene_target = NULL;
+                }
+
+                D3D12_RESOURCE_DESC target = {0};
+                target.Dimension = D3D12_RESOURCE_DIMENSION_TEXTURE2D;
+                target.Width = (UINT64)window_width;
+                target.Height = (UINT)window_height;
+                target.DepthOrArraySize = 1;
+                target.MipLevels = 1;
+                target.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+                target.SampleDesc = {1, 0};
+                target.Layout = D3D12_TEXTURE_LAYOUT_UNKNOWN;
+                target.Flags = D3D12_RESOURCE_FLAG_ALLOW_RENDER_TARGET;
+
+                scene_target_memory = create_placed_resource(
+                    &gpu_memory, POOL_TARGETS, &target, D3D12_RESOURCE_STATE_RENDER_TARGET, &scene_target);
+                ASSERT(scene_target_memory.block);
+
+                if (scene_srv != DESCRIPTORS_NONE)
+                    descriptors_free(&srv_heap.alloc, scene_srv, frames_drain(&frames));
+                scene_srv = descriptors_alloc(&srv_heap.alloc, 1);
+                ASSERT(scene_srv != DESCRIPTORS_NONE);
+
+                device->CreateRenderTargetView(scene_target, NULL, cpu_descriptor(&rtv_heap, scene_rtv, 0));
+                device->CreateShaderResourceView(
+                    scene_target, NULL, cpu_descriptor(&startup.staging_heap, scene_staging, 0));
+                descriptors_copy(&srv_heap.alloc, descriptors_index(&srv_heap.alloc, scene_srv),
+                                 descriptors_index(&startup.staging_heap.alloc, scene_staging), 1);
+                descriptors_flush(&srv_heap.alloc);
+
+                barriers_rebind(&barriers, scene_target_barriers, scene_target, BARRIERS_RENDER_TARGET);
             }
         }
 
@@ -583,121 +2492,296 @@ int WINAPI WinMain(HINSTANCE instance, HINSTANCE instance_p, LPSTR cmd_line, int
             HRESULT hr;
 
 
-            hr = cmd_alloc->Reset();
-            ASSERT_HR(hr);
-
-            hr = cmd_list->Reset(cmd_alloc, pipeline);
-            ASSERT_HR(hr);
-
-
-            // Initialization that invoke the command list.
+            // Wait until the GPU is done with the frame that last used this
+            // slot, and no longer.  Resizing counts as waiting too.
+            wait_for_fence(fence, frames_begin(&frames), fence_event);
+            profile_mark(&profile, PROFILE_WAIT, elapsed(tick_0, freq));
 
-            if (first_time) {
-                first_time = false;
+            UINT slot = (UINT)frames.index;
 
+            // That frame's timestamps have been resolved by now.
+            if (timestamp_frames[slot]) {
+                D3D12_RANGE read = {2 * slot * sizeof(UINT64), (2 * slot + 2) * sizeof(UINT64)};
+                UINT64 *ticks;
+                hr = timestamp_readback->Map(0, &read, (void **)&ticks);
+                ASSERT_HR(hr);
 
-                // Transfer vertex data in the upload buffer to the vertex buffer.
+                double begin = gpu_offset + (double)ticks[2 * slot] / (double)timestamp_frequency;
+                double end = gpu_offset + (double)ticks[2 * slot + 1] / (double)timestamp_frequency;
 
-                cmd_list->CopyBufferRegion(
-                    vertex_buffer, 0, upload_buffer, triangle_offset, sizeof(triangle));
+                D3D12_RANGE written = {0, 0};
+                timestamp_readback->Unmap(0, &written);
 
+                profile_gpu(&profile, timestamp_frames[slot] - 1, begin, end);
+                pacing_gpu(&pacing, end - begin);
+                if (blit_pipeline)
+                    resolution_update(&resolution, end - begin);
+            }
+            timestamp_frames[slot] = frame_index + 1;
 
-                // Transfer texture data in upload buffer to the texture resource.
+            // A rebuilt pipeline comes in here, and draws the whole frame.
+            // The one it replaces goes once the frames in flight are done.
+            pipeline = (ID3D12PipelineState *)reload_frame(
+                &reload, fence->GetCompletedValue(), frames_drain(&frames));
 
-                D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint = {0};
+            char reload_error[RELOAD_ERROR];
+            if (reload_failed(&reload, reload_error, sizeof(reload_error))) {
+                OutputDebugStringA(reload_error);
+                OutputDebugStringA("shaders.hlsl: still drawing with the last pipeline that built\n");
+            }
 
-                device->GetCopyableFootprints(
-                    &checkers_texture->GetDesc(), 0, 1, checkers_offset,
-                    &footprint, NULL, NULL, NULL);
+            ID3D12CommandAllocator *cmd_alloc = cmd_allocs[frames.index];
 
-                D3D12_TEXTURE_COPY_LOCATION src = {0};
-                src.pResource = upload_buffer;
-                src.Type = D3D12_TEXTURE_COPY_TYPE_PLACED_FOOTPRINT;
-                src.PlacedFootprint = footprint;
+            hr = cmd_alloc->Reset();
+            ASSERT_HR(hr);
 
-                D3D12_TEXTURE_COPY_LOCATION dst = {0};
-                dst.pResource = checkers_texture;
-                dst.Type = D3D12_TEXTURE_COPY_TYPE_SUBRESOURCE_INDEX;
-                dst.SubresourceIndex = 0;
+            hr = cmd_list->Reset(cmd_alloc, pipeline);
+            ASSERT_HR(hr);
 
-                cmd_list->CopyTextureRegion(&dst, 0, 0, 0, &src, NULL);
+            cmd_list->EndQuery(timestamps, D3D12_QUERY_TYPE_TIMESTAMP, 2 * slot);
 
+            capturing_frame = capturing && captured < capture_frames;
+            if (capturing_frame) {
+                capture_frame(&capture, frame_index);
+                capture_list_reset(capture_begin);
+                capture_list_reset(capture_end);
+            }
+            barrier_list.capture = (capturing_frame) ? capture_begin : NULL;
 
-                D3D12_RESOURCE_BARRIER vb = {0};
-                vb.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
-                vb.Transition.pResource = vertex_buffer;
-                vb.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
-                vb.Transition.StateBefore = D3D12_RESOURCE_STATE_COPY_DEST;
-                vb.Transition.StateAfter = D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER;
 
-                D3D12_RESOURCE_BARRIER tex = {0};
-                tex.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
-                tex.Transition.pResource = checkers_texture;
-                tex.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
-                tex.Transition.StateBefore = D3D12_RESOURCE_STATE_COPY_DEST;
-                tex.Transition.StateAfter = D3D12_RESOURCE_STATE_PIXEL_SHADER_RESOURCE;
+            // The render target can start becoming one while the rest of the
+            // state is set up.
+            UINT render_target_index = swapchain->GetCurrentBackBufferIndex();
+            int render_target = render_target_barriers[render_target_index];
 
-                D3D12_RESOURCE_BARRIER bars[] = {vb, tex};
+            barriers_begin(&barriers, render_target, BARRIERS_ALL, BARRIERS_RENDER_TARGET);
+            barriers_flush(&barriers);
 
-                cmd_list->ResourceBarrier(_countof(bars), bars);
-            }
 
+            assets_ready = transfer_ready(assets_ticket, copy_fence->GetCompletedValue());
 
-            cmd_list->SetGraphicsRootSignature(signature);
 
-            cmd_list->SetDescriptorHeaps(1, &srv_heap);
-            cmd_list->SetGraphicsRootDescriptorTable(
-                table_slot, srv_heap->GetGPUDescriptorHandleForHeapStart());
+            // Descriptors freed by frames the GPU is done with can be reused.
+            descriptors_retire(&srv_heap.alloc, fence->GetCompletedValue());
 
             float consts[] = {
                 (float)window_width, (float)window_height, window_aspect, (float)uptime
             };
-            cmd_list->SetGraphicsRoot32BitConstants(consts_slot, _countof(consts), consts, 0);
 
+            // Drawn smaller, the scene goes into the top-left corner of a
+            // target of its own.  Captured frames are drawn at the size of
+            // the window, straight into the back buffer, as they always were.
+            bool scaled = scene_target && !capturing_frame;
+            int scene_width = window_width;
+            int scene_height = window_height;
+            if (scaled)
+                resolution_size(&resolution, window_width, window_height, &scene_width, &scene_height);
 
             D3D12_VIEWPORT viewport = {0};
-            viewport.Width = (float)window_width;
-            viewport.Height = (float)window_height;
+            viewport.Width = (float)scene_width;
+            viewport.Height = (float)scene_height;
 
             D3D12_RECT scissor = {0};
-            scissor.right = (ULONG)window_width;
-            scissor.bottom = (ULONG)window_height;
+            scissor.right = (ULONG)scene_width;
+            scissor.bottom = (ULONG)scene_height;
+
+
+            // The draw lists come after this one, so whatever they use is
+            // in its state by the time they run.
+            barriers_use(&barriers, render_target, BARRIERS_ALL, BARRIERS_RENDER_TARGET);
+            if (scaled)
+                barriers_use(&barriers, scene_target_barriers, BARRIERS_ALL, BARRIERS_RENDER_TARGET);
+            if (assets_ready) {
+                barriers_use(&barriers, vertex_barriers, BARRIERS_ALL, BARRIERS_VERTEX_BUFFER);
+                barriers_use(&barriers, checkers_barriers, BARRIERS_ALL, BARRIERS_PIXEL_SHADER);
+            }
+            barriers_flush(&barriers);
 
-            cmd_list->RSSetViewports(1, &viewport);
-            cmd_list->RSSetScissorRects(1, &scissor);
 
+            D3D12_CPU_DESCRIPTOR_HANDLE rtv_handle = (scaled)
+                ? cpu_descriptor(&rtv_heap, scene_rtv, 0)
+                : cpu_descriptor(&rtv_heap, rtvs, render_target_index);
+            cmd_list->ClearRenderTargetView(rtv_handle, background, 1, &scissor);
+            if (capturing_frame)
+                capture_clear(capture_begin, (uint64_t)(uintptr_t)render_targets[render_target_index], background);
 
-            UINT render_target_index = swapchain->GetCurrentBackBufferIndex();
+            hr = cmd_list->Close();
+            ASSERT_HR(hr);
 
 
-            D3D12_RESOURCE_BARRIER rt = {0};
-            rt.Type = D3D12_RESOURCE_BARRIER_TYPE_TRANSITION;
-            rt.Transition.pResource = render_targets[render_target_index];
-            rt.Transition.Subresource = D3D12_RESOURCE_BARRIER_ALL_SUBRESOURCES;
-            rt.Transition.StateBefore = D3D12_RESOURCE_STATE_COMMON;
-            rt.Transition.StateAfter = D3D12_RESOURCE_STATE_RENDER_TARGET;
+            // Only draw the triangles once the copy queue has uploaded them.
+            // The instances vs() puts on screen are packed into this frame's
+            // upload memory, and drawn a chunk at a time; or, drawn
+            // indirectly, the groups of them on screen get a command each in
+            // upload memory instead.  The draws are split into ranges,
+            // recorded in parallel into lists of their own while this
+            // thread helps.
+            draw_list_count = 0;
+            if (assets_ready) {
+                UploadAllocation packed = {0};
+                if (!draw_indirect) {
+                    bool ok = upload_alloc(
+                        &frame_upload, batch.count * sizeof(BatchInstance), UPLOAD_ALIGN_VERTEX, &packed);
+                    ASSERT(ok);
+
+                    batch_pack(&batch, &pool, consts, (BatchInstance *)packed.cpu);
+
+                    // Read back from upload memory, which is slow, but only
+                    // while capturing.
+                    if (capturing_frame)
+                        capture_data(&capture, packed.gpu, packed.cpu, batch.count * sizeof(BatchInstance));
+                }
+                int draw_count = (draw_indirect) ? INDIRECT_TINTS : batch.draw_count;
+
+                // The constants of the frame and of every draw, each chunk of
+                // instances tinted and faded a little differently.
+                ConstantStream stream;
+                constants_init(&stream, &frame_upload, 64 * 1024);
+
+                UINT64 frame_constants = constants_push(&stream, consts, sizeof(FrameConstants));
+                ASSERT(frame_constants);
+                if (capturing_frame)
+                    capture_data(&capture, frame_constants, consts, sizeof(FrameConstants));
+
+                if (draw_count > draw_constants_capacity) {
+                    draw_constants_capacity = draw_count;
+                    draw_constants = (UINT64 *)realloc(draw_constants, draw_constants_capacity * sizeof(UINT64));
+                    ASSERT(draw_constants);
+                }
+                for (int i = 0; i < draw_count; i++) {
+                    DrawConstants draw = draw_constants_default;
+                    draw.position_scale = vertex_scale;
+                    if (i > 0) {
+                        float hue = (float)i * 2.39996323f;     // The golden angle.
+                        draw.tint.x = 0.75f + 0.25f * cosf(hue);
+                        draw.tint.y = 0.75f + 0.25f * cosf(hue - 2.09439510f);
+                        draw.tint.z = 0.75f + 0.25f * cosf(hue + 2.09439510f);
+                        draw.fade_phase = (float)i * 0.5f;
+                    }
+                    draw_constants[i] = constants_push(&stream, &draw, sizeof(draw));
+                    ASSERT(draw_constants[i]);
+                    if (capturing_frame)
+                        capture_data(&capture, draw_constants[i], &draw, sizeof(draw));
+                }
+                constants_finish(&stream);
+
+                // The groups on screen, as vs() places them, each drawn
+                // with one of the blocks of constants.
+                UploadAllocation commands = {0};
+                int command_count = 0;
+                if (draw_indirect) {
+                    IndirectView view;
+                    indirect_view_2d(consts, &view);
+                    command_count = indirect_cull(&scene, &pool, &view);
+
+                    bool ok = upload_alloc(&frame_upload, (command_count + 1) * sizeof(IndirectCommand),
+                                           UPLOAD_ALIGN_VERTEX, &commands);
+                    ASSERT(ok);
+                    indirect_write(&scene, index_count, draw_constants, draw_count, (IndirectCommand *)commands.cpu);
+                    draw_count = command_count;
+                }
+
+                RecordDraws record;
+                record.allocs = draw_allocs[slot];
+                record.lists = draw_lists;
+                record.list_count = (draw_count < record_lists) ? draw_count : record_lists;
+                record.pipeline = pipeline;
+                record.signature = signature;
+                record.srv_heap = srv_heap.heap;
+                record.table_slot = table_slot;
+                record.table = gpu_descriptor(&srv_heap, checkers_srv, 0);
+                record.frame_slot = frame_slot;
+                record.draw_slot = draw_slot;
+                record.frame_constants = frame_constants;
+                record.draw_constants = draw_constants;
+                record.viewport = viewport;
+                record.scissor = scissor;
+                record.rtv = rtv_handle;
+                record.views[0] = vbv;
+                record.views[1].BufferLocation = packed.gpu;
+                record.views[1].StrideInBytes = sizeof(BatchInstance);
+                record.views[1].SizeInBytes = batch.count * sizeof(BatchInstance);
+                if (draw_indirect)
+                    record.views[1] = instances_view;
+                record.index_view = ibv;
+                record.index_count = index_count;
+                record.draws = batch.draws;
+                record.draw_count = batch.draw_count;
+                record.command_signature = (draw_indirect) ? command_signature : NULL;
+                record.commands = (ID3D12Resource *)commands.resource;
+                record.commands_offset = commands.offset;
+                record.command_data = (IndirectCommand const *)commands.cpu;
+                record.command_count = command_count;
+                record.captures = (capturing_frame) ? capture_draws : NULL;
+                record.texture = checkers_texture;
+                record.target = (scaled) ? scene_target : render_targets[render_target_index];
+
+                JobCounter recorded(0);
+                jobs_for(&jobs, 0, record.list_count, record_draws, &record, &recorded);
+                jobs_wait(&jobs, 0, &recorded);
+
+                draw_list_count = record.list_count;
+            }
+
 
-            cmd_list->ResourceBarrier(1, &rt);
+            // The end of the frame goes into a list that comes after all the
+            // draws.
+            ID3D12CommandAllocator *end_alloc = end_allocs[slot];
 
+            hr = end_alloc->Reset();
+            ASSERT_HR(hr);
 
-            D3D12_CPU_DESCRIPTOR_HANDLE rtv_handle = rtv_base;
-            rtv_handle.ptr += rtv_stride * render_target_index;
-            cmd_list->OMSetRenderTargets(1, &rtv_handle, FALSE, NULL);
+            hr = end_list->Reset(end_alloc, NULL);
+            ASSERT_HR(hr);
 
-            cmd_list->ClearRenderTargetView(rtv_handle, background, 0, NULL);
-            cmd_list->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-            cmd_list->IASetVertexBuffers(0, 1, &vbv);
-            cmd_list->DrawInstanced(_countof(triangle), 1, 0, 0);
+            barrier_list.list = end_list;
+            barrier_list.capture = (capturing_frame) ? capture_end : NULL;
+
+            // The scene, stretched over the whole back buffer.
+            if (scaled) {
+                barriers_use(&barriers, scene_target_barriers, BARRIERS_ALL, BARRIERS_PIXEL_SHADER);
+                barriers_flush(&barriers);
+
+                float blit[4] = {
+                    (float)scene_width / (float)window_width, (float)scene_height / (float)window_height,
+                    1.0f / (float)window_width, 1.0f / (float)window_height
+                };
+
+                D3D12_VIEWPORT window_viewport = {0};
+                window_viewport.Width = (float)window_width;
+                window_viewport.Height = (float)window_height;
+                D3D12_RECT window_scissor = {0, 0, (LONG)window_width, (LONG)window_height};
+                D3D12_CPU_DESCRIPTOR_HANDLE back_buffer = cpu_descriptor(&rtv_heap, rtvs, render_target_index);
+
+                end_list->SetPipelineState(blit_pipeline);
+                end_list->SetGraphicsRootSignature(signature);
+                ID3D12DescriptorHeap *heap = srv_heap.heap;
+                end_list->SetDescriptorHeaps(1, &heap);
+                end_list->SetGraphicsRootDescriptorTable(table_slot, gpu_descriptor(&srv_heap, scene_srv, 0));
+                end_list->SetGraphicsRoot32BitConstants(blit_slot, 4, blit, 0);
+                end_list->RSSetViewports(1, &window_viewport);
+                end_list->RSSetScissorRects(1, &window_scissor);
+                end_list->OMSetRenderTargets(1, &back_buffer, FALSE, NULL);
+                end_list->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+                end_list->DrawInstanced(3, 1, 0, 0);
+            }
 
+            barriers_use(&barriers, render_target, BARRIERS_ALL, BARRIERS_PRESENT);
+            barriers_flush(&barriers);
+            barrier_list.list = cmd_list;
+            barrier_list.capture = NULL;
 
-            rt.Transition.StateBefore = D3D12_RESOURCE_STATE_RENDER_TARGET;
-            rt.Transition.StateAfter = D3D12_RESOURCE_STATE_COMMON;
 
-            cmd_list->ResourceBarrier(1, &rt);
+            end_list->EndQuery(timestamps, D3D12_QUERY_TYPE_TIMESTAMP, 2 * slot + 1);
+            end_list->ResolveQueryData(
+                timestamps, D3D12_QUERY_TYPE_TIMESTAMP, 2 * slot, 2,
+                timestamp_readback, 2 * slot * sizeof(UINT64));
 
 
-            hr = cmd_list->Close();
+            hr = end_list->Close();
             ASSERT_HR(hr);
+
+            profile_mark(&profile, PROFILE_RECORD, elapsed(tick_0, freq));
         }
 
 
@@ -706,29 +2790,65 @@ int WINAPI WinMain(HINSTANCE instance, HINSTANCE instance_p, LPSTR cmd_line, int
         {
             HRESULT hr;
 
-            cmd_queue->ExecuteCommandLists(1, (ID3D12CommandList **)&cmd_list);
+            // Have the direct queue wait on the copies it is about to use, the
+            // first time only.  They are already done, so it never stalls.
+            if (assets_ready) {
+                UINT64 wait = transfer_wait(&transfer, assets_ticket);
+                if (wait) {
+                    hr = cmd_queue->Wait(copy_fence, wait);
+                    ASSERT_HR(hr);
+                }
+            }
+
+            // The lists of the frame, in the order they were meant to run.
+            ID3D12CommandList *lists[2 + RECORD_LISTS_MAX];
+            UINT list_count = 0;
+
+            lists[list_count++] = cmd_list;
+            for (int i = 0; i < draw_list_count; i++)
+                lists[list_count++] = draw_lists[i];
+            lists[list_count++] = end_list;
+
+            cmd_queue->ExecuteCommandLists(list_count, lists);
+            barriers_submit(&barriers);
+
+            if (capturing_frame) {
+                capture_submit(&capture, CAPTURE_DIRECT, capture_begin);
+                for (int i = 0; i < draw_list_count; i++)
+                    capture_submit(&capture, CAPTURE_DIRECT, &capture_draws[i]);
+                capture_submit(&capture, CAPTURE_DIRECT, capture_end);
+
+                if (++captured == capture_frames) {
+                    capturing = false;
+                    OutputDebugStringA((capture_close(&capture)) ? "hello.capture written\n"
+                                                                 : "hello.capture could not be written\n");
+                }
+            }
+            profile_mark(&profile, PROFILE_EXECUTE, elapsed(tick_0, freq));
 
-            bool vsync = true;
-            hr = swapchain->Present((vsync) ? 1 : 0, 0);
+            UINT interval = (UINT)pacing_present(&pacing);
+            hr = swapchain->Present(interval, 0);
             ASSERT_HR(hr);
+            profile_mark(&profile, PROFILE_PRESENT, elapsed(tick_0, freq));
         }
 
 
 
-        // Wait for the GPU to finish.
+        // Mark the end of this frame, without waiting for it.
         {
             HRESULT hr;
 
-            hr = cmd_queue->Signal(fence, fence_value);
+            UINT64 value = frames_end(&frames);
+
+            hr = cmd_queue->Signal(fence, value);
             ASSERT_HR(hr);
 
-            if (fence->GetCompletedValue() < fence_value) {
-                hr = fence->SetEventOnCompletion(fence_value, fence_event);
-                ASSERT_HR(hr);
+            upload_end_frame(&frame_upload, value);
 
-                WaitForSingleObject(fence_event, INFINITE);
-            }
-            fence_value++;
+            // The GPU reports on the frame once the slot comes around again.
+            double now = elapsed(tick_0, freq);
+            profile_end_frame(&profile, now, true);
+            frame_index = profile_begin_frame(&profile, now);
         }
 
 
@@ -747,9 +2867,18 @@ int WINAPI WinMain(HINSTANCE instance, HINSTANCE instance_p, LPSTR cmd_line, int
                 double FPS = (double)frame_count *
                     ((double)freq.QuadPart / (double)(tick.QuadPart - tick_p.QuadPart));
 
+                // Along with how even the frames of the last second were.
+                static ProfileFrame recent[PROFILE_CAPACITY];
+                int count = profile_read(&profile, recent, frame_count);
+
+                ProfileStats frame_stats;
+                profile_stats(recent, count, &frame_stats);
+
                 wchar_t stats[1024];
-                swprintf_s(stats, 1024, L"%s [Uptime: %.0fs, FPS: %.1f]",
-                           window_title, uptime, FPS);
+                swprintf_s(stats, 1024,
+                           L"%s [%hs, Uptime: %.0fs, FPS: %.1f, p99: %.1f ms, GPU: %.1f ms, Hitches: %d]",
+                           window_title, pacing_mode_names[pacing_mode], uptime, FPS,
+                           1000.0 * frame_stats.frame.p99, 1000.0 * frame_stats.gpu.p50, frame_stats.hitches);
                 SetWindowTextW(window, stats);
 
                 tick_p.QuadPart = tick.QuadPart;
@@ -764,28 +2893,146 @@ int WINAPI WinMain(HINSTANCE instance, HINSTANCE instance_p, LPSTR cmd_line, int
 
     // Clean up.
 
+    wait_for_fence(fence, frames_drain(&frames), fence_event);
+    wait_for_fence(copy_fence, transfer_drain(&transfer), copy_event);
+
+
+    // Report on the last frames, and write them out for a closer look.
+    {
+        static ProfileFrame last[PROFILE_CAPACITY];
+        profile_flush(&profile);
+        int count = profile_read(&profile, last, PROFILE_CAPACITY);
+
+        ProfileStats stats;
+        profile_stats(last, count, &stats);
+
+        char report[2048];
+        profile_report(&stats, report, sizeof(report));
+        OutputDebugStringA(report);
+
+        EventStats events = events_stats(&window_events);
+        snprintf(report, sizeof(report),
+                 "events: %llu sent, %llu coalesced, %llu dropped, %.3f ms on average to the frame, %.3f ms at most\n",
+                 (unsigned long long)events.sent, (unsigned long long)events.coalesced,
+                 (unsigned long long)events.dropped,
+                 (events.received) ? 1000.0 * events.latency_sum / (double)events.received : 0.0,
+                 1000.0 * events.latency_max);
+        OutputDebugStringA(report);
+
+        PipelineStats pipeline_stats = pipelines_stats(&pipelines);
+        snprintf(report, sizeof(report),
+                 "pipelines: %d created, %d of them loaded from pipelines.cache, %d failed, %d requests joined one on its way, %.1f ms spent creating them\n",
+                 pipeline_stats.created, pipeline_stats.loaded, pipeline_stats.failed,
+                 pipeline_stats.joined, 1000.0 * pipeline_stats.seconds);
+        OutputDebugStringA(report);
+
+        if (blit_pipeline) {
+            ResolutionStats scaling = resolution_stats(&resolution);
+            snprintf(report, sizeof(report),
+                     "resolution: %d of %d frames over %.2f ms, %d changes of scale, from %.2f to %.2f, %.2f last\n",
+                     scaling.over, scaling.frames, 1000.0 * resolution_budget,
+                     scaling.changes, scaling.lowest, scaling.highest,
+                     resolution.scale);
+            OutputDebugStringA(report);
+        }
+
+        report_gpu_memory(&gpu_memory);
+
+        FILE *trace = fopen("frames.json", "wb");
+        if (trace) {
+            profile_write_trace(trace, last, count);
+            fclose(trace);
+        }
+
+        FILE *csv = fopen("frames.csv", "wb");
+        if (csv) {
+            profile_write_csv(csv, last, count);
+            fclose(csv);
+        }
+    }
+
     for (UINT i = 0; i < buffer_count; i++)
         render_targets[i]->Release();
-    rtv_heap->Release();
+    // Descriptors only the CPU sees are done with once they were recorded
+    // or copied; shader-visible ones are freed with the last frame's fence
+    // value, like everything else the frames read.
+    descriptors_free(&rtv_heap.alloc, rtvs, 0);
+    if (scene_target) {
+        release_placed_resource(&gpu_memory, POOL_TARGETS, scene_target, &scene_target_memory);
+        descriptors_free(&rtv_heap.alloc, scene_rtv, 0);
+        descriptors_free(&srv_heap.alloc, scene_srv, frames_drain(&frames));
+        descriptors_free(&startup.staging_heap.alloc, scene_staging, 0);
+    }
+    barriers_shutdown(&barriers);
+
+    CloseHandle(pacing_context.timer);
+    if (frame_waitable)
+        CloseHandle(frame_waitable);
 
+    CloseHandle(copy_event);
+    copy_fence->Release();
     CloseHandle(fence_event);
     fence->Release();
 
-    srv_heap->Release();
-    checkers_texture->Release();
-    vertex_buffer->Release();
-    upload_buffer->Release();
-
+    timestamp_readback->Release();
+    timestamps->Release();
+
+    descriptors_free(&srv_heap.alloc, checkers_srv, frames_drain(&frames));
+    descriptors_free(&startup.staging_heap.alloc, startup.checkers_staging, 0);
+    destroy_descriptor_heap(&rtv_heap);
+    destroy_descriptor_heap(&srv_heap);
+    destroy_descriptor_heap(&startup.staging_heap);
+    release_placed_resource(&gpu_memory, POOL_TEXTURES, checkers_texture, &startup.checkers_memory);
+    release_placed_resource(&gpu_memory, POOL_BUFFERS, vertex_buffer, &startup.vertex_memory);
+    indirect_free(&scene);
+    batch_free(&batch);
+    free(draw_constants);
+    for (int i = 0; i < _countof(capture_lists); i++)
+        capture_list_free(&capture_lists[i]);
+    if (capturing)
+        capture_close(&capture);
+    upload_shutdown(&frame_upload);
+    upload_shutdown(&upload);
+    shutdown_gpu_memory(&gpu_memory);
+
+    copy_list->Release();
+    for (int i = 0; i < transfer.lists.count; i++)
+        copy_allocs[i]->Release();
+    end_list->Release();
+    for (int i = 0; i < frames_in_flight; i++)
+        end_allocs[i]->Release();
+    for (int l = 0; l < record_lists; l++) {
+        draw_lists[l]->Release();
+        for (int i = 0; i < frames_in_flight; i++)
+            draw_allocs[i][l]->Release();
+    }
     cmd_list->Release();
-    cmd_alloc->Release();
+    for (int i = 0; i < frames_in_flight; i++)
+        cmd_allocs[i]->Release();
+    reload_stop(&reload);
     pipeline->Release();
+    pipelines_shutdown(&pipelines);
+    close_pipeline_library(&pipeline_library, "pipelines.cache");
+    cache_close(&startup.shader_cache);
+    if (command_signature)
+        command_signature->Release();
     signature->Release();
     swapchain->Release();
+    copy_queue->Release();
     cmd_queue->Release();
     device->Release();
 
 
 
+    jobs_shutdown(&jobs);
+    pool_shutdown(&pool);
+
+    // The window can go now, and its thread with it.
+    PostMessageW(window, WM_RENDER_DONE, 0, 0);
+    window_pump.join();
+
+
+
     // Indicate that the program terminated successfully.
     const wchar_t *success = L"You have succeeded in the game's industry.";
     OutputDebugStringW(success);
@@ -0,0 +1,472 @@
+// Draws written by the CPU for ExecuteIndirect().
+//
+// The instances of a batch are uploaded once, grouped by where they are:
+// every group is an object of the scene, with a sphere around all of its
+// instances.  Once a frame, the objects are culled against the planes of
+// the view, several at a time with SIMD (8 with AVX2, 4 with SSE2), the ones
+// left are compacted into a list, and a command is written for each: the
+// address of its constants and the arguments of an indexed draw of its
+// instances.  One ExecuteIndirect() then draws them all, so the CPU no
+// longer touches the instances themselves, only a command per object.
+//
+// The view is a set of planes, the four edges of the screen for the 2D
+// scene of hello.cpp, and a frustum's six for a 3D one: what is in front of
+// every plane, as far as its sphere reaches, is drawn.
+//
+// Nothing here talks to Direct3D 12: an IndirectCommand is laid out the way
+// the command signature of hello.cpp reads it, a root CBV and then
+// D3D12_DRAW_INDEXED_ARGUMENTS, and goes wherever the caller puts it.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <float.h>
+#include <assert.h>
+
+#include <immintrin.h>
+
+#include "batch.h"
+#include "threads.h"
+
+#ifndef ASSERT
+#define ASSERT(expr)    assert(expr)
+#endif
+
+
+
+#define INDIRECT_GROUP  256     // Instances per object, at most.
+#define INDIRECT_CHUNK  4096    // Objects culled by a thread at a time.
+#define INDIRECT_PLANES 6
+
+// Room every chunk has in `visible`: compaction stores whole registers,
+// past the last object it keeps, and must not reach into the next chunk.
+#define INDIRECT_STRIDE (INDIRECT_CHUNK + 8)
+
+typedef struct IndirectCommand {
+    uint64_t    constants;          // The root CBV of the draw.
+    uint32_t    index_count;        // D3D12_DRAW_INDEXED_ARGUMENTS from here on.
+    uint32_t    instance_count;
+    uint32_t    first_index;
+    int32_t     base_vertex;
+    uint32_t    first_instance;
+    uint32_t    pad;                // So that the next CBV address is aligned.
+} IndirectCommand;
+
+static_assert(sizeof(IndirectCommand) == 32, "IndirectCommand is not the stride of the command signature");
+
+// Visible is n . p + d > -radius.
+typedef struct IndirectPlane {
+    float   n[3];
+    float   d;
+} IndirectPlane;
+
+typedef struct IndirectView {
+    IndirectPlane   planes[INDIRECT_PLANES];
+    int             count;
+} IndirectView;
+
+enum {
+    INDIRECT_X, INDIRECT_Y, INDIRECT_Z,
+    INDIRECT_RADIUS,
+    INDIRECT_FIELDS
+};
+
+typedef struct IndirectScene {
+    // The objects, structure-of-arrays, padded to a whole number of SIMD
+    // registers so that loads never run off the end.
+    float           *fields[INDIRECT_FIELDS];
+    uint32_t        *first;         // Of the instances of every object.
+    uint32_t        *count;
+    int             object_count;
+    int             capacity;
+
+    // The instances, object by object, as they are uploaded.
+    BatchInstance   *instances;
+    int             instance_count;
+
+    // Made by indirect_cull(): the objects left, in order, and how many of
+    // them every chunk left, at INDIRECT_STRIDE apart until they are moved
+    // up behind one another.
+    int             *visible;
+    int             visible_count;
+    int             *chunk_counts;
+} IndirectScene;
+
+
+
+// The Scene
+
+static void indirect_init(IndirectScene *scene)
+{
+    memset(scene, 0, sizeof(*scene));
+}
+
+static void indirect_free(IndirectScene *scene)
+{
+    for (int f = 0; f < INDIRECT_FIELDS; f++)
+        free(scene->fields[f]);
+    free(scene->first);
+    free(scene->count);
+    free(scene->instances);
+    free(scene->visible);
+    free(scene->chunk_counts);
+    memset(scene, 0, sizeof(*scene));
+}
+
+// Returns the index of the object.
+static int indirect_add(IndirectScene *scene, float x, float y, float z, float radius,
+                        uint32_t first, uint32_t count)
+{
+    if (scene->object_count == scene->capacity) {
+        int capacity = (scene->capacity) ? scene->capacity * 2 : 1024;
+        for (int f = 0; f < INDIRECT_FIELDS; f++) {
+            scene->fields[f] = (float *)realloc(scene->fields[f], capacity * sizeof(float));
+            ASSERT(scene->fields[f]);
+        }
+        scene->first = (uint32_t *)realloc(scene->first, capacity * sizeof(uint32_t));
+        scene->count = (uint32_t *)realloc(scene->count, capacity * sizeof(uint32_t));
+
+        int chunks = (capacity + INDIRECT_CHUNK - 1) / INDIRECT_CHUNK;
+        scene->visible = (int *)realloc(scene->visible, chunks * INDIRECT_STRIDE * sizeof(int));
+        scene->chunk_counts = (int *)realloc(scene->chunk_counts, chunks * sizeof(int));
+        ASSERT(scene->first && scene->count && scene->visible && scene->chunk_counts);
+        scene->capacity = capacity;
+    }
+
+    int i = scene->object_count++;
+    scene->fields[INDIRECT_X][i] = x;
+    scene->fields[INDIRECT_Y][i] = y;
+    scene->fields[INDIRECT_Z][i] = z;
+    scene->fields[INDIRECT_RADIUS][i] = radius;
+    scene->first[i] = first;
+    scene->count[i] = count;
+    return i;
+}
+
+// Makes the objects out of the instances of a batch: they are sorted into
+// square cells of about INDIRECT_GROUP instances each, and a cell with more
+// than that is split.
+static void indirect_group(IndirectScene *scene, Batch const *batch)
+{
+    float *const *f = batch->fields;
+    int count = batch->count;
+
+    scene->object_count = 0;
+    scene->instances = (BatchInstance *)realloc(scene->instances, (count > 0 ? count : 1) * sizeof(BatchInstance));
+    ASSERT(scene->instances);
+    scene->instance_count = count;
+    if (count == 0)
+        return;
+
+    float lo[2] = {f[BATCH_X][0], f[BATCH_Y][0]};
+    float hi[2] = {lo[0], lo[1]};
+    for (int i = 1; i < count; i++) {
+        lo[0] = fminf(lo[0], f[BATCH_X][i]);
+        lo[1] = fminf(lo[1], f[BATCH_Y][i]);
+        hi[0] = fmaxf(hi[0], f[BATCH_X][i]);
+        hi[1] = fmaxf(hi[1], f[BATCH_Y][i]);
+    }
+
+    int side = (int)ceilf(sqrtf((float)count / (float)INDIRECT_GROUP));
+    side = (side > 0) ? side : 1;
+    float scale[2] = {
+        (hi[0] > lo[0]) ? (float)side / (hi[0] - lo[0]) : 0.0f,
+        (hi[1] > lo[1]) ? (float)side / (hi[1] - lo[1]) : 0.0f,
+    };
+
+    // A counting sort by cell, row by row.
+    int cells = side * side;
+    int *cell_of = (int *)malloc(count * sizeof(int));
+    int *starts = (int *)calloc(cells + 1, sizeof(int));
+    int *order = (int *)malloc(count * sizeof(int));
+    ASSERT(cell_of && starts && order);
+
+    for (int i = 0; i < count; i++) {
+        int cx = (int)((f[BATCH_X][i] - lo[0]) * scale[0]);
+        int cy = (int)((f[BATCH_Y][i] - lo[1]) * scale[1]);
+        cx = (cx < side) ? cx : side - 1;
+        cy = (cy < side) ? cy : side - 1;
+        cell_of[i] = cy * side + cx;
+        starts[cell_of[i] + 1]++;
+    }
+    for (int c = 0; c < cells; c++)
+        starts[c + 1] += starts[c];
+    for (int i = 0; i < count; i++)
+        order[starts[cell_of[i]]++] = i;
+
+    // starts[] now holds where every cell ends.
+    int first = 0;
+    for (int c = 0; c < cells; c++) {
+        for (int run = first; run < starts[c]; run += INDIRECT_GROUP) {
+            int end = (run + INDIRECT_GROUP < starts[c]) ? run + INDIRECT_GROUP : starts[c];
+
+            float box_lo[2] = {FLT_MAX, FLT_MAX};
+            float box_hi[2] = {-FLT_MAX, -FLT_MAX};
+            for (int k = run; k < end; k++) {
+                int i = order[k];
+                box_lo[0] = fminf(box_lo[0], f[BATCH_X][i]);
+                box_lo[1] = fminf(box_lo[1], f[BATCH_Y][i]);
+                box_hi[0] = fmaxf(box_hi[0], f[BATCH_X][i]);
+                box_hi[1] = fmaxf(box_hi[1], f[BATCH_Y][i]);
+            }
+
+            float x = 0.5f * (box_lo[0] + box_hi[0]);
+            float y = 0.5f * (box_lo[1] + box_hi[1]);
+            float radius = 0.0f;
+            for (int k = run; k < end; k++) {
+                int i = order[k];
+                float dx = f[BATCH_X][i] - x;
+                float dy = f[BATCH_Y][i] - y;
+                radius = fmaxf(radius, sqrtf(dx * dx + dy * dy) + f[BATCH_RADIUS][i]);
+
+                BatchInstance *dst = &scene->instances[k];
+                dst->transform[0] = f[BATCH_M00][i];
+                dst->transform[1] = f[BATCH_M01][i];
+                dst->transform[2] = f[BATCH_M10][i];
+                dst->transform[3] = f[BATCH_M11][i];
+                dst->offset[0] = f[BATCH_X][i];
+                dst->offset[1] = f[BATCH_Y][i];
+                dst->uv_offset[0] = f[BATCH_U][i];
+                dst->uv_offset[1] = f[BATCH_V][i];
+                dst->color[0] = f[BATCH_R][i];
+                dst->color[1] = f[BATCH_G][i];
+                dst->color[2] = f[BATCH_B][i];
+                dst->color[3] = f[BATCH_A][i];
+            }
+
+            // Rounding must not leave an edge of an instance out.
+            indirect_add(scene, x, y, 0.0f, radius * 1.0001f, (uint32_t)run, (uint32_t)(end - run));
+        }
+        first = starts[c];
+    }
+
+    free(cell_of);
+    free(starts);
+    free(order);
+}
+
+
+
+// Views
+
+// The edges of the screen, as vs() places the scene given cbuffer0: a
+// center on screen is within [-1, 1] along either axis, and a radius
+// reaches as far as the row of the view it goes through stretches it.
+static void indirect_view_2d(float const consts[4], IndirectView *view)
+{
+    float m[4];
+    batch_view(consts, m);
+
+    view->count = 0;
+    for (int row = 0; row < 2; row++) {
+        float a = m[2 * row];
+        float b = m[2 * row + 1];
+        float length = sqrtf(a * a + b * b);
+        for (int sign = -1; sign <= 1; sign += 2) {
+            IndirectPlane *plane = &view->planes[view->count++];
+            plane->n[0] = (float)sign * a / length;
+            plane->n[1] = (float)sign * b / length;
+            plane->n[2] = 0.0f;
+            plane->d = 1.0f / length;
+        }
+    }
+}
+
+// A frustum looking down +z from the origin, `fov` radians from top to
+// bottom, cut at `z_near` and `z_far`.
+static void indirect_view_frustum(float fov, float aspect, float z_near, float z_far, IndirectView *view)
+{
+    float vertical = 0.5f * fov;
+    float horizontal = atanf(aspect * tanf(vertical));
+    float ch = cosf(horizontal), sh = sinf(horizontal);
+    float cv = cosf(vertical), sv = sinf(vertical);
+
+    IndirectPlane planes[INDIRECT_PLANES] = {
+        {{ ch, 0.0f, sh}, 0.0f},
+        {{-ch, 0.0f, sh}, 0.0f},
+        {{0.0f,  cv, sv}, 0.0f},
+        {{0.0f, -cv, sv}, 0.0f},
+        {{0.0f, 0.0f,  1.0f}, -z_near},
+        {{0.0f, 0.0f, -1.0f}, z_far},
+    };
+    memcpy(view->planes, planes, sizeof(planes));
+    view->count = INDIRECT_PLANES;
+}
+
+// The same test as indirect_cull(), one object at a time, in the same
+// order of operations so that both round alike.
+static bool indirect_visible(IndirectView const *view, float x, float y, float z, float radius)
+{
+    for (int p = 0; p < view->count; p++) {
+        IndirectPlane const *plane = &view->planes[p];
+        float distance = (plane->n[0] * x + plane->n[1] * y) + (plane->n[2] * z + plane->d);
+        if (!(-radius < distance))
+            return false;
+    }
+    return true;
+}
+
+
+
+// Culling
+
+#ifdef __AVX2__
+
+// For every mask of lanes, the lanes that are set, first to last.
+typedef struct IndirectCompact {
+    uint32_t    lanes[256][8];
+} IndirectCompact;
+
+static IndirectCompact indirect_compact_build(void)
+{
+    IndirectCompact table;
+    for (int mask = 0; mask < 256; mask++) {
+        int n = 0;
+        for (int lane = 0; lane < 8; lane++) {
+            if (mask & (1 << lane))
+                table.lanes[mask][n++] = (uint32_t)lane;
+        }
+        while (n < 8)
+            table.lanes[mask][n++] = 0;
+    }
+    return table;
+}
+
+static IndirectCompact const *indirect_compact_table(void)
+{
+    static IndirectCompact const table = indirect_compact_build();
+    return &table;
+}
+
+#endif
+
+typedef struct IndirectCull {
+    IndirectScene       *scene;
+    IndirectView const  *view;
+} IndirectCull;
+
+// Leaves the objects of the chunk that are in view at the start of its
+// part of `visible`.
+static void indirect_cull_chunk(void *ctx, int chunk, int thread)
+{
+    IndirectCull *cull = (IndirectCull *)ctx;
+    IndirectScene *scene = cull->scene;
+    IndirectView const *view = cull->view;
+    float *const *f = scene->fields;
+
+    int first = chunk * INDIRECT_CHUNK;
+    int end = first + INDIRECT_CHUNK;
+    if (end > scene->object_count)
+        end = scene->object_count;
+
+    int *out = scene->visible + chunk * INDIRECT_STRIDE;
+    int count = 0;
+
+    BatchF nx[INDIRECT_PLANES], ny[INDIRECT_PLANES], nz[INDIRECT_PLANES], d[INDIRECT_PLANES];
+    for (int p = 0; p < view->count; p++) {
+        nx[p] = batch_v1(view->planes[p].n[0]);
+        ny[p] = batch_v1(view->planes[p].n[1]);
+        nz[p] = batch_v1(view->planes[p].n[2]);
+        d[p] = batch_v1(view->planes[p].d);
+    }
+    BatchF zero = batch_v1(0.0f);
+
+#ifdef __AVX2__
+    IndirectCompact const *table = indirect_compact_table();
+#endif
+
+    for (int i = first; i < end; i += BATCH_LANES) {
+        BatchF x = batch_vload(f[INDIRECT_X] + i);
+        BatchF y = batch_vload(f[INDIRECT_Y] + i);
+        BatchF z = batch_vload(f[INDIRECT_Z] + i);
+        BatchF below = batch_vsub(zero, batch_vload(f[INDIRECT_RADIUS] + i));
+
+        BatchF in = batch_vlt(below, batch_vadd(batch_vadd(batch_vmul(nx[0], x), batch_vmul(ny[0], y)),
+                                                batch_vadd(batch_vmul(nz[0], z), d[0])));
+        for (int p = 1; p < view->count; p++) {
+            BatchF distance = batch_vadd(batch_vadd(batch_vmul(nx[p], x), batch_vmul(ny[p], y)),
+                                         batch_vadd(batch_vmul(nz[p], z), d[p]));
+            in = batch_vand(in, batch_vlt(below, distance));
+        }
+
+        int mask = batch_vmask(in);
+        if (end - i < BATCH_LANES)
+            mask &= (1 << (end - i)) - 1;
+
+#ifdef __AVX2__
+        // The indices of the lanes left, moved to the front of a register
+        // and stored whole; the next store starts where these end.
+        __m256i lanes = _mm256_loadu_si256((__m256i const *)table->lanes[mask]);
+        __m256i index = _mm256_add_epi32(_mm256_set1_epi32(i), lanes);
+        _mm256_storeu_si256((__m256i *)(out + count), index);
+        count += batch_popcount((unsigned)mask);
+#else
+        while (mask) {
+            out[count++] = i + batch_ctz((unsigned)mask);
+            mask &= mask - 1;
+        }
+#endif
+    }
+
+    scene->chunk_counts[chunk] = count;
+}
+
+// Culls the objects against the view, across the threads of the pool if
+// there is one.  Returns how many are left, in scene->visible.
+static int indirect_cull(IndirectScene *scene, Pool *pool, IndirectView const *view)
+{
+    ASSERT(view->count >= 1 && view->count <= INDIRECT_PLANES);
+
+    // The padding past the last object is read, and must be initialized.
+    for (int f = 0; f < INDIRECT_FIELDS; f++) {
+        for (int i = scene->object_count; i < scene->capacity && i % BATCH_LANES; i++)
+            scene->fields[f][i] = 0.0f;
+    }
+
+    IndirectCull cull = {scene, view};
+    int chunks = (scene->object_count + INDIRECT_CHUNK - 1) / INDIRECT_CHUNK;
+    if (pool && chunks > 1)
+        pool_for(pool, chunks, indirect_cull_chunk, &cull);
+    else {
+        for (int c = 0; c < chunks; c++)
+            indirect_cull_chunk(&cull, c, 0);
+    }
+
+    // Every chunk left its objects at its own start, so they are moved up
+    // to follow the ones before them.
+    int count = 0;
+    for (int c = 0; c < chunks; c++) {
+        int n = scene->chunk_counts[c];
+        if (count != c * INDIRECT_STRIDE)
+            memmove(scene->visible + count, scene->visible + c * INDIRECT_STRIDE, n * sizeof(int));
+        count += n;
+    }
+    scene->visible_count = count;
+    return count;
+}
+
+// Writes a command for every object left into `dst`, which has room for
+// them all.  Each draws `index_count` indices of the mesh for the instances
+// of its object, with constants[object % constant_count].
+static void indirect_write(IndirectScene const *scene, uint32_t index_count,
+                           uint64_t const *constants, int constant_count, IndirectCommand *dst)
+{
+    ASSERT(constant_count > 0);
+
+    // Upload memory is write-combined: whole commands, front to back.
+    for (int k = 0; k < scene->visible_count; k++) {
+        int i = scene->visible[k];
+        IndirectCommand command;
+        command.constants = constants[i % constant_count];
+        command.index_count = index_count;
+        command.instance_count = scene->count[i];
+        command.first_index = 0;
+        command.base_vertex = 0;
+        command.first_instance = scene->first[i];
+        command.pad = 0;
+        memcpy(&dst[k], &command, sizeof(command));
+    }
+}
@@ -0,0 +1,315 @@
+// A job system whose workers steal from one another.
+//
+// Every thread has a deque of jobs of its own: it adds jobs to the bottom of
+// it and takes them back from there, last in first out, which keeps what it
+// works on warm in its caches.  A thread that runs out takes the oldest job
+// from the top of another thread's deque instead, which tends to be the
+// largest piece of work left there.  Neither end needs a lock.
+//
+// Unlike the Pool of threads.h, jobs may add more jobs, and wait for them:
+// a thread that waits runs other jobs in the meantime, so waiting inside a
+// job never stalls the system.  Threads with nothing to do sleep until
+// more jobs are added.
+
+#pragma once
+
+#include <stdint.h>
+#include <assert.h>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#ifndef ASSERT
+#define ASSERT(expr)    assert(expr)
+#endif
+
+
+
+#define JOBS_MAX_THREADS    64
+#define JOBS_CAPACITY       4096        // Per thread, a power of two.
+#define JOBS_SPINS          256         // Tries to steal before sleeping.
+
+// Called with the `index` the job was added with.  `thread` identifies the
+// thread running it, in [0, thread_count), for per-thread scratch memory
+// and for adding more jobs from there.
+typedef void JobFunc(void *ctx, int index, int thread);
+
+// How many jobs are left to do.  Jobs count down their counter once they
+// have run, and jobs_wait() waits for it to reach 0.
+typedef std::atomic<int> JobCounter;
+
+typedef struct Job {
+    JobFunc     *func;
+    void        *ctx;
+    int         index;
+    JobCounter  *counter;
+} Job;
+
+// A job in a deque.  Thieves read it before they know whether they got it,
+// while the owner may be writing it, so every field is atomic.
+typedef struct JobSlot {
+    std::atomic<JobFunc *>      func;
+    std::atomic<void *>         ctx;
+    std::atomic<int>            index;
+    std::atomic<JobCounter *>   counter;
+} JobSlot;
+
+typedef struct JobDeque {
+    alignas(64) std::atomic<int64_t>    top;        // Where thieves take from.
+    alignas(64) std::atomic<int64_t>    bottom;     // Where the owner works.
+    JobSlot                             slots[JOBS_CAPACITY];
+
+    // Only ever written by the thread, and read once it is done.
+    uint64_t                            executed;
+    uint64_t                            stolen;
+    uint64_t                            inline_jobs;  // Run at once, the deque being full.
+} JobDeque;
+
+typedef struct JobStats {
+    uint64_t    executed;
+    uint64_t    stolen;
+    uint64_t    inline_jobs;
+} JobStats;
+
+typedef struct Jobs {
+    int                         thread_count;   // Including the caller.
+    std::thread                 threads[JOBS_MAX_THREADS];
+    JobDeque                    *deques;
+
+    // Jobs in deques, and threads asleep waiting for them.
+    std::atomic<int>            queued;
+    std::atomic<int>            sleepers;
+    std::mutex                  mutex;
+    std::condition_variable     wake;
+    std::atomic<bool>           quit;
+} Jobs;
+
+
+
+// Deques
+
+// Only the owner adds.  Returns false when the deque is full.
+static bool jobs_push(JobDeque *deque, Job const *job)
+{
+    int64_t b = deque->bottom.load(std::memory_order_relaxed);
+    int64_t t = deque->top.load(std::memory_order_acquire);
+    if (b - t >= JOBS_CAPACITY)
+        return false;
+
+    JobSlot *slot = &deque->slots[b & (JOBS_CAPACITY - 1)];
+    slot->func.store(job->func, std::memory_order_relaxed);
+    slot->ctx.store(job->ctx, std::memory_order_relaxed);
+    slot->index.store(job->index, std::memory_order_relaxed);
+    slot->counter.store(job->counter, std::memory_order_relaxed);
+
+    std::atomic_thread_fence(std::memory_order_release);
+    deque->bottom.store(b + 1, std::memory_order_relaxed);
+    return true;
+}
+
+static void jobs_read(JobSlot const *slot, Job *job)
+{
+    job->func = slot->func.load(std::memory_order_relaxed);
+    job->ctx = slot->ctx.load(std::memory_order_relaxed);
+    job->index = slot->index.load(std::memory_order_relaxed);
+    job->counter = slot->counter.load(std::memory_order_relaxed);
+}
+
+// Only the owner takes from the bottom.  The last job left may be taken by
+// a thief at the same time, and only one of them gets it.
+static bool jobs_pop(JobDeque *deque, Job *job)
+{
+    int64_t b = deque->bottom.load(std::memory_order_relaxed) - 1;
+    deque->bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = deque->top.load(std::memory_order_relaxed);
+
+    if (t > b) {
+        deque->bottom.store(b + 1, std::memory_order_relaxed);
+        return false;
+    }
+
+    jobs_read(&deque->slots[b & (JOBS_CAPACITY - 1)], job);
+    if (t < b)
+        return true;
+
+    bool won = deque->top.compare_exchange_strong(
+        t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    deque->bottom.store(b + 1, std::memory_order_relaxed);
+    return won;
+}
+
+// Any other thread takes from the top.
+static bool jobs_steal(JobDeque *deque, Job *job)
+{
+    int64_t t = deque->top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = deque->bottom.load(std::memory_order_acquire);
+    if (t >= b)
+        return false;
+
+    jobs_read(&deque->slots[t & (JOBS_CAPACITY - 1)], job);
+    return deque->top.compare_exchange_strong(
+        t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+
+
+// Running Jobs
+
+static void jobs_execute(Jobs *jobs, Job const *job, int thread)
+{
+    job->func(job->ctx, job->index, thread);
+    jobs->deques[thread].executed++;
+    if (job->counter)
+        job->counter->fetch_sub(1, std::memory_order_release);
+}
+
+// Takes a job from the thread's own deque, or else from another one's,
+// trying them in turn from a different one every time.
+static bool jobs_take(Jobs *jobs, int thread, uint32_t *random, Job *job)
+{
+    if (jobs_pop(&jobs->deques[thread], job)) {
+        jobs->queued.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    int count = jobs->thread_count;
+    *random = *random * 1664525u + 1013904223u;
+    int first = (int)((*random >> 16) % (uint32_t)count);
+    for (int i = 0; i < count; i++) {
+        int victim = (first + i) % count;
+        if (victim != thread && jobs_steal(&jobs->deques[victim], job)) {
+            jobs->queued.fetch_sub(1, std::memory_order_relaxed);
+            jobs->deques[thread].stolen++;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void jobs_worker(Jobs *jobs, int thread)
+{
+    uint32_t random = (uint32_t)thread * 2654435761u;
+    int idle = 0;
+
+    while (!jobs->quit.load(std::memory_order_relaxed)) {
+        Job job;
+        if (jobs_take(jobs, thread, &random, &job)) {
+            jobs_execute(jobs, &job, thread);
+            idle = 0;
+            continue;
+        }
+
+        if (++idle < JOBS_SPINS) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        // Whoever adds a job sees that this thread sleeps, or this thread
+        // sees the job: both are sequentially consistent.
+        std::unique_lock<std::mutex> lock(jobs->mutex);
+        jobs->sleepers.fetch_add(1);
+        while (jobs->queued.load() <= 0 && !jobs->quit.load())
+            jobs->wake.wait(lock);
+        jobs->sleepers.fetch_sub(1);
+        idle = 0;
+    }
+}
+
+// A thread_count of 0 picks one thread per hardware thread.
+static void jobs_init(Jobs *jobs, int thread_count)
+{
+    if (thread_count <= 0)
+        thread_count = (int)std::thread::hardware_concurrency();
+    if (thread_count <= 0)
+        thread_count = 1;
+    if (thread_count > JOBS_MAX_THREADS)
+        thread_count = JOBS_MAX_THREADS;
+
+    jobs->thread_count = thread_count;
+    jobs->deques = new JobDeque[thread_count];
+    for (int i = 0; i < thread_count; i++) {
+        jobs->deques[i].top = 0;
+        jobs->deques[i].bottom = 0;
+        jobs->deques[i].executed = 0;
+        jobs->deques[i].stolen = 0;
+        jobs->deques[i].inline_jobs = 0;
+    }
+    jobs->queued = 0;
+    jobs->sleepers = 0;
+    jobs->quit = false;
+
+    // The calling thread is thread 0, it works while it waits.
+    for (int i = 1; i < thread_count; i++)
+        jobs->threads[i] = std::thread(jobs_worker, jobs, i);
+}
+
+static void jobs_shutdown(Jobs *jobs)
+{
+    {
+        std::unique_lock<std::mutex> lock(jobs->mutex);
+        jobs->quit = true;
+        jobs->wake.notify_all();
+    }
+    for (int i = 1; i < jobs->thread_count; i++)
+        jobs->threads[i].join();
+    delete[] jobs->deques;
+}
+
+// Adds a job, from `thread`: 0 for the thread that called jobs_init(), or
+// the thread a job runs on.  The counter, if any, is counted up.
+static void jobs_add(Jobs *jobs, int thread, JobFunc *func, void *ctx, int index, JobCounter *counter)
+{
+    Job job = {func, ctx, index, counter};
+    if (counter)
+        counter->fetch_add(1, std::memory_order_relaxed);
+
+    // With no room left, the job is as good as taken by this thread.
+    if (!jobs_push(&jobs->deques[thread], &job)) {
+        jobs->deques[thread].inline_jobs++;
+        jobs_execute(jobs, &job, thread);
+        return;
+    }
+
+    jobs->queued.fetch_add(1);
+    if (jobs->sleepers.load() > 0) {
+        std::unique_lock<std::mutex> lock(jobs->mutex);
+        jobs->wake.notify_one();
+    }
+}
+
+// Adds `count` jobs, for every index in [0, count).
+static void jobs_for(Jobs *jobs, int thread, int count, JobFunc *func, void *ctx, JobCounter *counter)
+{
+    for (int i = 0; i < count; i++)
+        jobs_add(jobs, thread, func, ctx, i, counter);
+}
+
+// Runs jobs until the counter is down to 0.  Jobs may wait too.
+static void jobs_wait(Jobs *jobs, int thread, JobCounter *counter)
+{
+    uint32_t random = (uint32_t)thread * 2246822519u + 1;
+
+    while (counter->load(std::memory_order_acquire) > 0) {
+        Job job;
+        if (jobs_take(jobs, thread, &random, &job))
+            jobs_execute(jobs, &job, thread);
+        else
+            std::this_thread::yield();
+    }
+}
+
+// Only meaningful while no jobs run.
+static JobStats jobs_stats(Jobs const *jobs)
+{
+    JobStats stats = {0};
+    for (int i = 0; i < jobs->thread_count; i++) {
+        stats.executed += jobs->deques[i].executed;
+        stats.stolen += jobs->deques[i].stolen;
+        stats.inline_jobs += jobs->deques[i].inline_jobs;
+    }
+    return stats;
+}
@@ -0,0 +1,524 @@
+// Indexed meshes, and the order their triangles and vertices are drawn in.
+//
+// A list of triangles, three vertices each, becomes vertices without
+// duplicates and indices into them with mesh_index().  Then, in the order
+// the GPU likes best:
+//
+// * mesh_order_cache() reorders the triangles so that their vertices are
+//   still in the post-transform cache when they come up again, with
+//   Tipsify (Sander, Nehab and Barczak, "Fast Triangle Reordering for
+//   Vertex Locality and Reduced Overdraw", 2007): it fans around one vertex
+//   after another, picking the next one among those just used that would
+//   still be in the cache, in linear time.
+//
+// * mesh_order_overdraw() then splits that order into clusters where the
+//   cache does as well as on the whole, and draws the clusters that face
+//   out of the mesh the most first, as they are the likeliest to hide the
+//   others.
+//
+// * mesh_order_fetch() renumbers the vertices in the order they are first
+//   used, so that fetching them goes through memory front to back.
+//
+// mesh_acmr() and mesh_atvr() are how many vertices the cache has to
+// transform, per triangle and per vertex, by simulating a FIFO of a given
+// size.  Vertices are whatever the caller makes them, of any stride; only
+// overdraw needs positions, as 2 or 3 floats at the start of each vertex.
+// In 2D, every triangle faces the same way, and the order stays as it is.
+//
+// Nothing here talks to Direct3D 12; hello.cpp draws what it makes with
+// DrawIndexedInstanced(), and bench.cpp puts it through large meshes.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include <immintrin.h>
+
+#ifndef ASSERT
+#define ASSERT(expr)    assert(expr)
+#endif
+
+
+
+#define MESH_CACHE          16      // Vertices in the post-transform cache, about.
+#define MESH_OVERDRAW       1.05f   // How much worse than the whole a cluster may do.
+#define MESH_AHEAD          16      // Vertices hashed ahead of the one looked up.
+
+
+
+// Indexing
+
+static uint64_t mesh_hash(void const *data, size_t size)
+{
+    uint8_t const *bytes = (uint8_t const *)data;
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; i++)
+        h = (h ^ bytes[i]) * 0x100000001b3ull;
+    return h ^ (h >> 29);
+}
+
+// Finds the vertices of `count` that are the same, byte for byte.
+// `remap[i]` is what vertex i becomes, numbered in the order they first
+// come up.  Returns how many there are left.
+static int mesh_remap(void const *vertices, int count, size_t stride, uint32_t *remap)
+{
+    uint8_t const *bytes = (uint8_t const *)vertices;
+
+    int capacity = 1;
+    while (capacity < 2 * count)
+        capacity *= 2;
+
+    // Slots hold the vertex that first came up, plus 1, and what it became.
+    // They are missed in the cache nearly every time, so they are hashed
+    // and fetched MESH_AHEAD vertices before they are needed.
+    uint32_t (*slots)[2] = (uint32_t (*)[2])calloc(capacity, sizeof(*slots));
+    uint32_t ahead[MESH_AHEAD];
+    ASSERT(slots);
+
+    for (int i = 0; i < MESH_AHEAD && i < count; i++) {
+        ahead[i] = (uint32_t)mesh_hash(bytes + i * stride, stride) & (capacity - 1);
+        _mm_prefetch((char const *)&slots[ahead[i]], _MM_HINT_T0);
+    }
+
+    int unique = 0;
+    for (int i = 0; i < count; i++) {
+        void const *v = bytes + i * stride;
+        uint32_t slot = ahead[i % MESH_AHEAD];
+
+        if (i + MESH_AHEAD < count) {
+            uint32_t later = (uint32_t)mesh_hash(bytes + (i + MESH_AHEAD) * stride, stride) & (capacity - 1);
+            ahead[i % MESH_AHEAD] = later;
+            _mm_prefetch((char const *)&slots[later], _MM_HINT_T0);
+        }
+
+        while (slots[slot][0] != 0 && memcmp(bytes + (slots[slot][0] - 1) * stride, v, stride) != 0)
+            slot = (slot + 1) & (capacity - 1);
+
+        if (slots[slot][0] == 0) {
+            slots[slot][0] = (uint32_t)i + 1;
+            slots[slot][1] = (uint32_t)unique++;
+        }
+        remap[i] = slots[slot][1];
+    }
+
+    free(slots);
+    return unique;
+}
+
+// From a list of triangles, `count` vertices: the vertices without the
+// duplicates into `dst`, and `count` indices into them.  Returns how many
+// vertices there are.  `dst` may be `vertices`.
+static int mesh_index(void const *vertices, int count, size_t stride, void *dst, uint32_t *indices)
+{
+    int unique = mesh_remap(vertices, count, stride, indices);
+
+    // Each one goes where it first came up or earlier, so moving them
+    // front to back never overwrites one still to be moved.
+    int next = 0;
+    for (int i = 0; i < count; i++) {
+        if ((int)indices[i] == next) {
+            memmove((uint8_t *)dst + next * stride, (uint8_t const *)vertices + i * stride, stride);
+            next++;
+        }
+    }
+    return unique;
+}
+
+// Bytes per index: 16 bits when every vertex can be told apart with them.
+static int mesh_index_size(int vertex_count)
+{
+    return (vertex_count <= 0x10000) ? 2 : 4;
+}
+
+// Into indices of mesh_index_size() bytes.  `dst` may be `indices`.
+static void mesh_narrow(uint32_t const *indices, int count, int size, void *dst)
+{
+    if (size == 4) {
+        memmove(dst, indices, count * sizeof(uint32_t));
+        return;
+    }
+    uint16_t *narrow = (uint16_t *)dst;
+    for (int i = 0; i < count; i++)
+        narrow[i] = (uint16_t)indices[i];
+}
+
+
+
+// Metrics
+
+// Vertices transformed by a FIFO cache of `cache` entries.
+static int mesh_misses(uint32_t const *indices, int count, int vertex_count, int cache)
+{
+    // When each vertex went into the cache; it is still there while fewer
+    // than `cache` others went in after it.
+    uint32_t *stamps = (uint32_t *)calloc(vertex_count, sizeof(uint32_t));
+    ASSERT(stamps);
+
+    uint32_t time = (uint32_t)cache + 1;
+    int misses = 0;
+    for (int i = 0; i < count; i++) {
+        uint32_t v = indices[i];
+        if (time - stamps[v] > (uint32_t)cache) {
+            stamps[v] = time++;
+            misses++;
+        }
+    }
+
+    free(stamps);
+    return misses;
+}
+
+// Average cache miss ratio: vertices transformed per triangle, 0.5 at best
+// and 3 at worst.
+static double mesh_acmr(uint32_t const *indices, int count, int vertex_count, int cache)
+{
+    return (count > 0) ? (double)mesh_misses(indices, count, vertex_count, cache) / (count / 3) : 0.0;
+}
+
+// Average transform to vertex ratio: vertices transformed per vertex, 1 at
+// best.
+static double mesh_atvr(uint32_t const *indices, int count, int vertex_count, int cache)
+{
+    return (vertex_count > 0) ? (double)mesh_misses(indices, count, vertex_count, cache) / vertex_count : 0.0;
+}
+
+
+
+// Triangle Order
+
+// The triangles around each vertex.
+typedef struct MeshAdjacency {
+    uint32_t    *first;         // Per vertex, into triangles, and one past the last.
+    uint32_t    *triangles;
+} MeshAdjacency;
+
+static void mesh_adjacency(MeshAdjacency *a, uint32_t const *indices, int count, int vertex_count)
+{
+    a->first = (uint32_t *)calloc(vertex_count + 1, sizeof(uint32_t));
+    a->triangles = (uint32_t *)malloc(count * sizeof(uint32_t));
+    ASSERT(a->first && a->triangles);
+
+    for (int i = 0; i < count; i++)
+        a->first[indices[i] + 1]++;
+    for (int v = 0; v < vertex_count; v++)
+        a->first[v + 1] += a->first[v];
+
+    uint32_t *fill = (uint32_t *)malloc(vertex_count * sizeof(uint32_t));
+    ASSERT(fill);
+    memcpy(fill, a->first, vertex_count * sizeof(uint32_t));
+    for (int i = 0; i < count; i++)
+        a->triangles[fill[indices[i]]++] = (uint32_t)(i / 3);
+    free(fill);
+}
+
+static void mesh_free_adjacency(MeshAdjacency *a)
+{
+    free(a->first);
+    free(a->triangles);
+}
+
+// Reorders the triangles of `indices` for a cache of `cache` vertices.
+// Where the order had to jump to a vertex that was not just used, a
+// cluster starts: `clusters`, when not NULL, gets the first triangle of
+// each, and the function returns how many there are.
+static int mesh_order_cache(uint32_t *indices, int count, int vertex_count, int cache, uint32_t *clusters)
+{
+    int triangle_count = count / 3;
+    if (triangle_count == 0)
+        return 0;
+
+    MeshAdjacency a;
+    mesh_adjacency(&a, indices, count, vertex_count);
+
+    uint32_t *live = (uint32_t *)malloc(vertex_count * sizeof(uint32_t));
+    uint32_t *stamps = (uint32_t *)calloc(vertex_count, sizeof(uint32_t));
+    uint32_t *dead_ends = (uint32_t *)malloc(count * sizeof(uint32_t));
+    uint32_t *candidates = (uint32_t *)malloc(count * sizeof(uint32_t));
+    bool *emitted = (bool *)calloc(triangle_count, sizeof(bool));
+    uint32_t *out = (uint32_t *)malloc(count * sizeof(uint32_t));
+    ASSERT(live && stamps && dead_ends && candidates && emitted && out);
+
+    for (int v = 0; v < vertex_count; v++)
+        live[v] = a.first[v + 1] - a.first[v];
+
+    uint32_t time = (uint32_t)cache + 1;
+    int dead_end_count = 0;
+    int cursor = 0;             // Every vertex before it has no triangles left.
+    int written = 0;
+    int cluster_count = 0;
+
+    while (cursor < vertex_count && live[cursor] == 0)
+        cursor++;
+    int fan = (cursor < vertex_count) ? cursor : -1;
+    bool jumped = true;
+    while (fan >= 0) {
+        if (jumped) {
+            if (clusters)
+                clusters[cluster_count] = (uint32_t)(written / 3);
+            cluster_count++;
+        }
+
+        // Every triangle left around the vertex.
+        int candidate_count = 0;
+        for (uint32_t k = a.first[fan]; k < a.first[fan + 1]; k++) {
+            uint32_t t = a.triangles[k];
+            if (emitted[t])
+                continue;
+            emitted[t] = true;
+
+            for (int c = 0; c < 3; c++) {
+                uint32_t v = indices[3 * t + c];
+                out[written++] = v;
+                dead_ends[dead_end_count++] = v;
+                candidates[candidate_count++] = v;
+                live[v]--;
+                if (time - stamps[v] > (uint32_t)cache)
+                    stamps[v] = time++;
+            }
+        }
+
+        // The next vertex is one just used that will still be in the cache
+        // once all its triangles are, the longest in it first.
+        int next = -1;
+        int best = -1;
+        for (int i = 0; i < candidate_count; i++) {
+            uint32_t v = candidates[i];
+            if (live[v] == 0)
+                continue;
+            int priority = 0;
+            if (time - stamps[v] + 2 * live[v] <= (uint32_t)cache)
+                priority = (int)(time - stamps[v]);
+            if (priority > best) {
+                best = priority;
+                next = (int)v;
+            }
+        }
+
+        // Otherwise, a vertex used lately, or the next one with triangles
+        // left.
+        jumped = false;
+        if (next < 0) {
+            while (dead_end_count > 0 && next < 0) {
+                uint32_t v = dead_ends[--dead_end_count];
+                if (live[v] > 0)
+                    next = (int)v;
+            }
+        }
+        if (next < 0) {
+            jumped = true;
+            while (cursor < vertex_count && live[cursor] == 0)
+                cursor++;
+            next = (cursor < vertex_count) ? cursor : -1;
+        }
+        fan = next;
+    }
+
+    ASSERT(written == 3 * triangle_count);
+    memcpy(indices, out, written * sizeof(uint32_t));
+
+    free(out);
+    free(emitted);
+    free(candidates);
+    free(dead_ends);
+    free(stamps);
+    free(live);
+    mesh_free_adjacency(&a);
+    return cluster_count;
+}
+
+typedef struct MeshCluster {
+    uint32_t    first;
+    uint32_t    count;          // Triangles.
+    float       key;            // How far out of the mesh it faces.
+} MeshCluster;
+
+static int mesh_compare_clusters(void const *a, void const *b)
+{
+    float ka = ((MeshCluster const *)a)->key;
+    float kb = ((MeshCluster const *)b)->key;
+    return (ka > kb) ? -1 : (ka < kb) ? 1 : (int)((MeshCluster const *)a)->first -
+                                            (int)((MeshCluster const *)b)->first;
+}
+
+static void mesh_position(void const *vertices, size_t stride, int dimensions, uint32_t v, float p[3])
+{
+    float const *pos = (float const *)((uint8_t const *)vertices + v * stride);
+    p[0] = pos[0];
+    p[1] = pos[1];
+    p[2] = (dimensions == 3) ? pos[2] : 0.0f;
+}
+
+// Reorders the clusters of an order from mesh_order_cache(), given as its
+// `cluster_count` first triangles, front-facing ones first.  Positions have
+// `dimensions` floats.  Clusters are
+// split further where the cache does no worse than `threshold` times as
+// badly as over the whole mesh, at the most.  Returns how many clusters
+// there are then.
+static int mesh_order_overdraw(uint32_t *indices, int count, void const *vertices, int vertex_count,
+                                size_t stride, int dimensions, uint32_t const *clusters,
+                                int cluster_count, int cache, float threshold)
+{
+    int triangle_count = count / 3;
+    if (triangle_count == 0)
+        return 0;
+
+    double acmr = mesh_acmr(indices, count, vertex_count, cache);
+    uint32_t *stamps = (uint32_t *)calloc(vertex_count, sizeof(uint32_t));
+    MeshCluster *split = (MeshCluster *)malloc(triangle_count * sizeof(MeshCluster));
+    ASSERT(stamps && split);
+
+    // Splitting: the cache starts out empty in every cluster, as it may
+    // come after any other.
+    int split_count = 0;
+    uint32_t time = (uint32_t)cache + 1;
+    for (int c = 0; c < cluster_count; c++) {
+        uint32_t end = (c + 1 < cluster_count) ? clusters[c + 1] : (uint32_t)triangle_count;
+        uint32_t start = clusters[c];
+        int misses = 0;
+
+        time += (uint32_t)cache + 1;
+        for (uint32_t t = start; t < end; t++) {
+            for (int k = 0; k < 3; k++) {
+                uint32_t v = indices[3 * t + k];
+                if (time - stamps[v] > (uint32_t)cache) {
+                    stamps[v] = time++;
+                    misses++;
+                }
+            }
+
+            uint32_t done = t + 1 - start;
+            if (t + 1 < end && (double)misses / done <= threshold * acmr) {
+                split[split_count].first = start;
+                split[split_count].count = done;
+                split_count++;
+                start = t + 1;
+                misses = 0;
+                time += (uint32_t)cache + 1;
+            }
+        }
+        if (start < end) {
+            split[split_count].first = start;
+            split[split_count].count = end - start;
+            split_count++;
+        }
+    }
+
+    // The centroid of the mesh, and of each cluster with its normal, both
+    // weighted by area.
+    double mesh_centre[3] = {0.0, 0.0, 0.0};
+    double mesh_area = 0.0;
+    float *normals = (float *)malloc(split_count * 6 * sizeof(float));
+    ASSERT(normals);
+
+    for (int c = 0; c < split_count; c++) {
+        double n[3] = {0.0, 0.0, 0.0}, centre[3] = {0.0, 0.0, 0.0}, area = 0.0;
+        for (uint32_t t = split[c].first; t < split[c].first + split[c].count; t++) {
+            float p0[3], p1[3], p2[3];
+            mesh_position(vertices, stride, dimensions, indices[3 * t + 0], p0);
+            mesh_position(vertices, stride, dimensions, indices[3 * t + 1], p1);
+            mesh_position(vertices, stride, dimensions, indices[3 * t + 2], p2);
+
+            double e1[3], e2[3];
+            for (int k = 0; k < 3; k++) {
+                e1[k] = p1[k] - p0[k];
+                e2[k] = p2[k] - p0[k];
+            }
+            double cross[3] = {
+                e1[1] * e2[2] - e1[2] * e2[1],
+                e1[2] * e2[0] - e1[0] * e2[2],
+                e1[0] * e2[1] - e1[1] * e2[0],
+            };
+            double a = sqrt(cross[0] * cross[0] + cross[1] * cross[1] + cross[2] * cross[2]);
+            for (int k = 0; k < 3; k++) {
+                n[k] += cross[k];
+                centre[k] += a * (p0[k] + p1[k] + p2[k]) / 3.0;
+            }
+            area += a;
+        }
+
+        double length = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        for (int k = 0; k < 3; k++) {
+            normals[6 * c + k] = (length > 0.0) ? (float)(n[k] / length) : 0.0f;
+            normals[6 * c + 3 + k] = (area > 0.0) ? (float)(centre[k] / area) : 0.0f;
+            mesh_centre[k] += centre[k];
+        }
+        mesh_area += area;
+    }
+
+    for (int c = 0; c < split_count; c++) {
+        float key = 0.0f;
+        for (int k = 0; k < 3; k++) {
+            float centre = (mesh_area > 0.0) ? (float)(mesh_centre[k] / mesh_area) : 0.0f;
+            key += normals[6 * c + k] * (normals[6 * c + 3 + k] - centre);
+        }
+        split[c].key = key;
+    }
+    qsort(split, split_count, sizeof(MeshCluster), mesh_compare_clusters);
+
+    uint32_t *out = (uint32_t *)malloc(count * sizeof(uint32_t));
+    ASSERT(out);
+    int written = 0;
+    for (int c = 0; c < split_count; c++) {
+        memcpy(out + written, indices + 3 * split[c].first, 3 * split[c].count * sizeof(uint32_t));
+        written += 3 * split[c].count;
+    }
+    memcpy(indices, out, count * sizeof(uint32_t));
+
+    free(out);
+    free(normals);
+    free(split);
+    free(stamps);
+    return split_count;
+}
+
+
+
+// Vertex Order
+
+// Renumbers the vertices in the order the indices first use them, and
+// moves them to `dst` in that order.  Vertices no index uses are dropped.
+// Returns how many are left.
+static int mesh_order_fetch(uint32_t *indices, int count, void const *vertices, int vertex_count,
+                            size_t stride, void *dst)
+{
+    uint32_t *remap = (uint32_t *)malloc(vertex_count * sizeof(uint32_t));
+    ASSERT(remap);
+    memset(remap, 0xff, vertex_count * sizeof(uint32_t));
+
+    int next = 0;
+    for (int i = 0; i < count; i++) {
+        uint32_t v = indices[i];
+        if (remap[v] == UINT32_MAX) {
+            memcpy((uint8_t *)dst + next * stride, (uint8_t const *)vertices + v * stride, stride);
+            remap[v] = (uint32_t)next++;
+        }
+        indices[i] = remap[v];
+    }
+
+    free(remap);
+    return next;
+}
+
+// All of the above, for vertices that have their position first, in
+// `dimensions` floats.  Returns how many vertices are left in `vertices`.
+static int mesh_optimize(uint32_t *indices, int count, void *vertices, int vertex_count, size_t stride,
+                         int dimensions)
+{
+    uint32_t *clusters = (uint32_t *)malloc((count / 3 + 1) * sizeof(uint32_t));
+    void *ordered = malloc(vertex_count * stride + 1);
+    ASSERT(clusters && ordered);
+
+    int cluster_count = mesh_order_cache(indices, count, vertex_count, MESH_CACHE, clusters);
+    mesh_order_overdraw(indices, count, vertices, vertex_count, stride, dimensions, clusters,
+                        cluster_count, MESH_CACHE, MESH_OVERDRAW);
+    int used = mesh_order_fetch(indices, count, vertices, vertex_count, stride, ordered);
+    memcpy(vertices, ordered, used * stride);
+
+    free(ordered);
+    free(clusters);
+    return used;
+}
@@ -0,0 +1,204 @@
+// Frame pacing: when a frame starts, and how it is presented.
+//
+// PACING_VSYNC presents on the vertical blank, and the CPU runs as far ahead
+// as the swap chain lets it.  PACING_UNCAPPED presents at once, as fast as
+// frames come.  PACING_CAPPED presents at once too, but starts frames no
+// faster than a given rate: it sleeps until just before the frame is due,
+// and spins the rest of the way, as sleeps wake late by as much as the
+// system's timer likes.  How late the last sleeps woke is kept track of, so
+// that it spins no longer than it has to.
+//
+// PACING_LOW_LATENCY presents on the vertical blank, but waits until the
+// swap chain has room for one more frame, and then some more: until just
+// before the frame has to be started to make the next blank, going by how
+// long the last frames took on the CPU and the GPU.  Input is read after
+// that, as late as it can be.
+//
+// Nothing here reads a clock or waits on Windows: that is what PacingClock
+// does, which bench.cpp stands in for with a simulated display.
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#ifndef ASSERT
+#define ASSERT(expr)    assert(expr)
+#endif
+
+
+
+#define PACING_SPIN_MIN     0.0002      // Spun at least, after a sleep, in seconds.
+#define PACING_MARGIN       0.0005      // Of a low-latency frame, to be safe.
+#define PACING_WINDOW       64          // Frames estimates go by.
+
+typedef enum PacingMode {
+    PACING_VSYNC,
+    PACING_UNCAPPED,
+    PACING_CAPPED,
+    PACING_LOW_LATENCY,
+    PACING_MODES
+} PacingMode;
+
+static char const *pacing_mode_names[PACING_MODES] = {
+    "vsync", "uncapped", "capped", "low latency"
+};
+
+// Times are seconds, on a clock of the caller's.
+typedef struct PacingClock {
+    void        *ctx;
+    double      (*now)(void *ctx);
+
+    // Sleeps for about as long, or longer.
+    void        (*sleep)(void *ctx, double duration);
+
+    // Until the swap chain takes another frame: its frame latency waitable.
+    void        (*wait_frame)(void *ctx);
+
+    // When the next vertical blank after `now` is, and how far apart they
+    // are.  Returns false when it cannot tell.
+    bool        (*vblank)(void *ctx, double now, double *next, double *period);
+} PacingClock;
+
+typedef struct PacingStats {
+    uint64_t    frames;
+    double      slept;              // In all.
+    double      spun;
+    double      delayed;            // By low latency, on top of the waitable.
+    double      oversleep_max;
+    uint64_t    late;               // Capped frames started after they were due.
+} PacingStats;
+
+// The worst of the last few values: what a frame has to be ready for.
+typedef struct PacingWindow {
+    double      values[PACING_WINDOW];
+    int         next;
+} PacingWindow;
+
+typedef struct Pacing {
+    PacingClock clock;
+    PacingMode  mode;
+    double      interval;           // Capped: between frames.
+
+    double      due;                // Capped: when the next frame starts.
+    double      begin;              // When this frame's work started.
+    PacingWindow oversleep;         // How late sleeps woke.
+    PacingWindow cpu;               // How long frames took.
+    PacingWindow gpu;
+
+    PacingStats stats;
+} Pacing;
+
+
+
+static void pacing_init(Pacing *pacing, PacingMode mode, double cap, PacingClock const *clock)
+{
+    ASSERT(mode >= 0 && mode < PACING_MODES);
+    ASSERT(mode != PACING_CAPPED || cap > 0.0);
+
+    memset(pacing, 0, sizeof(*pacing));
+    pacing->clock = *clock;
+    pacing->mode = mode;
+    pacing->interval = (cap > 0.0) ? 1.0 / cap : 0.0;
+    pacing->oversleep.values[0] = 0.001;
+    pacing->due = pacing->clock.now(pacing->clock.ctx);
+}
+
+static void pacing_add(PacingWindow *window, double value)
+{
+    window->values[window->next] = value;
+    window->next = (window->next + 1) % PACING_WINDOW;
+}
+
+static double pacing_worst(PacingWindow const *window)
+{
+    double worst = 0.0;
+    for (int i = 0; i < PACING_WINDOW; i++) {
+        if (window->values[i] > worst)
+            worst = window->values[i];
+    }
+    return worst;
+}
+
+// Sleeps for as much of the time as it can trust the timer with, and spins
+// the rest.
+static void pacing_wait_until(Pacing *pacing, double until)
+{
+    PacingClock const *clock = &pacing->clock;
+    double now = clock->now(clock->ctx);
+
+    double margin = pacing_worst(&pacing->oversleep) + PACING_SPIN_MIN;
+    if (until - now > margin) {
+        double duration = until - now - margin;
+        clock->sleep(clock->ctx, duration);
+
+        double woke = clock->now(clock->ctx);
+        double late = woke - now - duration;
+        if (late < 0.0)
+            late = 0.0;
+        pacing_add(&pacing->oversleep, late);
+        if (late > pacing->stats.oversleep_max)
+            pacing->stats.oversleep_max = late;
+
+        pacing->stats.slept += woke - now;
+        now = woke;
+    }
+
+    double spin = now;
+    while (now < until)
+        now = clock->now(clock->ctx);
+    pacing->stats.spun += now - spin;
+}
+
+// Before the frame does anything else, input included.
+static void pacing_begin(Pacing *pacing)
+{
+    PacingClock const *clock = &pacing->clock;
+
+    if (pacing->mode == PACING_CAPPED) {
+        double now = clock->now(clock->ctx);
+        if (now > pacing->due + pacing->interval) {
+            // Too late to catch up on: start counting again from here.
+            pacing->stats.late++;
+            pacing->due = now;
+        }
+        pacing_wait_until(pacing, pacing->due);
+        pacing->due += pacing->interval;
+    }
+
+    if (pacing->mode == PACING_LOW_LATENCY) {
+        if (clock->wait_frame)
+            clock->wait_frame(clock->ctx);
+
+        // Start so that the frame is done on the GPU just before the next
+        // blank.  A frame that cannot make it starts at once.
+        double now = clock->now(clock->ctx);
+        double next, period;
+        if (clock->vblank && clock->vblank(clock->ctx, now, &next, &period)) {
+            double start = next - (pacing_worst(&pacing->cpu) + pacing_worst(&pacing->gpu) + PACING_MARGIN);
+            if (start > now) {
+                pacing_wait_until(pacing, start);
+                pacing->stats.delayed += start - now;
+            }
+        }
+    }
+
+    pacing->begin = clock->now(clock->ctx);
+}
+
+// The sync interval to present the frame with.  Call just before presenting.
+static int pacing_present(Pacing *pacing)
+{
+    double now = pacing->clock.now(pacing->clock.ctx);
+    pacing_add(&pacing->cpu, now - pacing->begin);
+    pacing->stats.frames++;
+
+    return (pacing->mode == PACING_VSYNC || pacing->mode == PACING_LOW_LATENCY) ? 1 : 0;
+}
+
+// How long a frame took on the GPU, once that is known.
+static void pacing_gpu(Pacing *pacing, double duration)
+{
+    pacing_add(&pacing->gpu, duration);
+}
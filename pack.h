@@ -0,0 +1,474 @@
+// A pack of assets, in one file laid out as the GPU wants them.
+//
+// The file is a header, the assets one after the other, each one starting
+// on a page of its own, and a table of contents at the end.  Every asset
+// is in the form it is copied to the GPU in: vertices in one of the formats
+// of vertices.h, indices as they are drawn with, and textures with every
+// mip at the offset and row pitch of its footprint, block-compressed
+// already.  So loading one is a single copy from the mapped file into
+// upload memory, with nothing in between: no decoding, no staging buffer,
+// and only the pages that are needed are ever read.
+//
+// The table of contents carries a checksum, as does every asset.  Assets
+// are not checked when they are loaded, as that would read all of them
+// twice; pack_verify() is there for the packer and the bench.
+//
+// packer.cpp writes the pack hello.cpp loads its triangle and texture
+// from.  Nothing here talks to Direct3D 12.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "texture.h"
+#include "bcn.h"
+#include "vertices.h"
+
+#ifndef ASSERT
+#define ASSERT(expr)    assert(expr)
+#endif
+
+
+
+#define PACK_MAGIC          0x4b434150u     // "PACK"
+#define PACK_VERSION        1
+#define PACK_ALIGN          4096            // Of every asset in the file.
+#define PACK_NAME           32
+#define PACK_MAX_ENTRIES    4096
+
+enum {
+    PACK_VERTICES,          // format: VERTICES_*, count: vertices.
+    PACK_INDICES,           // format: bytes per index, count: indices.
+    PACK_TEXTURE,           // format: TEXTURE_*, width, height, mip_levels.
+    PACK_TYPES
+};
+
+typedef struct PackHeader {
+    uint32_t    magic;
+    uint32_t    version;
+    uint32_t    count;
+    uint32_t    reserved;
+    uint64_t    toc_offset;
+    uint64_t    size;               // Of the whole file.
+    uint64_t    toc_checksum;
+    uint64_t    checksum;           // Of the header, up to here.
+} PackHeader;
+
+typedef struct PackEntry {
+    char        name[PACK_NAME];
+    uint32_t    type;
+    uint32_t    format;
+    uint64_t    offset;
+    uint64_t    size;
+    uint64_t    checksum;
+    uint32_t    count;
+    float       scale;              // Of SNORM positions, see vertices_scale().
+    uint32_t    width;
+    uint32_t    height;
+    uint32_t    mip_levels;
+    uint32_t    reserved;
+} PackEntry;
+
+static_assert(sizeof(PackHeader) == 48 && sizeof(PackEntry) == 88, "pack structs are padded");
+
+// FNV-1a, finished with an avalanche.
+static uint64_t pack_checksum(void const *data, size_t size)
+{
+    uint8_t const *bytes = (uint8_t const *)data;
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; i++)
+        h = (h ^ bytes[i]) * 0x100000001b3ull;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return h;
+}
+
+static uint64_t pack_header_checksum(PackHeader const *header)
+{
+    return pack_checksum(header, offsetof(PackHeader, checksum));
+}
+
+// The footprints of a texture in the pack, offsets from the start of it.
+static uint64_t pack_footprints(PackEntry const *entry, TextureFootprint *footprints)
+{
+    TextureDesc desc = {
+        (int)entry->format, (int)entry->width, (int)entry->height, 1, (int)entry->mip_levels
+    };
+    return texture_footprints(&desc, 0, desc.mip_levels, 0, footprints);
+}
+
+
+
+// Reading
+
+typedef struct Pack {
+    uint8_t             *map;
+    size_t              size;
+    PackEntry const     *entries;
+    int                 count;
+#ifdef _WIN32
+    HANDLE              file;
+    HANDLE              mapping;
+#endif
+} Pack;
+
+static bool pack_map(Pack *pack, char const *path)
+{
+#ifdef _WIN32
+    pack->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                             FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (pack->file == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(pack->file, &size) || size.QuadPart == 0) {
+        CloseHandle(pack->file);
+        return false;
+    }
+
+    pack->mapping = CreateFileMappingA(pack->file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (!pack->mapping) {
+        CloseHandle(pack->file);
+        return false;
+    }
+
+    pack->map = (uint8_t *)MapViewOfFile(pack->mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!pack->map) {
+        CloseHandle(pack->mapping);
+        CloseHandle(pack->file);
+        return false;
+    }
+    pack->size = (size_t)size.QuadPart;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+
+    pack->map = (uint8_t *)map;
+    pack->size = (size_t)st.st_size;
+#endif
+    return true;
+}
+
+static void pack_close(Pack *pack)
+{
+    if (!pack->map)
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(pack->map);
+    CloseHandle(pack->mapping);
+    CloseHandle(pack->file);
+#else
+    munmap(pack->map, pack->size);
+#endif
+    memset(pack, 0, sizeof(*pack));
+}
+
+// Maps the pack at `path`, and checks its header and table of contents.
+// Returns false if there is no such file, or it is not a pack that can be
+// trusted.
+static bool pack_open(Pack *pack, char const *path)
+{
+    memset(pack, 0, sizeof(*pack));
+    if (!pack_map(pack, path))
+        return false;
+
+    PackHeader const *header = (PackHeader const *)pack->map;
+    bool ok = pack->size >= sizeof(PackHeader) &&
+              header->magic == PACK_MAGIC && header->version == PACK_VERSION &&
+              header->checksum == pack_header_checksum(header) &&
+              header->size == pack->size && header->count <= PACK_MAX_ENTRIES &&
+              header->toc_offset % 8 == 0 && header->toc_offset <= pack->size &&
+              (uint64_t)header->count * sizeof(PackEntry) <= pack->size - header->toc_offset;
+    if (ok) {
+        pack->entries = (PackEntry const *)(pack->map + header->toc_offset);
+        pack->count = (int)header->count;
+        ok = pack_checksum(pack->entries, pack->count * sizeof(PackEntry)) == header->toc_checksum;
+    }
+
+    for (int i = 0; ok && i < pack->count; i++) {
+        PackEntry const *e = &pack->entries[i];
+        ok = e->type < PACK_TYPES && memchr(e->name, 0, PACK_NAME) != NULL &&
+             e->offset % PACK_ALIGN == 0 && e->offset <= pack->size && e->size <= pack->size - e->offset;
+
+        // What the GPU is told of the asset has to agree with its size.
+        if (ok && e->type == PACK_VERTICES)
+            ok = e->format < VERTICES_FORMATS && vertices_size(e->format, e->count) == e->size;
+        if (ok && e->type == PACK_INDICES)
+            ok = (e->format == 2 || e->format == 4) && (uint64_t)e->format * e->count == e->size;
+        if (ok && e->type == PACK_TEXTURE) {
+            TextureFootprint footprints[TEXTURE_MAX_MIPS];
+            ok = e->format < TEXTURE_FORMATS && e->width > 0 && e->height > 0 &&
+                 e->width <= 16384 && e->height <= 16384 &&
+                 e->mip_levels > 0 && e->mip_levels <= TEXTURE_MAX_MIPS &&
+                 e->mip_levels <= (uint32_t)texture_mip_count(e->width, e->height) &&
+                 pack_footprints(e, footprints) == e->size;
+        }
+    }
+
+    if (!ok)
+        pack_close(pack);
+    return ok;
+}
+
+// The asset called `name` of the given type and format, or NULL.
+static PackEntry const *pack_find(Pack const *pack, char const *name, int type, int format)
+{
+    for (int i = 0; i < pack->count; i++) {
+        PackEntry const *e = &pack->entries[i];
+        if (e->type == (uint32_t)type && e->format == (uint32_t)format && strcmp(e->name, name) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+// Where the asset is in the mapping: straight out of the file, as it is
+// copied to upload memory.
+static void const *pack_data(Pack const *pack, PackEntry const *entry)
+{
+    return pack->map + entry->offset;
+}
+
+// Asks for the asset to be read in, ahead of copying it: rather than a
+// page at a time as it is touched, in as large reads as the system likes.
+static void pack_prefetch(Pack const *pack, PackEntry const *entry)
+{
+    if (entry->size == 0)
+        return;
+#ifdef _WIN32
+    WIN32_MEMORY_RANGE_ENTRY range = {pack->map + entry->offset, (SIZE_T)entry->size};
+    PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+    madvise(pack->map + entry->offset, (size_t)entry->size, MADV_WILLNEED);
+#endif
+}
+
+// Reads all of the asset, to see it is what was written.
+static bool pack_verify(Pack const *pack, PackEntry const *entry)
+{
+    return pack_checksum(pack_data(pack, entry), (size_t)entry->size) == entry->checksum;
+}
+
+
+
+// Writing
+
+typedef struct PackWriter {
+    FILE        *file;
+    uint64_t    end;
+    PackEntry   *entries;
+    int         count;
+    bool        failed;
+} PackWriter;
+
+static bool pack_create(PackWriter *w, char const *path)
+{
+    memset(w, 0, sizeof(*w));
+    w->file = fopen(path, "wb");
+    if (!w->file)
+        return false;
+
+    w->entries = (PackEntry *)calloc(PACK_MAX_ENTRIES, sizeof(PackEntry));
+    ASSERT(w->entries);
+
+    // The header is written again once the table of contents is known.
+    PackHeader header = {0};
+    w->failed = fwrite(&header, sizeof(header), 1, w->file) != 1;
+    w->end = sizeof(header);
+    return !w->failed;
+}
+
+static void pack_pad(PackWriter *w, uint64_t alignment)
+{
+    static uint8_t const zeros[PACK_ALIGN] = {0};
+    uint64_t padding = texture_align(w->end, alignment) - w->end;
+    if (padding > 0 && fwrite(zeros, (size_t)padding, 1, w->file) != 1)
+        w->failed = true;
+    w->end += padding;
+}
+
+// Adds an asset, and returns its entry for the rest to be filled in.
+static PackEntry *pack_add(PackWriter *w, char const *name, int type, int format,
+                           void const *data, uint64_t size)
+{
+    ASSERT(strlen(name) < PACK_NAME);
+    ASSERT(w->count < PACK_MAX_ENTRIES);
+
+    pack_pad(w, PACK_ALIGN);
+
+    PackEntry *e = &w->entries[w->count++];
+    strcpy(e->name, name);
+    e->type = (uint32_t)type;
+    e->format = (uint32_t)format;
+    e->offset = w->end;
+    e->size = size;
+    e->checksum = pack_checksum(data, (size_t)size);
+    e->scale = 1.0f;
+
+    if (size > 0 && fwrite(data, (size_t)size, 1, w->file) != 1)
+        w->failed = true;
+    w->end += size;
+    return e;
+}
+
+static void pack_add_vertices(PackWriter *w, char const *name, int format,
+                              Vertex const *vertices, int count)
+{
+    uint64_t size = vertices_size(format, count);
+    void *data = malloc((size_t)size + 1);
+    ASSERT(data);
+
+    float scale = vertices_scale(format, vertices, count);
+    vertices_pack(format, vertices, count, scale, data);
+
+    PackEntry *e = pack_add(w, name, PACK_VERTICES, format, data, size);
+    e->count = (uint32_t)count;
+    e->scale = scale;
+    free(data);
+}
+
+// 16-bit indices when they all fit, 32-bit otherwise.
+static void pack_add_indices(PackWriter *w, char const *name, uint32_t const *indices, int count)
+{
+    uint32_t largest = 0;
+    for (int i = 0; i < count; i++)
+        largest = (indices[i] > largest) ? indices[i] : largest;
+
+    int bytes = (largest <= 0xffff) ? 2 : 4;
+    uint8_t *data = (uint8_t *)malloc((size_t)count * bytes + 1);
+    ASSERT(data);
+    for (int i = 0; i < count; i++) {
+        if (bytes == 2) {
+            uint16_t index = (uint16_t)indices[i];
+            memcpy(data + 2 * i, &index, 2);
+        } else {
+            memcpy(data + 4 * i, &indices[i], 4);
+        }
+    }
+
+    PackEntry *e = pack_add(w, name, PACK_INDICES, bytes, data, (uint64_t)count * bytes);
+    e->count = (uint32_t)count;
+    free(data);
+}
+
+// Every subresource is given as tightly packed rows of blocks, as bcn_encode()
+// leaves them, and goes in at its footprint.
+static void pack_add_texture(PackWriter *w, Pool *pool, char const *name, TextureDesc const *desc,
+                             uint8_t const *const *subresources)
+{
+    TextureFootprint footprints[TEXTURE_MAX_MIPS];
+    ASSERT(desc->array_size == 1 && desc->mip_levels <= TEXTURE_MAX_MIPS);
+    uint64_t size = texture_footprints(desc, 0, desc->mip_levels, 0, footprints);
+
+    // Calloc, so that the padding of the rows is zeros too.
+    uint8_t *data = (uint8_t *)calloc((size_t)size, 1);
+    ASSERT(data);
+    texture_pack(pool, footprints, desc->mip_levels, subresources, data);
+
+    PackEntry *e = pack_add(w, name, PACK_TEXTURE, desc->format, data, size);
+    e->width = (uint32_t)desc->width;
+    e->height = (uint32_t)desc->height;
+    e->mip_levels = (uint32_t)desc->mip_levels;
+    free(data);
+}
+
+// From an RGBA8 image: its mip chain, in `format`.  A top level that is
+// not whole blocks has every texel repeated until it is, which looks the
+// same to a point sampler.
+static void pack_add_image(PackWriter *w, Pool *pool, char const *name, int format, int quality,
+                           TextureImage const *image)
+{
+    int bw = texture_formats[format].block_width;
+    int bh = texture_formats[format].block_height;
+    int scale = 1;
+    while ((image->width * scale) % bw != 0 || (image->height * scale) % bh != 0)
+        scale *= 2;
+
+    TextureImage mips[TEXTURE_MAX_MIPS];
+    mips[0].width = image->width * scale;
+    mips[0].height = image->height * scale;
+    mips[0].texels = (uint32_t *)malloc((size_t)mips[0].width * mips[0].height * sizeof(uint32_t));
+    ASSERT(mips[0].texels);
+    for (int y = 0; y < mips[0].height; y++) {
+        for (int x = 0; x < mips[0].width; x++)
+            mips[0].texels[y * mips[0].width + x] = image->texels[(y / scale) * image->width + x / scale];
+    }
+
+    int mip_count = texture_mip_count(mips[0].width, mips[0].height);
+    texture_mips(pool, mips, mip_count, TEXTURE_BOX, false);
+
+    uint8_t *subresources[TEXTURE_MAX_MIPS];
+    for (int i = 0; i < mip_count; i++) {
+        if (format == TEXTURE_RGBA8) {
+            subresources[i] = (uint8_t *)mips[i].texels;
+        } else {
+            subresources[i] = (uint8_t *)malloc(texture_size(format, mips[i].width, mips[i].height));
+            ASSERT(subresources[i]);
+            bcn_encode(pool, format, quality, &mips[i], subresources[i]);
+        }
+    }
+
+    TextureDesc desc = {format, mips[0].width, mips[0].height, 1, mip_count};
+    pack_add_texture(w, pool, name, &desc, subresources);
+
+    if (format != TEXTURE_RGBA8) {
+        for (int i = 0; i < mip_count; i++)
+            free(subresources[i]);
+    }
+    texture_free_mips(mips, mip_count);
+    free(mips[0].texels);
+}
+
+// Writes the table of contents and the header.  Returns false if anything
+// could not be written.
+static bool pack_finish(PackWriter *w)
+{
+    pack_pad(w, 8);
+
+    PackHeader header = {0};
+    header.magic = PACK_MAGIC;
+    header.version = PACK_VERSION;
+    header.count = (uint32_t)w->count;
+    header.toc_offset = w->end;
+    header.size = w->end + w->count * sizeof(PackEntry);
+    header.toc_checksum = pack_checksum(w->entries, w->count * sizeof(PackEntry));
+    header.checksum = pack_header_checksum(&header);
+
+    if (w->count > 0 && fwrite(w->entries, w->count * sizeof(PackEntry), 1, w->file) != 1)
+        w->failed = true;
+    if (fseek(w->file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(header), 1, w->file) != 1)
+        w->failed = true;
+    if (fclose(w->file) != 0)
+        w->failed = true;
+
+    free(w->entries);
+    bool ok = !w->failed;
+    memset(w, 0, sizeof(*w));
+    return ok;
+}
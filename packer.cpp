@@ -0,0 +1,139 @@
+// The asset packer: what hello.cpp draws, in a pack it can map and upload
+// straight from.
+//
+// Usage: packer [-quality fast|normal|high] [-threads N] [-out assets.pack]
+//
+// The triangle goes in indexed and optimized by mesh.h, with its vertices
+// in every vertex format of vertices.h and its indices as narrow as they
+// can be, and the checkerboard in every texture format of texture.h, mip
+// chain and all, so that whichever ones hello.cpp is set to use are there.
+// The pack is read back and checked before the packer is done.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include <chrono>
+
+#define ASSERT(expr)    assert(expr)
+
+#include "scene.h"
+#include "threads.h"
+#include "texture.h"
+#include "bcn.h"
+#include "vertices.h"
+#include "pack.h"
+#include "mesh.h"
+
+
+
+static double seconds(void)
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+static char const *const texture_names[TEXTURE_FORMATS] = {"rgba8", "bc1", "bc3", "bc7"};
+
+
+
+int main(int argc, char **argv)
+{
+    int quality = BCN_NORMAL;
+    int threads = 0;
+    char const *out = "assets.pack";
+
+    for (int i = 1; i < argc; i++) {
+        bool more = i + 1 < argc;
+
+        if (!strcmp(argv[i], "-quality") && more) {
+            i++;
+            quality = !strcmp(argv[i], "fast") ? BCN_FAST : !strcmp(argv[i], "high") ? BCN_HIGH :
+                      !strcmp(argv[i], "normal") ? BCN_NORMAL : -1;
+        } else if (!strcmp(argv[i], "-threads") && more) {
+            threads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-out") && more) {
+            out = argv[++i];
+        } else {
+            quality = -1;
+        }
+    }
+
+    if (quality < 0) {
+        fprintf(stderr, "usage: %s [-quality fast|normal|high] [-threads N] [-out assets.pack]\n", argv[0]);
+        return 1;
+    }
+
+    Pool pool;
+    pool_init(&pool, threads);
+
+    double t0 = seconds();
+
+    PackWriter w;
+    if (!pack_create(&w, out)) {
+        fprintf(stderr, "could not create %s\n", out);
+        return 1;
+    }
+
+    int index_count = (int)(sizeof(triangle) / sizeof(*triangle));
+    Vertex *vertices = (Vertex *)malloc(index_count * sizeof(Vertex));
+    uint32_t *indices = (uint32_t *)malloc(index_count * sizeof(uint32_t));
+    int vertex_count = mesh_index(triangle, index_count, sizeof(Vertex), vertices, indices);
+    vertex_count = mesh_optimize(indices, index_count, vertices, vertex_count, sizeof(Vertex), 2);
+
+    for (int format = 0; format < VERTICES_FORMATS; format++)
+        pack_add_vertices(&w, "triangle", format, vertices, vertex_count);
+    pack_add_indices(&w, "triangle", indices, index_count);
+    free(indices);
+    free(vertices);
+
+    // The image is only read.
+    TextureImage image = {(int)checkers_width, (int)checkers_height, (uint32_t *)checkers};
+    for (int format = 0; format < TEXTURE_FORMATS; format++)
+        pack_add_image(&w, &pool, "checkers", format, quality, &image);
+
+    if (!pack_finish(&w)) {
+        fprintf(stderr, "could not write %s\n", out);
+        return 1;
+    }
+
+    double elapsed = seconds() - t0;
+
+
+    // Read it back, as hello.cpp would.
+    Pack pack;
+    if (!pack_open(&pack, out)) {
+        fprintf(stderr, "%s does not read back\n", out);
+        return 1;
+    }
+
+    for (int i = 0; i < pack.count; i++) {
+        PackEntry const *e = &pack.entries[i];
+        if (!pack_verify(&pack, e)) {
+            fprintf(stderr, "%s: %s does not match its checksum\n", out, e->name);
+            return 1;
+        }
+
+        if (e->type == PACK_VERTICES) {
+            printf("  %-10s %-8s %6llu bytes at %6llu, %u vertices\n", e->name,
+                   vertices_formats[e->format].name, (unsigned long long)e->size,
+                   (unsigned long long)e->offset, e->count);
+        } else if (e->type == PACK_INDICES) {
+            printf("  %-10s %-8s %6llu bytes at %6llu, %u indices\n", e->name,
+                   (e->format == 2) ? "16-bit" : "32-bit", (unsigned long long)e->size,
+                   (unsigned long long)e->offset, e->count);
+        } else if (e->type == PACK_TEXTURE) {
+            printf("  %-10s %-8s %6llu bytes at %6llu, %ux%u, %u mips\n", e->name,
+                   texture_names[e->format], (unsigned long long)e->size,
+                   (unsigned long long)e->offset, e->width, e->height, e->mip_levels);
+        }
+    }
+
+    printf("%s: %d assets, %zu bytes, in %.1f ms\n", out, pack.count, pack.size, 1000.0 * elapsed);
+
+    pack_close(&pack);
+    pool_shutdown(&pool);
+    return 0;
+}
@@ -0,0 +1,516 @@
+// A cache of pipeline state objects, created on threads of their own.
+//
+// Creating a pipeline compiles its shaders for the GPU at hand, which takes
+// long enough to be felt as a hitch, and more so with every variant of
+// blending, rasterizing and formats there is.  So pipelines are asked for by
+// a PipelineDesc, and found by a 128-bit key: a hash of every field of it
+// that goes into the pipeline, taken field by field, so that neither where
+// the bytecode and semantic names are in memory nor padding changes it.
+//
+// A request returns at once with a PipelineEntry, which stands for the
+// pipeline until it is ready, a future of sorts.  Asking again for one that
+// is on its way, from any thread, joins the request already made rather
+// than creating it twice.  Workers create the pipelines in the order they
+// were asked for, and a thread that waits for one creates whatever is next
+// in line in the meantime.
+//
+// The key spelled out in hex is the same from one run to the next, and the
+// creator is handed it as a name, which is what a pipeline library finds
+// pipelines by: hello.cpp keeps one in a file between runs, and loads from
+// it what an earlier run has created.
+//
+// Nothing here talks to Direct3D 12: formats, blend factors and the like
+// are the numbers it uses, and the creator is a callback, so that all of it
+// can be tried out with a stand-in.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#ifndef ASSERT
+#define ASSERT(expr)    assert(expr)
+#endif
+
+
+
+#define PIPELINES_INPUTS    16      // Input elements a pipeline may have.
+#define PIPELINES_TARGETS   8       // Render targets a pipeline may have.
+#define PIPELINES_THREADS   8       // Workers at most.
+#define PIPELINES_NAME      33      // A key in hex, and its terminator.
+
+
+
+// Describing Pipelines
+// Whatever is not there, beyond the counts, is left out of the key.
+
+typedef struct PipelineInput {
+    char const  *semantic;
+    uint32_t    index;
+    uint32_t    format;
+    uint32_t    slot;
+    uint32_t    offset;
+    uint32_t    step;       // Instances per element, 0 for per-vertex data.
+} PipelineInput;
+
+typedef struct PipelineBlend {
+    uint32_t    enable;
+    uint32_t    src;
+    uint32_t    dst;
+    uint32_t    op;
+    uint32_t    src_alpha;
+    uint32_t    dst_alpha;
+    uint32_t    op_alpha;
+    uint32_t    write_mask;
+} PipelineBlend;
+
+typedef struct PipelineDesc {
+    // The root signature, passed through to the creator, and what it is
+    // told apart by, the same from run to run: a hash of it serialized.
+    void            *signature;
+    uint64_t        signature_key;
+
+    void const      *vs;
+    size_t          vs_size;
+    void const      *ps;
+    size_t          ps_size;
+
+    PipelineInput   inputs[PIPELINES_INPUTS];
+    int             input_count;
+
+    uint32_t        fill;
+    uint32_t        cull;
+    uint32_t        depth;      // Whether depth is tested.
+    uint32_t        topology;
+    uint32_t        samples;
+
+    uint32_t        formats[PIPELINES_TARGETS];
+    PipelineBlend   blend[PIPELINES_TARGETS];
+    int             target_count;
+} PipelineDesc;
+
+
+
+// Hashing
+// Two 64-bit FNV-1a lanes with different seeds, each finished with an
+// avalanche, as cache.h keys shaders.
+
+typedef struct PipelineKey {
+    uint64_t    lo;
+    uint64_t    hi;
+} PipelineKey;
+
+static void pipelines_hash(PipelineKey *h, void const *data, size_t size)
+{
+    uint8_t const *bytes = (uint8_t const *)data;
+    uint64_t lo = h->lo;
+    uint64_t hi = h->hi;
+    for (size_t i = 0; i < size; i++) {
+        lo = (lo ^ bytes[i]) * 0x100000001b3ull;
+        hi = (hi ^ bytes[i]) * 0x00000100000001b3ull + 0x9e3779b97f4a7c15ull;
+    }
+    h->lo = lo;
+    h->hi = hi;
+}
+
+static void pipelines_hash_u32(PipelineKey *h, uint32_t value)
+{
+    pipelines_hash(h, &value, sizeof(value));
+}
+
+// Bytes are hashed along with their size, so that one field running into
+// the next does not hash the same as the other way around.  Bytecode runs
+// to kilobytes, so it goes eight bytes at a time, and the rest one by one.
+static void pipelines_hash_bytes(PipelineKey *h, void const *data, size_t size)
+{
+    uint64_t length = size;
+    pipelines_hash(h, &length, sizeof(length));
+
+    uint8_t const *bytes = (uint8_t const *)data;
+    uint64_t lo = h->lo;
+    uint64_t hi = h->hi;
+    size_t words = size / 8;
+    for (size_t i = 0; i < words; i++) {
+        uint64_t word;
+        memcpy(&word, bytes + 8 * i, sizeof(word));
+        lo = (lo ^ word) * 0x100000001b3ull;
+        hi = (hi ^ word) * 0x00000100000001b3ull;
+        hi = (hi << 31) | (hi >> 33);
+    }
+    h->lo = lo;
+    h->hi = hi;
+    pipelines_hash(h, bytes + 8 * words, size - 8 * words);
+}
+
+static uint64_t pipelines_mix(uint64_t x)
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdull;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ull;
+    x ^= x >> 33;
+    return x;
+}
+
+static PipelineKey pipelines_key(PipelineDesc const *desc)
+{
+    ASSERT(desc->input_count >= 0 && desc->input_count <= PIPELINES_INPUTS);
+    ASSERT(desc->target_count >= 0 && desc->target_count <= PIPELINES_TARGETS);
+
+    PipelineKey h = {0xcbf29ce484222325ull, 0x84222325cbf29ce4ull};
+    pipelines_hash(&h, &desc->signature_key, sizeof(desc->signature_key));
+    pipelines_hash_bytes(&h, desc->vs, desc->vs_size);
+    pipelines_hash_bytes(&h, desc->ps, desc->ps_size);
+
+    pipelines_hash_u32(&h, (uint32_t)desc->input_count);
+    for (int i = 0; i < desc->input_count; i++) {
+        PipelineInput const *input = &desc->inputs[i];
+        pipelines_hash_bytes(&h, input->semantic, strlen(input->semantic));
+        pipelines_hash_u32(&h, input->index);
+        pipelines_hash_u32(&h, input->format);
+        pipelines_hash_u32(&h, input->slot);
+        pipelines_hash_u32(&h, input->offset);
+        pipelines_hash_u32(&h, input->step);
+    }
+
+    pipelines_hash_u32(&h, desc->fill);
+    pipelines_hash_u32(&h, desc->cull);
+    pipelines_hash_u32(&h, desc->depth);
+    pipelines_hash_u32(&h, desc->topology);
+    pipelines_hash_u32(&h, desc->samples);
+
+    pipelines_hash_u32(&h, (uint32_t)desc->target_count);
+    for (int i = 0; i < desc->target_count; i++) {
+        PipelineBlend const *blend = &desc->blend[i];
+        pipelines_hash_u32(&h, desc->formats[i]);
+        pipelines_hash_u32(&h, blend->enable);
+        pipelines_hash_u32(&h, blend->src);
+        pipelines_hash_u32(&h, blend->dst);
+        pipelines_hash_u32(&h, blend->op);
+        pipelines_hash_u32(&h, blend->src_alpha);
+        pipelines_hash_u32(&h, blend->dst_alpha);
+        pipelines_hash_u32(&h, blend->op_alpha);
+        pipelines_hash_u32(&h, blend->write_mask);
+    }
+
+    PipelineKey key = {pipelines_mix(h.lo), pipelines_mix(h.hi ^ h.lo)};
+    return key;
+}
+
+static bool pipelines_key_equal(PipelineKey a, PipelineKey b)
+{
+    return a.lo == b.lo && a.hi == b.hi;
+}
+
+static void pipelines_name(PipelineKey key, char name[PIPELINES_NAME])
+{
+    snprintf(name, PIPELINES_NAME, "%016llx%016llx",
+             (unsigned long long)key.hi, (unsigned long long)key.lo);
+}
+
+
+
+// The Cache
+
+typedef struct PipelineCreator {
+    void    *ctx;
+
+    // Creates the pipeline, on whichever thread gets to it.  `name` tells it
+    // apart from every other pipeline, the same from run to run.  Sets
+    // `*loaded` if it came out of a library rather than being created.
+    // Returns NULL if it cannot be created.
+    void    *(*create)(void *ctx, PipelineDesc const *desc, char const *name, bool *loaded);
+
+    // Releases a pipeline once the cache is shut down.
+    void    (*release)(void *ctx, void *pipeline);
+} PipelineCreator;
+
+enum {
+    PIPELINE_PENDING,
+    PIPELINE_READY,
+    PIPELINE_FAILED,
+};
+
+typedef struct PipelineEntry {
+    PipelineKey             key;
+    std::atomic<int>        state;
+    void                    *pipeline;  // Once the state is PIPELINE_READY.
+    bool                    loaded;
+
+    // Until it is created: a copy of the desc, whose bytecode and semantic
+    // names are in `storage`, and the next in line.
+    PipelineDesc            desc;
+    void                    *storage;
+    struct PipelineEntry    *next;
+} PipelineEntry;
+
+typedef struct PipelineStats {
+    int     requests;
+    int     hits;       // Found ready, or found to have failed.
+    int     joined;     // Found on their way.
+    int     created;
+    int     loaded;     // Of those created, the ones from a library.
+    int     failed;
+    int     helped;     // Created by a thread waiting for a pipeline.
+    double  seconds;    // Spent creating, on all threads together.
+} PipelineStats;
+
+typedef struct Pipelines {
+    PipelineCreator             creator;
+    std::thread                 threads[PIPELINES_THREADS];
+    int                         thread_count;
+
+    std::mutex                  mutex;
+    std::condition_variable     work;
+    std::condition_variable     done;
+    bool                        quit;
+
+    // Open addressing, by key.
+    PipelineEntry               **table;
+    uint32_t                    count;
+    uint32_t                    capacity;
+
+    PipelineEntry               *head;      // Next to create.
+    PipelineEntry               *tail;
+
+    PipelineStats               stats;
+} Pipelines;
+
+// The mutex must be held.
+static PipelineEntry **pipelines_slot(Pipelines *p, PipelineKey key)
+{
+    uint32_t mask = p->capacity - 1;
+    for (uint32_t i = (uint32_t)key.lo & mask;; i = (i + 1) & mask) {
+        if (!p->table[i] || pipelines_key_equal(p->table[i]->key, key))
+            return &p->table[i];
+    }
+}
+
+static void pipelines_grow(Pipelines *p)
+{
+    PipelineEntry **old = p->table;
+    uint32_t old_capacity = p->capacity;
+
+    p->capacity = (old_capacity > 0) ? 2 * old_capacity : 64;
+    p->table = (PipelineEntry **)calloc(p->capacity, sizeof(PipelineEntry *));
+    ASSERT(p->table);
+    for (uint32_t i = 0; i < old_capacity; i++) {
+        if (old[i])
+            *pipelines_slot(p, old[i]->key) = old[i];
+    }
+    free(old);
+}
+
+// Copies what the desc points to into one block, for the workers to read
+// once the caller has moved on.
+static void pipelines_copy(PipelineEntry *entry, PipelineDesc const *desc)
+{
+    size_t size = desc->vs_size + desc->ps_size;
+    for (int i = 0; i < desc->input_count; i++)
+        size += strlen(desc->inputs[i].semantic) + 1;
+
+    uint8_t *at = (uint8_t *)malloc((size > 0) ? size : 1);
+    ASSERT(at);
+    entry->storage = at;
+    entry->desc = *desc;
+
+    memcpy(at, desc->vs, desc->vs_size);
+    entry->desc.vs = at;
+    at += desc->vs_size;
+    memcpy(at, desc->ps, desc->ps_size);
+    entry->desc.ps = at;
+    at += desc->ps_size;
+    for (int i = 0; i < desc->input_count; i++) {
+        size_t length = strlen(desc->inputs[i].semantic) + 1;
+        memcpy(at, desc->inputs[i].semantic, length);
+        entry->desc.inputs[i].semantic = (char const *)at;
+        at += length;
+    }
+}
+
+static void pipelines_create(Pipelines *p, PipelineEntry *entry, bool helping)
+{
+    char name[PIPELINES_NAME];
+    pipelines_name(entry->key, name);
+
+    bool loaded = false;
+    auto t0 = std::chrono::steady_clock::now();
+    void *pipeline = p->creator.create(p->creator.ctx, &entry->desc, name, &loaded);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    free(entry->storage);
+    entry->storage = NULL;
+
+    std::unique_lock<std::mutex> lock(p->mutex);
+    entry->pipeline = pipeline;
+    entry->loaded = loaded;
+    entry->state.store((pipeline) ? PIPELINE_READY : PIPELINE_FAILED, std::memory_order_release);
+
+    p->stats.created += (pipeline) ? 1 : 0;
+    p->stats.loaded += (pipeline && loaded) ? 1 : 0;
+    p->stats.failed += (pipeline) ? 0 : 1;
+    p->stats.helped += (helping) ? 1 : 0;
+    p->stats.seconds += seconds;
+    p->done.notify_all();
+}
+
+// The mutex must be held.
+static PipelineEntry *pipelines_take(Pipelines *p)
+{
+    PipelineEntry *entry = p->head;
+    if (entry) {
+        p->head = entry->next;
+        p->tail = (p->head) ? p->tail : NULL;
+        entry->next = NULL;
+    }
+    return entry;
+}
+
+static void pipelines_worker(Pipelines *p)
+{
+    std::unique_lock<std::mutex> lock(p->mutex);
+    while (1) {
+        while (!p->quit && !p->head)
+            p->work.wait(lock);
+        PipelineEntry *entry = pipelines_take(p);
+        if (!entry)
+            return;
+
+        lock.unlock();
+        pipelines_create(p, entry, false);
+        lock.lock();
+    }
+}
+
+// A thread_count of 0 picks one worker per hardware thread but one.
+static void pipelines_init(Pipelines *p, PipelineCreator creator, int thread_count)
+{
+    if (thread_count <= 0)
+        thread_count = (int)std::thread::hardware_concurrency() - 1;
+    if (thread_count <= 0)
+        thread_count = 1;
+    if (thread_count > PIPELINES_THREADS)
+        thread_count = PIPELINES_THREADS;
+
+    p->creator = creator;
+    p->thread_count = thread_count;
+    p->quit = false;
+    p->table = NULL;
+    p->count = 0;
+    p->capacity = 0;
+    p->head = NULL;
+    p->tail = NULL;
+    memset(&p->stats, 0, sizeof(p->stats));
+    pipelines_grow(p);
+
+    for (int i = 0; i < thread_count; i++)
+        p->threads[i] = std::thread(pipelines_worker, p);
+}
+
+// Returns the entry for the pipeline the desc describes, from any thread,
+// without waiting for it to be created.  The desc, and what it points to,
+// can go as soon as this returns.
+static PipelineEntry *pipelines_request(Pipelines *p, PipelineDesc const *desc)
+{
+    PipelineKey key = pipelines_key(desc);
+
+    std::unique_lock<std::mutex> lock(p->mutex);
+    p->stats.requests++;
+
+    PipelineEntry **slot = pipelines_slot(p, key);
+    if (*slot) {
+        bool pending = (*slot)->state.load(std::memory_order_relaxed) == PIPELINE_PENDING;
+        p->stats.joined += (pending) ? 1 : 0;
+        p->stats.hits += (pending) ? 0 : 1;
+        return *slot;
+    }
+
+    PipelineEntry *entry = new PipelineEntry;
+    entry->key = key;
+    entry->state.store(PIPELINE_PENDING, std::memory_order_relaxed);
+    entry->pipeline = NULL;
+    entry->loaded = false;
+    entry->next = NULL;
+    pipelines_copy(entry, desc);
+
+    *slot = entry;
+    if (++p->count > p->capacity / 4 * 3)
+        pipelines_grow(p);
+
+    if (p->tail)
+        p->tail->next = entry;
+    else
+        p->head = entry;
+    p->tail = entry;
+    p->work.notify_one();
+    return entry;
+}
+
+// The pipeline if it is ready, NULL if it is not yet or failed.
+static void *pipelines_get(PipelineEntry const *entry)
+{
+    if (entry->state.load(std::memory_order_acquire) != PIPELINE_READY)
+        return NULL;
+    return entry->pipeline;
+}
+
+// Waits for the pipeline, creating whatever is next in line meanwhile.
+// Returns NULL if it could not be created.
+static void *pipelines_wait(Pipelines *p, PipelineEntry *entry)
+{
+    std::unique_lock<std::mutex> lock(p->mutex);
+    while (entry->state.load(std::memory_order_acquire) == PIPELINE_PENDING) {
+        PipelineEntry *next = pipelines_take(p);
+        if (next) {
+            lock.unlock();
+            pipelines_create(p, next, true);
+            lock.lock();
+        } else {
+            p->done.wait(lock);
+        }
+    }
+    return entry->pipeline;
+}
+
+static PipelineStats pipelines_stats(Pipelines *p)
+{
+    std::unique_lock<std::mutex> lock(p->mutex);
+    return p->stats;
+}
+
+// Creates whatever is still in line, and releases every pipeline.  Nothing
+// may be using any of them any more.
+static void pipelines_shutdown(Pipelines *p)
+{
+    {
+        std::unique_lock<std::mutex> lock(p->mutex);
+        p->quit = true;
+        p->work.notify_all();
+    }
+    for (int i = 0; i < p->thread_count; i++)
+        p->threads[i].join();
+
+    for (uint32_t i = 0; i < p->capacity; i++) {
+        PipelineEntry *entry = p->table[i];
+        if (!entry)
+            continue;
+        if (entry->pipeline)
+            p->creator.release(p->creator.ctx, entry->pipeline);
+        free(entry->storage);
+        delete entry;
+    }
+    free(p->table);
+    p->table = NULL;
+    p->count = 0;
+    p->capacity = 0;
+}
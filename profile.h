@@ -0,0 +1,397 @@
+// A frame profiler.
+//
+// Every frame is split into the phases the frame loop goes through, each of
+// which is timed on the CPU, and the GPU's own timestamps for the frame are
+// added once they have been read back, a few frames later.  Finished frames
+// go into a ring that other threads may copy out of at any time, without
+// locks: the ring only has one writer, and a reader that was overtaken by
+// it while copying drops what may have been overwritten.
+//
+// From a copy of the ring come percentiles, a histogram and a count of
+// hitches, and the frames can be written out as a Chrome trace (for
+// chrome://tracing or Perfetto) or as CSV.
+//
+// Times are seconds on whatever clock the caller reads; nothing here reads
+// one itself, so the same code runs against made-up times in bench.cpp.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include <atomic>
+
+#ifndef ASSERT
+#define ASSERT(expr)    assert(expr)
+#endif
+
+
+
+#define PROFILE_CAPACITY    1024    // Frames kept in the ring, a power of two.
+#define PROFILE_PENDING     8       // Frames that may wait for the GPU at once.
+#define PROFILE_BUCKETS     34      // Of 1 ms each; the last takes the rest.
+#define PROFILE_HITCH       2.0     // A hitch takes this many times the median.
+
+enum {
+    PROFILE_PACE,                   // Waiting to start the frame on time.
+    PROFILE_PUMP,                   // Handling window messages.
+    PROFILE_WAIT,                   // Waiting for the frame slot to retire.
+    PROFILE_RECORD,                 // Recording the command list.
+    PROFILE_EXECUTE,                // Submitting it.
+    PROFILE_PRESENT,                // Presenting.
+    PROFILE_PHASES
+};
+
+static char const *profile_phase_names[PROFILE_PHASES] = {
+    "pace", "pump", "wait", "record", "execute", "present"
+};
+
+typedef struct ProfileFrame {
+    uint64_t    index;
+    double      begin;
+    double      end;
+
+    // When every phase first began, and how long it took in all.
+    double      phase_begin[PROFILE_PHASES];
+    double      phase_time[PROFILE_PHASES];
+
+    // When the GPU began and finished the frame, on the same clock.
+    bool        gpu;
+    double      gpu_begin;
+    double      gpu_end;
+} ProfileFrame;
+
+typedef struct Profile {
+    // Only touched by the thread running the frame loop.
+    ProfileFrame    pending[PROFILE_PENDING];
+    uint64_t        next;               // The frame being recorded.
+    uint64_t        unpublished;        // The oldest frame not in the ring.
+    double          mark;
+
+    ProfileFrame                ring[PROFILE_CAPACITY];
+    std::atomic<uint64_t>       published;
+    std::atomic<uint64_t>       started;    // Frames being written, or published.
+} Profile;
+
+
+
+static void profile_init(Profile *profile)
+{
+    profile->next = 0;
+    profile->unpublished = 0;
+    profile->mark = 0.0;
+    profile->published.store(0, std::memory_order_relaxed);
+    profile->started.store(0, std::memory_order_relaxed);
+}
+
+static void profile_publish(Profile *profile)
+{
+    ASSERT(profile->unpublished < profile->next);
+
+    ProfileFrame const *frame = &profile->pending[profile->unpublished % PROFILE_PENDING];
+    uint64_t at = profile->published.load(std::memory_order_relaxed);
+
+    // Readers that see any of the write see that it started.
+    profile->started.store(at + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    profile->ring[at % PROFILE_CAPACITY] = *frame;
+    profile->published.store(at + 1, std::memory_order_release);
+    profile->unpublished++;
+}
+
+// Returns the index of the frame, which profile_gpu() takes.
+static uint64_t profile_begin_frame(Profile *profile, double now)
+{
+    // A frame the GPU never reported on goes into the ring without.
+    if (profile->next - profile->unpublished == PROFILE_PENDING)
+        profile_publish(profile);
+
+    ProfileFrame *frame = &profile->pending[profile->next % PROFILE_PENDING];
+    frame->index = profile->next;
+    frame->begin = now;
+    frame->end = now;
+    for (int i = 0; i < PROFILE_PHASES; i++) {
+        frame->phase_begin[i] = now;
+        frame->phase_time[i] = 0.0;
+    }
+    frame->gpu = false;
+    frame->gpu_begin = 0.0;
+    frame->gpu_end = 0.0;
+
+    profile->mark = now;
+    return profile->next;
+}
+
+// The phase ends now.  It began where the last one ended, or where the frame
+// did; a phase may come up more than once.
+static void profile_mark(Profile *profile, int phase, double now)
+{
+    ASSERT(phase >= 0 && phase < PROFILE_PHASES);
+
+    ProfileFrame *frame = &profile->pending[profile->next % PROFILE_PENDING];
+    if (frame->phase_time[phase] == 0.0)
+        frame->phase_begin[phase] = profile->mark;
+    frame->phase_time[phase] += now - profile->mark;
+    profile->mark = now;
+}
+
+// With `gpu`, the frame is held back until profile_gpu() reports on it.
+static void profile_end_frame(Profile *profile, double now, bool gpu)
+{
+    ProfileFrame *frame = &profile->pending[profile->next % PROFILE_PENDING];
+    frame->end = now;
+    profile->next++;
+
+    if (!gpu) {
+        while (profile->unpublished < profile->next)
+            profile_publish(profile);
+    }
+}
+
+// Reports on a frame the GPU is done with.  Frames are expected in order;
+// those before it that the GPU never reported on are published as they are.
+static void profile_gpu(Profile *profile, uint64_t index, double begin, double end)
+{
+    if (index < profile->unpublished)
+        return;
+    ASSERT(index < profile->next);
+
+    ProfileFrame *frame = &profile->pending[index % PROFILE_PENDING];
+    frame->gpu = true;
+    frame->gpu_begin = begin;
+    frame->gpu_end = end;
+
+    while (profile->unpublished <= index)
+        profile_publish(profile);
+}
+
+// Publishes every frame that has ended, e.g. before the program quits.
+static void profile_flush(Profile *profile)
+{
+    while (profile->unpublished < profile->next)
+        profile_publish(profile);
+}
+
+
+
+// Reading the Ring
+// Safe from any thread, while the frame loop keeps publishing.
+
+// Copies the latest `max` frames at most, oldest first.  Returns how many.
+static int profile_read(Profile const *profile, ProfileFrame *frames, int max)
+{
+    uint64_t end = profile->published.load(std::memory_order_acquire);
+    uint64_t count = (end < (uint64_t)max) ? end : (uint64_t)max;
+    if (count > PROFILE_CAPACITY)
+        count = PROFILE_CAPACITY;
+    uint64_t begin = end - count;
+
+    for (uint64_t i = begin; i < end; i++)
+        frames[i - begin] = profile->ring[i % PROFILE_CAPACITY];
+
+    // The writer may have lapped the copy.  What it started writing over
+    // since is dropped, and nothing more: with the writer idle, every frame
+    // copied is kept.
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t started = profile->started.load(std::memory_order_relaxed);
+    uint64_t valid = (started > PROFILE_CAPACITY) ? started - PROFILE_CAPACITY : 0;
+    if (valid > begin) {
+        uint64_t drop = (valid < end) ? valid - begin : count;
+        for (uint64_t i = drop; i < count; i++)
+            frames[i - drop] = frames[i];
+        count -= drop;
+    }
+
+    return (int)count;
+}
+
+
+
+// Statistics
+
+typedef struct ProfileSummary {
+    double      mean;
+    double      p50;
+    double      p95;
+    double      p99;
+    double      max;
+} ProfileSummary;
+
+typedef struct ProfileStats {
+    int             count;
+    ProfileSummary  frame;
+    ProfileSummary  phases[PROFILE_PHASES];
+
+    int             gpu_count;          // Frames the GPU reported on.
+    ProfileSummary  gpu;
+
+    int             hitches;
+    int             histogram[PROFILE_BUCKETS];
+} ProfileStats;
+
+static int profile_compare(void const *a, void const *b)
+{
+    double x = *(double const *)a;
+    double y = *(double const *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentiles.  Sorts `values`.
+static ProfileSummary profile_summarize(double *values, int count)
+{
+    ProfileSummary summary = {0};
+    if (count == 0)
+        return summary;
+
+    qsort(values, (size_t)count, sizeof(double), profile_compare);
+
+    double sum = 0.0;
+    for (int i = 0; i < count; i++)
+        sum += values[i];
+
+    int p50 = (count * 50 + 99) / 100;
+    int p95 = (count * 95 + 99) / 100;
+    int p99 = (count * 99 + 99) / 100;
+
+    summary.mean = sum / count;
+    summary.p50 = values[(p50 > 0) ? p50 - 1 : 0];
+    summary.p95 = values[(p95 > 0) ? p95 - 1 : 0];
+    summary.p99 = values[(p99 > 0) ? p99 - 1 : 0];
+    summary.max = values[count - 1];
+    return summary;
+}
+
+static void profile_stats(ProfileFrame const *frames, int count, ProfileStats *stats)
+{
+    ASSERT(count >= 0 && count <= PROFILE_CAPACITY);
+
+    double values[PROFILE_CAPACITY];
+
+    stats->count = count;
+
+    for (int i = 0; i < count; i++)
+        values[i] = frames[i].end - frames[i].begin;
+    stats->frame = profile_summarize(values, count);
+
+    for (int p = 0; p < PROFILE_PHASES; p++) {
+        for (int i = 0; i < count; i++)
+            values[i] = frames[i].phase_time[p];
+        stats->phases[p] = profile_summarize(values, count);
+    }
+
+    stats->gpu_count = 0;
+    for (int i = 0; i < count; i++) {
+        if (frames[i].gpu)
+            values[stats->gpu_count++] = frames[i].gpu_end - frames[i].gpu_begin;
+    }
+    stats->gpu = profile_summarize(values, stats->gpu_count);
+
+    stats->hitches = 0;
+    for (int b = 0; b < PROFILE_BUCKETS; b++)
+        stats->histogram[b] = 0;
+
+    for (int i = 0; i < count; i++) {
+        double time = frames[i].end - frames[i].begin;
+        if (time > PROFILE_HITCH * stats->frame.p50)
+            stats->hitches++;
+
+        int bucket = (int)(time * 1000.0);
+        if (bucket >= PROFILE_BUCKETS)
+            bucket = PROFILE_BUCKETS - 1;
+        stats->histogram[(bucket > 0) ? bucket : 0]++;
+    }
+}
+
+// Writes the statistics as a table into `buffer`.  Returns the length of
+// the text, which is cut short if need be.
+static int profile_report(ProfileStats const *stats, char *buffer, size_t size)
+{
+    size_t used = 0;
+#define PROFILE_PRINT(...) \
+    used += (size_t)snprintf(buffer + used, (used < size) ? size - used : 0, __VA_ARGS__); \
+    if (used >= size) used = size - 1
+
+    ASSERT(size > 0);
+    buffer[0] = 0;
+
+#define PROFILE_ROW(name, s) \
+    PROFILE_PRINT("  %-8s %8.3f %8.3f %8.3f %8.3f %8.3f ms\n", name, \
+                  1000.0 * (s).mean, 1000.0 * (s).p50, 1000.0 * (s).p95, \
+                  1000.0 * (s).p99, 1000.0 * (s).max)
+
+    PROFILE_PRINT("%d frames, %d hitches\n", stats->count, stats->hitches);
+    PROFILE_PRINT("  %-8s %8s %8s %8s %8s %8s\n", "", "mean", "p50", "p95", "p99", "max");
+    PROFILE_ROW("frame", stats->frame);
+    for (int p = 0; p < PROFILE_PHASES; p++) {
+        PROFILE_ROW(profile_phase_names[p], stats->phases[p]);
+    }
+    if (stats->gpu_count > 0) {
+        PROFILE_ROW("gpu", stats->gpu);
+    }
+
+#undef PROFILE_ROW
+#undef PROFILE_PRINT
+    return (int)used;
+}
+
+
+
+// Export
+
+// The Chrome trace event format: the CPU's frames and phases on one track,
+// the GPU's on another, in microseconds.
+static bool profile_write_trace(FILE *file, ProfileFrame const *frames, int count)
+{
+    fprintf(file, "{\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU\"}},\n");
+    fprintf(file, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU\"}}");
+
+    for (int i = 0; i < count; i++) {
+        ProfileFrame const *f = &frames[i];
+
+        fprintf(file, ",\n{\"name\":\"frame %llu\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+                (unsigned long long)f->index, 1e6 * f->begin, 1e6 * (f->end - f->begin));
+
+        for (int p = 0; p < PROFILE_PHASES; p++) {
+            if (f->phase_time[p] > 0.0) {
+                fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+                        profile_phase_names[p], 1e6 * f->phase_begin[p], 1e6 * f->phase_time[p]);
+            }
+        }
+
+        if (f->gpu) {
+            fprintf(file, ",\n{\"name\":\"frame %llu\",\"ph\":\"X\",\"pid\":1,\"tid\":2,\"ts\":%.3f,\"dur\":%.3f}",
+                    (unsigned long long)f->index, 1e6 * f->gpu_begin, 1e6 * (f->gpu_end - f->gpu_begin));
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    return !ferror(file);
+}
+
+// One row per frame, times in milliseconds; the GPU column is empty for
+// frames the GPU did not report on.
+static bool profile_write_csv(FILE *file, ProfileFrame const *frames, int count)
+{
+    fprintf(file, "frame,begin,time");
+    for (int p = 0; p < PROFILE_PHASES; p++)
+        fprintf(file, ",%s", profile_phase_names[p]);
+    fprintf(file, ",gpu\n");
+
+    for (int i = 0; i < count; i++) {
+        ProfileFrame const *f = &frames[i];
+
+        fprintf(file, "%llu,%.4f,%.4f", (unsigned long long)f->index,
+                1000.0 * f->begin, 1000.0 * (f->end - f->begin));
+        for (int p = 0; p < PROFILE_PHASES; p++)
+            fprintf(file, ",%.4f", 1000.0 * f->phase_time[p]);
+        if (f->gpu)
+            fprintf(file, ",%.4f\n", 1000.0 * (f->gpu_end - f->gpu_begin));
+        else
+            fprintf(file, ",\n");
+    }
+
+    return !ferror(file);
+}
@@ -0,0 +1,374 @@
+// Reloading shaders while the program runs.
+//
+// A thread of its own looks at the shader source every so often.  Once a
+// save has settled, meaning the file looks the same twice in a row, it reads
+// the source and, unless the text is what it built last, hands it to a
+// ReloadDevice that compiles it and builds a pipeline out of it.  The new
+// pipeline waits in a mailbox for the thread that renders.
+//
+// That thread calls reload_frame() at the start of every frame, and only
+// there does the pipeline change, so every list of a frame draws with the
+// same one.  The one it replaces may still be in use by the frames in
+// flight, so it is retired with the last fence value handed out, and
+// released once the fence has passed it.  The frame never waits for any of
+// this: a pipeline that is not ready yet is simply swapped in a frame later.
+//
+// When the source does not compile, nothing is swapped, and frames go on
+// with the last pipeline that built until the next save.
+//
+// Nothing here talks to Direct3D 12: the device is a callback, so that the
+// watcher and the swap can be tried out with a stand-in compiler.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#ifndef ASSERT
+#define ASSERT(expr)    assert(expr)
+#endif
+
+
+
+#define RELOAD_PATH     260     // Longest path watched.
+#define RELOAD_RETIRED  8       // Pipelines waiting for the GPU at a time.
+#define RELOAD_ERROR    1024    // Longest error kept.
+
+
+
+// The File
+// What a file looks like from the outside, which is cheap enough to look at
+// a few times a second, and a hash of what is inside.
+
+typedef struct ReloadStamp {
+    int64_t     time;       // Last written, in whatever units the system keeps.
+    int64_t     size;
+} ReloadStamp;
+
+static bool reload_stamp(char const *path, ReloadStamp *stamp)
+{
+#ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data))
+        return false;
+    stamp->time = ((int64_t)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+    stamp->size = ((int64_t)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+#else
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return false;
+    stamp->time = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    stamp->size = (int64_t)st.st_size;
+#endif
+    return true;
+}
+
+static bool reload_stamp_equal(ReloadStamp a, ReloadStamp b)
+{
+    return a.time == b.time && a.size == b.size;
+}
+
+static uint64_t reload_hash(void const *data, size_t size)
+{
+    uint8_t const *bytes = (uint8_t const *)data;
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < size; i++)
+        h = (h ^ bytes[i]) * 0x100000001b3ull;
+    return h;
+}
+
+// Returns the contents of the file from malloc(), or NULL if it cannot be
+// read, e.g. halfway through being replaced.
+static char *reload_read_file(char const *path, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return NULL;
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    char *data = (length >= 0) ? (char *)malloc((length > 0) ? (size_t)length : 1) : NULL;
+    if (data && fread(data, 1, (size_t)length, file) != (size_t)length) {
+        free(data);
+        data = NULL;
+    }
+    fclose(file);
+
+    *size = (size_t)length;
+    return data;
+}
+
+
+
+// Reloading
+
+typedef struct ReloadDevice {
+    void    *ctx;
+
+    // Compiles the source and builds a pipeline out of it, on the reload
+    // thread.  Returns NULL if it does not compile, and why in `error`.
+    void    *(*build)(void *ctx, char const *source, size_t size, char *error, size_t error_size);
+
+    // Releases a pipeline that the GPU is done with, or never got to see.
+    // Called from either thread.
+    void    (*release)(void *ctx, void *pipeline);
+} ReloadDevice;
+
+typedef struct ReloadRetired {
+    void        *pipeline;
+    uint64_t    value;      // The fence value that retires it.
+} ReloadRetired;
+
+typedef struct ReloadStats {
+    int         builds;     // Sources handed to the device.
+    int         failures;   // Of those, the ones that did not build.
+    int         unchanged;  // Saves that left the text as it was.
+    int         swaps;      // Pipelines swapped in.
+    int         dropped;    // Built, but overtaken by the next one before a frame took it.
+    int         released;   // Retired pipelines released.
+    double      build;      // Seconds the last build took.
+    double      latency;    // Seconds from noticing the last swapped save to the swap.
+} ReloadStats;
+
+typedef struct Reload {
+    ReloadDevice                device;
+    char                        path[RELOAD_PATH];
+    double                      interval;   // Seconds between looks, 0 if there is no thread.
+
+    // The thread that renders owns these.
+    void                        *current;
+    ReloadRetired               retired[RELOAD_RETIRED];
+    int                         retired_count;
+
+    // The reload thread owns these.
+    ReloadStamp                 seen;       // At the last look.
+    ReloadStamp                 built;      // Of the last text read.
+    uint64_t                    hash;       // Of the last text read.
+    std::chrono::steady_clock::time_point noticed;
+
+    // Shared, behind the mutex.
+    std::thread                 thread;
+    std::mutex                  mutex;
+    std::condition_variable     changed;
+    bool                        quit;
+    void                        *ready;     // Built, not yet swapped in.
+    std::chrono::steady_clock::time_point ready_noticed;
+    bool                        failed;     // Since reload_failed() last asked.
+    char                        error[RELOAD_ERROR];
+    ReloadStats                 stats;
+} Reload;
+
+// Looks at the file once, and builds it if a save has settled.  Returns
+// true if it built, whether or not it compiled.  The reload thread calls
+// this every `interval`; without one, whoever wants to look calls it.
+static bool reload_check(Reload *reload)
+{
+    ReloadStamp stamp;
+    if (!reload_stamp(reload->path, &stamp))
+        return false;
+
+    if (reload_stamp_equal(stamp, reload->built)) {
+        reload->seen = stamp;
+        return false;
+    }
+
+    // Editors write in more than one go, so it has to look the same twice.
+    if (!reload_stamp_equal(stamp, reload->seen)) {
+        if (reload_stamp_equal(reload->seen, reload->built))
+            reload->noticed = std::chrono::steady_clock::now();
+        reload->seen = stamp;
+        return false;
+    }
+
+    size_t size;
+    char *source = reload_read_file(reload->path, &size);
+    if (!source)
+        return false;
+    reload->built = stamp;
+
+    uint64_t hash = reload_hash(source, size);
+    if (hash == reload->hash) {
+        free(source);
+        std::unique_lock<std::mutex> lock(reload->mutex);
+        reload->stats.unchanged++;
+        return false;
+    }
+    reload->hash = hash;
+
+    char error[RELOAD_ERROR];
+    error[0] = '\0';
+    auto t0 = std::chrono::steady_clock::now();
+    void *pipeline = reload->device.build(reload->device.ctx, source, size, error, sizeof(error));
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+    free(source);
+
+    void *overtaken = NULL;
+    {
+        std::unique_lock<std::mutex> lock(reload->mutex);
+        reload->stats.builds++;
+        reload->stats.build = seconds;
+        if (pipeline) {
+            overtaken = reload->ready;
+            reload->stats.dropped += (overtaken) ? 1 : 0;
+            reload->ready = pipeline;
+            reload->ready_noticed = reload->noticed;
+        } else {
+            reload->stats.failures++;
+            reload->failed = true;
+            memcpy(reload->error, error, sizeof(error));
+            reload->error[RELOAD_ERROR - 1] = '\0';
+        }
+    }
+
+    // No frame took it, so the GPU never saw it.
+    if (overtaken)
+        reload->device.release(reload->device.ctx, overtaken);
+    return true;
+}
+
+static void reload_run(Reload *reload)
+{
+    std::unique_lock<std::mutex> lock(reload->mutex);
+    while (!reload->quit) {
+        lock.unlock();
+        reload_check(reload);
+        lock.lock();
+
+        auto interval = std::chrono::duration<double>(reload->interval);
+        reload->changed.wait_for(lock, interval, [reload] { return reload->quit; });
+    }
+}
+
+// Watches `path`, which `current` was built from as it is now.  With an
+// `interval` of 0 no thread is started, and reload_check() is left to the
+// caller.
+static void reload_start(Reload *reload, char const *path, ReloadDevice device,
+                         void *current, double interval)
+{
+    ASSERT(strlen(path) < RELOAD_PATH);
+
+    strcpy(reload->path, path);
+    reload->device = device;
+    reload->interval = interval;
+    reload->current = current;
+    reload->retired_count = 0;
+
+    // Whatever the file holds now is what is already built.
+    reload->seen = {0, -1};
+    reload_stamp(reload->path, &reload->seen);
+    reload->built = reload->seen;
+    size_t size;
+    char *source = reload_read_file(reload->path, &size);
+    reload->hash = (source) ? reload_hash(source, size) : 0;
+    free(source);
+    reload->noticed = std::chrono::steady_clock::now();
+
+    reload->quit = false;
+    reload->ready = NULL;
+    reload->ready_noticed = reload->noticed;
+    reload->failed = false;
+    reload->error[0] = '\0';
+    memset(&reload->stats, 0, sizeof(reload->stats));
+
+    if (interval > 0.0)
+        reload->thread = std::thread(reload_run, reload);
+}
+
+// Called at the start of every frame, before anything is recorded with the
+// pipeline, with the fence value the GPU has reached and the last one handed
+// out.  Releases the pipelines the GPU is done with, swaps in a new one if
+// there is one, and returns the pipeline to draw the frame with.
+static void *reload_frame(Reload *reload, uint64_t completed, uint64_t submitted)
+{
+    int kept = 0;
+    int released = 0;
+    for (int i = 0; i < reload->retired_count; i++) {
+        if (reload->retired[i].value <= completed) {
+            reload->device.release(reload->device.ctx, reload->retired[i].pipeline);
+            released++;
+        } else {
+            reload->retired[kept++] = reload->retired[i];
+        }
+    }
+    reload->retired_count = kept;
+
+    void *ready;
+    {
+        std::unique_lock<std::mutex> lock(reload->mutex);
+        reload->stats.released += released;
+
+        // With every slot taken, the new pipeline waits for a later frame.
+        if (reload->retired_count == RELOAD_RETIRED)
+            return reload->current;
+
+        ready = reload->ready;
+        reload->ready = NULL;
+        if (ready) {
+            reload->stats.swaps++;
+            reload->stats.latency = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - reload->ready_noticed).count();
+        }
+    }
+
+    if (ready) {
+        reload->retired[reload->retired_count++] = {reload->current, submitted};
+        reload->current = ready;
+    }
+    return reload->current;
+}
+
+// Returns true once for every build that failed since the last call, with
+// why in `error`.
+static bool reload_failed(Reload *reload, char *error, size_t size)
+{
+    std::unique_lock<std::mutex> lock(reload->mutex);
+    if (!reload->failed)
+        return false;
+    reload->failed = false;
+    snprintf(error, size, "%s", reload->error);
+    return true;
+}
+
+static ReloadStats reload_stats(Reload *reload)
+{
+    std::unique_lock<std::mutex> lock(reload->mutex);
+    return reload->stats;
+}
+
+// Stops watching, and releases every pipeline but the current one, which
+// is left to the caller.  The GPU must be done with all of them.
+static void reload_stop(Reload *reload)
+{
+    if (reload->thread.joinable()) {
+        {
+            std::unique_lock<std::mutex> lock(reload->mutex);
+            reload->quit = true;
+            reload->changed.notify_all();
+        }
+        reload->thread.join();
+    }
+
+    if (reload->ready)
+        reload->device.release(reload->device.ctx, reload->ready);
+    reload->ready = NULL;
+    for (int i = 0; i < reload->retired_count; i++)
+        reload->device.release(reload->device.ctx, reload->retired[i].pipeline);
+    reload->retired_count = 0;
+}
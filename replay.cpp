@@ -0,0 +1,365 @@
+// Replays a capture hello.cpp wrote, headless.
+//
+// Usage: replay [-backend null|soft] [-repeat N] [-threads N] [-out frame.png] hello.capture
+//
+// With the null backend, the records are only read and the GPU memory they
+// refer to kept up to date, so what is timed is what submitting the frames
+// costs the CPU, apart from the driver.  With the soft backend, soft.h draws
+// them as well, the way soft.cpp draws the frames it makes up itself, and
+// the last frame is written out.  Either way, the capture is replayed N
+// times and the records of every kind are counted.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include <chrono>
+
+#define ASSERT(expr)    assert(expr)
+
+#include "scene.h"
+#include "threads.h"
+#include "texture.h"
+#include "bcn.h"
+#include "soft.h"
+#include "batch.h"
+#include "vertices.h"
+#include "capture.h"
+
+
+
+static double seconds(void)
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+static bool ends_with(char const *s, char const *suffix)
+{
+    size_t n = strlen(s);
+    size_t m = strlen(suffix);
+    return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+
+
+// The Soft Backend
+// What the root signature and input layout of hello.cpp are, soft.h draws
+// with.  cbuffer0 is bound at slot 1 and cbuffer1 at slot 2; the mesh is in
+// the first vertex buffer and its instances in the second.
+
+#define REPLAY_FRAME_SLOT   1
+#define REPLAY_DRAW_SLOT    2
+#define REPLAY_TEXTURES     16
+
+typedef struct ReplayTexture {
+    uint64_t    resource;
+    uint32_t    format;
+    uint32_t    *texels;    // The top mip, as RGBA8.
+    SoftTexture soft;
+} ReplayTexture;
+
+typedef struct SoftReplay {
+    Soft                soft;
+    SoftTarget          target;
+
+    ReplayTexture       textures[REPLAY_TEXTURES];
+    int                 texture_count;
+    SoftTexture const   *table;
+
+    uint64_t            cbvs[4];
+    CaptureVertexBuffer views[2];
+    CaptureIndexBuffer  index_buffer;
+
+    // Scratch, grown as needed.
+    uint8_t             *bytes;
+    size_t              byte_capacity;
+    Vertex              *vertices;
+    int                 vertex_capacity;
+} SoftReplay;
+
+static void *soft_replay_scratch(void **p, size_t *capacity, size_t size)
+{
+    if (size > *capacity) {
+        *p = realloc(*p, size);
+        ASSERT(*p);
+        *capacity = size;
+    }
+    return *p;
+}
+
+static ReplayTexture *soft_replay_texture(SoftReplay *r, uint64_t resource)
+{
+    for (int i = 0; i < r->texture_count; i++) {
+        if (r->textures[i].resource == resource)
+            return &r->textures[i];
+    }
+    return NULL;
+}
+
+static void soft_replay_copy_texture(SoftReplay *r, CaptureReplay *replay, CaptureCopyTexture const *copy)
+{
+    ReplayTexture *t = soft_replay_texture(r, copy->resource);
+    if (!t || copy->subresource != 0)
+        return;
+
+    // Rows of texels, or of blocks, at the pitch of the footprint.
+    int bw = texture_formats[t->format].block_width;
+    int bh = texture_formats[t->format].block_height;
+    int rows = (int)(copy->height + bh - 1) / bh;
+    size_t row_bytes = (size_t)(copy->width + bw - 1) / bw * texture_formats[t->format].block_bytes;
+    uint8_t *tight = (uint8_t *)malloc(rows * row_bytes);
+    ASSERT(tight);
+    for (int y = 0; y < rows; y++)
+        capture_memory_read(&replay->memory, copy->src + (uint64_t)y * copy->row_pitch, row_bytes,
+                            tight + y * row_bytes);
+
+    free(t->texels);
+    t->texels = (uint32_t *)malloc((size_t)copy->width * copy->height * sizeof(uint32_t));
+    ASSERT(t->texels);
+    if (t->format == TEXTURE_RGBA8)
+        memcpy(t->texels, tight, (size_t)copy->width * copy->height * sizeof(uint32_t));
+    else
+        bcn_decode(t->format, tight, (int)copy->width, (int)copy->height, t->texels);
+    free(tight);
+
+    t->soft.width = (int)copy->width;
+    t->soft.height = (int)copy->height;
+    t->soft.texels = t->texels;
+}
+
+static void soft_replay_draw(SoftReplay *r, CaptureReplay *replay, CaptureDrawIndexed const *draw)
+{
+    CaptureVertexBuffer const *mesh = &r->views[0];
+    CaptureVertexBuffer const *instances = &r->views[1];
+    if (!r->table || instances->stride != sizeof(BatchInstance))
+        return;
+
+    int format = -1;
+    for (int f = 0; f < VERTICES_FORMATS; f++)
+        format = (vertices_formats[f].stride == mesh->stride) ? f : format;
+    if (format < 0)
+        return;
+
+    FrameConstants frame;
+    DrawConstants constants;
+    capture_memory_read(&replay->memory, r->cbvs[REPLAY_FRAME_SLOT], sizeof(frame), &frame);
+    capture_memory_read(&replay->memory, r->cbvs[REPLAY_DRAW_SLOT], sizeof(constants), &constants);
+
+    // The mesh, as a list of triangles.
+    int vertex_count = (int)(mesh->size / mesh->stride);
+    int index_count = (int)draw->index_count;
+    size_t index_bytes = (size_t)index_count * r->index_buffer.index_size;
+    size_t mesh_bytes = (size_t)vertex_count * mesh->stride;
+    size_t instance_bytes = (size_t)draw->instance_count * sizeof(BatchInstance);
+    uint8_t *bytes = (uint8_t *)soft_replay_scratch(
+        (void **)&r->bytes, &r->byte_capacity, index_bytes + mesh_bytes + instance_bytes);
+
+    capture_memory_read(&replay->memory, r->index_buffer.address +
+                        (uint64_t)draw->first_index * r->index_buffer.index_size, index_bytes, bytes);
+    capture_memory_read(&replay->memory, mesh->address, mesh_bytes, bytes + index_bytes);
+    capture_memory_read(&replay->memory, instances->address + (uint64_t)draw->first_instance * sizeof(BatchInstance),
+                        instance_bytes, bytes + index_bytes + mesh_bytes);
+
+    int total = index_count + vertex_count + index_count * (int)draw->instance_count;
+    if (total > r->vertex_capacity) {
+        r->vertices = (Vertex *)realloc(r->vertices, total * sizeof(Vertex));
+        ASSERT(r->vertices);
+        r->vertex_capacity = total;
+    }
+    Vertex *unpacked = r->vertices;
+    Vertex *listed = unpacked + vertex_count;
+    Vertex *expanded = listed + index_count;
+
+    vertices_unpack(format, bytes + index_bytes, vertex_count, constants.position_scale, unpacked);
+    for (int i = 0; i < index_count; i++) {
+        uint32_t index = (r->index_buffer.index_size == 2) ? ((uint16_t *)bytes)[i] : ((uint32_t *)bytes)[i];
+        index += draw->base_vertex;
+        listed[i] = (index < (uint32_t)vertex_count) ? unpacked[index] : unpacked[0];
+    }
+
+    batch_expand((BatchInstance const *)(bytes + index_bytes + mesh_bytes), (int)draw->instance_count,
+                 listed, index_count, expanded);
+
+    float consts[4] = {frame.width, frame.height, frame.aspect, frame.uptime};
+    soft_draw(&r->soft, &r->target, r->table, expanded, index_count * (int)draw->instance_count, consts);
+}
+
+static void soft_replay_execute(void *ctx, CaptureReplay *replay, int op, void const *payload, uint32_t size)
+{
+    SoftReplay *r = (SoftReplay *)ctx;
+
+    switch (op) {
+    case CAPTURE_VIEWPORT: {
+        CaptureViewport const *viewport = (CaptureViewport const *)payload;
+        int width = (int)viewport->width, height = (int)viewport->height;
+        if (width != r->target.width || height != r->target.height) {
+            r->target.width = width;
+            r->target.height = height;
+            r->target.pixels = (uint32_t *)realloc(r->target.pixels, (size_t)width * height * sizeof(uint32_t));
+            ASSERT(r->target.pixels);
+        }
+        break;
+    }
+    case CAPTURE_CLEAR:
+        if (r->target.pixels)
+            soft_clear(&r->soft, &r->target, ((CaptureClear const *)payload)->color);
+        break;
+    case CAPTURE_TEXTURE: {
+        CaptureTexture const *texture = (CaptureTexture const *)payload;
+        if (r->texture_count < REPLAY_TEXTURES && texture->format < TEXTURE_FORMATS &&
+            !soft_replay_texture(r, texture->resource)) {
+            ReplayTexture *t = &r->textures[r->texture_count++];
+            memset(t, 0, sizeof(*t));
+            t->resource = texture->resource;
+            t->format = texture->format;
+        }
+        break;
+    }
+    case CAPTURE_COPY_TEXTURE:
+        soft_replay_copy_texture(r, replay, (CaptureCopyTexture const *)payload);
+        break;
+    case CAPTURE_TABLE: {
+        ReplayTexture *t = soft_replay_texture(r, ((CaptureTable const *)payload)->resource);
+        r->table = (t && t->texels) ? &t->soft : NULL;
+        break;
+    }
+    case CAPTURE_CBV: {
+        CaptureCbv const *cbv = (CaptureCbv const *)payload;
+        if (cbv->slot < 4)
+            r->cbvs[cbv->slot] = cbv->address;
+        break;
+    }
+    case CAPTURE_VERTEX_BUFFERS: {
+        CaptureVertexBuffers const *buffers = (CaptureVertexBuffers const *)payload;
+        CaptureVertexBuffer const *views = (CaptureVertexBuffer const *)(buffers + 1);
+        for (uint32_t i = 0; i < buffers->count; i++) {
+            if (buffers->first + i < 2)
+                r->views[buffers->first + i] = views[i];
+        }
+        break;
+    }
+    case CAPTURE_INDEX_BUFFER:
+        r->index_buffer = *(CaptureIndexBuffer const *)payload;
+        break;
+    case CAPTURE_DRAW_INDEXED:
+        if (r->target.pixels)
+            soft_replay_draw(r, replay, (CaptureDrawIndexed const *)payload);
+        break;
+    }
+    (void)size;
+}
+
+
+
+int main(int argc, char **argv)
+{
+    bool soft = false;
+    int repeat = 10;
+    int threads = 0;
+    char const *out = "replay.png";
+    char const *path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        bool more = i + 1 < argc;
+
+        if (!strcmp(argv[i], "-backend") && more) {
+            i++;
+            soft = !strcmp(argv[i], "soft");
+            repeat = (soft || !strcmp(argv[i], "null")) ? repeat : 0;
+        } else if (!strcmp(argv[i], "-repeat") && more) {
+            repeat = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-threads") && more) {
+            threads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-out") && more) {
+            out = argv[++i];
+        } else if (argv[i][0] != '-' && !path) {
+            path = argv[i];
+        } else {
+            repeat = 0;
+        }
+    }
+
+    if (!path || repeat <= 0) {
+        fprintf(stderr, "usage: %s [-backend null|soft] [-repeat N] [-threads N] [-out frame.png] "
+                        "hello.capture\n", argv[0]);
+        return 1;
+    }
+
+    CaptureReader reader;
+    if (!capture_load(&reader, path)) {
+        fprintf(stderr, "%s is not a capture\n", path);
+        return 1;
+    }
+    printf("%s: %llu frames, %llu records, %.1f MB\n", path, (unsigned long long)reader.header.frames,
+           (unsigned long long)reader.header.records, reader.size / 1e6);
+
+    Pool pool;
+    pool_init(&pool, threads);
+
+    SoftReplay r;
+    memset(&r, 0, sizeof(r));
+    soft_init(&r.soft, &pool);
+    CaptureBackend backend = {&r, soft_replay_execute};
+
+    // The first time through touches all the memory, and is not counted.
+    CaptureReplay replay;
+    capture_replay_init(&replay);
+    if (!capture_replay(&reader, &replay, (soft) ? &backend : NULL)) {
+        fprintf(stderr, "%s ends in the middle of a record\n", path);
+        return 1;
+    }
+
+    double best = 1e9;
+    for (int i = 0; i < repeat; i++) {
+        memset(replay.counts, 0, sizeof(replay.counts));
+        memset(replay.lists, 0, sizeof(replay.lists));
+        replay.instances = replay.primitives = replay.data_bytes = replay.copy_bytes = 0;
+
+        double t0 = seconds();
+        capture_replay(&reader, &replay, (soft) ? &backend : NULL);
+        double elapsed = seconds() - t0;
+        best = (elapsed < best) ? elapsed : best;
+    }
+
+    uint64_t records = 0;
+    for (int op = 0; op < CAPTURE_OPS; op++) {
+        records += replay.counts[op];
+        if (replay.counts[op])
+            printf("  %-15s %10llu\n", capture_names[op], (unsigned long long)replay.counts[op]);
+    }
+    ASSERT(records == reader.header.records);
+
+    uint64_t frames = reader.header.frames ? reader.header.frames : 1;
+    printf("%s backend, best of %d: %.3f ms/frame, %.1f ns/record, %.1f M records/s\n",
+           (soft) ? "soft" : "null", repeat, 1000.0 * best / frames, 1e9 * best / records,
+           records / best / 1e6);
+    printf("  per frame: %.1f direct lists, %.1f copy lists, %.0f instances, %.0f triangles, "
+           "%.1f KB of data\n", (double)replay.lists[0] / frames, (double)replay.lists[1] / frames,
+           (double)replay.instances / frames, (double)replay.primitives / frames,
+           replay.data_bytes / 1e3 / frames);
+
+    int status = 0;
+    if (soft && r.target.pixels) {
+        bool ok = (ends_with(out, ".ppm")) ? soft_write_ppm(&r.target, out) : soft_write_png(&r.target, out);
+        if (ok) {
+            printf("wrote %s\n", out);
+        } else {
+            fprintf(stderr, "could not write %s\n", out);
+            status = 1;
+        }
+    }
+
+    for (int i = 0; i < r.texture_count; i++)
+        free(r.textures[i].texels);
+    free(r.bytes);
+    free(r.vertices);
+    free(r.target.pixels);
+    soft_free(&r.soft);
+    pool_shutdown(&pool);
+    capture_replay_free(&replay);
+    capture_unload(&reader);
+    return status;
+}
@@ -0,0 +1,173 @@
+// Dynamic resolution.
+//
+// The scene is drawn into the top-left corner of an offscreen target as
+// large as the window, `scale` of its width and height, and stretched over
+// the back buffer.  Once a frame, resolution_update() is told how long the
+// GPU took over a frame, and picks the scale of the next one so that frames
+// take about as long as the budget allows, a little less to be safe.
+//
+// What it drives is the log of the area drawn, which the time a frame takes
+// is roughly proportional to: a frame twice as slow as it should be takes
+// the same step down wherever the scale is.  The step is that of a PID
+// controller in its incremental form, so that it never winds up against the
+// smallest or largest scale.  It goes down faster than up, since a frame
+// over budget is a missed frame and one under is merely a softer one.
+//
+// Times come in a few frames late, from the timestamps of the frame the
+// slot last held, so the gains are kept low enough not to oscillate with
+// that delay.  Single slow frames, a shader being compiled or the window
+// being moved, are left out by taking the median of the last three, and
+// within `hysteresis` of the aim the scale is held, so it does not hunt
+// around the budget.  It changes in whole steps, and only by at least one.
+//
+// Nothing here talks to Direct3D 12: frame times go in and a scale comes
+// out, so that the controller can be tried out on made-up frame times.
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#ifndef ASSERT
+#define ASSERT(expr)    assert(expr)
+#endif
+
+
+
+typedef struct ResolutionConfig {
+    double      budget;         // Seconds of GPU time a frame may take.
+    double      headroom;       // Of the budget, left free to be safe.
+    double      hysteresis;     // How far off the aim a frame may be, relatively, with the scale held.
+    float       min_scale;
+    float       max_scale;
+    float       step;           // The scale changes in whole steps of this.
+    double      kp;
+    double      ki;
+    double      kd;
+    double      recovery;       // Of the gains, on the way up.
+} ResolutionConfig;
+
+typedef struct ResolutionStats {
+    int         frames;         // Frame times handed in.
+    int         over;           // Of those, over budget.
+    int         changes;        // Times the scale changed.
+    float       lowest;         // Scale, since the start.
+    float       highest;
+} ResolutionStats;
+
+typedef struct Resolution {
+    ResolutionConfig    config;
+    double              level;          // The log of the area the controller wants.
+    double              errors[2];      // The last two, latest first.
+    double              samples[3];     // The last three frame times.
+    int                 sample_count;
+    float               scale;          // In use.
+    ResolutionStats     stats;
+} Resolution;
+
+// What hello.cpp uses, for a budget in seconds.
+static ResolutionConfig resolution_config(double budget)
+{
+    ResolutionConfig config;
+    config.budget = budget;
+    config.headroom = 0.1;
+    config.hysteresis = 0.05;
+    config.min_scale = 0.5f;
+    config.max_scale = 1.0f;
+    config.step = 1.0f / 32.0f;
+    config.kp = 0.1;
+    config.ki = 0.25;
+    config.kd = 0.05;
+    config.recovery = 0.5;
+    return config;
+}
+
+static void resolution_init(Resolution *r, ResolutionConfig const *config)
+{
+    ASSERT(config->budget > 0.0);
+    ASSERT(config->min_scale > 0.0f && config->min_scale <= config->max_scale);
+    ASSERT(config->step > 0.0f);
+
+    memset(r, 0, sizeof(*r));
+    r->config = *config;
+    r->scale = config->max_scale;
+    r->level = 2.0 * log((double)config->max_scale);
+    r->stats.lowest = r->scale;
+    r->stats.highest = r->scale;
+}
+
+static double resolution_median(double const *samples, int count)
+{
+    if (count < 3)
+        return samples[0];
+
+    double a = samples[0], b = samples[1], c = samples[2];
+    if (a > b) { double t = a; a = b; b = t; }
+    if (b > c) { double t = b; b = c; c = t; }
+    return (a > b) ? a : b;
+}
+
+// Takes how long the GPU took over a frame, in seconds, and returns the
+// scale to draw the next frame at.
+static float resolution_update(Resolution *r, double gpu_seconds)
+{
+    ResolutionConfig const *c = &r->config;
+
+    r->stats.frames++;
+    r->stats.over += (gpu_seconds > c->budget) ? 1 : 0;
+
+    r->samples[2] = r->samples[1];
+    r->samples[1] = r->samples[0];
+    r->samples[0] = gpu_seconds;
+    r->sample_count += (r->sample_count < 3) ? 1 : 0;
+    double seconds = resolution_median(r->samples, r->sample_count);
+    if (!(seconds > 0.0))
+        return r->scale;
+
+    // How many times over the area could grow, in log units.
+    double aim = c->budget * (1.0 - c->headroom);
+    double error = log(aim / seconds);
+    if (fabs(error) < c->hysteresis)
+        error = 0.0;
+
+    double change = c->ki * error +
+                    c->kp * (error - r->errors[0]) +
+                    c->kd * (error - 2.0 * r->errors[0] + r->errors[1]);
+    if (change > 0.0)
+        change *= c->recovery;
+    r->errors[1] = r->errors[0];
+    r->errors[0] = error;
+
+    double lo = 2.0 * log((double)c->min_scale);
+    double hi = 2.0 * log((double)c->max_scale);
+    r->level += change;
+    r->level = (r->level < lo) ? lo : (r->level > hi) ? hi : r->level;
+
+    // Whole steps, and only once the scale wanted is a step away.
+    float wanted = (float)exp(0.5 * r->level);
+    float scale = c->step * floorf(wanted / c->step + 0.5f);
+    scale = (scale < c->min_scale) ? c->min_scale : (scale > c->max_scale) ? c->max_scale : scale;
+    if (fabsf(scale - r->scale) >= 0.5f * c->step && fabsf(wanted - r->scale) >= c->step) {
+        r->scale = scale;
+        r->stats.changes++;
+        r->stats.lowest = (scale < r->stats.lowest) ? scale : r->stats.lowest;
+        r->stats.highest = (scale > r->stats.highest) ? scale : r->stats.highest;
+    }
+    return r->scale;
+}
+
+// The size to draw at, for a window of `width` by `height`.
+static void resolution_size(Resolution const *r, int width, int height, int *scaled_width, int *scaled_height)
+{
+    *scaled_width = (int)((float)width * r->scale + 0.5f);
+    *scaled_height = (int)((float)height * r->scale + 0.5f);
+    *scaled_width = (*scaled_width > 1) ? *scaled_width : 1;
+    *scaled_height = (*scaled_height > 1) ? *scaled_height : 1;
+}
+
+static ResolutionStats resolution_stats(Resolution const *r)
+{
+    return r->stats;
+}
@@ -0,0 +1,75 @@
+// The data the examples feed to the GPU (or to the CPU in its place).
+//
+// Shared by hello.cpp and the headless programs, so that whatever they draw
+// is directly comparable to each other.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "constants.h"
+
+
+
+// What We Seek to Draw
+
+typedef struct Vertex {
+    float pos[2];
+    float uv[2];
+    float color[4];
+} Vertex;
+
+static const Vertex triangle[] = {
+    {{-0.0f,  0.7f}, {1.5f, 0.0f}, {1.0f, 0.0f, 0.0f, 1.0f}},
+    {{ 0.7f, -0.7f}, {3.0f, 3.0f}, {0.0f, 1.0f, 0.0f, 1.0f}},
+    {{-0.7f, -0.7f}, {0.0f, 3.0f}, {0.0f, 0.0f, 1.0f, 1.0f}},
+};
+
+// Checkerboard texture with 32% transparency.
+static const uint32_t checkers[] = {
+    0x20000000, 0x20ffffff,
+    0x20ffffff, 0x20000000,
+};
+static const size_t checkers_width = 2;
+static const size_t checkers_height = 2;
+
+static const float background[] = {0.117f, 0.117f, 0.120f, 1.0f};
+
+
+
+// What the Shaders See
+// The cbuffers of shaders.hlsl, as C++ has them.  bench.cpp checks them
+// against the shader source.
+
+// cbuffer0, for the whole frame.  The same as the consts[] the CPU side
+// passes around.
+typedef struct FrameConstants {
+    float width;
+    float height;
+    float aspect;
+    float uptime;
+} FrameConstants;
+
+CONSTANTS_FIELD(FrameConstants, width);
+CONSTANTS_FIELD(FrameConstants, height);
+CONSTANTS_FIELD(FrameConstants, aspect);
+CONSTANTS_FIELD(FrameConstants, uptime);
+CONSTANTS_BLOCK(FrameConstants);
+static_assert(sizeof(FrameConstants) == 4 * sizeof(float), "FrameConstants is not consts[]");
+
+// cbuffer1, for each draw.
+typedef struct DrawConstants {
+    Float4 tint;
+    float fade_phase;
+    float position_scale;   // Of the mesh, see vertices_scale().
+    float pad[2];
+} DrawConstants;
+
+CONSTANTS_FIELD(DrawConstants, tint);
+CONSTANTS_FIELD(DrawConstants, fade_phase);
+CONSTANTS_FIELD(DrawConstants, position_scale);
+CONSTANTS_BLOCK(DrawConstants);
+
+// A draw that changes nothing, as the first one of a frame is.
+static const DrawConstants draw_constants_default = {{1.0f, 1.0f, 1.0f, 1.0f}, 0.0f, 1.0f, {0.0f, 0.0f}};
@@ -5,6 +5,12 @@ struct VS_INPUT {
    float2 pos   : POSITION;
    float2 uv    : TEXCOORD;
    float4 color : COLOR;
+
+   // Per instance, see BatchInstance in batch.h.
+   float4 transform : INSTANCE_TRANSFORM;
+   float2 offset    : INSTANCE_OFFSET;
+   float2 uv_offset : INSTANCE_UV;
+   float4 tint      : INSTANCE_COLOR;
 };
 
 struct PS_INPUT {
@@ -28,14 +34,31 @@ cbuffer cbuffer0 : register(b0) {
     float uptime;
 };
 
+// Per draw, see DrawConstants in scene.h.
+
+cbuffer cbuffer1 : register(b1) {
+    float4 tint;
+    float fade_phase;
+    float position_scale;
+};
+
 
 
 PS_INPUT vs(VS_INPUT input)
 {
-    float2 pos = input.pos;
+    float2 pos = input.pos * position_scale;
     float2 uv = input.uv;
 
 
+    // Place the instance.
+    float2x2 transform = {
+        input.transform.x, input.transform.y,
+        input.transform.z, input.transform.w,
+    };
+    pos = mul(transform, pos) + input.offset;
+    uv += input.uv_offset;
+
+
     float angle = fmod(uptime / 21.0f, 1.0f) * TWO_PI;
 
     float2x2 rotation = {
@@ -56,7 +79,7 @@ PS_INPUT vs(VS_INPUT input)
     PS_INPUT output;
     output.pos = float4(pos, 0.0f, 1.0f);
     output.uv = uv;
-    output.color = input.color;
+    output.color = input.color * input.tint * tint;
     return output;
 }
 
@@ -73,8 +96,34 @@ float4 ps(PS_INPUT input) : SV_TARGET
     float4 color = input.color;
 
     // Fade the checkerboard in/out.
-    texel.a *= (cos(uptime) + 1.0f)/2.0f;
+    texel.a *= (cos(uptime + fade_phase) + 1.0f)/2.0f;
 
     color.rgb = (texel.rgb * texel.a) + color.rgb * (1.0f - texel.a);
     return color;
-}
\ No newline at end of file
+}
+
+
+// The upscale pass, see resolution.h.  The scene was drawn into the
+// top-left corner of texture0, `blit_scale` of it, and is stretched over
+// the whole window, filtered.
+
+sampler sampler1 : register(s1);
+
+cbuffer cbuffer2 : register(b2) {
+    float2 blit_scale;
+    float2 blit_texel;      // The size of a pixel of the window, and of texture0.
+};
+
+float4 blit_vs(uint id : SV_VertexID) : SV_POSITION
+{
+    // One triangle that covers the window.
+    float2 corner = float2((id << 1) & 2, id & 2);
+    return float4(corner * float2(2.0f, -2.0f) + float2(-1.0f, 1.0f), 0.0f, 1.0f);
+}
+
+float4 blit_ps(float4 pos : SV_POSITION) : SV_TARGET
+{
+    // Filtering must not reach past what was drawn.
+    float2 uv = min(pos.xy * blit_texel * blit_scale, blit_scale - 0.5f * blit_texel);
+    return texture0.Sample(sampler1, uv);
+}
@@ -0,0 +1,178 @@
+// The frame loop of hello.cpp, headless, with the CPU standing in for the GPU.
+//
+// Usage: soft [-size WxH] [-frames N] [-threads N] [-uptime S] [-scaling]
+//             [-instances N] [-out frame.png|frame.ppm]
+//
+// Draws N frames of the animated triangle into a W x H frame buffer, the
+// uptime advancing 1/60 s per frame from S so that runs are reproducible,
+// then writes the last frame out.  With -instances, a grid of that many
+// triangles is drawn instead, culled and packed as hello.cpp does.  With
+// -scaling, the same frames are drawn again with 1, 2, 4, ... threads up to
+// the requested count, to show how the throughput scales across cores.
+
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include <chrono>
+
+#define ASSERT(expr)    assert(expr)
+
+#include "scene.h"
+#include "threads.h"
+#include "soft.h"
+#include "batch.h"
+
+
+
+static double seconds(void)
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+static bool ends_with(char const *s, char const *suffix)
+{
+    size_t n = strlen(s);
+    size_t m = strlen(suffix);
+    return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+
+
+// Draws `frames` frames and returns how long it took, in seconds.
+static double run(Pool *pool, SoftTarget *target, int frames, double uptime_0, int instances)
+{
+    SoftTexture texture = {(int)checkers_width, (int)checkers_height, checkers};
+    int mesh_count = (int)(sizeof(triangle) / sizeof(*triangle));
+
+    Soft soft;
+    soft_init(&soft, pool);
+
+    Batch batch;
+    batch_init(&batch, triangle, mesh_count);
+    batch_grid(&batch, instances);
+
+    BatchInstance *packed = (BatchInstance *)malloc(batch.count * sizeof(BatchInstance));
+    Vertex *vertices = (Vertex *)malloc((size_t)batch.count * mesh_count * sizeof(Vertex));
+    ASSERT(packed && vertices);
+
+    double t0 = seconds();
+
+    for (int frame = 0; frame < frames; frame++) {
+        float width = (float)target->width;
+        float height = (float)target->height;
+        float uptime = (float)(uptime_0 + frame / 60.0);
+
+        float consts[] = {width, height, height / width, uptime};
+
+        // Every draw's instances start at its own chunk of `packed`.  They
+        // are expanded one draw after another, so one soft_draw() stands in
+        // for all of them.
+        int visible = batch_pack(&batch, pool, consts, packed);
+        Vertex *out = vertices;
+        for (int d = 0; d < batch.draw_count; d++) {
+            BatchDraw const *draw = &batch.draws[d];
+            batch_expand(packed + draw->first, draw->count, triangle, mesh_count, out);
+            out += draw->count * mesh_count;
+        }
+
+        soft_clear(&soft, target, background);
+        soft_draw(&soft, target, &texture, vertices, visible * mesh_count, consts);
+    }
+
+    double t1 = seconds();
+
+    free(vertices);
+    free(packed);
+    batch_free(&batch);
+    soft_free(&soft);
+    return t1 - t0;
+}
+
+int main(int argc, char **argv)
+{
+    int width = 720;
+    int height = 480;
+    int frames = 600;
+    int threads = 0;
+    double uptime = 0.0;
+    int instances = 1;
+    bool scaling = false;
+    char const *out = "soft.png";
+
+    for (int i = 1; i < argc; i++) {
+        bool more = i + 1 < argc;
+
+        if (!strcmp(argv[i], "-size") && more) {
+            if (sscanf(argv[++i], "%dx%d", &width, &height) != 2)
+                width = height = 0;
+        } else if (!strcmp(argv[i], "-frames") && more) {
+            frames = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-threads") && more) {
+            threads = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-uptime") && more) {
+            uptime = atof(argv[++i]);
+        } else if (!strcmp(argv[i], "-instances") && more) {
+            instances = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-out") && more) {
+            out = argv[++i];
+        } else if (!strcmp(argv[i], "-scaling")) {
+            scaling = true;
+        } else {
+            fprintf(stderr, "usage: %s [-size WxH] [-frames N] [-threads N] "
+                            "[-uptime S] [-scaling] [-instances N] [-out frame.png|frame.ppm]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (width <= 0 || height <= 0 || frames <= 0 || instances <= 0) {
+        fprintf(stderr, "nothing to draw\n");
+        return 1;
+    }
+
+
+    SoftTarget target;
+    target.width = width;
+    target.height = height;
+    target.pixels = (uint32_t *)malloc((size_t)width * height * sizeof(uint32_t));
+    ASSERT(target.pixels);
+
+    Pool pool;
+    pool_init(&pool, threads);
+    threads = pool.thread_count;
+    pool_shutdown(&pool);
+
+    double pixels = (double)width * height * frames;
+
+    printf("%dx%d, %d frames, %d instance(s), %d-wide SIMD\n",
+           width, height, frames, instances, SOFT_LANES);
+
+    int n = (scaling) ? 1 : threads;
+    while (1) {
+        pool_init(&pool, n);
+        double elapsed = run(&pool, &target, frames, uptime, instances);
+        pool_shutdown(&pool);
+
+        printf("%2d thread(s): %8.2f ms/frame, %8.1f FPS, %8.1f Mpixels/s\n",
+               n, 1000.0 * elapsed / frames, frames / elapsed, pixels / elapsed / 1e6);
+
+        if (n == threads)
+            break;
+        n = (n * 2 < threads) ? n * 2 : threads;
+    }
+
+
+    bool ok = (ends_with(out, ".ppm")) ?
+        soft_write_ppm(&target, out) : soft_write_png(&target, out);
+    if (!ok) {
+        fprintf(stderr, "could not write %s\n", out);
+        return 1;
+    }
+    printf("wrote %s\n", out);
+
+    free(target.pixels);
+    return 0;
+}
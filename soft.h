@@ -0,0 +1,757 @@
+// A software stand-in for the GPU.
+//
+// It does what hello.cpp asks Direct3D 12 to do with shaders.hlsl, except on
+// the CPU: vs() runs once per vertex, the triangles are cut up into screen
+// tiles, and every tile is rasterized with edge functions, shaded with ps()
+// and blended into an RGBA8 frame buffer, several pixels at a time (8 with
+// AVX2, 4 with SSE2) and several tiles at a time (one per pool thread).
+//
+// The rules match the ones the GPU follows closely enough for the output to
+// be compared with hello.png: pixel centers at half-integers, the top-left
+// fill rule, point sampling with wrap addressing, and SRC_ALPHA /
+// INV_SRC_ALPHA blending.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <math.h>
+#include <assert.h>
+
+#include <immintrin.h>
+
+#include "scene.h"
+#include "threads.h"
+
+#ifndef ASSERT
+#define ASSERT(expr)    assert(expr)
+#endif
+
+
+
+#define SOFT_TILE_SIZE      64
+#define SOFT_SUBPIXELS      256.0   // 8 bits of sub-pixel precision.
+
+static const float      SOFT_PI         = 3.14159265359f;
+static const float      SOFT_TWO_PI     = 2.0f * SOFT_PI;
+
+
+
+// The Frame Buffer and the Texture
+//
+// Both are 32-bit RGBA, red in the lowest byte, just as checkers[] is laid
+// out and as DXGI_FORMAT_R8G8B8A8_UNORM is in memory.
+
+typedef struct SoftTarget {
+    int         width;
+    int         height;
+    uint32_t    *pixels;
+} SoftTarget;
+
+typedef struct SoftTexture {
+    int             width;
+    int             height;
+    uint32_t const  *texels;
+} SoftTexture;
+
+
+
+// Vertex Shader Output
+
+typedef struct SoftVertex {
+    float pos[2];   // In pixels.
+    float uv[2];
+    float color[4];
+} SoftVertex;
+
+// The same as vs() in shaders.hlsl, followed by the viewport transform,
+// for vertices batch_expand() has already placed where their instance is.
+// consts[] is cbuffer0: {width, height, aspect, uptime}.  cbuffer1 is
+// draw_constants_default, as it is for the first chunk of instances.
+static void soft_vs(Vertex const *input, float const consts[4],
+                    int width, int height, SoftVertex *output)
+{
+    float aspect = consts[2];
+    float uptime = consts[3];
+
+    float angle = fmodf(uptime / 21.0f, 1.0f) * SOFT_TWO_PI;
+    float c = cosf(angle);
+    float s = sinf(angle);
+
+    float x = input->pos[0];
+    float y = input->pos[1];
+
+    // Rotate the triangle.
+    float rx = aspect * c * x + aspect * s * y;
+    float ry = -s * x + c * y;
+
+    // Zoom the triangle in/out.
+    float zoom = powf(cosf(uptime - SOFT_PI) + 1.0f, 3.0f) + 1.0f;
+    rx *= zoom;
+    ry *= zoom;
+
+    // Zoom the checkerboard in/out.
+    float uv_zoom = cosf(uptime) + 1.0f;
+
+    output->pos[0] = (rx + 1.0f) * 0.5f * (float)width;
+    output->pos[1] = (1.0f - ry) * 0.5f * (float)height;
+    output->uv[0] = input->uv[0] * uv_zoom;
+    output->uv[1] = input->uv[1] * uv_zoom;
+    for (int i = 0; i < 4; i++)
+        output->color[i] = input->color[i];
+}
+
+
+
+// Triangle Setup
+//
+// Every edge and every attribute becomes a plane f(x, y) = dx*x + dy*y + c
+// over the screen, so that stepping one pixel to the right is one addition.
+
+enum {
+    SOFT_U, SOFT_V, SOFT_R, SOFT_G, SOFT_B, SOFT_A,
+    SOFT_ATTRIBUTES
+};
+
+typedef struct SoftPlane {
+    double dx, dy, c;
+} SoftPlane;
+
+typedef struct SoftTriangle {
+    SoftPlane   edges[3];
+    bool        top_left[3];
+    SoftPlane   attributes[SOFT_ATTRIBUTES];
+    int         x0, y0, x1, y1; // Pixel bounds, exclusive of x1/y1.
+} SoftTriangle;
+
+static double soft_snap(float v)
+{
+    return floor((double)v * SOFT_SUBPIXELS + 0.5) / SOFT_SUBPIXELS;
+}
+
+// Returns false for triangles that cover no pixel at all.
+static bool soft_setup(SoftVertex const v[3], int width, int height, SoftTriangle *t)
+{
+    double x[3], y[3];
+    for (int i = 0; i < 3; i++) {
+        x[i] = soft_snap(v[i].pos[0]);
+        y[i] = soft_snap(v[i].pos[1]);
+    }
+
+    // Twice the signed area.  Positive when clockwise on screen.
+    double area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (area == 0.0)
+        return false;
+
+    // Nothing is culled, so flip the edges of the other winding.
+    double sign = (area > 0.0) ? 1.0 : -1.0;
+
+    for (int i = 0; i < 3; i++) {
+        int a = i;
+        int b = (i + 1) % 3;
+
+        SoftPlane *e = &t->edges[i];
+        e->dx = -(y[b] - y[a]) * sign;
+        e->dy =  (x[b] - x[a]) * sign;
+        e->c = -(e->dx * x[a] + e->dy * y[a]);
+
+        // With y pointing down, a top edge has the inside below it and a
+        // left edge has the inside to its right.
+        t->top_left[i] = (e->dx > 0.0) || (e->dx == 0.0 && e->dy > 0.0);
+    }
+
+    float const *values[SOFT_ATTRIBUTES][3];
+    for (int i = 0; i < 3; i++) {
+        values[SOFT_U][i] = &v[i].uv[0];
+        values[SOFT_V][i] = &v[i].uv[1];
+        values[SOFT_R][i] = &v[i].color[0];
+        values[SOFT_G][i] = &v[i].color[1];
+        values[SOFT_B][i] = &v[i].color[2];
+        values[SOFT_A][i] = &v[i].color[3];
+    }
+
+    for (int k = 0; k < SOFT_ATTRIBUTES; k++) {
+        double a0 = *values[k][0];
+        double a1 = *values[k][1];
+        double a2 = *values[k][2];
+
+        SoftPlane *p = &t->attributes[k];
+        p->dx = ((a1 - a0) * (y[2] - y[0]) - (a2 - a0) * (y[1] - y[0])) / area;
+        p->dy = ((a2 - a0) * (x[1] - x[0]) - (a1 - a0) * (x[2] - x[0])) / area;
+        p->c = a0 - p->dx * x[0] - p->dy * y[0];
+    }
+
+    double min_x = fmin(x[0], fmin(x[1], x[2]));
+    double min_y = fmin(y[0], fmin(y[1], y[2]));
+    double max_x = fmax(x[0], fmax(x[1], x[2]));
+    double max_y = fmax(y[0], fmax(y[1], y[2]));
+
+    // Pixels whose centers could possibly be inside.
+    t->x0 = (int)fmax(0.0, floor(min_x - 0.5));
+    t->y0 = (int)fmax(0.0, floor(min_y - 0.5));
+    t->x1 = (int)fmin((double)width, ceil(max_x + 0.5));
+    t->y1 = (int)fmin((double)height, ceil(max_y + 0.5));
+
+    return (t->x0 < t->x1) && (t->y0 < t->y1);
+}
+
+
+
+// SIMD Lanes
+//
+// The rasterizer is written once against these, and runs 8 pixels wide with
+// AVX2 (/arch:AVX2, -mavx2) or 4 pixels wide with the SSE2 baseline.
+
+#if defined(__AVX2__)
+
+#define SOFT_LANES 8
+
+typedef __m256  SoftF;
+typedef __m256i SoftI;
+
+static inline SoftF soft_f1(float a)            { return _mm256_set1_ps(a); }
+static inline SoftF soft_ramp(void)             { return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); }
+static inline SoftF soft_add(SoftF a, SoftF b)  { return _mm256_add_ps(a, b); }
+static inline SoftF soft_sub(SoftF a, SoftF b)  { return _mm256_sub_ps(a, b); }
+static inline SoftF soft_mul(SoftF a, SoftF b)  { return _mm256_mul_ps(a, b); }
+static inline SoftF soft_min(SoftF a, SoftF b)  { return _mm256_min_ps(a, b); }
+static inline SoftF soft_max(SoftF a, SoftF b)  { return _mm256_max_ps(a, b); }
+static inline SoftF soft_floor(SoftF a)         { return _mm256_floor_ps(a); }
+static inline SoftF soft_gt(SoftF a, SoftF b)   { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+static inline SoftF soft_ge(SoftF a, SoftF b)   { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+static inline SoftF soft_and(SoftF a, SoftF b)  { return _mm256_and_ps(a, b); }
+static inline SoftF soft_or(SoftF a, SoftF b)   { return _mm256_or_ps(a, b); }
+static inline int   soft_any(SoftF a)           { return _mm256_movemask_ps(a); }
+
+static inline SoftI soft_i1(int a)              { return _mm256_set1_epi32(a); }
+static inline SoftI soft_cvt(SoftF a)           { return _mm256_cvttps_epi32(a); }
+static inline SoftF soft_cvtf(SoftI a)          { return _mm256_cvtepi32_ps(a); }
+static inline SoftI soft_iadd(SoftI a, SoftI b) { return _mm256_add_epi32(a, b); }
+static inline SoftI soft_imul(SoftI a, SoftI b) { return _mm256_mullo_epi32(a, b); }
+static inline SoftI soft_iand(SoftI a, SoftI b) { return _mm256_and_si256(a, b); }
+static inline SoftI soft_ior(SoftI a, SoftI b)  { return _mm256_or_si256(a, b); }
+static inline SoftI soft_shl(SoftI a, int n)    { return _mm256_slli_epi32(a, n); }
+static inline SoftI soft_shr(SoftI a, int n)    { return _mm256_srli_epi32(a, n); }
+static inline SoftI soft_select(SoftF m, SoftI a, SoftI b)
+{
+    return _mm256_blendv_epi8(b, a, _mm256_castps_si256(m));
+}
+static inline SoftI soft_load(uint32_t const *p){ return _mm256_loadu_si256((__m256i const *)p); }
+static inline void  soft_store(uint32_t *p, SoftI a) { _mm256_storeu_si256((__m256i *)p, a); }
+static inline SoftI soft_gather(uint32_t const *base, SoftI index)
+{
+    return _mm256_i32gather_epi32((int const *)base, index, 4);
+}
+
+#else
+
+#define SOFT_LANES 4
+
+typedef __m128  SoftF;
+typedef __m128i SoftI;
+
+static inline SoftF soft_f1(float a)            { return _mm_set1_ps(a); }
+static inline SoftF soft_ramp(void)             { return _mm_setr_ps(0, 1, 2, 3); }
+static inline SoftF soft_add(SoftF a, SoftF b)  { return _mm_add_ps(a, b); }
+static inline SoftF soft_sub(SoftF a, SoftF b)  { return _mm_sub_ps(a, b); }
+static inline SoftF soft_mul(SoftF a, SoftF b)  { return _mm_mul_ps(a, b); }
+static inline SoftF soft_min(SoftF a, SoftF b)  { return _mm_min_ps(a, b); }
+static inline SoftF soft_max(SoftF a, SoftF b)  { return _mm_max_ps(a, b); }
+static inline SoftF soft_gt(SoftF a, SoftF b)   { return _mm_cmpgt_ps(a, b); }
+static inline SoftF soft_ge(SoftF a, SoftF b)   { return _mm_cmpge_ps(a, b); }
+static inline SoftF soft_and(SoftF a, SoftF b)  { return _mm_and_ps(a, b); }
+static inline SoftF soft_or(SoftF a, SoftF b)   { return _mm_or_ps(a, b); }
+static inline int   soft_any(SoftF a)           { return _mm_movemask_ps(a); }
+
+static inline SoftI soft_i1(int a)              { return _mm_set1_epi32(a); }
+static inline SoftI soft_cvt(SoftF a)           { return _mm_cvttps_epi32(a); }
+static inline SoftF soft_cvtf(SoftI a)          { return _mm_cvtepi32_ps(a); }
+static inline SoftI soft_iadd(SoftI a, SoftI b) { return _mm_add_epi32(a, b); }
+static inline SoftI soft_iand(SoftI a, SoftI b) { return _mm_and_si128(a, b); }
+static inline SoftI soft_ior(SoftI a, SoftI b)  { return _mm_or_si128(a, b); }
+static inline SoftI soft_shl(SoftI a, int n)    { return _mm_slli_epi32(a, n); }
+static inline SoftI soft_shr(SoftI a, int n)    { return _mm_srli_epi32(a, n); }
+static inline SoftI soft_select(SoftF m, SoftI a, SoftI b)
+{
+    SoftI mi = _mm_castps_si128(m);
+    return _mm_or_si128(_mm_and_si128(mi, a), _mm_andnot_si128(mi, b));
+}
+static inline SoftI soft_load(uint32_t const *p){ return _mm_loadu_si128((__m128i const *)p); }
+static inline void  soft_store(uint32_t *p, SoftI a) { _mm_storeu_si128((__m128i *)p, a); }
+
+// SSE2 has neither a floor nor a 32-bit multiply nor a gather.
+static inline SoftF soft_floor(SoftF a)
+{
+    SoftF t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a));
+    return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a), _mm_set1_ps(1.0f)));
+}
+static inline SoftI soft_imul(SoftI a, SoftI b)
+{
+    SoftI even = _mm_mul_epu32(a, b);
+    SoftI odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+static inline SoftI soft_gather(uint32_t const *base, SoftI index)
+{
+    int i[4];
+    _mm_storeu_si128((__m128i *)i, index);
+    return _mm_setr_epi32((int)base[i[0]], (int)base[i[1]], (int)base[i[2]], (int)base[i[3]]);
+}
+
+#endif
+
+
+
+// The Rasterizer
+
+typedef struct Soft {
+    Pool            *pool;
+
+    // The draw being rasterized.
+    SoftTarget      *target;
+    SoftTexture     const *texture;
+    float           fade;
+    float           clear[4];
+
+    SoftVertex      *vertices;
+    int             vertex_capacity;
+    SoftTriangle    *triangles;
+    int             triangle_count;
+    int             triangle_capacity;
+
+    // Which triangles touch which tile, in the order they were submitted.
+    int             tiles_x;
+    int             tiles_y;
+    int             tile_capacity;
+    uint32_t        **bins;
+    int             *bin_counts;
+    int             *bin_capacities;
+} Soft;
+
+static void soft_init(Soft *soft, Pool *pool)
+{
+    memset(soft, 0, sizeof(*soft));
+    soft->pool = pool;
+}
+
+static void soft_free(Soft *soft)
+{
+    for (int i = 0; i < soft->tile_capacity; i++)
+        free(soft->bins[i]);
+    free(soft->bins);
+    free(soft->bin_counts);
+    free(soft->bin_capacities);
+    free(soft->triangles);
+    free(soft->vertices);
+    memset(soft, 0, sizeof(*soft));
+}
+
+static void soft_tiles(Soft *soft, SoftTarget *target)
+{
+    soft->target = target;
+    soft->tiles_x = (target->width + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+    soft->tiles_y = (target->height + SOFT_TILE_SIZE - 1) / SOFT_TILE_SIZE;
+
+    int count = soft->tiles_x * soft->tiles_y;
+    if (count > soft->tile_capacity) {
+        soft->bins = (uint32_t **)realloc(soft->bins, count * sizeof(*soft->bins));
+        soft->bin_counts = (int *)realloc(soft->bin_counts, count * sizeof(int));
+        soft->bin_capacities = (int *)realloc(soft->bin_capacities, count * sizeof(int));
+        ASSERT(soft->bins && soft->bin_counts && soft->bin_capacities);
+
+        for (int i = soft->tile_capacity; i < count; i++) {
+            soft->bins[i] = NULL;
+            soft->bin_capacities[i] = 0;
+        }
+        soft->tile_capacity = count;
+    }
+    memset(soft->bin_counts, 0, count * sizeof(int));
+}
+
+static void soft_tile_rect(Soft *soft, int tile, int *x0, int *y0, int *x1, int *y1)
+{
+    *x0 = (tile % soft->tiles_x) * SOFT_TILE_SIZE;
+    *y0 = (tile / soft->tiles_x) * SOFT_TILE_SIZE;
+    *x1 = *x0 + SOFT_TILE_SIZE;
+    *y1 = *y0 + SOFT_TILE_SIZE;
+    if (*x1 > soft->target->width)
+        *x1 = soft->target->width;
+    if (*y1 > soft->target->height)
+        *y1 = soft->target->height;
+}
+
+
+
+// Clear
+
+static void soft_clear_tile(void *ctx, int tile, int thread)
+{
+    Soft *soft = (Soft *)ctx;
+    SoftTarget *target = soft->target;
+
+    uint32_t c = 0;
+    for (int i = 0; i < 4; i++) {
+        float v = fminf(fmaxf(soft->clear[i], 0.0f), 1.0f);
+        c |= (uint32_t)(v * 255.0f + 0.5f) << (8 * i);
+    }
+
+    int x0, y0, x1, y1;
+    soft_tile_rect(soft, tile, &x0, &y0, &x1, &y1);
+
+    for (int y = y0; y < y1; y++) {
+        uint32_t *row = target->pixels + (size_t)y * target->width;
+        for (int x = x0; x < x1; x++)
+            row[x] = c;
+    }
+}
+
+static void soft_clear(Soft *soft, SoftTarget *target, float const color[4])
+{
+    soft_tiles(soft, target);
+    memcpy(soft->clear, color, sizeof(soft->clear));
+    pool_for(soft->pool, soft->tiles_x * soft->tiles_y, soft_clear_tile, soft);
+}
+
+
+
+// Draw
+
+// Shades and blends one row of a triangle within a tile, SOFT_LANES pixels
+// at a time.  This is ps() in shaders.hlsl plus the output merger.
+static void soft_span(Soft *soft, SoftTriangle const *t, int x0, int x1, int y)
+{
+    SoftTarget *target = soft->target;
+    SoftTexture const *tex = soft->texture;
+
+    // Evaluate every plane at the center of the first pixel in double, then
+    // move along the row in float.  Each pixel is computed from its distance
+    // to the first one rather than accumulated, so the result does not depend
+    // on how many lanes there are.
+    double px = (double)x0 + 0.5;
+    double py = (double)y + 0.5;
+
+    SoftF zero = soft_f1(0.0f);
+    SoftF ones = soft_ge(zero, zero);
+    SoftF ramp = soft_ramp();
+
+    SoftF e_0[3], e_dx[3];
+    SoftF top_left[3];
+    for (int i = 0; i < 3; i++) {
+        SoftPlane const *p = &t->edges[i];
+        e_0[i] = soft_f1((float)(p->dx * px + p->dy * py + p->c));
+        e_dx[i] = soft_f1((float)p->dx);
+        top_left[i] = t->top_left[i] ? ones : zero;
+    }
+
+    SoftF a_0[SOFT_ATTRIBUTES], a_dx[SOFT_ATTRIBUTES];
+    for (int k = 0; k < SOFT_ATTRIBUTES; k++) {
+        SoftPlane const *p = &t->attributes[k];
+        a_0[k] = soft_f1((float)(p->dx * px + p->dy * py + p->c));
+        a_dx[k] = soft_f1((float)p->dx);
+    }
+
+    SoftF one = soft_f1(1.0f);
+    SoftF to_unorm = soft_f1(255.0f);
+    SoftF from_unorm = soft_f1(1.0f / 255.0f);
+    SoftF half = soft_f1(0.5f);
+    SoftF fade = soft_f1(soft->fade);
+    SoftF tex_w = soft_f1((float)tex->width);
+    SoftF tex_h = soft_f1((float)tex->height);
+    SoftF inv_tex_w = soft_f1(1.0f / (float)tex->width);
+    SoftF inv_tex_h = soft_f1(1.0f / (float)tex->height);
+    SoftF max_tx = soft_f1((float)(tex->width - 1));
+    SoftF max_ty = soft_f1((float)(tex->height - 1));
+    SoftI stride = soft_i1(tex->width);
+    SoftI byte = soft_i1(0xff);
+
+    uint32_t *row = target->pixels + (size_t)y * target->width;
+
+    for (int x = x0; x < x1; x += SOFT_LANES) {
+        SoftF dx = soft_add(soft_f1((float)(x - x0)), ramp);
+
+        SoftF inside = soft_ge(soft_f1((float)(x1 - x)), soft_add(ramp, one));
+        for (int i = 0; i < 3; i++) {
+            SoftF e = soft_add(e_0[i], soft_mul(e_dx[i], dx));
+            SoftF edge = soft_or(soft_gt(e, zero), soft_and(soft_ge(e, zero), top_left[i]));
+            inside = soft_and(inside, edge);
+        }
+
+        if (soft_any(inside)) {
+            SoftF a[SOFT_ATTRIBUTES];
+            for (int k = 0; k < SOFT_ATTRIBUTES; k++)
+                a[k] = soft_add(a_0[k], soft_mul(a_dx[k], dx));
+
+            // Point sampling with wrap addressing.
+            SoftF tu = soft_mul(a[SOFT_U], tex_w);
+            SoftF tv = soft_mul(a[SOFT_V], tex_h);
+            tu = soft_sub(tu, soft_mul(soft_floor(soft_mul(tu, inv_tex_w)), tex_w));
+            tv = soft_sub(tv, soft_mul(soft_floor(soft_mul(tv, inv_tex_h)), tex_h));
+            tu = soft_min(soft_max(soft_floor(tu), zero), max_tx);
+            tv = soft_min(soft_max(soft_floor(tv), zero), max_ty);
+            SoftI index = soft_iadd(soft_imul(soft_cvt(tv), stride), soft_cvt(tu));
+            SoftI texel = soft_gather(tex->texels, index);
+
+            SoftF tr = soft_mul(soft_cvtf(soft_iand(texel, byte)), from_unorm);
+            SoftF tg = soft_mul(soft_cvtf(soft_iand(soft_shr(texel, 8), byte)), from_unorm);
+            SoftF tb = soft_mul(soft_cvtf(soft_iand(soft_shr(texel, 16), byte)), from_unorm);
+            SoftF ta = soft_mul(soft_cvtf(soft_shr(texel, 24)), from_unorm);
+
+            // Fade the checkerboard in/out.
+            ta = soft_mul(ta, fade);
+            SoftF ita = soft_sub(one, ta);
+
+            SoftF sr = soft_add(soft_mul(tr, ta), soft_mul(a[SOFT_R], ita));
+            SoftF sg = soft_add(soft_mul(tg, ta), soft_mul(a[SOFT_G], ita));
+            SoftF sb = soft_add(soft_mul(tb, ta), soft_mul(a[SOFT_B], ita));
+            SoftF sa = a[SOFT_A];
+
+            // Blend with what is already there.
+            SoftI dst = soft_load(row + x);
+            SoftF dr = soft_mul(soft_cvtf(soft_iand(dst, byte)), from_unorm);
+            SoftF dg = soft_mul(soft_cvtf(soft_iand(soft_shr(dst, 8), byte)), from_unorm);
+            SoftF db = soft_mul(soft_cvtf(soft_iand(soft_shr(dst, 16), byte)), from_unorm);
+            SoftF da = soft_mul(soft_cvtf(soft_shr(dst, 24)), from_unorm);
+
+            SoftF isa = soft_sub(one, sa);
+            SoftF o[4];
+            o[0] = soft_add(soft_mul(sr, sa), soft_mul(dr, isa));
+            o[1] = soft_add(soft_mul(sg, sa), soft_mul(dg, isa));
+            o[2] = soft_add(soft_mul(sb, sa), soft_mul(db, isa));
+            o[3] = soft_add(soft_mul(sa, sa), soft_mul(da, isa));
+
+            SoftI out = soft_i1(0);
+            for (int i = 0; i < 4; i++) {
+                SoftF v = soft_min(soft_max(o[i], zero), one);
+                SoftI c = soft_cvt(soft_add(soft_mul(v, to_unorm), half));
+                out = soft_ior(out, soft_shl(c, 8 * i));
+            }
+
+            // The tail of the row may be narrower than the lanes, only touch
+            // what belongs to this tile.
+            if (x + SOFT_LANES <= x1) {
+                soft_store(row + x, soft_select(inside, out, dst));
+            } else {
+                uint32_t lanes[SOFT_LANES];
+                soft_store(lanes, soft_select(inside, out, dst));
+                for (int i = 0; i < x1 - x; i++)
+                    row[x + i] = lanes[i];
+            }
+        }
+    }
+}
+
+static void soft_draw_tile(void *ctx, int tile, int thread)
+{
+    Soft *soft = (Soft *)ctx;
+
+    int tx0, ty0, tx1, ty1;
+    soft_tile_rect(soft, tile, &tx0, &ty0, &tx1, &ty1);
+
+    uint32_t const *bin = soft->bins[tile];
+    int count = soft->bin_counts[tile];
+
+    for (int i = 0; i < count; i++) {
+        SoftTriangle const *t = &soft->triangles[bin[i]];
+
+        int x0 = (t->x0 > tx0) ? t->x0 : tx0;
+        int y0 = (t->y0 > ty0) ? t->y0 : ty0;
+        int x1 = (t->x1 < tx1) ? t->x1 : tx1;
+        int y1 = (t->y1 < ty1) ? t->y1 : ty1;
+
+        for (int y = y0; y < y1; y++)
+            soft_span(soft, t, x0, x1, y);
+    }
+}
+
+static void soft_bin(Soft *soft, uint32_t triangle)
+{
+    SoftTriangle const *t = &soft->triangles[triangle];
+
+    int tx0 = t->x0 / SOFT_TILE_SIZE;
+    int ty0 = t->y0 / SOFT_TILE_SIZE;
+    int tx1 = (t->x1 - 1) / SOFT_TILE_SIZE;
+    int ty1 = (t->y1 - 1) / SOFT_TILE_SIZE;
+
+    for (int ty = ty0; ty <= ty1; ty++) {
+        for (int tx = tx0; tx <= tx1; tx++) {
+            int tile = ty * soft->tiles_x + tx;
+
+            if (soft->bin_counts[tile] == soft->bin_capacities[tile]) {
+                int capacity = soft->bin_capacities[tile] ? soft->bin_capacities[tile] * 2 : 64;
+                soft->bins[tile] = (uint32_t *)realloc(
+                    soft->bins[tile], capacity * sizeof(uint32_t));
+                ASSERT(soft->bins[tile]);
+                soft->bin_capacities[tile] = capacity;
+            }
+            soft->bins[tile][soft->bin_counts[tile]++] = triangle;
+        }
+    }
+}
+
+// The equivalent of DrawInstanced(vertex_count, 1, 0, 0) with a triangle
+// list, the pipeline of hello.cpp and a viewport that covers the target.
+static void soft_draw(Soft *soft, SoftTarget *target, SoftTexture const *texture,
+                      Vertex const *vertices, int vertex_count, float const consts[4])
+{
+    soft_tiles(soft, target);
+    soft->texture = texture;
+    soft->fade = (cosf(consts[3]) + 1.0f) / 2.0f;
+
+    if (vertex_count > soft->vertex_capacity) {
+        soft->vertices = (SoftVertex *)realloc(soft->vertices, vertex_count * sizeof(SoftVertex));
+        ASSERT(soft->vertices);
+        soft->vertex_capacity = vertex_count;
+    }
+    for (int i = 0; i < vertex_count; i++)
+        soft_vs(&vertices[i], consts, target->width, target->height, &soft->vertices[i]);
+
+    int triangle_count = vertex_count / 3;
+    if (triangle_count > soft->triangle_capacity) {
+        soft->triangles = (SoftTriangle *)realloc(
+            soft->triangles, triangle_count * sizeof(SoftTriangle));
+        ASSERT(soft->triangles);
+        soft->triangle_capacity = triangle_count;
+    }
+
+    soft->triangle_count = 0;
+    for (int i = 0; i < triangle_count; i++) {
+        SoftTriangle *t = &soft->triangles[soft->triangle_count];
+        if (soft_setup(&soft->vertices[3 * i], target->width, target->height, t))
+            soft_bin(soft, (uint32_t)soft->triangle_count++);
+    }
+
+    pool_for(soft->pool, soft->tiles_x * soft->tiles_y, soft_draw_tile, soft);
+}
+
+
+
+// Dumping the Frame Buffer
+
+static bool soft_write_ppm(SoftTarget const *target, char const *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f)
+        return false;
+
+    fprintf(f, "P6\n%d %d\n255\n", target->width, target->height);
+
+    size_t count = (size_t)target->width * target->height;
+    for (size_t i = 0; i < count; i++) {
+        uint32_t c = target->pixels[i];
+        uint8_t rgb[3] = {(uint8_t)c, (uint8_t)(c >> 8), (uint8_t)(c >> 16)};
+        fwrite(rgb, 1, 3, f);
+    }
+
+    bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
+
+static uint32_t soft_crc32(uint32_t crc, uint8_t const *p, size_t size)
+{
+    static uint32_t table[256];
+    if (!table[1]) {
+        for (uint32_t n = 0; n < 256; n++) {
+            uint32_t c = n;
+            for (int k = 0; k < 8; k++)
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+    }
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+        crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void soft_png_chunk(FILE *f, char const *type, uint8_t const *data, uint32_t size)
+{
+    uint8_t be[4] = {(uint8_t)(size >> 24), (uint8_t)(size >> 16), (uint8_t)(size >> 8), (uint8_t)size};
+    fwrite(be, 1, 4, f);
+
+    uint32_t crc = soft_crc32(0, (uint8_t const *)type, 4);
+    crc = soft_crc32(crc, data, size);
+    fwrite(type, 1, 4, f);
+    fwrite(data, 1, size, f);
+
+    uint8_t crc_be[4] = {(uint8_t)(crc >> 24), (uint8_t)(crc >> 16), (uint8_t)(crc >> 8), (uint8_t)crc};
+    fwrite(crc_be, 1, 4, f);
+}
+
+// An RGBA PNG with uncompressed (stored) deflate blocks: larger than it needs
+// to be, but any viewer opens it and nothing beyond the C library is needed.
+static bool soft_write_png(SoftTarget const *target, char const *path)
+{
+    FILE *f = fopen(path, "wb");
+    if (!f)
+        return false;
+
+    static uint8_t const signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    fwrite(signature, 1, 8, f);
+
+    uint32_t w = (uint32_t)target->width;
+    uint32_t h = (uint32_t)target->height;
+    uint8_t header[13] = {
+        (uint8_t)(w >> 24), (uint8_t)(w >> 16), (uint8_t)(w >> 8), (uint8_t)w,
+        (uint8_t)(h >> 24), (uint8_t)(h >> 16), (uint8_t)(h >> 8), (uint8_t)h,
+        8, 6, 0, 0, 0, // 8-bit RGBA, no interlacing.
+    };
+    soft_png_chunk(f, "IHDR", header, sizeof(header));
+
+    // Every row starts with its filter type, 0 for none.
+    size_t row_size = 1 + (size_t)w * 4;
+    size_t raw_size = row_size * h;
+    size_t block_count = (raw_size + 65534) / 65535;
+    size_t zlib_size = 2 + raw_size + block_count * 5 + 4;
+
+    uint8_t *raw = (uint8_t *)malloc(raw_size);
+    uint8_t *zlib = (uint8_t *)malloc(zlib_size);
+    ASSERT(raw && zlib);
+
+    for (uint32_t y = 0; y < h; y++) {
+        uint8_t *row = raw + y * row_size;
+        row[0] = 0;
+        memcpy(row + 1, target->pixels + (size_t)y * w, (size_t)w * 4);
+    }
+
+    uint8_t *z = zlib;
+    *z++ = 0x78;
+    *z++ = 0x01;
+    for (size_t offset = 0; offset < raw_size; offset += 65535) {
+        size_t size = raw_size - offset;
+        if (size > 65535)
+            size = 65535;
+        *z++ = (offset + size == raw_size) ? 1 : 0;
+        *z++ = (uint8_t)size;
+        *z++ = (uint8_t)(size >> 8);
+        *z++ = (uint8_t)~size;
+        *z++ = (uint8_t)(~size >> 8);
+        memcpy(z, raw + offset, size);
+        z += size;
+    }
+
+    uint32_t s1 = 1, s2 = 0;
+    for (size_t i = 0; i < raw_size; i++) {
+        s1 = (s1 + raw[i]) % 65521;
+        s2 = (s2 + s1) % 65521;
+    }
+    uint32_t adler = (s2 << 16) | s1;
+    *z++ = (uint8_t)(adler >> 24);
+    *z++ = (uint8_t)(adler >> 16);
+    *z++ = (uint8_t)(adler >> 8);
+    *z++ = (uint8_t)adler;
+
+    soft_png_chunk(f, "IDAT", zlib, (uint32_t)(z - zlib));
+    soft_png_chunk(f, "IEND", NULL, 0);
+
+    free(zlib);
+    free(raw);
+
+    bool ok = !ferror(f);
+    fclose(f);
+    return ok;
+}
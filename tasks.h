@@ -0,0 +1,249 @@
+// A small graph of tasks that depend on one another.
+//
+// Every task runs once, as soon as the tasks it depends on are done, on
+// whichever thread of a Pool is free; ready tasks are taken in the order
+// they were added.  The graph is meant for the one-off stages of starting
+// up, where some stages take long and most do not need each other.
+//
+// The wall time of every task is recorded, and the report lists them along
+// with the critical path: the chain of dependent tasks that took longest,
+// which no number of threads can make any shorter.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <assert.h>
+
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+#include "threads.h"
+
+#ifndef ASSERT
+#define ASSERT(expr)    assert(expr)
+#endif
+
+
+
+#define TASKS_MAX       64
+#define TASKS_MAX_DEPS  8
+
+typedef void TaskFunc(void *ctx);
+
+typedef struct Task {
+    char const  *name;
+    TaskFunc    *func;
+    void        *ctx;
+
+    // Tasks this one waits for.  They were all added before it.
+    int         deps[TASKS_MAX_DEPS];
+    int         dep_count;
+
+    // Seconds since tasks_run() was called, and the thread that ran it.
+    double      start;
+    double      end;
+    int         thread;
+} Task;
+
+typedef struct Tasks {
+    Task                        tasks[TASKS_MAX];
+    int                         count;
+
+    // While running.
+    std::mutex                  mutex;
+    std::condition_variable     changed;
+    int                         waiting[TASKS_MAX];     // Dependencies not done yet.
+    bool                        started[TASKS_MAX];
+    int                         done;
+    std::chrono::steady_clock::time_point   t0;
+
+    double                      wall;
+} Tasks;
+
+
+
+static void tasks_init(Tasks *tasks)
+{
+    tasks->count = 0;
+    tasks->done = 0;
+    tasks->wall = 0.0;
+}
+
+// Returns the task's index, which tasks_after() takes.
+static int tasks_add(Tasks *tasks, char const *name, TaskFunc *func, void *ctx)
+{
+    ASSERT(tasks->count < TASKS_MAX);
+
+    Task *task = &tasks->tasks[tasks->count];
+    task->name = name;
+    task->func = func;
+    task->ctx = ctx;
+    task->dep_count = 0;
+    task->start = 0.0;
+    task->end = 0.0;
+    task->thread = -1;
+    return tasks->count++;
+}
+
+// Makes `task` wait for `dependency`, which must have been added before it.
+// That keeps the graph free of cycles.
+static void tasks_after(Tasks *tasks, int task, int dependency)
+{
+    ASSERT(dependency >= 0 && dependency < task && task < tasks->count);
+
+    Task *t = &tasks->tasks[task];
+    ASSERT(t->dep_count < TASKS_MAX_DEPS);
+    t->deps[t->dep_count++] = dependency;
+}
+
+static double tasks_now(Tasks *tasks)
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now() - tasks->t0).count();
+}
+
+// What every thread of the pool does: take the first ready task, run it,
+// and let the ones waiting for it know, until none are left.
+static void tasks_work(void *ctx, int index, int thread)
+{
+    Tasks *tasks = (Tasks *)ctx;
+
+    std::unique_lock<std::mutex> lock(tasks->mutex);
+
+    while (tasks->done < tasks->count) {
+        int next = -1;
+        for (int i = 0; i < tasks->count && next < 0; i++) {
+            if (!tasks->started[i] && tasks->waiting[i] == 0)
+                next = i;
+        }
+
+        if (next < 0) {
+            tasks->changed.wait(lock);
+            continue;
+        }
+
+        Task *task = &tasks->tasks[next];
+        tasks->started[next] = true;
+        task->thread = thread;
+        task->start = tasks_now(tasks);
+
+        lock.unlock();
+        task->func(task->ctx);
+        lock.lock();
+
+        task->end = tasks_now(tasks);
+        tasks->done++;
+
+        for (int i = next + 1; i < tasks->count; i++) {
+            Task const *t = &tasks->tasks[i];
+            for (int d = 0; d < t->dep_count; d++) {
+                if (t->deps[d] == next)
+                    tasks->waiting[i]--;
+            }
+        }
+        tasks->changed.notify_all();
+    }
+}
+
+// Runs every task, and returns once all of them are done.  Tasks may use
+// pools of their own, but not this one.
+static void tasks_run(Tasks *tasks, Pool *pool)
+{
+    for (int i = 0; i < tasks->count; i++) {
+        tasks->waiting[i] = tasks->tasks[i].dep_count;
+        tasks->started[i] = false;
+    }
+    tasks->done = 0;
+    tasks->t0 = std::chrono::steady_clock::now();
+
+    pool_for(pool, pool->thread_count, tasks_work, tasks);
+
+    tasks->wall = tasks_now(tasks);
+}
+
+
+
+// Reports
+
+// The chain of dependent tasks that took longest, first task first.
+// Returns how many tasks are in it, and the time they took in `length`.
+static int tasks_critical_path(Tasks const *tasks, int *path, double *length)
+{
+    double longest[TASKS_MAX];
+    int previous[TASKS_MAX];
+    int last = -1;
+
+    // Dependencies come before the tasks that wait for them.
+    for (int i = 0; i < tasks->count; i++) {
+        Task const *t = &tasks->tasks[i];
+        longest[i] = 0.0;
+        previous[i] = -1;
+        for (int d = 0; d < t->dep_count; d++) {
+            if (longest[t->deps[d]] > longest[i] || previous[i] < 0) {
+                longest[i] = longest[t->deps[d]];
+                previous[i] = t->deps[d];
+            }
+        }
+        longest[i] += t->end - t->start;
+
+        if (last < 0 || longest[i] > longest[last])
+            last = i;
+    }
+
+    *length = (last >= 0) ? longest[last] : 0.0;
+
+    int count = 0;
+    for (int i = last; i >= 0; i = previous[i])
+        count++;
+    int at = count;
+    for (int i = last; i >= 0; i = previous[i])
+        path[--at] = i;
+    return count;
+}
+
+// Writes a table of when every task ran, and the critical path, into
+// `buffer`.  Returns the length of the text, which is cut short if need be.
+static int tasks_report(Tasks const *tasks, char *buffer, size_t size)
+{
+    int path[TASKS_MAX];
+    double length;
+    int path_count = tasks_critical_path(tasks, path, &length);
+
+    bool critical[TASKS_MAX] = {false};
+    for (int i = 0; i < path_count; i++)
+        critical[path[i]] = true;
+
+    double work = 0.0;
+    for (int i = 0; i < tasks->count; i++)
+        work += tasks->tasks[i].end - tasks->tasks[i].start;
+
+    size_t used = 0;
+#define TASKS_PRINT(...) \
+    used += (size_t)snprintf(buffer + used, (used < size) ? size - used : 0, __VA_ARGS__); \
+    if (used >= size) used = size - 1
+
+    ASSERT(size > 0);
+    buffer[0] = 0;
+
+    TASKS_PRINT("%d tasks: %.2f ms wall, %.2f ms of work (%.2fx)\n",
+                tasks->count, 1000.0 * tasks->wall, 1000.0 * work,
+                (tasks->wall > 0.0) ? work / tasks->wall : 0.0);
+
+    for (int i = 0; i < tasks->count; i++) {
+        Task const *t = &tasks->tasks[i];
+        TASKS_PRINT("  %c %-20s %8.2f .. %8.2f ms  %8.2f ms  thread %d\n",
+                    critical[i] ? '*' : ' ', t->name, 1000.0 * t->start, 1000.0 * t->end,
+                    1000.0 * (t->end - t->start), t->thread);
+    }
+
+    TASKS_PRINT("  critical path, %.2f ms:", 1000.0 * length);
+    for (int i = 0; i < path_count; i++) {
+        TASKS_PRINT("%s %s", (i > 0) ? " >" : "", tasks->tasks[path[i]].name);
+    }
+    TASKS_PRINT("\n");
+
+#undef TASKS_PRINT
+    return (int)used;
+}
@@ -0,0 +1,460 @@
+// Preparing textures for upload.
+//
+// Three steps stand between an image and a texture the GPU can copy from an
+// upload buffer:
+//
+// * The mip chain is generated, each level from the one above it, with a box
+//   or a Kaiser-windowed sinc filter.  Filtering happens in linear space when
+//   the texels are sRGB, one RGBA texel per SSE register.
+//
+// * The placed footprint of every subresource is worked out, the way
+//   ID3D12Device::GetCopyableFootprints() does: where each one starts in the
+//   upload buffer, and how far apart its rows are.
+//
+// * The rows are copied at that pitch into the upload memory.
+//
+// The first and last steps are spread across the threads of a Pool.
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include <emmintrin.h>
+
+#include "threads.h"
+
+#ifndef ASSERT
+#define ASSERT(expr)    assert(expr)
+#endif
+
+
+
+// What the GPU requires of texture data in an upload buffer.
+
+#define TEXTURE_PITCH_ALIGNMENT         256     // D3D12_TEXTURE_DATA_PITCH_ALIGNMENT
+#define TEXTURE_PLACEMENT_ALIGNMENT     512     // D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT
+
+#define TEXTURE_MAX_MIPS                16
+
+
+
+// Formats
+// Only the layout of a format matters here: how many texels a block covers,
+// and how many bytes it takes.
+
+enum {
+    TEXTURE_RGBA8,          // DXGI_FORMAT_R8G8B8A8_UNORM (or _SRGB)
+    TEXTURE_BC1,            // DXGI_FORMAT_BC1_UNORM
+    TEXTURE_BC3,            // DXGI_FORMAT_BC3_UNORM
+    TEXTURE_BC7,            // DXGI_FORMAT_BC7_UNORM
+    TEXTURE_FORMATS
+};
+
+static struct {
+    int block_width;
+    int block_height;
+    int block_bytes;
+} const texture_formats[TEXTURE_FORMATS] = {
+    {1, 1, 4},
+    {4, 4, 8},
+    {4, 4, 16},
+    {4, 4, 16},
+};
+
+
+
+// Footprints
+
+typedef struct TextureDesc {
+    int format;
+    int width;
+    int height;
+    int array_size;
+    int mip_levels;
+} TextureDesc;
+
+// D3D12_PLACED_SUBRESOURCE_FOOTPRINT, plus what GetCopyableFootprints()
+// returns alongside it.
+typedef struct TextureFootprint {
+    uint64_t    offset;
+    int         width;          // Rounded up to whole blocks.
+    int         height;
+    uint32_t    row_pitch;
+    int         rows;           // Rows of blocks.
+    uint64_t    row_size;       // Bytes of data in each row.
+} TextureFootprint;
+
+static int texture_mip_count(int width, int height)
+{
+    int count = 1;
+    while ((width > 1 || height > 1) && count < TEXTURE_MAX_MIPS) {
+        width = (width > 1) ? width / 2 : 1;
+        height = (height > 1) ? height / 2 : 1;
+        count++;
+    }
+    return count;
+}
+
+static int texture_mip_size(int size, int mip)
+{
+    size >>= mip;
+    return (size > 0) ? size : 1;
+}
+
+static uint64_t texture_align(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+// Bytes taken by a subresource whose rows of blocks are tightly packed.
+static uint64_t texture_size(int format, int width, int height)
+{
+    int bw = texture_formats[format].block_width;
+    int bh = texture_formats[format].block_height;
+    return (uint64_t)((width + bw - 1) / bw) * ((height + bh - 1) / bh) *
+        texture_formats[format].block_bytes;
+}
+
+// Subresources are numbered as in Direct3D 12: mip + slice * mip_levels.
+// Returns the number of bytes from base_offset to the end of the last one.
+static uint64_t texture_footprints(TextureDesc const *desc, int first, int count,
+                                   uint64_t base_offset, TextureFootprint *footprints)
+{
+    int bw = texture_formats[desc->format].block_width;
+    int bh = texture_formats[desc->format].block_height;
+    int bytes = texture_formats[desc->format].block_bytes;
+
+    uint64_t end = base_offset;
+
+    for (int i = 0; i < count; i++) {
+        int mip = (first + i) % desc->mip_levels;
+
+        int blocks_x = (texture_mip_size(desc->width, mip) + bw - 1) / bw;
+        int blocks_y = (texture_mip_size(desc->height, mip) + bh - 1) / bh;
+
+        TextureFootprint *f = &footprints[i];
+        f->offset = texture_align(end, TEXTURE_PLACEMENT_ALIGNMENT);
+        f->width = blocks_x * bw;
+        f->height = blocks_y * bh;
+        f->rows = blocks_y;
+        f->row_size = (uint64_t)blocks_x * bytes;
+        f->row_pitch = (uint32_t)texture_align(f->row_size, TEXTURE_PITCH_ALIGNMENT);
+
+        // The last row needs no padding.
+        end = f->offset + (uint64_t)f->row_pitch * (f->rows - 1) + f->row_size;
+    }
+
+    return end - base_offset;
+}
+
+
+
+// Conversions
+// Texels are RGBA8, red in the lowest byte.  While filtering they are four
+// floats, linear if the texture is sRGB.
+
+static float    texture_to_linear[256];
+static uint8_t  texture_to_srgb[4096];
+
+static void texture_init_tables(void)
+{
+    static bool done = false;
+    if (done)
+        return;
+
+    for (int i = 0; i < 256; i++) {
+        float c = i / 255.0f;
+        texture_to_linear[i] = (c <= 0.04045f) ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+    }
+    for (int i = 0; i < 4096; i++) {
+        float l = i / 4095.0f;
+        float c = (l <= 0.0031308f) ? l * 12.92f : 1.055f * powf(l, 1.0f / 2.4f) - 0.055f;
+        texture_to_srgb[i] = (uint8_t)(c * 255.0f + 0.5f);
+    }
+    done = true;
+}
+
+static inline __m128 texture_load(uint32_t texel, bool srgb)
+{
+    if (srgb) {
+        return _mm_setr_ps(texture_to_linear[texel & 0xff],
+                           texture_to_linear[(texel >> 8) & 0xff],
+                           texture_to_linear[(texel >> 16) & 0xff],
+                           (float)(texel >> 24) * (1.0f / 255.0f));
+    }
+
+    __m128i zero = _mm_setzero_si128();
+    __m128i p = _mm_cvtsi32_si128((int)texel);
+    p = _mm_unpacklo_epi16(_mm_unpacklo_epi8(p, zero), zero);
+    return _mm_mul_ps(_mm_cvtepi32_ps(p), _mm_set1_ps(1.0f / 255.0f));
+}
+
+static inline uint32_t texture_store(__m128 v, bool srgb)
+{
+    v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+
+    if (srgb) {
+        __m128i i = _mm_cvttps_epi32(_mm_add_ps(
+            _mm_mul_ps(v, _mm_setr_ps(4095.0f, 4095.0f, 4095.0f, 255.0f)), _mm_set1_ps(0.5f)));
+        int c[4];
+        _mm_storeu_si128((__m128i *)c, i);
+        return (uint32_t)texture_to_srgb[c[0]] |
+               ((uint32_t)texture_to_srgb[c[1]] << 8) |
+               ((uint32_t)texture_to_srgb[c[2]] << 16) |
+               ((uint32_t)c[3] << 24);
+    }
+
+    __m128i i = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f)));
+    i = _mm_packs_epi32(i, i);
+    i = _mm_packus_epi16(i, i);
+    return (uint32_t)_mm_cvtsi128_si32(i);
+}
+
+
+
+// Mip Generation
+
+enum {
+    TEXTURE_BOX,        // Averages the texels each one covers.
+    TEXTURE_KAISER,     // Sharper, at the cost of more taps.
+};
+
+typedef struct TextureImage {
+    int         width;
+    int         height;
+    uint32_t    *texels;    // Tightly packed rows.
+} TextureImage;
+
+// The weights a filter gives to the source texels of every destination
+// texel along one axis.  Edges wrap around, as the sampler in hello.cpp does.
+typedef struct TextureKernel {
+    int     taps;
+    int     *first;     // Per destination texel, the first source texel.
+    float   *weights;   // Per destination texel, `taps` weights.
+} TextureKernel;
+
+static float texture_sinc(float x)
+{
+    if (fabsf(x) < 1e-6f)
+        return 1.0f;
+    x *= 3.14159265359f;
+    return sinf(x) / x;
+}
+
+// The zeroth-order modified Bessel function of the first kind.
+static float texture_bessel0(float x)
+{
+    float sum = 1.0f;
+    float term = 1.0f;
+    for (int k = 1; k < 20; k++) {
+        term *= (x / (2.0f * k)) * (x / (2.0f * k));
+        sum += term;
+    }
+    return sum;
+}
+
+static void texture_kernel(TextureKernel *kernel, int filter, int src, int dst)
+{
+    float scale = (float)src / (float)dst;
+    float radius = (filter == TEXTURE_BOX) ? 0.5f * scale : 1.5f * scale;
+    float alpha = 4.0f;
+
+    kernel->taps = (int)ceilf(2.0f * radius) + 1;
+    kernel->first = (int *)malloc(dst * sizeof(int));
+    kernel->weights = (float *)malloc((size_t)dst * kernel->taps * sizeof(float));
+    ASSERT(kernel->first && kernel->weights);
+
+    for (int x = 0; x < dst; x++) {
+        float center = (x + 0.5f) * scale;
+        int first = (int)floorf(center - radius);
+        float *w = &kernel->weights[x * kernel->taps];
+        float sum = 0.0f;
+
+        for (int t = 0; t < kernel->taps; t++) {
+            float lo = (float)(first + t);
+            float d = lo + 0.5f - center;
+
+            if (filter == TEXTURE_BOX) {
+                // How much of the source texel [lo, lo + 1) the box covers.
+                float a = fmaxf(lo, center - radius);
+                float b = fminf(lo + 1.0f, center + radius);
+                w[t] = fmaxf(b - a, 0.0f);
+            } else {
+                float r = d / radius;
+                w[t] = (fabsf(r) < 1.0f) ?
+                    texture_sinc(d / scale) * texture_bessel0(alpha * sqrtf(1.0f - r * r)) /
+                    texture_bessel0(alpha) : 0.0f;
+            }
+            sum += w[t];
+        }
+        for (int t = 0; t < kernel->taps; t++)
+            w[t] /= sum;
+
+        kernel->first[x] = first;
+    }
+}
+
+static void texture_free_kernel(TextureKernel *kernel)
+{
+    free(kernel->first);
+    free(kernel->weights);
+}
+
+static int texture_wrap(int i, int size)
+{
+    i %= size;
+    return (i < 0) ? i + size : i;
+}
+
+typedef struct TextureMipJob {
+    TextureImage const  *src;
+    TextureImage        *dst;
+    TextureKernel       h;
+    TextureKernel       v;
+    bool                srgb;
+    __m128              *scratch[POOL_MAX_THREADS];
+} TextureMipJob;
+
+// Filters the columns, then the row, of one destination row.
+static void texture_mip_row(void *ctx, int y, int thread)
+{
+    TextureMipJob *job = (TextureMipJob *)ctx;
+    TextureImage const *src = job->src;
+    TextureImage *dst = job->dst;
+    __m128 *column = job->scratch[thread];
+
+    int first = job->v.first[y];
+    float const *vw = &job->v.weights[y * job->v.taps];
+
+    for (int x = 0; x < src->width; x++)
+        column[x] = _mm_setzero_ps();
+
+    for (int t = 0; t < job->v.taps; t++) {
+        if (vw[t] == 0.0f)
+            continue;
+        __m128 w = _mm_set1_ps(vw[t]);
+        uint32_t const *row = src->texels + (size_t)texture_wrap(first + t, src->height) * src->width;
+        for (int x = 0; x < src->width; x++)
+            column[x] = _mm_add_ps(column[x], _mm_mul_ps(w, texture_load(row[x], job->srgb)));
+    }
+
+    uint32_t *out = dst->texels + (size_t)y * dst->width;
+
+    for (int x = 0; x < dst->width; x++) {
+        int first_x = job->h.first[x];
+        float const *hw = &job->h.weights[x * job->h.taps];
+
+        __m128 sum = _mm_setzero_ps();
+        for (int t = 0; t < job->h.taps; t++) {
+            int i = texture_wrap(first_x + t, src->width);
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(hw[t]), column[i]));
+        }
+        out[x] = texture_store(sum, job->srgb);
+    }
+}
+
+// Fills levels[1..count) from levels[0], allocating their texels.
+// Free them with texture_free_mips().
+static void texture_mips(Pool *pool, TextureImage *levels, int count, int filter, bool srgb)
+{
+    texture_init_tables();
+
+    for (int mip = 1; mip < count; mip++) {
+        TextureImage const *src = &levels[mip - 1];
+        TextureImage *dst = &levels[mip];
+
+        dst->width = (src->width > 1) ? src->width / 2 : 1;
+        dst->height = (src->height > 1) ? src->height / 2 : 1;
+        dst->texels = (uint32_t *)malloc((size_t)dst->width * dst->height * sizeof(uint32_t));
+        ASSERT(dst->texels);
+
+        TextureMipJob job;
+        job.src = src;
+        job.dst = dst;
+        job.srgb = srgb;
+        texture_kernel(&job.h, filter, src->width, dst->width);
+        texture_kernel(&job.v, filter, src->height, dst->height);
+
+        for (int i = 0; i < pool->thread_count; i++) {
+            job.scratch[i] = (__m128 *)_mm_malloc(src->width * sizeof(__m128), 16);
+            ASSERT(job.scratch[i]);
+        }
+
+        pool_for(pool, dst->height, texture_mip_row, &job);
+
+        for (int i = 0; i < pool->thread_count; i++)
+            _mm_free(job.scratch[i]);
+        texture_free_kernel(&job.h);
+        texture_free_kernel(&job.v);
+    }
+}
+
+static void texture_free_mips(TextureImage *levels, int count)
+{
+    for (int mip = 1; mip < count; mip++) {
+        free(levels[mip].texels);
+        levels[mip].texels = NULL;
+    }
+}
+
+
+
+// Packing
+// Copies every subresource, given as tightly packed rows of blocks, into
+// upload memory at the offsets and pitches of its footprint.
+
+#define TEXTURE_PACK_ROWS   64
+
+typedef struct TexturePackJob {
+    TextureFootprint const  *footprints;
+    uint8_t const *const    *subresources;
+    uint8_t                 *dst;
+    int                     *bands;     // Per subresource, the first band.
+    int                     count;
+} TexturePackJob;
+
+static void texture_pack_band(void *ctx, int band, int thread)
+{
+    TexturePackJob *job = (TexturePackJob *)ctx;
+
+    int i = 0;
+    while (i + 1 < job->count && job->bands[i + 1] <= band)
+        i++;
+
+    TextureFootprint const *f = &job->footprints[i];
+    int row0 = (band - job->bands[i]) * TEXTURE_PACK_ROWS;
+    int row1 = (row0 + TEXTURE_PACK_ROWS < f->rows) ? row0 + TEXTURE_PACK_ROWS : f->rows;
+
+    uint8_t const *src = job->subresources[i] + (size_t)row0 * f->row_size;
+    uint8_t *dst = job->dst + f->offset + (size_t)row0 * f->row_pitch;
+
+    for (int row = row0; row < row1; row++) {
+        memcpy(dst, src, f->row_size);
+        src += f->row_size;
+        dst += f->row_pitch;
+    }
+}
+
+// `dst` is where offset 0 of the footprints is.
+static void texture_pack(Pool *pool, TextureFootprint const *footprints, int count,
+                         uint8_t const *const *subresources, uint8_t *dst)
+{
+    int *bands = (int *)malloc((count + 1) * sizeof(int));
+    ASSERT(bands);
+
+    int band_count = 0;
+    for (int i = 0; i < count; i++) {
+        bands[i] = band_count;
+        band_count += (footprints[i].rows + TEXTURE_PACK_ROWS - 1) / TEXTURE_PACK_ROWS;
+    }
+    bands[count] = band_count;
+
+    TexturePackJob job = {footprints, subresources, dst, bands, count};
+    pool_for(pool, band_count, texture_pack_band, &job);
+
+    free(bands);
+}
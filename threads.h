@@ -0,0 +1,148 @@
+// A minimal pool of worker threads.
+//
+// The pool runs one kind of job only: a loop of `count` independent
+// iterations, which the workers and the calling thread pick off a shared
+// counter until none remain.  That covers everything the examples need to
+// spread across cores, so nothing fancier is provided.
+
+#pragma once
+
+#include <stdint.h>
+#include <assert.h>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#ifndef ASSERT
+#define ASSERT(expr)    assert(expr)
+#endif
+
+
+
+#define POOL_MAX_THREADS    64
+
+// Called once for every `index` in [0, count).  `thread` identifies the
+// thread running it, in [0, thread_count), for per-thread scratch memory.
+typedef void PoolFunc(void *ctx, int index, int thread);
+
+typedef struct Pool {
+    int                         thread_count;   // Including the caller.
+    std::thread                 threads[POOL_MAX_THREADS];
+
+    std::mutex                  mutex;
+    std::condition_variable     wake;
+    std::condition_variable     done;
+    uint64_t                    generation;
+    int                         busy;
+    bool                        quit;
+
+    PoolFunc                    *func;
+    void                        *ctx;
+    int                         count;
+    std::atomic<int>            next;
+} Pool;
+
+
+
+static void pool_run(Pool *pool, int thread)
+{
+    while (1) {
+        int index = pool->next.fetch_add(1, std::memory_order_relaxed);
+        if (index >= pool->count)
+            break;
+        pool->func(pool->ctx, index, thread);
+    }
+}
+
+static void pool_worker(Pool *pool, int thread)
+{
+    uint64_t seen = 0;
+
+    while (1) {
+        {
+            std::unique_lock<std::mutex> lock(pool->mutex);
+            while (!pool->quit && pool->generation == seen)
+                pool->wake.wait(lock);
+            if (pool->quit)
+                return;
+            seen = pool->generation;
+        }
+
+        pool_run(pool, thread);
+
+        {
+            std::unique_lock<std::mutex> lock(pool->mutex);
+            if (--pool->busy == 0)
+                pool->done.notify_one();
+        }
+    }
+}
+
+// A thread_count of 0 picks one thread per hardware thread.
+static void pool_init(Pool *pool, int thread_count)
+{
+    if (thread_count <= 0)
+        thread_count = (int)std::thread::hardware_concurrency();
+    if (thread_count <= 0)
+        thread_count = 1;
+    if (thread_count > POOL_MAX_THREADS)
+        thread_count = POOL_MAX_THREADS;
+
+    pool->thread_count = thread_count;
+    pool->generation = 0;
+    pool->busy = 0;
+    pool->quit = false;
+    pool->func = NULL;
+    pool->ctx = NULL;
+    pool->count = 0;
+    pool->next = 0;
+
+    // The calling thread is thread 0, it works too.
+    for (int i = 1; i < thread_count; i++)
+        pool->threads[i] = std::thread(pool_worker, pool, i);
+}
+
+static void pool_shutdown(Pool *pool)
+{
+    {
+        std::unique_lock<std::mutex> lock(pool->mutex);
+        pool->quit = true;
+        pool->wake.notify_all();
+    }
+    for (int i = 1; i < pool->thread_count; i++)
+        pool->threads[i].join();
+}
+
+// Returns once every iteration has completed.
+static void pool_for(Pool *pool, int count, PoolFunc *func, void *ctx)
+{
+    if (count <= 0)
+        return;
+
+    if (pool->thread_count == 1 || count == 1) {
+        for (int i = 0; i < count; i++)
+            func(ctx, i, 0);
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(pool->mutex);
+        pool->func = func;
+        pool->ctx = ctx;
+        pool->count = count;
+        pool->next = 0;
+        pool->busy = pool->thread_count - 1;
+        pool->generation++;
+        pool->wake.notify_all();
+    }
+
+    pool_run(pool, 0);
+
+    {
+        std::unique_lock<std::mutex> lock(pool->mutex);
+        while (pool->busy > 0)
+            pool->done.wait(lock);
+    }
+}
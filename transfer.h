@@ -0,0 +1,136 @@
+// Bookkeeping for uploads on a copy queue of their own.
+//
+// Copies are recorded into a command list for the copy queue, and submitted
+// together in batches: when the batch is full, or when the caller decides to
+// (once per frame, typically).  Each batch signals the copy queue's fence
+// with a value of its own, and every copy in it is handed that value as its
+// ticket.  Once the fence reaches a ticket, the copy is done and what it
+// copied is resident, so it can be drawn with; the direct queue only has to
+// be told to wait for the copy fence the first time it uses a ticket.
+//
+// As with frames.h, nothing here talks to Direct3D 12: the caller records,
+// submits, signals and waits with what these functions return.
+
+#pragma once
+
+#include <stdint.h>
+#include <assert.h>
+
+#include "frames.h"
+
+#ifndef ASSERT
+#define ASSERT(expr)    assert(expr)
+#endif
+
+
+
+typedef struct TransferStats {
+    uint64_t    batches;
+    uint64_t    copies;
+    uint64_t    bytes;
+} TransferStats;
+
+typedef struct Transfer {
+    // The copy command allocators, recycled as the batches that used them
+    // are retired.  Batch values double as the tickets.
+    Frames          lists;
+    bool            open;
+
+    // The batch being recorded.
+    int             copies;
+    uint64_t        bytes;
+    int             max_copies;
+    uint64_t        max_bytes;
+
+    // The highest copy fence value the direct queue has been made to wait on.
+    uint64_t        waited;
+
+    TransferStats   stats;
+} Transfer;
+
+// A batch is submitted once it holds `max_copies` copies or `max_bytes`
+// bytes, whichever comes first.  `list_count` copy command allocators
+// (at most FRAMES_MAX) take turns.
+static void transfer_init(Transfer *transfer, int list_count, int max_copies, uint64_t max_bytes)
+{
+    frames_init(&transfer->lists, list_count);
+    transfer->open = false;
+    transfer->copies = 0;
+    transfer->bytes = 0;
+    transfer->max_copies = (max_copies > 0) ? max_copies : 1;
+    transfer->max_bytes = max_bytes;
+    transfer->waited = 0;
+    transfer->stats.batches = 0;
+    transfer->stats.copies = 0;
+    transfer->stats.bytes = 0;
+}
+
+// Call before recording a copy.  If a new batch has to be started, returns
+// true, along with the copy fence value to wait for before the allocator in
+// slot transfer->lists.index can be reset, and the list reset with it.
+static bool transfer_begin(Transfer *transfer, uint64_t *wait)
+{
+    if (transfer->open)
+        return false;
+
+    transfer->open = true;
+    *wait = frames_begin(&transfer->lists);
+    return true;
+}
+
+// Call for every copy recorded.  Returns its ticket.
+static uint64_t transfer_add(Transfer *transfer, uint64_t bytes)
+{
+    ASSERT(transfer->open);
+
+    transfer->copies++;
+    transfer->bytes += bytes;
+    return transfer->lists.value + 1;
+}
+
+// Whether the batch should be submitted before anything else is added.
+static bool transfer_full(Transfer const *transfer)
+{
+    return transfer->open &&
+        (transfer->copies >= transfer->max_copies || transfer->bytes >= transfer->max_bytes);
+}
+
+// Call once the batch has been closed and submitted to the copy queue.
+// Returns the value the copy queue must signal, or 0 if there was no batch.
+static uint64_t transfer_submit(Transfer *transfer)
+{
+    if (!transfer->open)
+        return 0;
+
+    transfer->stats.batches++;
+    transfer->stats.copies += transfer->copies;
+    transfer->stats.bytes += transfer->bytes;
+
+    transfer->open = false;
+    transfer->copies = 0;
+    transfer->bytes = 0;
+    return frames_end(&transfer->lists);
+}
+
+// Whether the copy behind a ticket is done, given the copy fence's
+// completed value.  A ticket still in an unsubmitted batch is never ready.
+static bool transfer_ready(uint64_t ticket, uint64_t completed)
+{
+    return ticket <= completed;
+}
+
+// The copy fence value the direct queue must wait on before it uses what
+// the ticket copied, or 0 if an earlier wait already covers it.
+static uint64_t transfer_wait(Transfer *transfer, uint64_t ticket)
+{
+    if (ticket <= transfer->waited)
+        return 0;
+    transfer->waited = ticket;
+    return ticket;
+}
+
+// The copy fence value to wait for before every copy is done.
+static uint64_t transfer_drain(Transfer const *transfer)
+{
+    return frames_drain(&transfer->lists);
+}
@@ -0,0 +1,273 @@
+// A ring allocator for upload memory.
+//
+// One persistently mapped buffer is handed out in aligned pieces, front to
+// back, wrapping around at its end.  At the end of every frame, the position
+// the ring has reached is recorded along with the fence value that the frame
+// signals; once the fence passes that value, everything up to that position
+// is free to be written again.
+//
+// When the ring runs out of room, it grows: a buffer twice the size replaces
+// it, and the old one is released as soon as the frames that used it are
+// done.  Only once it has reached its maximum size does it wait for the GPU.
+//
+// The allocator does not know about Direct3D 12.  Creating buffers, reading
+// the fence and waiting on it go through the callbacks of UploadDevice.
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#ifndef ASSERT
+#define ASSERT(expr)    assert(expr)
+#endif
+
+
+
+// What the GPU requires of the offset of data in an upload buffer.
+
+#define UPLOAD_ALIGN_VERTEX     16      // Any multiple of 4 would do.
+#define UPLOAD_ALIGN_CONSTANTS  256     // D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT
+#define UPLOAD_ALIGN_TEXTURE    512     // D3D12_TEXTURE_DATA_PLACEMENT_ALIGNMENT
+
+// Buffers are sized in multiples of this, as the GPU allocates them anyway.
+#define UPLOAD_GRANULARITY      (64 * 1024)
+
+#define UPLOAD_MAX_MARKS        64
+#define UPLOAD_MAX_OLD          16
+
+
+
+typedef struct UploadBuffer {
+    void        *resource;  // ID3D12Resource *, or whatever the device uses.
+    uint8_t     *cpu;       // Mapped for as long as the buffer lives.
+    uint64_t    gpu;        // GPU virtual address of the first byte.
+    uint64_t    size;
+    void        *memory;    // Whatever else the device keeps for it.
+} UploadBuffer;
+
+typedef struct UploadDevice {
+    void        *ctx;
+    bool        (*create)(void *ctx, uint64_t size, UploadBuffer *buffer);
+    void        (*destroy)(void *ctx, UploadBuffer *buffer);
+    uint64_t    (*completed)(void *ctx);
+    void        (*wait)(void *ctx, uint64_t value);
+} UploadDevice;
+
+typedef struct UploadAllocation {
+    void        *resource;
+    uint64_t    offset;     // Within resource.
+    uint8_t     *cpu;
+    uint64_t    gpu;
+} UploadAllocation;
+
+typedef struct UploadStats {
+    uint64_t    frames;
+    uint64_t    bytes;          // Asked for, over all frames.
+    uint64_t    padding;        // Lost to alignment and to wrapping around.
+    uint64_t    frame_bytes;    // Asked for during the frame in progress.
+    uint64_t    peak_bytes;     // The most asked for during a single frame.
+    uint64_t    stalls;         // Times the CPU had to wait for the GPU.
+    uint64_t    grows;
+} UploadStats;
+
+typedef struct Upload {
+    UploadDevice    device;
+    UploadBuffer    buffer;
+    uint64_t        max_size;
+
+    // Positions only ever increase, the offset in the buffer being the
+    // position modulo its size.  Everything in [tail, head) may be in use.
+    uint64_t        head;
+    uint64_t        tail;
+
+    // Where the ring was at the end of each frame still in flight.
+    struct {
+        uint64_t    fence;
+        uint64_t    end;
+    }               marks[UPLOAD_MAX_MARKS];
+    int             mark_first;
+    int             mark_count;
+
+    // Buffers the ring has grown out of.  A fence of 0 means the frame in
+    // progress still uses it.
+    struct {
+        UploadBuffer    buffer;
+        uint64_t        fence;
+    }               old[UPLOAD_MAX_OLD];
+    int             old_count;
+
+    UploadStats     stats;
+} Upload;
+
+
+
+static uint64_t upload_align(uint64_t value, uint64_t alignment)
+{
+    return (value + alignment - 1) & ~(alignment - 1);
+}
+
+static bool upload_init(Upload *upload, UploadDevice const *device,
+                        uint64_t size, uint64_t max_size)
+{
+    ASSERT(size > 0);
+
+    memset(upload, 0, sizeof(*upload));
+    upload->device = *device;
+
+    size = upload_align(size, UPLOAD_GRANULARITY);
+    max_size = upload_align(max_size, UPLOAD_GRANULARITY);
+    upload->max_size = (max_size > size) ? max_size : size;
+
+    return device->create(device->ctx, size, &upload->buffer);
+}
+
+// Frees whatever the GPU is done with, given the fence's completed value.
+static void upload_retire(Upload *upload, uint64_t completed)
+{
+    while (upload->mark_count > 0 && upload->marks[upload->mark_first].fence <= completed) {
+        upload->tail = upload->marks[upload->mark_first].end;
+        upload->mark_first = (upload->mark_first + 1) % UPLOAD_MAX_MARKS;
+        upload->mark_count--;
+    }
+
+    int kept = 0;
+    for (int i = 0; i < upload->old_count; i++) {
+        if (upload->old[i].fence != 0 && upload->old[i].fence <= completed)
+            upload->device.destroy(upload->device.ctx, &upload->old[i].buffer);
+        else
+            upload->old[kept++] = upload->old[i];
+    }
+    upload->old_count = kept;
+}
+
+// Releases every buffer.  The GPU must be done with all of them.
+static void upload_shutdown(Upload *upload)
+{
+    for (int i = 0; i < upload->old_count; i++)
+        upload->device.destroy(upload->device.ctx, &upload->old[i].buffer);
+    upload->device.destroy(upload->device.ctx, &upload->buffer);
+    memset(upload, 0, sizeof(*upload));
+}
+
+static bool upload_grow(Upload *upload, uint64_t at_least)
+{
+    uint64_t size = (upload->buffer.size > 0) ? upload->buffer.size : UPLOAD_GRANULARITY;
+    while (size < at_least || size == upload->buffer.size)
+        size *= 2;
+    if (size > upload->max_size)
+        size = upload->max_size;
+    if (size < at_least || size <= upload->buffer.size)
+        return false;
+    if (upload->old_count == UPLOAD_MAX_OLD)
+        return false;
+
+    UploadBuffer buffer;
+    if (!upload->device.create(upload->device.ctx, size, &buffer))
+        return false;
+
+    upload->old[upload->old_count].buffer = upload->buffer;
+    upload->old[upload->old_count].fence = 0;
+    upload->old_count++;
+
+    // The frames in flight keep using the old buffer, the new one is empty.
+    upload->buffer = buffer;
+    upload->head = 0;
+    upload->tail = 0;
+    upload->mark_first = 0;
+    upload->mark_count = 0;
+    upload->stats.grows++;
+    return true;
+}
+
+// Returns false only if `size` bytes cannot fit even in the largest buffer
+// the ring is allowed to grow to.  `alignment` must be a power of two.
+static bool upload_alloc(Upload *upload, uint64_t size, uint64_t alignment,
+                         UploadAllocation *allocation)
+{
+    ASSERT(alignment > 0 && (alignment & (alignment - 1)) == 0);
+    ASSERT(alignment <= UPLOAD_GRANULARITY);
+
+    if (size == 0)
+        size = 1;
+
+    upload_retire(upload, upload->device.completed(upload->device.ctx));
+
+    while (1) {
+        uint64_t capacity = upload->buffer.size;
+        uint64_t start = upload_align(upload->head, alignment);
+
+        // Data does not wrap around, it starts over at the front instead.
+        if (size <= capacity && start / capacity != (start + size - 1) / capacity)
+            start = (start / capacity + 1) * capacity;
+
+        if (size <= capacity && start + size - upload->tail <= capacity) {
+            upload->stats.padding += start - upload->head;
+            upload->stats.bytes += size;
+            upload->stats.frame_bytes += size;
+            upload->head = start + size;
+
+            uint64_t offset = start % capacity;
+            allocation->resource = upload->buffer.resource;
+            allocation->offset = offset;
+            allocation->cpu = upload->buffer.cpu + offset;
+            allocation->gpu = upload->buffer.gpu + offset;
+            return true;
+        }
+
+        if (upload_grow(upload, size))
+            continue;
+
+        // At full size: wait for the oldest frame in flight to be done.
+        if (upload->mark_count == 0)
+            return false;
+
+        uint64_t fence = upload->marks[upload->mark_first].fence;
+        upload->device.wait(upload->device.ctx, fence);
+        upload->stats.stalls++;
+        upload_retire(upload, fence);
+    }
+}
+
+// Call once the frame has been submitted, with the fence value it signals.
+static void upload_end_frame(Upload *upload, uint64_t fence)
+{
+    for (int i = 0; i < upload->old_count; i++) {
+        if (upload->old[i].fence == 0)
+            upload->old[i].fence = fence;
+    }
+
+    uint64_t last = upload->tail;
+    if (upload->mark_count > 0) {
+        int i = (upload->mark_first + upload->mark_count - 1) % UPLOAD_MAX_MARKS;
+        last = upload->marks[i].end;
+    }
+
+    if (upload->head != last) {
+        if (upload->mark_count == UPLOAD_MAX_MARKS) {
+            // Too many frames in flight to tell apart: fold the newest one
+            // into the previous, which then retires a little later.
+            int i = (upload->mark_first + upload->mark_count - 1) % UPLOAD_MAX_MARKS;
+            upload->marks[i].fence = fence;
+            upload->marks[i].end = upload->head;
+        } else {
+            int i = (upload->mark_first + upload->mark_count) % UPLOAD_MAX_MARKS;
+            upload->marks[i].fence = fence;
+            upload->marks[i].end = upload->head;
+            upload->mark_count++;
+        }
+    }
+
+    upload->stats.frames++;
+    if (upload->stats.frame_bytes > upload->stats.peak_bytes)
+        upload->stats.peak_bytes = upload->stats.frame_bytes;
+    upload->stats.frame_bytes = 0;
+}
+
+static double upload_bytes_per_frame(Upload const *upload)
+{
+    if (upload->stats.frames == 0)
+        return 0.0;
+    return (double)upload->stats.bytes / (double)upload->stats.frames;
+}
@@ -0,0 +1,355 @@
+// Vertices in fewer bytes.
+//
+// Vertex is all floats, 32 bytes of them, where colors need no more than 8
+// bits a channel and texture coordinates no more than half floats.  The
+// packed formats keep positions as floats, or as 16-bit SNORM scaled to
+// the extent of the mesh, which vs() scales back by the position_scale of
+// its DrawConstants:
+//
+//   VERTICES_FLOAT     32 bytes    float2 pos, float2 uv, float4 color
+//   VERTICES_PACKED    16 bytes    float2 pos, half2 uv, unorm8x4 color
+//   VERTICES_COMPACT   12 bytes    snorm16x2 pos, half2 uv, unorm8x4 color
+//
+// vertices_pack() converts four vertices at a time with SSE2, half floats
+// included, and gets the same bits as the one-at-a-time conversion: every
+// value rounded to the nearest, ties to even, as the GPU would read it.
+//
+// Nothing here talks to Direct3D 12: hello.cpp turns vertices_formats[]
+// into input elements, and bench.cpp checks what comes back out.
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include <emmintrin.h>
+
+#include "scene.h"
+
+#ifndef ASSERT
+#define ASSERT(expr)    assert(expr)
+#endif
+
+
+
+// Formats
+
+enum {
+    VERTICES_FLOAT,
+    VERTICES_PACKED,
+    VERTICES_COMPACT,
+    VERTICES_FORMATS
+};
+
+// How an element is stored.
+enum {
+    VERTICES_FLOAT2,        // DXGI_FORMAT_R32G32_FLOAT
+    VERTICES_FLOAT4,        // DXGI_FORMAT_R32G32B32A32_FLOAT
+    VERTICES_HALF2,         // DXGI_FORMAT_R16G16_FLOAT
+    VERTICES_SNORM16X2,     // DXGI_FORMAT_R16G16_SNORM
+    VERTICES_UNORM8X4,      // DXGI_FORMAT_R8G8B8A8_UNORM
+    VERTICES_TYPES
+};
+
+enum {
+    VERTICES_POSITION,
+    VERTICES_TEXCOORD,
+    VERTICES_COLOR,
+    VERTICES_ELEMENTS
+};
+
+static char const *const vertices_semantics[VERTICES_ELEMENTS] = {
+    "POSITION", "TEXCOORD", "COLOR"
+};
+
+typedef struct PackedVertex {
+    float       pos[2];
+    uint16_t    uv[2];
+    uint8_t     color[4];
+} PackedVertex;
+
+typedef struct CompactVertex {
+    int16_t     pos[2];
+    uint16_t    uv[2];
+    uint8_t     color[4];
+} CompactVertex;
+
+static struct {
+    char const  *name;
+    uint32_t    stride;
+    struct {
+        int         type;
+        uint32_t    offset;
+    } elements[VERTICES_ELEMENTS];
+} const vertices_formats[VERTICES_FORMATS] = {
+    {"float", sizeof(Vertex), {
+        {VERTICES_FLOAT2, offsetof(Vertex, pos)},
+        {VERTICES_FLOAT2, offsetof(Vertex, uv)},
+        {VERTICES_FLOAT4, offsetof(Vertex, color)}}},
+    {"packed", sizeof(PackedVertex), {
+        {VERTICES_FLOAT2, offsetof(PackedVertex, pos)},
+        {VERTICES_HALF2, offsetof(PackedVertex, uv)},
+        {VERTICES_UNORM8X4, offsetof(PackedVertex, color)}}},
+    {"compact", sizeof(CompactVertex), {
+        {VERTICES_SNORM16X2, offsetof(CompactVertex, pos)},
+        {VERTICES_HALF2, offsetof(CompactVertex, uv)},
+        {VERTICES_UNORM8X4, offsetof(CompactVertex, color)}}},
+};
+
+static_assert(sizeof(PackedVertex) == 16 && sizeof(CompactVertex) == 12, "vertices are padded");
+
+static uint64_t vertices_size(int format, int count)
+{
+    return (uint64_t)vertices_formats[format].stride * count;
+}
+
+// What positions are scaled by, for vs() to undo: the largest of their
+// coordinates when they are SNORM, so that they use the whole range.
+static float vertices_scale(int format, Vertex const *src, int count)
+{
+    if (vertices_formats[format].elements[VERTICES_POSITION].type != VERTICES_SNORM16X2)
+        return 1.0f;
+
+    float scale = 0.0f;
+    for (int i = 0; i < count; i++) {
+        for (int k = 0; k < 2; k++) {
+            if (fabsf(src[i].pos[k]) > scale)
+                scale = fabsf(src[i].pos[k]);
+        }
+    }
+    return (scale > 0.0f) ? scale : 1.0f;
+}
+
+
+
+// One at a Time
+
+static uint32_t vertices_bits(float f)
+{
+    uint32_t u;
+    memcpy(&u, &f, 4);
+    return u;
+}
+
+static float vertices_from_bits(uint32_t u)
+{
+    float f;
+    memcpy(&f, &u, 4);
+    return f;
+}
+
+// Rounds to the nearest half, ties to even.  Too large becomes infinity.
+static uint16_t vertices_half(float f)
+{
+    uint32_t u = vertices_bits(f);
+    uint32_t sign = (u >> 16) & 0x8000;
+    uint32_t a = u & 0x7fffffff;
+
+    uint32_t h;
+    if (a > 0x7f800000)
+        h = 0x7e00;
+    else if (a >= 0x477ff000)
+        h = 0x7c00;
+    else if (a < 0x38800000)
+        // Too small for a normal half: adding 0.5 rounds off what a half's
+        // denormals cannot hold, and leaves them in the low bits.
+        h = vertices_bits(vertices_from_bits(a) + 0.5f) - 0x3f000000;
+    else
+        // Rebias the exponent, round on the bits that are cut off.
+        h = (a - 0x38000000 + 0xfff + ((a >> 13) & 1)) >> 13;
+
+    return (uint16_t)(h | sign);
+}
+
+static float vertices_unhalf(uint16_t h)
+{
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+
+    if (exponent == 0)
+        return vertices_from_bits(sign | vertices_bits((float)mantissa * (1.0f / 16777216.0f)));
+    if (exponent == 31)
+        return vertices_from_bits(sign | 0x7f800000 | (mantissa << 13));
+    return vertices_from_bits(sign | ((exponent + 112) << 23) | (mantissa << 13));
+}
+
+static uint8_t vertices_unorm8(float f)
+{
+    f = fminf(fmaxf(f, 0.0f), 1.0f);
+    return (uint8_t)lrintf(f * 255.0f);
+}
+
+// `k` is 32767 over the scale.
+static int16_t vertices_snorm16(float f, float k)
+{
+    long v = lrintf(f * k);
+    return (int16_t)((v < -32767) ? -32767 : (v > 32767) ? 32767 : v);
+}
+
+static void vertices_pack_one(int format, Vertex const *src, float k, uint8_t *dst)
+{
+    if (format == VERTICES_FLOAT) {
+        memcpy(dst, src, sizeof(Vertex));
+        return;
+    }
+
+    uint16_t uv[2] = {vertices_half(src->uv[0]), vertices_half(src->uv[1])};
+    uint8_t color[4];
+    for (int c = 0; c < 4; c++)
+        color[c] = vertices_unorm8(src->color[c]);
+
+    if (format == VERTICES_PACKED) {
+        PackedVertex *v = (PackedVertex *)dst;
+        memcpy(v->pos, src->pos, sizeof(v->pos));
+        memcpy(v->uv, uv, sizeof(uv));
+        memcpy(v->color, color, sizeof(color));
+    } else {
+        CompactVertex *v = (CompactVertex *)dst;
+        v->pos[0] = vertices_snorm16(src->pos[0], k);
+        v->pos[1] = vertices_snorm16(src->pos[1], k);
+        memcpy(v->uv, uv, sizeof(uv));
+        memcpy(v->color, color, sizeof(color));
+    }
+}
+
+// Back to floats, as the input assembler reads them.
+static void vertices_unpack(int format, void const *src, int count, float scale, Vertex *dst)
+{
+    uint8_t const *from = (uint8_t const *)src;
+    uint32_t stride = vertices_formats[format].stride;
+
+    for (int i = 0; i < count; i++, from += stride) {
+        if (format == VERTICES_FLOAT) {
+            memcpy(&dst[i], from, sizeof(Vertex));
+            continue;
+        }
+
+        // The same members at the same offsets in both, but the position.
+        PackedVertex const *p = (PackedVertex const *)from;
+        CompactVertex const *c = (CompactVertex const *)from;
+        for (int k = 0; k < 2; k++) {
+            if (format == VERTICES_PACKED) {
+                dst[i].pos[k] = p->pos[k];
+                dst[i].uv[k] = vertices_unhalf(p->uv[k]);
+            } else {
+                float snorm = (float)c->pos[k] / 32767.0f;
+                dst[i].pos[k] = ((snorm < -1.0f) ? -1.0f : snorm) * scale;
+                dst[i].uv[k] = vertices_unhalf(c->uv[k]);
+            }
+        }
+        uint8_t const *color = (format == VERTICES_PACKED) ? p->color : c->color;
+        for (int k = 0; k < 4; k++)
+            dst[i].color[k] = (float)color[k] / 255.0f;
+    }
+}
+
+
+
+// Four at a Time
+// The same conversions, a lane per value.
+
+static __m128i vertices_half4(__m128 f)
+{
+    __m128i u = _mm_castps_si128(f);
+    __m128i a = _mm_and_si128(u, _mm_set1_epi32(0x7fffffff));
+
+    __m128i lsb = _mm_and_si128(_mm_srli_epi32(a, 13), _mm_set1_epi32(1));
+    __m128i normal = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(a, _mm_set1_epi32((int)0xc8000fff)), lsb), 13);
+    __m128i denormal = _mm_sub_epi32(
+        _mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(a), _mm_set1_ps(0.5f))), _mm_set1_epi32(0x3f000000));
+
+    __m128i is_denormal = _mm_cmplt_epi32(a, _mm_set1_epi32(0x38800000));
+    __m128i is_inf = _mm_cmpgt_epi32(a, _mm_set1_epi32(0x477fefff));
+    __m128i is_nan = _mm_cmpgt_epi32(a, _mm_set1_epi32(0x7f800000));
+
+    __m128i h = _mm_or_si128(_mm_and_si128(is_denormal, denormal), _mm_andnot_si128(is_denormal, normal));
+    h = _mm_or_si128(_mm_and_si128(is_inf, _mm_set1_epi32(0x7c00)), _mm_andnot_si128(is_inf, h));
+    h = _mm_or_si128(h, _mm_and_si128(is_nan, _mm_set1_epi32(0x0200)));
+
+    // The sign as the 16-bit -32768, so that packing leaves it be.
+    __m128i sign = _mm_srai_epi32(_mm_and_si128(u, _mm_set1_epi32((int)0x80000000)), 16);
+    return _mm_or_si128(h, sign);
+}
+
+static __m128i vertices_unorm8x4(__m128 c)
+{
+    c = _mm_min_ps(_mm_max_ps(c, _mm_setzero_ps()), _mm_set1_ps(1.0f));
+    return _mm_cvtps_epi32(_mm_mul_ps(c, _mm_set1_ps(255.0f)));
+}
+
+static __m128 vertices_pick(__m128i a, __m128i b, int lo, int hi)
+{
+    __m128 fa = _mm_castsi128_ps(a), fb = _mm_castsi128_ps(b);
+    return (lo == 0) ? ((hi == 0) ? _mm_shuffle_ps(fa, fb, _MM_SHUFFLE(1, 0, 1, 0))
+                                  : _mm_shuffle_ps(fa, fb, _MM_SHUFFLE(3, 2, 1, 0)))
+                     : ((hi == 0) ? _mm_shuffle_ps(fa, fb, _MM_SHUFFLE(1, 0, 3, 2))
+                                  : _mm_shuffle_ps(fa, fb, _MM_SHUFFLE(3, 2, 3, 2)));
+}
+
+// Converts `count` vertices into `dst`, in `format`.  `scale` is what
+// vertices_scale() gave for them, or for a mesh they are part of.
+static void vertices_pack(int format, Vertex const *src, int count, float scale, void *dst)
+{
+    uint8_t *to = (uint8_t *)dst;
+    uint32_t stride = vertices_formats[format].stride;
+    float k = 32767.0f / scale;
+
+    if (format == VERTICES_FLOAT) {
+        memcpy(dst, src, vertices_size(format, count));
+        return;
+    }
+
+    int i = 0;
+    for (; i + 4 <= count; i += 4, to += 4 * stride) {
+        // Each vertex is two registers: x y u v, and r g b a.
+        __m128 a[4], c[4];
+        for (int v = 0; v < 4; v++) {
+            a[v] = _mm_loadu_ps(src[i + v].pos);
+            c[v] = _mm_loadu_ps(src[i + v].color);
+        }
+
+        // A 32-bit lane per vertex, for each element.
+        __m128i uv = _mm_packs_epi32(
+            vertices_half4(_mm_shuffle_ps(a[0], a[1], _MM_SHUFFLE(3, 2, 3, 2))),
+            vertices_half4(_mm_shuffle_ps(a[2], a[3], _MM_SHUFFLE(3, 2, 3, 2))));
+        __m128i color = _mm_packus_epi16(
+            _mm_packs_epi32(vertices_unorm8x4(c[0]), vertices_unorm8x4(c[1])),
+            _mm_packs_epi32(vertices_unorm8x4(c[2]), vertices_unorm8x4(c[3])));
+
+        __m128i uv_color_01 = _mm_unpacklo_epi32(uv, color);       // uv0 c0 uv1 c1
+        __m128i uv_color_23 = _mm_unpackhi_epi32(uv, color);       // uv2 c2 uv3 c3
+
+        if (format == VERTICES_PACKED) {
+            __m128i xy[4];
+            for (int v = 0; v < 4; v++)
+                xy[v] = _mm_castps_si128(a[v]);
+            _mm_storeu_ps((float *)(to + 0),  vertices_pick(xy[0], uv_color_01, 0, 0));
+            _mm_storeu_ps((float *)(to + 16), vertices_pick(xy[1], uv_color_01, 0, 1));
+            _mm_storeu_ps((float *)(to + 32), vertices_pick(xy[2], uv_color_23, 0, 0));
+            _mm_storeu_ps((float *)(to + 48), vertices_pick(xy[3], uv_color_23, 0, 1));
+            continue;
+        }
+
+        __m128 vk = _mm_set1_ps(k);
+        __m128i pos = _mm_packs_epi32(
+            _mm_cvtps_epi32(_mm_mul_ps(_mm_shuffle_ps(a[0], a[1], _MM_SHUFFLE(1, 0, 1, 0)), vk)),
+            _mm_cvtps_epi32(_mm_mul_ps(_mm_shuffle_ps(a[2], a[3], _MM_SHUFFLE(1, 0, 1, 0)), vk)));
+        pos = _mm_max_epi16(pos, _mm_set1_epi16(-32767));
+
+        // Three registers of 12-byte vertices: p0 uv0 c0 p1 | uv1 c1 p2 uv2 | c2 p3 uv3 c3
+        __m128i pos_uv_01 = _mm_unpacklo_epi32(pos, uv);           // p0 uv0 p1 uv1
+        __m128i pos_uv_23 = _mm_unpackhi_epi32(pos, uv);           // p2 uv2 p3 uv3
+        __m128i next = _mm_srli_si128(pos, 4);
+        __m128i color_pos_01 = _mm_unpacklo_epi32(color, next);    // c0 p1 c1 p2
+        __m128i color_pos_23 = _mm_unpackhi_epi32(color, next);    // c2 p3 c3 -
+        _mm_storeu_ps((float *)(to + 0),  vertices_pick(pos_uv_01, color_pos_01, 0, 0));
+        _mm_storeu_ps((float *)(to + 16), vertices_pick(uv_color_01, pos_uv_23, 1, 0));
+        _mm_storeu_ps((float *)(to + 32), vertices_pick(color_pos_23, uv_color_23, 0, 1));
+    }
+
+    for (; i < count; i++, to += stride)
+        vertices_pack_one(format, &src[i], k, to);
+}